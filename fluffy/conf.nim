@@ -8,6 +8,7 @@
 {.push raises: [Defect].}
 
 import
+  std/os,
   confutils, confutils/std/net, chronicles,
   eth/keys, eth/net/nat, eth/p2p/discoveryv5/[enr, node]
 
@@ -16,6 +17,16 @@ const
   DefaultAdminListenAddress* = (static ValidIpAddress.init("127.0.0.1"))
   DefaultProxyAddress* = (static "http://127.0.0.1:8546")
 
+proc defaultDataDir*(): string =
+  let dataDir = when defined(windows):
+    "AppData" / "Roaming" / "Fluffy"
+  elif defined(macosx):
+    "Library" / "Application Support" / "Fluffy"
+  else:
+    ".cache" / "fluffy"
+
+  getHomeDir() / dataDir
+
 type
   PortalCmd* = enum
     noCommand
@@ -58,6 +69,17 @@ type
       defaultValue: PrivateKey.random(keys.newRng()[])
       name: "nodekey" .}: PrivateKey
 
+    dataDir* {.
+      desc: "Directory of the content database, it is created if needed"
+      defaultValue: defaultDataDir()
+      name: "data-dir" .}: OutDir
+
+    storageSize* {.
+      defaultValue: 512
+      desc: "Maximum size of the stored content, in MiB. Content furthest " &
+            "away from the local node id is evicted first"
+      name: "storage-size" .}: uint32
+
     metricsEnabled* {.
       defaultValue: false
       desc: "Enable the metrics server"
@@ -11,7 +11,7 @@
 
 import
   nimcrypto/[sha2, hash], stew/objects,
-  eth/ssz/ssz_serialization, eth/trie/[hexary, db]
+  eth/ssz/ssz_serialization
 
 export ssz_serialization
 
@@ -66,21 +66,3 @@ func toContentId*(contentKey: ContentKey): ContentId =
   # with keccak256 that is used for the actual nodes:
   # https://github.com/ethereum/stateless-ethereum-specs/blob/master/state-network.md#content
   sha2.sha_256.digest(SSZ.encode(contentKey))
-
-type
-  ContentStorage* = object
-    # TODO: Quick implementation for now where we just use HexaryTrie, current
-    # idea is to move in here a more direct storage of the trie nodes, but have
-    # an `ContentProvider` "interface" that could provide the trie nodes via
-    # this direct storage, via the HexaryTrie (for full nodes), or also without
-    # storage, via json rpc client requesting data from a full eth1 client.
-    trie*: HexaryTrie
-
-proc getContent*(storage: ContentStorage, key: ContentKey): Option[seq[byte]] =
-  if storage.trie.db == nil: # TODO: for now...
-    return none(seq[byte])
-  let val = storage.trie.db.get(key.nodeHash.asSeq())
-  if val.len > 0:
-    some(val)
-  else:
-    none(seq[byte])
@@ -0,0 +1,194 @@
+# Nimbus
+# Copyright (c) 2021 Status Research & Development GmbH
+# Licensed and distributed under either of
+#   * MIT license (license terms in the root directory or at https://opensource.org/licenses/MIT).
+#   * Apache v2 license (license terms in the root directory or at https://www.apache.org/licenses/LICENSE-2.0).
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+# Content store of a Portal node, keyed by `ContentId`.
+#
+# Only content within `radius` of the local node id is accepted. Once the
+# stored data exceeds the size cap, the content furthest away from the local
+# node id is evicted first and the radius shrinks accordingly, so requests
+# for evicted content are rejected without a database lookup. Recently read
+# or written content is served from an in-memory hot cache.
+#
+# The content itself lives in an SQLite key-value store, on disk unless no
+# path is given. The index (id, size and distance of the stored items) is
+# kept in memory and rebuilt from the store when it is opened, the store
+# has one row per item and nothing else.
+
+{.push raises: [Defect].}
+
+import
+  std/[options, tables, heapqueue],
+  stint, eth/common/eth_types, eth/db/[kvstore, kvstore_sqlite3],
+  eth/p2p/discoveryv5/node,
+  ../nimbus/utils/lru_cache,
+  ./content
+
+export options
+
+const
+  defaultMaxSize* = 512 * 1024 * 1024
+    ## Default cap on the stored content, in bytes
+  defaultHotCacheSize* = 4096
+    ## Default number of items in the in-memory cache
+
+type
+  HotCache = LruCache[ContentId,ContentId,seq[byte],void]
+
+  StoredItem = object
+    distance: UInt256
+    id: ContentId
+
+  ContentStorage* = ref object
+    db: SqStoreRef
+    kv: KvStoreRef                # `kvstore` table of `db`
+    localId: NodeId
+    radius*: UInt256              # content further away is not stored
+    maxSize: int                  # cap on the size of all values, in bytes
+    size: int                     # size of all stored values
+    items: Table[ContentId,int]   # stored content and its size
+    furthest: HeapQueue[StoredItem]
+    hot: HotCache
+
+template expectDb(x: auto): untyped =
+  # there is no way to recover from a broken content database
+  x.expect("working content database")
+
+func `<`(a, b: StoredItem): bool =
+  # `HeapQueue` is a min-heap, keep the furthest item on top
+  a.distance > b.distance
+
+func distanceTo*(s: ContentStorage, id: ContentId): UInt256 =
+  s.localId xor readUintBE[256](id.data)
+
+func inRadius*(s: ContentStorage, id: ContentId): bool =
+  s.distanceTo(id) <= s.radius
+
+proc initHotCache(cache: var HotCache; maxItems: int) =
+  var
+    toKey: LruKey[ContentId,ContentId] =
+      proc(id: ContentId): ContentId = id
+    toValue: LruValue[ContentId,seq[byte],void] =
+      proc(id: ContentId): Result[seq[byte],void] = err()
+  cache.initCache(toKey, toValue, maxItems)
+
+proc evict(s: ContentStorage)
+
+proc loadIndex(s: ContentStorage) =
+  # rebuild the index from the rows of the store
+  let stmt = s.db.prepareStmt(
+    "SELECT key, length(value) FROM kvstore;",
+    NoParams, (seq[byte], int64), managed = false).expectDb()
+  proc onRow(row: (seq[byte], int64)) =
+    let (key, size) = row
+    if key.len == sizeof(ContentId):
+      var id: ContentId
+      id.data[0 .. ^1] = key
+      s.items[id] = size.int
+      s.size += size.int
+      s.furthest.push(StoredItem(distance: s.distanceTo(id), id: id))
+  discard stmt.exec((), onRow).expectDb()
+  stmt.dispose()
+
+proc new*(T: type ContentStorage, localId: NodeId, path = "",
+    radius = UInt256.high(), maxSize = defaultMaxSize,
+    hotCacheSize = defaultHotCacheSize): T =
+  ## Open the store in directory `path`, creating it if needed, or an
+  ## in-memory store if `path` is empty. Content left by an earlier run is
+  ## kept unless it exceeds `maxSize`.
+  let db =
+    if path.len == 0:
+      SqStoreRef.init("", "fluffy", inMemory = true).expectDb()
+    else:
+      SqStoreRef.init(path, "fluffy").expectDb()
+  result = ContentStorage(
+    db: db,
+    kv: kvStore db.openKvStore().expectDb(),
+    localId: localId,
+    radius: radius,
+    maxSize: maxSize,
+    items: initTable[ContentId,int]())
+  result.hot.initHotCache(hotCacheSize)
+  result.loadIndex()
+  result.evict()
+
+func contains*(s: ContentStorage, id: ContentId): bool =
+  id in s.items
+
+func len*(s: ContentStorage): int =
+  s.items.len
+
+func size*(s: ContentStorage): int =
+  ## Size of all stored values, in bytes
+  s.size
+
+proc get*(s: ContentStorage, id: ContentId): Option[seq[byte]] =
+  if id notin s.items:
+    # covers everything out of the radius too
+    return none(seq[byte])
+
+  try:
+    let rc = s.hot.getItem(id)
+    if rc.isOk:
+      return some(rc.value)
+  except CatchableError:
+    discard
+
+  var val: seq[byte]
+  proc onData(data: openArray[byte]) = val = @data
+  if not s.kv.get(id.data, onData).expectDb() or val.len == 0:
+    return none(seq[byte])
+  try:
+    s.hot.putItem(id, val)
+  except CatchableError:
+    discard
+  some(val)
+
+proc evict(s: ContentStorage) =
+  while s.size > s.maxSize and s.furthest.len > 0:
+    let item = s.furthest.pop()
+    s.size -= s.items.getOrDefault(item.id)
+    s.items.del(item.id)
+    s.kv.del(item.id.data).expectDb()
+    try:
+      discard s.hot.delItem(item.id)
+    except CatchableError:
+      discard
+    # anything at least this far away would be evicted again
+    if item.distance.isZero:
+      s.radius = 0.u256
+    else:
+      s.radius = min(s.radius, item.distance - 1.u256)
+
+proc put*(s: ContentStorage, id: ContentId, value: openArray[byte]): bool =
+  ## Store content, returns false if it is out of the radius or does not fit
+  if value.len == 0 or value.len > s.maxSize or not s.inRadius(id):
+    return false
+
+  let old = s.items.getOrDefault(id, -1)
+  if old < 0:
+    s.furthest.push(StoredItem(distance: s.distanceTo(id), id: id))
+  else:
+    s.size -= old
+  s.items[id] = value.len
+  s.size += value.len
+  s.kv.put(id.data, value).expectDb()
+  try:
+    s.hot.putItem(id, @value)
+  except CatchableError:
+    discard
+
+  s.evict()
+  id in s.items
+
+proc close*(s: ContentStorage) =
+  s.db.close()
+
+proc put*(s: ContentStorage, key: ContentKey, value: openArray[byte]): bool =
+  s.put(toContentId(key), value)
+
+proc getContent*(s: ContentStorage, key: ContentKey): Option[seq[byte]] =
+  s.get(toContentId(key))
@@ -52,7 +52,9 @@ proc run(config: PortalConf) {.raises: [CatchableError, Defect].} =
 
   d.open()
 
-  let portal = PortalProtocol.new(d)
+  let portal = PortalProtocol.new(d,
+    storageSize = int(config.storageSize) * 1024 * 1024,
+    storagePath = config.dataDir.string)
 
   if config.metricsEnabled:
     let
@@ -29,6 +29,11 @@ type
     foundcontent = 0x06
     advertise = 0x07
     requestproofs = 0x08
+    # Not in the spec (yet): paged node and chunked content responses, for
+    # data that does not fit in a single talkresp
+    findnodepage = 0x09
+    findcontentchunk = 0x0A
+    contentchunk = 0x0B
 
   PingMessage* = object
     enrSeq*: uint64
@@ -63,6 +68,18 @@ type
     connectionId*: List[byte, 4]
     contentKeys*: List[ByteList, 32]
 
+  FindNodePageMessage* = object
+    distances*: List[uint16, 256]
+    page*: uint8 # Index of the requested page, answered with a NodesMessage
+
+  FindContentChunkMessage* = object
+    contentKey*: ContentKey
+    offset*: uint32
+
+  ContentChunkMessage* = object
+    total*: uint32 # Size of the full content, 0 when not available
+    payload*: ByteList # Content bytes starting at the requested offset
+
   Message* = object
     case kind*: MessageKind
     of ping:
@@ -81,6 +98,12 @@ type
       advertise*: AdvertiseMessage
     of requestproofs:
       requestproofs*: RequestProofsMessage
+    of findnodepage:
+      findnodepage*: FindNodePageMessage
+    of findcontentchunk:
+      findcontentchunk*: FindContentChunkMessage
+    of contentchunk:
+      contentchunk*: ContentChunkMessage
     else:
       discard
 
@@ -88,7 +111,8 @@ type
     PingMessage or PongMessage or
     FindNodeMessage or NodesMessage or
     FindContentMessage or FoundContentMessage or
-    AdvertiseMessage or RequestProofsMessage
+    AdvertiseMessage or RequestProofsMessage or
+    FindNodePageMessage or FindContentChunkMessage or ContentChunkMessage
 
 template messageKind*(T: typedesc[SomeMessage]): MessageKind =
   when T is PingMessage: ping
@@ -99,6 +123,22 @@ template messageKind*(T: typedesc[SomeMessage]): MessageKind =
   elif T is FoundContentMessage: foundcontent
   elif T is AdvertiseMessage: advertise
   elif T is RequestProofsMessage: requestproofs
+  elif T is FindNodePageMessage: findnodepage
+  elif T is FindContentChunkMessage: findcontentchunk
+  elif T is ContentChunkMessage: contentchunk
+
+template innerMessage*(m: Message, T: typedesc[SomeMessage]): T =
+  when T is PingMessage: m.ping
+  elif T is PongMessage: m.pong
+  elif T is FindNodeMessage: m.findNode
+  elif T is NodesMessage: m.nodes
+  elif T is FindContentMessage: m.findcontent
+  elif T is FoundContentMessage: m.foundcontent
+  elif T is AdvertiseMessage: m.advertise
+  elif T is RequestProofsMessage: m.requestproofs
+  elif T is FindNodePageMessage: m.findnodepage
+  elif T is FindContentChunkMessage: m.findcontentchunk
+  elif T is ContentChunkMessage: m.contentchunk
 
 template toSszType*(x: UInt256): array[32, byte] =
   toBytesLE(x)
@@ -143,6 +183,12 @@ proc decodeMessage*(body: openarray[byte]): Result[Message, cstring] =
       message.advertise = SSZ.decode(body.toOpenArray(1, body.high), AdvertiseMessage)
     of requestproofs:
       message.requestproofs = SSZ.decode(body.toOpenArray(1, body.high), RequestProofsMessage)
+    of findnodepage:
+      message.findnodepage = SSZ.decode(body.toOpenArray(1, body.high), FindNodePageMessage)
+    of findcontentchunk:
+      message.findcontentchunk = SSZ.decode(body.toOpenArray(1, body.high), FindContentChunkMessage)
+    of contentchunk:
+      message.contentchunk = SSZ.decode(body.toOpenArray(1, body.high), ContentChunkMessage)
   except SszError:
     return err("Invalid message encoding")
 
@@ -8,13 +8,13 @@
 {.push raises: [Defect].}
 
 import
-  std/sequtils,
-  stew/[results, byteutils], chronicles,
+  std/[sequtils, tables],
+  stew/[results, byteutils], chronicles, chronos,
   eth/rlp, eth/p2p/discoveryv5/[protocol, node, enr],
-  ../content,
+  ../content, ../content_storage,
   ./messages
 
-export messages
+export messages, content_storage
 
 logScope:
   topics = "portal"
@@ -22,11 +22,40 @@ logScope:
 const
   PortalProtocolId* = "portal".toBytes()
 
+  maxTalkRespSize* = 1000
+    ## Budget for an encoded response, keeps the talkresp packet well below
+    ## the discv5 limit of 1280 bytes
+  contentChunkSize* = 960
+    ## Content larger than this is sent in chunks of this size
+  maxChunksInFlight* = 4
+    ## Number of outstanding content chunk requests per transfer
+  maxContentSize* = 1024 * 1024
+    ## Chunked content of larger announced size is refused
+  nodesSnapshotTimeout = 30.seconds
+    ## FindNodePage requests are answered from the node set of the FindNode
+    ## request for this long
+  maxNodesSnapshots = 64
+    ## Cap on the node sets kept for FindNodePage requests
+
 type
+  NodesSnapshot = object
+    pages: seq[seq[ByteList]]
+    expiry: Moment
+
   PortalProtocol* = ref object of TalkProtocol
     baseProtocol*: protocol.Protocol
-    dataRadius*: UInt256
     contentStorage*: ContentStorage
+    nodesSnapshots: Table[seq[uint16], NodesSnapshot]
+      # The talk handler does not see the discv5 request or the requester,
+      # the node sets of paged responses are kept by requested distances
+
+  FoundContent* = object
+    enrs*: List[ByteList, 32]
+    payload*: seq[byte] # Full content, also when it was sent in chunks
+
+func dataRadius*(p: PortalProtocol): UInt256 =
+  ## Radius as advertised, shrinks when the content storage is full
+  p.contentStorage.radius
 
 proc handlePing(p: PortalProtocol, ping: PingMessage):
     seq[byte] =
@@ -35,39 +64,108 @@ proc handlePing(p: PortalProtocol, ping: PingMessage):
 
   encodeMessage(p)
 
-proc handleFindNode(p: PortalProtocol, fn: FindNodeMessage): seq[byte] =
-  if fn.distances.len == 0:
-    let enrs = List[ByteList, 32](@[])
-    encodeMessage(NodesMessage(total: 1, enrs: enrs))
-  elif fn.distances.contains(0):
+func nodesPages(enrs: openArray[ByteList]): seq[seq[ByteList]] =
+  # Split the ENRs over as many NodesMessages as needed to keep each of them
+  # within `maxTalkRespSize`
+  const emptySize = 1 + 1 + 4 # message kind, total, list offset
+  var
+    page: seq[ByteList]
+    size = emptySize
+  for enr in enrs:
+    let enrSize = enr.len + 4 # list element offset
+    if page.len > 0 and (size + enrSize > maxTalkRespSize or page.len == 32):
+      result.add page
+      page.setLen(0)
+      size = emptySize
+    page.add enr
+    size += enrSize
+  if page.len > 0 or result.len == 0:
+    result.add page
+
+proc findNodeEnrs(p: PortalProtocol, distances: seq[uint16]): seq[ByteList] =
+  if distances.len == 0:
+    @[]
+  elif distances.contains(0):
     # A request for our own record.
-    let enr = ByteList(rlp.encode(p.baseProtocol.localNode.record))
-    encodeMessage(NodesMessage(total: 1, enrs: List[ByteList, 32](@[enr])))
+    @[ByteList(rlp.encode(p.baseProtocol.localNode.record))]
+  elif distances.all(proc (x: uint16): bool = return x <= 256):
+    let nodes = p.baseProtocol.neighboursAtDistances(distances, seenOnly = true)
+    nodes.map(proc(x: Node): ByteList = ByteList(x.record.raw))
   else:
-    let distances = fn.distances.asSeq()
-    if distances.all(proc (x: uint16): bool = return x <= 256):
-      let
-        nodes = p.baseProtocol.neighboursAtDistances(distances, seenOnly = true)
-        enrs = nodes.map(proc(x: Node): ByteList = ByteList(x.record.raw))
-
-      # TODO: Fixed here to total message of 1 for now, as else we would need to
-      # either move the send of the talkresp messages here, or allow for
-      # returning multiple messages.
-      # On the long run, it might just be better to use a stream in these cases?
-      encodeMessage(
-        NodesMessage(total: 1, enrs: List[ByteList, 32](List(enrs))))
-    else:
-      # invalid request, send empty back
-      let enrs = List[ByteList, 32](@[])
-      encodeMessage(NodesMessage(total: 1, enrs: enrs))
+    # invalid request, send empty back
+    @[]
+
+func nodesPage(pages: seq[seq[ByteList]], page: int): seq[byte] =
+  let total = uint8(min(pages.len, int(high(uint8))))
+  if page < total.int:
+    encodeMessage(
+      NodesMessage(total: total, enrs: List[ByteList, 32](pages[page])))
+  else:
+    encodeMessage(
+      NodesMessage(total: total, enrs: List[ByteList, 32](@[])))
+
+proc pruneNodesSnapshots(p: PortalProtocol, now: Moment) =
+  var expired: seq[seq[uint16]]
+  for distances, snapshot in p.nodesSnapshots:
+    if snapshot.expiry <= now:
+      expired.add(distances)
+  for distances in expired:
+    p.nodesSnapshots.del(distances)
+  if p.nodesSnapshots.len >= maxNodesSnapshots:
+    p.nodesSnapshots.clear()
+
+proc handleFindNode(p: PortalProtocol, fn: FindNodeMessage): seq[byte] =
+  # Responses that do not fit in one message have `total > 1`, the requester
+  # fetches the other pages with FindNodePage requests. These are answered
+  # from the same node set, so the pages neither overlap nor miss nodes when
+  # the routing table changes in between.
+  let
+    distances = fn.distances.asSeq()
+    pages = nodesPages(p.findNodeEnrs(distances))
+  if pages.len > 1:
+    let now = Moment.now()
+    p.pruneNodesSnapshots(now)
+    p.nodesSnapshots[distances] = NodesSnapshot(
+      pages: pages, expiry: now + nodesSnapshotTimeout)
+  nodesPage(pages, 0)
+
+proc handleFindNodePage(p: PortalProtocol, fnp: FindNodePageMessage):
+    seq[byte] =
+  let
+    distances = fnp.distances.asSeq()
+    snapshot = p.nodesSnapshots.getOrDefault(distances)
+  if Moment.now() < snapshot.expiry:
+    nodesPage(snapshot.pages, fnp.page.int)
+  else:
+    # expired or never requested, best effort
+    nodesPage(nodesPages(p.findNodeEnrs(distances)), fnp.page.int)
+
+proc getLocalContent(p: PortalProtocol, contentId: ContentId):
+    Option[seq[byte]] =
+  # Content out of the radius is never stored, skip the lookup
+  if p.contentStorage.inRadius(contentId):
+    p.contentStorage.get(contentId)
+  else:
+    none(seq[byte])
+
+func contentChunk(content: openArray[byte], offset: int): ContentChunkMessage =
+  let last = min(offset + contentChunkSize, content.len)
+  let payload =
+    if offset < last: @(content.toOpenArray(offset, last - 1))
+    else: @[]
+  ContentChunkMessage(total: uint32(content.len), payload: ByteList(payload))
 
 proc handleFindContent(p: PortalProtocol, fc: FindContentMessage): seq[byte] =
   # TODO: Need to check networkId, type, trie path
   let
-    # TODO: Should we first do a simple check on ContentId versus Radius?
     contentId = toContentId(fc.contentKey)
-    content = p.contentStorage.getContent(fc.contentKey)
+    content = p.getLocalContent(contentId)
   if content.isSome():
+    if content.get().len > contentChunkSize:
+      # Too large for one message, send the first chunk. The requester
+      # continues with FindContentChunk requests.
+      return encodeMessage(contentChunk(content.get(), 0))
+
     let enrs = List[ByteList, 32](@[]) # Empty enrs when payload is send
     encodeMessage(FoundContentMessage(
       enrs: enrs, payload: ByteList(content.get())))
@@ -82,6 +180,14 @@ proc handleFindContent(p: PortalProtocol, fc: FindContentMessage): seq[byte] =
     encodeMessage(FoundContentMessage(
       enrs: List[ByteList, 32](List(enrs)), payload: payload))
 
+proc handleFindContentChunk(p: PortalProtocol, fcc: FindContentChunkMessage):
+    seq[byte] =
+  let content = p.getLocalContent(toContentId(fcc.contentKey))
+  if content.isSome():
+    encodeMessage(contentChunk(content.get(), fcc.offset.int))
+  else:
+    encodeMessage(ContentChunkMessage(total: 0, payload: ByteList(@[])))
+
 proc handleAdvertise(p: PortalProtocol, a: AdvertiseMessage): seq[byte] =
   # TODO: Not implemented
   let
@@ -108,17 +214,25 @@ proc messageHandler*(protocol: TalkProtocol, request: seq[byte]): seq[byte] =
       p.handleFindContent(message.findcontent)
     of MessageKind.advertise:
       p.handleAdvertise(message.advertise)
+    of MessageKind.findnodepage:
+      p.handleFindNodePage(message.findnodepage)
+    of MessageKind.findcontentchunk:
+      p.handleFindContentChunk(message.findcontentchunk)
     else:
       @[]
   else:
     @[]
 
 proc new*(T: type PortalProtocol, baseProtocol: protocol.Protocol,
-    dataRadius = UInt256.high()): T =
+    dataRadius = UInt256.high(), storageSize = defaultMaxSize,
+    storagePath = ""): T =
+  ## The content is stored in directory `storagePath`, or in memory if it
+  ## is empty.
   let proto = PortalProtocol(
     protocolHandler: messageHandler,
     baseProtocol: baseProtocol,
-    dataRadius: dataRadius)
+    contentStorage: ContentStorage.new(baseProtocol.localNode.id,
+      path = storagePath, radius = dataRadius, maxSize = storageSize))
 
   proto.baseProtocol.registerTalkProtocol(PortalProtocolId, proto).expect(
     "Only one protocol should have this id")
@@ -171,8 +285,103 @@ proc findNode*(p: PortalProtocol, dst: Node, distances: List[uint16, 256]):
   else:
     return err(talkresp.error)
 
+proc reqResponse[Request: SomeMessage, Response: SomeMessage](
+    p: PortalProtocol, dst: Node, request: Request):
+    Future[DiscResult[Response]] {.async.} =
+  trace "Send message request", dstId = dst.id, kind = messageKind(Request)
+  let talkresp = await talkreq(p.baseProtocol, dst, PortalProtocolId,
+    encodeMessage(request))
+
+  if talkresp.isOk():
+    let decoded = decodeMessage(talkresp.get().response)
+    if decoded.isOk():
+      let message = decoded.get()
+      if message.kind == messageKind(Response):
+        return ok(message.innerMessage(Response))
+      else:
+        return err("Invalid message response received")
+    else:
+      return err(decoded.error)
+  else:
+    return err(talkresp.error)
+
+proc findNodePage*(p: PortalProtocol, dst: Node,
+    distances: List[uint16, 256], page: uint8):
+    Future[DiscResult[NodesMessage]] =
+  reqResponse[FindNodePageMessage, NodesMessage](p, dst,
+    FindNodePageMessage(distances: distances, page: page))
+
+proc findNodes*(p: PortalProtocol, dst: Node, distances: List[uint16, 256]):
+    Future[DiscResult[seq[Record]]] {.async.} =
+  ## All records at `distances`, following the pages of the response
+  let first = await p.findNode(dst, distances)
+  if first.isErr():
+    return err(first.error)
+
+  var enrs = first.get().enrs.asSeq()
+  for page in 1'u8 ..< first.get().total:
+    let nodes = await p.findNodePage(dst, distances, page)
+    if nodes.isErr():
+      return err(nodes.error)
+    enrs.add(nodes.get().enrs.asSeq())
+
+  var records: seq[Record]
+  for enr in enrs:
+    var record: Record
+    if record.fromBytes(enr.asSeq()):
+      records.add(record)
+  return ok(records)
+
+proc findContentChunk*(p: PortalProtocol, dst: Node, contentKey: ContentKey,
+    offset: uint32): Future[DiscResult[ContentChunkMessage]] =
+  reqResponse[FindContentChunkMessage, ContentChunkMessage](p, dst,
+    FindContentChunkMessage(contentKey: contentKey, offset: offset))
+
+proc cancelPending[T](requests: openArray[Future[T]]) =
+  for request in requests:
+    if not request.finished():
+      request.cancel()
+
+proc fetchContent(p: PortalProtocol, dst: Node, contentKey: ContentKey,
+    first: ContentChunkMessage): Future[DiscResult[seq[byte]]] {.async.} =
+  # The first chunk sets the content size and the chunk size, the remaining
+  # chunks are requested with at most `maxChunksInFlight` outstanding. The
+  # transfer is abandoned on the first failing chunk, the requests still
+  # outstanding are cancelled.
+  let
+    total = first.total.int
+    chunkSize = first.payload.len
+  if total > maxContentSize or chunkSize == 0 or chunkSize > total:
+    return err("Invalid content chunk")
+
+  var content = newSeq[byte](total)
+  content[0 ..< chunkSize] = first.payload.asSeq()
+
+  var offset = chunkSize
+  while offset < total:
+    var
+      offsets: seq[int]
+      requests: seq[Future[DiscResult[ContentChunkMessage]]]
+    while requests.len < maxChunksInFlight and offset < total:
+      offsets.add(offset)
+      requests.add(p.findContentChunk(dst, contentKey, uint32(offset)))
+      offset += chunkSize
+
+    for i, request in requests:
+      let chunk = await request
+      if chunk.isErr():
+        cancelPending(requests.toOpenArray(i + 1, requests.high))
+        return err(chunk.error)
+      let size = min(chunkSize, total - offsets[i])
+      if chunk.get().total.int != total or chunk.get().payload.len != size:
+        cancelPending(requests.toOpenArray(i + 1, requests.high))
+        return err("Invalid content chunk")
+      content[offsets[i] ..< offsets[i] + size] = chunk.get().payload.asSeq()
+
+  return ok(content)
+
 proc findContent*(p: PortalProtocol, dst: Node, contentKey: ContentKey):
-    Future[DiscResult[FoundContentMessage]] {.async.} =
+    Future[DiscResult[FoundContent]] {.async.} =
   let fc = FindContentMessage(contentKey: contentKey)
 
   trace "Send message request", dstId = dst.id, kind = MessageKind.findcontent
@@ -183,8 +392,16 @@ proc findContent*(p: PortalProtocol, dst: Node, contentKey: ContentKey):
     let decoded = decodeMessage(talkresp.get().response)
     if decoded.isOk():
       let message = decoded.get()
-      if message.kind == foundcontent:
-        return ok(message.foundcontent)
+      case message.kind
+      of foundcontent:
+        return ok(FoundContent(enrs: message.foundcontent.enrs,
+          payload: message.foundcontent.payload.asSeq()))
+      of contentchunk:
+        let content =
+          await p.fetchContent(dst, contentKey, message.contentchunk)
+        if content.isErr():
+          return err(content.error)
+        return ok(FoundContent(payload: content.get()))
       else:
         return err("Invalid message response received")
     else:
@@ -12,6 +12,7 @@ import ../../test_macro
 import
   ./test_portal_encoding,
   ./test_portal,
+  ./test_content_storage,
   ./test_content_network
 
 cliBuilder:
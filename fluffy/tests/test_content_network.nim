@@ -47,11 +47,14 @@ procSuite "Content Network":
     let trie =
       genesisToTrie("fluffy" / "tests" / "custom_genesis" / "chainid7.json")
 
-    proto1.contentStorage = ContentStorage(trie: trie)
-
     var keys: seq[seq[byte]]
     for k, v in trie.replicate:
       keys.add(k)
+      let contentKey = ContentKey(
+        networkId: 0'u16,
+        contentType: content.ContentType.Account,
+        nodeHash: List[byte, 32](k))
+      check proto1.contentStorage.put(contentKey, v)
 
     for key in keys:
       let
@@ -68,5 +71,5 @@ procSuite "Content Network":
         foundContent.get().payload.len() != 0
         foundContent.get().enrs.len() == 0
 
-      let hash = hexary.keccak(foundContent.get().payload.asSeq())
+      let hash = hexary.keccak(foundContent.get().payload)
       check hash.data == key
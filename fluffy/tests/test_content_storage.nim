@@ -0,0 +1,89 @@
+# Nimbus - Portal Network
+# Copyright (c) 2021 Status Research & Development GmbH
+# Licensed and distributed under either of
+#   * MIT license (license terms in the root directory or at https://opensource.org/licenses/MIT).
+#   * Apache v2 license (license terms in the root directory or at https://www.apache.org/licenses/LICENSE-2.0).
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+{.used.}
+
+import
+  std/os,
+  testutils/unittests, stint, nimcrypto/hash,
+  ../content, ../content_storage
+
+func contentIdAt(distance: UInt256): ContentId =
+  # content id at `distance` from the zero node id
+  ContentId(data: distance.toBytesBE())
+
+suite "Content Storage":
+  test "Radius":
+    let storage = ContentStorage.new(0.u256, radius = 1000.u256)
+
+    check:
+      storage.put(contentIdAt(1000.u256), [1'u8, 2, 3])
+      not storage.put(contentIdAt(1001.u256), [1'u8, 2, 3])
+      storage.get(contentIdAt(1000.u256)) == some(@[1'u8, 2, 3])
+      storage.get(contentIdAt(1001.u256)).isNone()
+      storage.len == 1
+      storage.size == 3
+
+  test "Evict furthest content":
+    let storage = ContentStorage.new(0.u256, maxSize = 30, hotCacheSize = 2)
+
+    for distance in [5, 1, 4, 2, 3]:
+      check storage.put(contentIdAt(distance.u256), newSeq[byte](10))
+
+    check:
+      storage.len == 3
+      storage.size == 30
+      contentIdAt(1.u256) in storage
+      contentIdAt(2.u256) in storage
+      contentIdAt(3.u256) in storage
+      contentIdAt(4.u256) notin storage
+      contentIdAt(5.u256) notin storage
+      storage.radius == 3.u256
+      not storage.put(contentIdAt(4.u256), newSeq[byte](10))
+      # served from the database, not only the hot cache
+      storage.get(contentIdAt(1.u256)) == some(newSeq[byte](10))
+
+  test "Overwrite content":
+    let storage = ContentStorage.new(0.u256, maxSize = 30)
+
+    check:
+      storage.put(contentIdAt(1.u256), newSeq[byte](10))
+      storage.put(contentIdAt(1.u256), newSeq[byte](20))
+      storage.len == 1
+      storage.size == 20
+      storage.put(contentIdAt(2.u256), newSeq[byte](10))
+      storage.radius == UInt256.high()
+
+  test "Reopen stored content":
+    let path = getTempDir() / "fluffy_test_content_storage"
+    removeDir(path)
+
+    block:
+      let storage = ContentStorage.new(0.u256, path = path)
+      for distance in [1, 2, 3]:
+        check storage.put(contentIdAt(distance.u256), newSeq[byte](10))
+      storage.close()
+
+    block:
+      let storage = ContentStorage.new(0.u256, path = path)
+      check:
+        storage.len == 3
+        storage.size == 30
+        storage.get(contentIdAt(2.u256)) == some(newSeq[byte](10))
+      storage.close()
+
+    block:
+      # the index is rebuilt before the new cap is applied
+      let storage = ContentStorage.new(0.u256, path = path, maxSize = 20)
+      check:
+        storage.len == 2
+        contentIdAt(3.u256) notin storage
+        storage.radius == 2.u256
+        storage.get(contentIdAt(1.u256)) == some(newSeq[byte](10))
+      storage.close()
+
+    removeDir(path)
@@ -8,8 +8,9 @@
 {.used.}
 
 import
+  std/sequtils,
   chronos, testutils/unittests, stew/shims/net,
-  eth/keys, eth/p2p/discoveryv5/routing_table,
+  eth/keys, eth/p2p/discoveryv5/[enr, node, routing_table],
   eth/p2p/discoveryv5/protocol as discv5_protocol,
   ../network/portal_protocol,
   ./test_helpers
@@ -88,6 +89,84 @@ procSuite "Portal Tests":
     await node1.closeWait()
     await node2.closeWait()
 
+  asyncTest "Portal FindNodePage/Nodes - paged response":
+    let
+      node1 = initDiscoveryNode(
+        rng, PrivateKey.random(rng[]), localAddress(20302))
+      node2 = initDiscoveryNode(
+        rng, PrivateKey.random(rng[]), localAddress(20303))
+
+      proto1 = PortalProtocol.new(node1)
+      proto2 = PortalProtocol.new(node2)
+
+    # More records than fit in one talkresp, but no more than the 16 nodes
+    # returned for a request.
+    var nodes = @[node1]
+    for i in 0..<12:
+      nodes.add(initDiscoveryNode(
+        rng, PrivateKey.random(rng[]), localAddress(20310 + i)))
+    for node in nodes:
+      # ping in one direction to add, ping in the other to update as seen.
+      check (await node.ping(node2.localNode)).isOk()
+      check (await node2.ping(node.localNode)).isOk()
+
+    let
+      dst = proto2.baseProtocol.localNode
+      distances = List[uint16, 256](toSeq(240'u16 .. 256'u16))
+      first = await proto1.findNode(dst, distances)
+
+    check:
+      first.isOk()
+      first.get().total > 1'u8
+      first.get().enrs.len() < nodes.len
+
+    # the other pages come from the same node set, a node added in between
+    # does not show up
+    let late = initDiscoveryNode(
+      rng, PrivateKey.random(rng[]), localAddress(20330))
+    check (await late.ping(node2.localNode)).isOk()
+    check (await node2.ping(late.localNode)).isOk()
+
+    var enrs = first.get().enrs.asSeq()
+    for page in 1'u8 ..< first.get().total:
+      let nodesPage = await proto1.findNodePage(dst, distances, page)
+      check:
+        nodesPage.isOk()
+        nodesPage.get().total == first.get().total
+      enrs.add(nodesPage.get().enrs.asSeq())
+
+    var ids: seq[NodeId]
+    for enr in enrs:
+      var record: Record
+      check record.fromBytes(enr.asSeq())
+      ids.add(newNode(record).get().id)
+    check:
+      ids.len == nodes.len
+      ids.deduplicate().len == nodes.len
+      late.localNode.id notin ids
+    for node in nodes:
+      check node.localNode.id in ids
+
+    block: # Page beyond the last one
+      let nodesPage = await proto1.findNodePage(dst, distances,
+        first.get().total)
+      check:
+        nodesPage.isOk()
+        nodesPage.get().enrs.len() == 0
+
+    block: # All pages of a new request, which sees the late node
+      let records = await proto1.findNodes(dst, distances)
+      check records.isOk()
+      let found = records.get().mapIt(newNode(it).get().id)
+      check:
+        found.len == nodes.len + 1
+        late.localNode.id in found
+
+    for node in nodes:
+      await node.closeWait()
+    await late.closeWait()
+    await node2.closeWait()
+
   asyncTest "Portal FindContent/FoundContent - send enrs":
     let
       node1 = initDiscoveryNode(
@@ -118,3 +197,34 @@ procSuite "Portal Tests":
 
     await node1.closeWait()
     await node2.closeWait()
+
+  asyncTest "Portal FindContent/ContentChunk - large content":
+    let
+      node1 = initDiscoveryNode(
+        rng, PrivateKey.random(rng[]), localAddress(20302))
+      node2 = initDiscoveryNode(
+        rng, PrivateKey.random(rng[]), localAddress(20303))
+
+      proto1 = PortalProtocol.new(node1)
+      proto2 = PortalProtocol.new(node2)
+
+    let contentKey = ContentKey(networkId: 0'u16,
+      contentType: ContentType.ContractBytecode,
+      nodeHash: List[byte, 32](@(UInt256.random(rng[]).toBytes())))
+
+    # spans several rounds of chunk requests
+    var content = newSeq[byte](contentChunkSize * maxChunksInFlight * 2 + 100)
+    for i in 0..<content.len:
+      content[i] = byte(i mod 251)
+    check proto2.contentStorage.put(contentKey, content)
+
+    let foundContent = await proto1.findContent(proto2.baseProtocol.localNode,
+      contentKey)
+
+    check:
+      foundContent.isOk()
+      foundContent.get().enrs.len() == 0
+      foundContent.get().payload == content
+
+    await node1.closeWait()
+    await node2.closeWait()
@@ -120,6 +120,61 @@ suite "Portal Protocol Message Encodings":
       message.foundcontent.enrs.len() == 0
       message.foundcontent.payload == payload
 
+  test "FindNodePage Request":
+    let
+      distances = List[uint16, 256](@[0x0100'u16])
+      fnp = FindNodePageMessage(distances: distances, page: 2'u8)
+
+    let encoded = encodeMessage(fnp)
+    check encoded.toHex == "0905000000020001"
+
+    let decoded = decodeMessage(encoded)
+    check decoded.isOk()
+
+    let message = decoded.get()
+    check:
+      message.kind == findnodepage
+      message.findnodepage.distances == distances
+      message.findnodepage.page == 2'u8
+
+  test "FindContentChunk Request":
+    var nodeHash: List[byte, 32]
+    let
+      contentKey = ContentKey(
+        networkId: 0'u16,
+        contentType: ContentType.Account,
+        nodeHash: nodeHash)
+      fcc = FindContentChunkMessage(contentKey: contentKey, offset: 960'u32)
+
+    let encoded = encodeMessage(fcc)
+    check encoded.toHex == "0a08000000c003000000000107000000"
+
+    let decoded = decodeMessage(encoded)
+    check decoded.isOk()
+
+    let message = decoded.get()
+    check:
+      message.kind == findcontentchunk
+      message.findcontentchunk.contentKey == contentKey
+      message.findcontentchunk.offset == 960'u32
+
+  test "ContentChunk Response":
+    let
+      payload = ByteList(@[byte 0x01, 0x02, 0x03])
+      cc = ContentChunkMessage(total: 2048'u32, payload: payload)
+
+    let encoded = encodeMessage(cc)
+    check encoded.toHex == "0b0008000008000000010203"
+
+    let decoded = decodeMessage(encoded)
+    check decoded.isOk()
+
+    let message = decoded.get()
+    check:
+      message.kind == contentchunk
+      message.contentchunk.total == 2048'u32
+      message.contentchunk.payload == payload
+
   test "Advertise Request":
     let
       contentKeys = List[ByteList, 32](List(@[ByteList(@[byte 0x01, 0x02, 0x03])]))
@@ -10,52 +10,11 @@
 import
   std/[terminal, os],
   chronicles, eth/trie/db, eth/[common, rlp], stew/[io2, byteutils],
-  ./config, ./genesis, ./p2p/chain,
+  ./config, ./genesis, ./p2p/chain, ./p2p/chain/rlp_import,
   ./db/[db_chain, select_backend, storage_types]
 
-type
-  # trick the rlp decoder
-  # so we can separate the body and header
-  EthHeader = object
-    header: BlockHeader
-
-proc importRlpBlock*(importFile: string; chainDB: BasechainDB): bool =
-  let res = io2.readAllBytes(importFile)
-  if res.isErr:
-    error "failed to import",
-      fileName = importFile
-    return false
-
-  var
-    # the encoded rlp can contains one or more blocks
-    rlp = rlpFromBytes(res.get)
-    chain = newChain(chainDB, extraValidation = true)
-    errorCount = 0
-  let
-    head = chainDB.getCanonicalHead()
-
-  while rlp.hasData:
-    try:
-      let
-        header = rlp.read(EthHeader).header
-        body = rlp.readRecordType(BlockBody, false)
-      if header.blockNumber > head.blockNumber:
-        if chain.persistBlocks([header], [body]) == ValidationResult.Error:
-          # register one more error and continue
-          errorCount.inc
-    except RlpError as e:
-      # terminate if there was a decoding error
-      error "rlp error",
-        fileName = importFile,
-        msg = e.msg,
-        exception = e.name
-      return false
-    except CatchableError as e:
-      # otherwise continue
-      error "import error",
-        fileName = importFile,
-        msg = e.msg,
-        exception = e.name
-      errorCount.inc
-
-  return errorCount == 0
+proc importRlpBlock*(importFile: string; chainDB: BasechainDB;
+                     checkSeal = false): bool =
+  ## Stream the blocks of `importFile` into `chainDB`, see `importRlpBlocks()`
+  let chain = newChain(chainDB, extraValidation = true)
+  chain.importRlpBlocks(importFile, checkSeal)
@@ -65,6 +65,10 @@ type
     ## JSON-RPC configuration object
     flags*: set[RpcFlags]         ## RPC flags
     binds*: seq[TransportAddress] ## RPC bind address
+    callWorkers*: int             ## Threads for `eth_call`, 0 for none
+    traceDir*: string             ## `debug_*ToFile` output, empty for
+                                  ## `<datadir>/traces`
+    traceFiles*: int              ## Trace files kept, older ones deleted
 
   GraphqlConfiguration* = object
     enabled*: bool
@@ -134,6 +138,11 @@ type
     rng*: ref BrHmacDrbgContext
     accounts*: Table[EthAddress, NimbusAccount]
     importFile*: string
+    snapshot*: bool               ## Maintain flat state snapshot
+    db*: DbOptions                ## Database backend tuning
+    ethashDag*: bool              ## Verify PoW seals using the full dataset
+    txConflictStats*: bool        ## Export transaction conflict statistics
+    stateHistory*: int            ## Recent states kept when pruning, 0 for all
 
 const
   # these are public network id
@@ -376,6 +385,31 @@ proc processEthArguments(key, value: string): ConfigStatus =
     result = processPruneList(value, config.prune)
   of "import":
     config.importFile = value
+  of "snapshot":
+    config.snapshot = true
+  of "db-cache":
+    result = processInteger(value, config.db.blockCacheMB)
+  of "db-bloom":
+    result = processInteger(value, config.db.bloomBitsPerKey)
+  of "db-write-buffer":
+    result = processInteger(value, config.db.writeBufferMB)
+  of "db-max-open-files":
+    result = processInteger(value, config.db.maxOpenFiles)
+  of "db-compaction":
+    case value.toLowerAscii()
+    of "level": config.db.compaction = DbCompactionStyle.Level
+    of "universal": config.db.compaction = DbCompactionStyle.Universal
+    else: result = ErrorIncorrectOption
+  of "db-column-families":
+    config.db.columnFamilies = true
+  of "ethash-dag":
+    config.ethashDag = true
+  of "tx-conflict-stats":
+    config.txConflictStats = true
+  of "state-history":
+    result = processInteger(value, config.stateHistory)
+    if result == Success and config.stateHistory < 0:
+      result = ErrorIncorrectOption
   else:
     result = EmptyOption
 
@@ -397,6 +431,16 @@ proc processRpcArguments(key, value: string): ConfigStatus =
     else:
       config.rpc.flags.incl(RpcFlags.Enabled)
     result = processRpcApiList(value, config.rpc.flags)
+  elif skey == "rpcworkers":
+    result = processInteger(value, config.rpc.callWorkers)
+    if result == Success and config.rpc.callWorkers < 0:
+      result = ErrorIncorrectOption
+  elif skey == "rpctracedir":
+    config.rpc.traceDir = value
+  elif skey == "rpctracefiles":
+    result = processInteger(value, config.rpc.traceFiles)
+    if result == Success and config.rpc.traceFiles < 1:
+      result = ErrorIncorrectOption
   else:
     result = EmptyOption
 
@@ -626,6 +670,7 @@ proc initConfiguration(): NimbusConfiguration =
   ## RPC defaults
   result.rpc.flags = {}
   result.rpc.binds = @[initTAddress("127.0.0.1:8545")]
+  result.rpc.traceFiles = 16
 
   ## Network defaults
   result.net.setNetwork(defaultNetwork)
@@ -647,6 +692,7 @@ proc initConfiguration(): NimbusConfiguration =
   result.dataDir = getHomeDir() / dataDir
   result.keystore = getHomeDir() / keystore
   result.prune = PruneMode.Full
+  result.db = defaultDbOptions
 
   ## Debug defaults
   result.debug.flags = {}
@@ -660,6 +706,12 @@ proc getConfiguration*(): NimbusConfiguration =
     nimbusConfig = initConfiguration()
   result = nimbusConfig
 
+proc pruneTrie*(conf: NimbusConfiguration): bool =
+  ## Whether replaced state trie nodes are deleted right away by the trie.
+  ## With `--state-history` they are deleted by the state pruner only, so
+  ## the recent states are kept and the reference counts stay intact.
+  conf.prune == PruneMode.Full and conf.stateHistory == 0
+
 proc getHelpString*(): string =
   var logLevels: seq[string]
   for level in LogLevel:
@@ -677,6 +729,18 @@ ETHEREUM OPTIONS:
   --keystore:<value>      Directory for the keystore (default: inside datadir)
   --prune:<value>         Blockchain prune mode (full or archive, default: full)
   --import:<path>         Import RLP encoded block(s), validate, write to database and quit
+  --state-history:<value> With --prune:full, delete the states of blocks older than the last <value> (default: 0, keep all)
+  --snapshot              Maintain a flat account/storage snapshot for faster state reads
+  --ethash-dag            Verify PoW seals on import, using a full ethash dataset in <datadir>/ethash (1GiB+)
+  --tx-conflict-stats     Diagnostics: export metrics on how many transactions per block would conflict under parallel execution (Berlin and later)
+
+DATABASE OPTIONS (RocksDB):
+  --db-cache:<value>      Block cache size in MiB (default: library default)
+  --db-bloom:<value>      Bloom filter bits per key, 0 disables filters (default: 0)
+  --db-write-buffer:<value> Memtable size in MiB (default: library default)
+  --db-max-open-files:<value> Max number of open files, -1 for unlimited (default: 512)
+  --db-compaction:<value> Compaction style (level or universal, default: level)
+  --db-column-families    Separate key spaces into column families (new databases only)
 
 NETWORKING OPTIONS:
   --bootnodes:<value>     Comma separated enode URLs for P2P discovery bootstrap (set v4+v5 instead for light servers)
@@ -710,6 +774,9 @@ LOCAL SERVICE OPTIONS:
   --rpc                   Enable the HTTP-RPC server
   --rpcbind:<value>       Set address:port pair(s) (comma-separated) HTTP-RPC server will bind to (default: localhost:8545)
   --rpcapi:<value>        Enable specific set of RPC API from list (comma-separated) (available: eth, debug)
+  --rpcworkers:<value>    Run eth_call and eth_estimateGas on <value> worker threads against database snapshots (default: 0, on the main thread)
+  --rpctracedir:<path>    Directory for the trace files of debug_*ToFile, local operators only (default: <datadir>/traces)
+  --rpctracefiles:<value> Number of trace files kept, older ones are deleted (default: 16)
   --graphql               Enable the HTTP-GraphQL server
   --graphqlbind:<value>   Set address:port pair GraphQL server will bind (default: localhost:8547)
 
@@ -40,5 +40,16 @@ proc add*(ac: var AccessList, address: EthAddress, slot: UInt256) =
   do:
     ac.slots[address] = toHashSet([slot])
 
+proc del*(ac: var AccessList, address: EthAddress) {.inline.} =
+  ac.slots.del(address)
+
+proc del*(ac: var AccessList, address: EthAddress, slot: UInt256) =
+  ac.slots.withValue(address, val):
+    val[].excl slot
+
 proc clear*(ac: var AccessList) {.inline.} =
   ac.slots.clear()
+
+iterator pairs*(ac: AccessList): (EthAddress, HashSet[UInt256]) =
+  for address, slots in ac.slots:
+    yield (address, slots)
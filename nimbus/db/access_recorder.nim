@@ -0,0 +1,87 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## State Access Recorder
+## =====================
+##
+## Read and write sets of a transaction, for diagnostics only. They are
+## collected after the transaction was executed, see
+## `AccountsCache.collectAccess()`, the state accessors do not record
+## anything. Accounts (balance, nonce, code and existence) and storage
+## slots are tracked separately, so transactions writing different slots of
+## the same contract do not collide. Miner fee credits are tracked apart
+## from the writes, they do not collide with each other.
+
+import
+  std/[sets, tables],
+  eth/common
+
+type
+  AccessSet* = object
+    accounts*: HashSet[EthAddress]              ## Account header fields
+    slots*: Table[EthAddress,HashSet[UInt256]]  ## Storage slots
+    wiped*: HashSet[EthAddress]                 ## All storage (writes only)
+    credited*: HashSet[EthAddress]              ## Balance added (writes only)
+
+  AccessRecorder* = ref object
+    reads*: AccessSet
+    writes*: AccessSet
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc newAccessRecorder*(): AccessRecorder =
+  AccessRecorder()
+
+proc addAccount*(s: var AccessSet; address: EthAddress) {.inline.} =
+  s.accounts.incl address
+
+proc addSlot*(s: var AccessSet; address: EthAddress; slot: UInt256) =
+  s.slots.mgetOrPut(address, initHashSet[UInt256]()).incl slot
+
+proc addWiped*(s: var AccessSet; address: EthAddress) {.inline.} =
+  s.wiped.incl address
+
+proc addCredit*(s: var AccessSet; address: EthAddress) {.inline.} =
+  s.credited.incl address
+
+proc merge*(s: var AccessSet; other: AccessSet) =
+  ## Add all entries of `other`
+  for address in other.accounts:
+    s.accounts.incl address
+  for address, slots in other.slots:
+    for slot in slots:
+      s.addSlot(address, slot)
+  for address in other.wiped:
+    s.wiped.incl address
+  for address in other.credited:
+    s.credited.incl address
+
+proc overlaps*(writes, reads: AccessSet): bool =
+  ## True if anything of `reads` was changed by `writes`. Credits do not
+  ## overlap with each other, but with a read of the account credited.
+  for address in reads.accounts:
+    if address in writes.accounts or address in writes.credited:
+      return true
+  for address, slots in reads.slots:
+    if address in writes.wiped:
+      return true
+    let written = writes.slots.getOrDefault(address)
+    if 0 < written.len:
+      for slot in slots:
+        if slot in written:
+          return true
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
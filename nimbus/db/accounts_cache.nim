@@ -1,9 +1,12 @@
 import
-  tables, hashes, sets,
+  algorithm, tables, hashes, sets,
   eth/[common, rlp], eth/trie/[hexary, db, trie_defs],
-  ../constants, ../utils, storage_types,
+  ../constants, ../utils, ../utils/evm_profiler, storage_types,
   ../../stateless/multi_keys,
-  ./access_list
+  ./access_list, ./access_recorder, ./state_snapshot, ./state_cache
+
+export
+  access_recorder
 
 type
   AccountFlag = enum
@@ -14,7 +17,9 @@ type
     IsClone
     CodeLoaded
     CodeChanged
+    NonceOrBalanceChanged
     StorageChanged
+    StorageCleared
 
   AccountFlags = set[AccountFlag]
 
@@ -24,6 +29,9 @@ type
     code: seq[byte]
     originalStorage: TableRef[UInt256, UInt256]
     overlayStorage: Table[UInt256, UInt256]
+    pendingStorage: TableRef[UInt256, UInt256] # staged for `flush()`
+    pendingFlags: AccountFlags              # staged for `flush()`
+    version: int     # journal position when this copy was cached
 
   WitnessData* = object
     storageKeys*: HashSet[UInt256]
@@ -33,8 +41,18 @@ type
     db: TrieDatabaseRef
     trie: SecureHexaryTrie
     savePoint: SavePoint
+    cache: Table[EthAddress, RefAccount] # latest copy of each account
+    accList: access_list.AccessList
+    journal: seq[JournalEntry]   # undo log for savepoint rollback
+    journalBase: int             # journal position of `journal[0]`
     witnessCache: Table[EthAddress, WitnessData]
     isDirty: bool
+    snap: StateSnapshot
+    snapOk: bool     # `snap` is consistent with `trie.rootHash`
+    stateCache: StateCacheRef
+    deferred: bool   # deferred commit mode, see `deferredCommit=`
+    pending: HashSet[EthAddress] # accounts staged by `persist()`
+    clearOnFlush: bool
 
   ReadOnlyStateDB* = distinct AccountsCache
 
@@ -45,10 +63,25 @@ type
 
   SavePoint* = ref object
     parentSavepoint: SavePoint
-    cache: Table[EthAddress, RefAccount]
-    accessList: access_list.AccessList
+    journalPos: int  # journal position when the savepoint was started
     state: TransactionState
 
+  JournalKind = enum
+    ## Undo actions for savepoint rollback
+    RestoreAccount   # `prev` is the previous copy, `nil` if not cached
+    ForgetAddress    # address added to the access list
+    ForgetSlot       # slot added to the access list
+
+  JournalEntry = object
+    address: EthAddress
+    case kind: JournalKind
+    of RestoreAccount:
+      prev: RefAccount
+    of ForgetAddress:
+      discard
+    of ForgetSlot:
+      slot: UInt256
+
 const
   emptyAcc = newAccount()
 
@@ -58,34 +91,82 @@ const
     IsTouched,
     IsClone,
     CodeChanged,
-    StorageChanged
+    NonceOrBalanceChanged,
+    StorageChanged,
+    StorageCleared
     }
 
 proc beginSavepoint*(ac: var AccountsCache): SavePoint {.gcsafe.}
+proc flush(ac: AccountsCache)
 
 # The AccountsCache is modeled after TrieDatabase for it's transaction style
 proc init*(x: typedesc[AccountsCache], db: TrieDatabaseRef,
-           root: KeccakHash, pruneTrie: bool = true): AccountsCache =
+           root: KeccakHash, pruneTrie: bool = true,
+           useSnapshot: bool = false): AccountsCache =
+  ## If `useSnapshot` is set and the flat state snapshot is consistent with
+  ## `root`, reads go to the snapshot and `persist()` keeps it up to date.
   new result
   result.db = db
   result.trie = initSecureHexaryTrie(db, root, pruneTrie)
   result.witnessCache = initTable[EthAddress, WitnessData]()
+  result.pending = initHashSet[EthAddress]()
+  result.cache = initTable[EthAddress, RefAccount]()
+  result.accList.init()
+  if useSnapshot:
+    result.snap = StateSnapshot.init(db)
+    result.snapOk = result.snap.isValidFor(root)
   discard result.beginSavepoint
 
 proc init*(x: typedesc[AccountsCache], db: TrieDatabaseRef, pruneTrie: bool = true): AccountsCache =
   init(x, db, emptyRlpHash, pruneTrie)
 
+proc attachStateCache*(ac: AccountsCache, sc: StateCacheRef) =
+  ## Use the cross-block cache `sc` in front of the database. Committed
+  ## writes from `persist()` are written through.
+  ac.stateCache = sc
+  if not sc.isNil:
+    sc.attach(ac.trie.rootHash)
+
+template sharedOk(ac: AccountsCache): bool =
+  # the shared cache might have been advanced by somebody else
+  not ac.stateCache.isNil and ac.stateCache.root == ac.trie.rootHash
+
 proc rootHash*(ac: AccountsCache): KeccakHash =
   # make sure all savepoint already committed
   doAssert(ac.savePoint.parentSavePoint.isNil)
   # make sure all cache already committed
   doAssert(ac.isDirty == false)
+  ac.flush()
   ac.trie.rootHash
 
+proc `deferredCommit=`*(ac: AccountsCache, enable: bool) =
+  ## In deferred commit mode, `persist()` only stages the changes. The
+  ## tries are updated when the `rootHash` is asked for, in trie key order
+  ## and once per account and slot, however often they were written by the
+  ## transactions of a block. The trie accessors `getStorageRoot()` and
+  ## `storage` see the staged changes only after `rootHash` was called.
+  if not enable:
+    ac.flush()
+  ac.deferred = enable
+
+template journalHead(ac: AccountsCache): int =
+  ac.journalBase + ac.journal.len
+
+template isWritable(ac: AccountsCache, acc: RefAccount): bool =
+  # the copy was cached within the current savepoint and can be modified
+  # in place, a rollback restores the previous copy
+  ac.savePoint.journalPos <= acc.version
+
+proc setAccount(ac: AccountsCache, address: EthAddress,
+                acc: RefAccount, prev: RefAccount) =
+  acc.version = ac.journalHead
+  ac.journal.add JournalEntry(
+    kind: RestoreAccount, address: address, prev: prev)
+  ac.cache[address] = acc
+
 proc beginSavepoint*(ac: var AccountsCache): SavePoint =
   new result
-  result.cache = initTable[EthAddress, RefAccount]()
-  result.accessList.init()
+  result.journalPos = ac.journalHead
   result.state = Pending
   result.parentSavepoint = ac.savePoint
   ac.savePoint = result
@@ -95,6 +176,24 @@ proc rollback*(ac: var AccountsCache, sp: Savepoint) =
   # Any child transaction must be committed or rolled-back before
   # its parent transactions:
   doAssert ac.savePoint == sp and sp.state == Pending
+
+  # replay the journal backwards, the journal might have been truncated
+  # by `persist()` for the lowest savepoint
+  let pos = max(sp.journalPos - ac.journalBase, 0)
+  for n in countdown(ac.journal.len - 1, pos):
+    let entry = ac.journal[n]
+    case entry.kind
+    of RestoreAccount:
+      if entry.prev.isNil:
+        ac.cache.del entry.address
+      else:
+        ac.cache[entry.address] = entry.prev
+    of ForgetAddress:
+      ac.accList.del entry.address
+    of ForgetSlot:
+      ac.accList.del(entry.address, entry.slot)
+  ac.journal.setLen(pos)
+
   ac.savePoint = sp.parentSavepoint
   sp.state = RolledBack
 
@@ -106,11 +205,8 @@ proc commit*(ac: var AccountsCache, sp: Savepoint) =
   # cannot commit most inner savepoint
   doAssert not sp.parentSavepoint.isNil
 
+  # the journal entries now belong to the parent savepoint
   ac.savePoint = sp.parentSavepoint
-  for k, v in sp.cache:
-    sp.parentSavepoint.cache[k] = v
-
-  ac.savePoint.accessList.merge(sp.accessList)
   sp.state = Committed
 
 proc dispose*(ac: var AccountsCache, sp: Savepoint) {.inline.} =
@@ -121,21 +217,39 @@ proc safeDispose*(ac: var AccountsCache, sp: Savepoint) {.inline.} =
   if (not isNil(sp)) and (sp.state == Pending):
     ac.rollback(sp)
 
+proc loadAccount(ac: AccountsCache, address: EthAddress, account: var Account): bool =
+  # committed account state, `false` if the account does not exist
+  let shared = ac.sharedOk
+  if shared:
+    let cached = ac.stateCache.getAccount(address)
+    if not cached.isNil:
+      account = cached.account
+      return cached.exists
+
+  profileDbRead(drAccount)
+  let recordFound =
+    if ac.snapOk: ac.snap.getAccount(keccakHash(address))
+    else: ac.trie.get(address)
+  if recordFound.len > 0:
+    account = rlp.decode(recordFound, Account)
+    result = true
+
+  if shared:
+    ac.stateCache.putAccount(address, result, account)
+
 proc getAccount(ac: AccountsCache, address: EthAddress, shouldCreate = true): RefAccount =
-  # search account from layers of cache
-  var sp = ac.savePoint
-  while sp != nil:
-    result = sp.cache.getOrDefault(address)
-    if not result.isNil:
-      return
-    sp = sp.parentSavepoint
+  # search account from the cache
+  result = ac.cache.getOrDefault(address)
+  if not result.isNil:
+    return
 
-  # not found in cache, look into state trie
-  let recordFound = ac.trie.get(address)
-  if recordFound.len > 0:
+  # not found in cache, look into the cross-block cache, flat snapshot or
+  # state trie
+  var account: Account
+  if ac.loadAccount(address, account):
     # we found it
     result = RefAccount(
-      account: rlp.decode(recordFound, Account),
+      account: account,
       flags: {IsAlive}
       )
   else:
@@ -148,18 +262,22 @@ proc getAccount(ac: AccountsCache, address: EthAddress, shouldCreate = true): Re
       )
 
   # cache the account
-  ac.savePoint.cache[address] = result
+  ac.setAccount(address, result, nil)
 
 proc clone(acc: RefAccount, cloneStorage: bool): RefAccount =
   new(result)
   result.account = acc.account
   result.flags = acc.flags + {IsClone}
   result.code = acc.code
+  result.pendingFlags = acc.pendingFlags
 
   if cloneStorage:
     result.originalStorage = acc.originalStorage
     # it's ok to clone a table this way
     result.overlayStorage = acc.overlayStorage
+    # shared by all versions, only modified by `persist()` and `flush()`
+    # when there is no savepoint to roll back into
+    result.pendingStorage = acc.pendingStorage
 
 proc isEmpty(acc: RefAccount): bool =
   result = acc.account.codeHash == EMPTY_SHA3 and
@@ -186,7 +304,8 @@ template getAccountTrie(db: TrieDatabaseRef, acc: RefAccount): auto =
   # see nim-eth#9
   initSecureHexaryTrie(db, acc.account.storageRoot, false)
 
-proc originalStorageValue(acc: RefAccount, slot: UInt256, db: TrieDatabaseRef): UInt256 =
+proc originalStorageValue(acc: RefAccount, slot: UInt256, ac: AccountsCache,
+                          address: EthAddress): UInt256 =
   # share the same original storage between multiple
   # versions of account
   if acc.originalStorage.isNil:
@@ -195,11 +314,26 @@ proc originalStorageValue(acc: RefAccount, slot: UInt256, db: TrieDatabaseRef):
     acc.originalStorage[].withValue(slot, val) do:
       return val[]
 
+  # an empty (or cleared) storage trie has no slots, whatever the snapshot
+  # still has on record before the next `persist()`
+  if acc.account.storageRoot == emptyRlpHash:
+    acc.originalStorage[slot] = result
+    return
+
+  let shared = ac.sharedOk
+  if shared and ac.stateCache.getSlot(address, slot, result):
+    acc.originalStorage[slot] = result
+    return
+
   # Not in the original values cache - go to the DB.
+  profileDbRead(drStorage)
   let
     slotAsKey = createTrieKeyFromSlot slot
-    accountTrie = getAccountTrie(db, acc)
-    foundRecord = accountTrie.get(slotAsKey)
+    foundRecord =
+      if ac.snapOk:
+        ac.snap.getStorage(keccakHash(address), keccakHash(slotAsKey))
+      else:
+        getAccountTrie(ac.db, acc).get(slotAsKey)
 
   result = if foundRecord.len > 0:
             rlp.decode(foundRecord, UInt256)
@@ -207,20 +341,32 @@ proc originalStorageValue(acc: RefAccount, slot: UInt256, db: TrieDatabaseRef):
             UInt256.zero()
 
   acc.originalStorage[slot] = result
+  if shared:
+    ac.stateCache.putSlot(address, slot, result)
 
-proc storageValue(acc: RefAccount, slot: UInt256, db: TrieDatabaseRef): UInt256 =
+proc storageValue(acc: RefAccount, slot: UInt256, ac: AccountsCache,
+                  address: EthAddress): UInt256 =
   acc.overlayStorage.withValue(slot, val) do:
     return val[]
   do:
-    result = acc.originalStorageValue(slot, db)
+    result = acc.originalStorageValue(slot, ac, address)
 
 proc kill(acc: RefAccount) =
   acc.flags.excl IsAlive
+  acc.flags.incl StorageCleared
   acc.overlayStorage.clear()
+  acc.pendingStorage = nil
   acc.originalStorage = nil
   acc.account = newAccount()
   acc.code = default(seq[byte])
 
+proc wipeSnapStorage(ac: AccountsCache, address: EthAddress) =
+  # drop the slots of the storage trie still on record in the state trie
+  let recordFound = ac.trie.get(address)
+  if recordFound.len > 0:
+    let oldAccount = rlp.decode(recordFound, Account)
+    ac.snap.wipeStorage(keccakHash(address), oldAccount.storageRoot)
+
 type
   PersistMode = enum
     DoNothing
@@ -236,39 +382,70 @@ proc persistMode(acc: RefAccount): PersistMode =
     if IsNew notin acc.flags:
       result = Remove
 
-proc persistCode(acc: RefAccount, db: TrieDatabaseRef) =
+proc persistCode(acc: RefAccount, ac: AccountsCache) =
   if acc.code.len != 0:
     when defined(geth):
-      db.put(acc.account.codeHash.data, acc.code)
+      ac.db.put(acc.account.codeHash.data, acc.code)
     else:
-      db.put(contractHashKey(acc.account.codeHash).toOpenArray, acc.code)
-
-proc persistStorage(acc: RefAccount, db: TrieDatabaseRef, clearCache: bool) =
-  if acc.overlayStorage.len == 0:
-    # TODO: remove the storage too if we figure out
-    # how to create 'virtual' storage room for each account
-    return
-
-  if not clearCache and acc.originalStorage.isNil:
-    acc.originalStorage = newTable[UInt256, UInt256]()
-
+      ac.db.put(contractHashKey(acc.account.codeHash).toOpenArray, acc.code)
+    if not ac.stateCache.isNil:
+      ac.stateCache.putCode(acc.account.codeHash, acc.code)
+
+proc cmpHash(a, b: Hash256): int =
+  for n in 0 ..< a.data.len:
+    if a.data[n] != b.data[n]:
+      return a.data[n].int - b.data[n].int
+
+proc writeStorage(acc: RefAccount, ac: AccountsCache, address: EthAddress,
+                  slots: Table[UInt256, UInt256], shared: bool) =
+  # update the storage trie in trie key order, consecutive updates share
+  # the path prefix down from the root
+  var updates = newSeqOfCap[(Hash256, UInt256)](slots.len)
+  for slot in slots.keys:
+    updates.add (keccakHash(createTrieKeyFromSlot slot), slot)
+  updates.sort(proc(x, y: (Hash256, UInt256)): int = cmpHash(x[0], y[0]))
+
+  let db = ac.db
   var accountTrie = getAccountTrie(db, acc)
+  let addrHash = if ac.snapOk: keccakHash(address) else: default(Hash256)
 
-  for slot, value in acc.overlayStorage:
-    let slotAsKey = createTrieKeyFromSlot slot
+  for item in updates:
+    let
+      (slotHash, slot) = item
+      value = slots[slot]
+      slotAsKey = createTrieKeyFromSlot slot
 
     if value > 0:
       let encodedValue = rlp.encode(value)
       accountTrie.put(slotAsKey, encodedValue)
+      if ac.snapOk:
+        ac.snap.putStorage(addrHash, slotHash, encodedValue)
     else:
       accountTrie.del(slotAsKey)
+      if ac.snapOk:
+        ac.snap.delStorage(addrHash, slotHash)
+
+    if shared:
+      ac.stateCache.putSlot(address, slot, value)
 
     # map slothash back to slot value
     # see iterator storage below
-    # slotHash can be obtained from accountTrie.put?
-    let slotHash = keccakHash(slotAsKey)
     db.put(slotHashToSlotKey(slotHash.data).toOpenArray, rlp.encode(slot))
 
+  acc.account.storageRoot = accountTrie.rootHash
+
+proc persistStorage(acc: RefAccount, ac: AccountsCache, address: EthAddress,
+                    clearCache, shared: bool) =
+  if acc.overlayStorage.len == 0:
+    # TODO: remove the storage too if we figure out
+    # how to create 'virtual' storage room for each account
+    return
+
+  if not clearCache and acc.originalStorage.isNil:
+    acc.originalStorage = newTable[UInt256, UInt256]()
+
+  acc.writeStorage(ac, address, acc.overlayStorage, shared)
+
   if not clearCache:
     # if we preserve cache, move the overlayStorage
     # to originalStorage, related to EIP2200, EIP1283
@@ -279,20 +456,98 @@ proc persistStorage(acc: RefAccount, db: TrieDatabaseRef, clearCache: bool) =
         acc.originalStorage.del(slot)
     acc.overlayStorage.clear()
 
-  acc.account.storageRoot = accountTrie.rootHash
+proc stageStorage(acc: RefAccount) =
+  # deferred commit mode: the slots are written by `flush()`, whereas the
+  # original values move on for EIP2200, EIP1283. Zero values are kept as
+  # well, the storage trie still has the values before the block.
+  if acc.originalStorage.isNil:
+    acc.originalStorage = newTable[UInt256, UInt256]()
+  if acc.pendingStorage.isNil:
+    acc.pendingStorage = newTable[UInt256, UInt256]()
+  for slot, value in acc.overlayStorage:
+    acc.pendingStorage[slot] = value
+    acc.originalStorage[slot] = value
+  acc.overlayStorage.clear()
+
+proc writeAccount(ac: AccountsCache, address: EthAddress, acc: RefAccount,
+                  shared: bool) =
+  let encodedAccount = rlp.encode(acc.account)
+  ac.trie.put address, encodedAccount
+  if ac.snapOk:
+    ac.snap.putAccount(keccakHash(address), encodedAccount)
+  if shared:
+    ac.stateCache.putAccount(address, true, acc.account)
+
+proc removeAccount(ac: AccountsCache, address: EthAddress, shared: bool) =
+  if ac.snapOk:
+    ac.wipeSnapStorage(address)
+    ac.snap.delAccount(keccakHash(address))
+  if shared:
+    ac.stateCache.wipeSlots(address)
+    ac.stateCache.putAccount(address, false, newAccount())
+  ac.trie.del address
+
+proc wipeStorage(ac: AccountsCache, address: EthAddress, shared: bool) =
+  if ac.snapOk:
+    ac.wipeSnapStorage(address)
+  if shared:
+    ac.stateCache.wipeSlots(address)
+
+proc commitCaches(ac: AccountsCache, shared: bool) =
+  if ac.snapOk:
+    ac.snap.commit(ac.trie.rootHash)
+  if shared:
+    ac.stateCache.commit(ac.trie.rootHash)
+
+proc flush(ac: AccountsCache) =
+  # deferred commit mode: write the staged accounts in trie key order
+  if ac.pending.len == 0 and not ac.clearOnFlush:
+    return
+  let shared = ac.sharedOk
+
+  var accounts = newSeqOfCap[(Hash256, EthAddress)](ac.pending.len)
+  for address in ac.pending:
+    accounts.add (keccakHash(address), address)
+  accounts.sort(proc(x, y: (Hash256, EthAddress)): int = cmpHash(x[0], y[0]))
+
+  for item in accounts:
+    let
+      address = item[1]
+      acc = ac.cache.getOrDefault(address)
+    if acc.isNil:
+      continue
+    if acc.exists:
+      if StorageCleared in acc.pendingFlags:
+        ac.wipeStorage(address, shared)
+      if not acc.pendingStorage.isNil:
+        acc.writeStorage(ac, address, acc.pendingStorage[], shared)
+        acc.pendingStorage = nil
+      ac.writeAccount(address, acc, shared)
+    else:
+      ac.removeAccount(address, shared)
+      ac.cache.del address
+    acc.pendingFlags = {}
+
+  ac.pending.clear()
+  if ac.clearOnFlush:
+    ac.cache.clear()
+    ac.clearOnFlush = false
+
+  ac.commitCaches(shared)
 
 proc makeDirty(ac: AccountsCache, address: EthAddress, cloneStorage = true): RefAccount =
   ac.isDirty = true
   result = ac.getAccount(address)
-  if address in ac.savePoint.cache:
+  if ac.isWritable(result):
     # it's already in latest savepoint
     result.flags.incl IsDirty
     return
 
   # put a copy into latest savepoint
+  let prev = result
   result = result.clone(cloneStorage)
   result.flags.incl IsDirty
-  ac.savePoint.cache[address] = result
+  ac.setAccount(address, result, prev)
 
 proc getCodeHash*(ac: AccountsCache, address: EthAddress): Hash256 {.inline.} =
   let acc = ac.getAccount(address, false)
@@ -316,12 +571,19 @@ proc getCode*(ac: AccountsCache, address: EthAddress): seq[byte] =
 
   if CodeLoaded in acc.flags or CodeChanged in acc.flags:
     result = acc.code
+  elif not ac.stateCache.isNil and
+       ac.stateCache.getCode(acc.account.codeHash, acc.code):
+    acc.flags.incl CodeLoaded
+    result = acc.code
   else:
+    profileDbRead(drCode)
     when defined(geth):
       let data = ac.db.get(acc.account.codeHash.data)
     else:
       let data = ac.db.get(contractHashKey(acc.account.codeHash).toOpenArray)
 
+    if not ac.stateCache.isNil and data.len != 0:
+      ac.stateCache.putCode(acc.account.codeHash, data)
     acc.code = data
     acc.flags.incl CodeLoaded
     result = acc.code
@@ -333,13 +595,13 @@ proc getCommittedStorage*(ac: AccountsCache, address: EthAddress, slot: UInt256)
   let acc = ac.getAccount(address, false)
   if acc.isNil:
     return
-  acc.originalStorageValue(slot, ac.db)
+  acc.originalStorageValue(slot, ac, address)
 
 proc getStorage*(ac: AccountsCache, address: EthAddress, slot: UInt256): UInt256 {.inline.} =
   let acc = ac.getAccount(address, false)
   if acc.isNil:
     return
-  acc.storageValue(slot, ac.db)
+  acc.storageValue(slot, ac, address)
 
 proc hasCodeOrNonce*(ac: AccountsCache, address: EthAddress): bool {.inline.} =
   let acc = ac.getAccount(address, false)
@@ -373,7 +635,9 @@ proc setBalance*(ac: var AccountsCache, address: EthAddress, balance: UInt256) =
   let acc = ac.getAccount(address)
   acc.flags.incl {IsTouched, IsAlive}
   if acc.account.balance != balance:
-    ac.makeDirty(address).account.balance = balance
+    var acc = ac.makeDirty(address)
+    acc.account.balance = balance
+    acc.flags.incl NonceOrBalanceChanged
 
 proc addBalance*(ac: var AccountsCache, address: EthAddress, delta: UInt256) {.inline.} =
   ac.setBalance(address, ac.getBalance(address) + delta)
@@ -385,7 +649,9 @@ proc setNonce*(ac: var AccountsCache, address: EthAddress, nonce: AccountNonce)
   let acc = ac.getAccount(address)
   acc.flags.incl {IsTouched, IsAlive}
   if acc.account.nonce != nonce:
-    ac.makeDirty(address).account.nonce = nonce
+    var acc = ac.makeDirty(address)
+    acc.account.nonce = nonce
+    acc.flags.incl NonceOrBalanceChanged
 
 proc incNonce*(ac: var AccountsCache, address: EthAddress) {.inline.} =
   ac.setNonce(address, ac.getNonce(address) + 1)
@@ -403,7 +669,7 @@ proc setCode*(ac: var AccountsCache, address: EthAddress, code: seq[byte]) =
 proc setStorage*(ac: var AccountsCache, address: EthAddress, slot, value: UInt256) =
   let acc = ac.getAccount(address)
   acc.flags.incl {IsTouched, IsAlive}
-  let oldValue = acc.storageValue(slot, ac.db)
+  let oldValue = acc.storageValue(slot, ac, address)
   if oldValue != value:
     var acc = ac.makeDirty(address)
     acc.overlayStorage[slot] = value
@@ -414,7 +680,10 @@ proc clearStorage*(ac: var AccountsCache, address: EthAddress) =
   acc.flags.incl {IsTouched, IsAlive}
   if acc.account.storageRoot != emptyRlpHash:
     # there is no point to clone the storage since we want to remove it
-    ac.makeDirty(address, cloneStorage = false).account.storageRoot = emptyRlpHash
+    let acc = ac.makeDirty(address, cloneStorage = false)
+    acc.account.storageRoot = emptyRlpHash
+    acc.pendingStorage = nil
+    acc.flags.incl StorageCleared
 
 proc deleteAccount*(ac: var AccountsCache, address: EthAddress) =
   # make sure all savepoints already committed
@@ -422,23 +691,72 @@ proc deleteAccount*(ac: var AccountsCache, address: EthAddress) =
   let acc = ac.getAccount(address)
   acc.kill()
 
+proc truncateJournal(ac: AccountsCache) =
+  # there is no savepoint left to roll back into the persisted state
+  ac.journalBase += ac.journal.len
+  ac.journal.setLen(0)
+
+proc stage(ac: var AccountsCache, clearCache: bool) =
+  # deferred commit mode version of `persist()`, the accounts stay in the
+  # cache until `flush()`
+  var removed: seq[EthAddress]
+  for address, acc in ac.cache:
+    case acc.persistMode()
+    of Update:
+      if CodeChanged in acc.flags:
+        acc.persistCode(ac)
+      if StorageChanged in acc.flags:
+        acc.stageStorage()
+      acc.pendingFlags = acc.pendingFlags + acc.flags * {StorageCleared}
+      ac.pending.incl address
+    of Remove:
+      removed.add address
+      ac.pending.incl address
+    of DoNothing:
+      discard
+
+    acc.flags = acc.flags - resetFlags
+
+  for address in removed:
+    # the state trie still has the account, so keep a non-existing one in
+    # its place (created again when needed, as if it was loaded)
+    ac.cache[address] = RefAccount(
+      account: newAccount(),
+      flags: {IsNew},
+      pendingFlags: {StorageCleared},
+      version: -1) # not journalled, never modified in place
+
+  ac.clearOnFlush = ac.clearOnFlush or clearCache
+
 proc persist*(ac: var AccountsCache, clearCache: bool = true) =
   # make sure all savepoint already committed
   doAssert(ac.savePoint.parentSavePoint.isNil)
+
+  if ac.deferred:
+    ac.stage(clearCache)
+    # EIP2929
+    ac.accList.clear()
+    ac.truncateJournal()
+    ac.isDirty = false
+    return
+
   var cleanAccounts = initHashSet[EthAddress]()
+  let shared = ac.sharedOk
 
-  for address, acc in ac.savePoint.cache:
+  for address, acc in ac.cache:
     case acc.persistMode()
     of Update:
       if CodeChanged in acc.flags:
-        acc.persistCode(ac.db)
+        acc.persistCode(ac)
+      if StorageCleared in acc.flags:
+        ac.wipeStorage(address, shared)
       if StorageChanged in acc.flags:
         # storageRoot must be updated first
         # before persisting account into merkle trie
-        acc.persistStorage(ac.db, clearCache)
-      ac.trie.put address, rlp.encode(acc.account)
+        acc.persistStorage(ac, address, clearCache, shared)
+      ac.writeAccount(address, acc, shared)
     of Remove:
-      ac.trie.del address
+      ac.removeAccount(address, shared)
       if not clearCache:
         #
         cleanAccounts.incl address
@@ -448,14 +766,16 @@ proc persist*(ac: var AccountsCache, clearCache: bool = true) =
     acc.flags = acc.flags - resetFlags
 
   if clearCache:
-    ac.savePoint.cache.clear()
+    ac.cache.clear()
   else:
     for x in cleanAccounts:
-      ac.savePoint.cache.del x
+      ac.cache.del x
 
   # EIP2929
-  ac.savePoint.accessList.clear()
+  ac.accList.clear()
+  ac.truncateJournal()
 
+  ac.commitCaches(shared)
   ac.isDirty = false
 
 iterator storage*(ac: AccountsCache, address: EthAddress): (UInt256, UInt256) =
@@ -503,12 +823,42 @@ proc collectWitnessData*(ac: var AccountsCache) =
   # make sure all savepoint already committed
   doAssert(ac.savePoint.parentSavePoint.isNil)
   # usually witness data is collected before we call persist()
-  for address, acc in ac.savePoint.cache:
+  for address, acc in ac.cache:
     ac.witnessCache.withValue(address, val) do:
       update(val[], acc)
     do:
       ac.witnessCache[address] = witnessData(acc)
 
+proc collectAccess*(ac: AccountsCache, rec: AccessRecorder,
+                    miner: EthAddress) =
+  ## Add the accounts and storage slots accessed since the last `persist()`
+  ## to `rec`, e.g. once per transaction before its `persist()`. The reads
+  ## are taken from the EIP-2929 access list, so they are only known from
+  ## Berlin on, and reads within reverted call frames are missing. Balance
+  ## changes of `miner` are recorded as a credit unless the miner account
+  ## was accessed otherwise.
+  doAssert(ac.savePoint.parentSavePoint.isNil)
+  for address, slots in ac.accList:
+    rec.reads.addAccount(address)
+    for slot in slots:
+      rec.reads.addSlot(address, slot)
+
+  for address, acc in ac.cache:
+    if acc.persistMode() == DoNothing:
+      continue
+    let wiped = StorageCleared in acc.flags or not acc.exists()
+    if wiped:
+      rec.writes.addWiped(address)
+    if address == miner and address notin ac.accList and
+       not wiped and CodeChanged notin acc.flags:
+      # the fee only, it does not depend on the miner account
+      rec.writes.addCredit(address)
+    elif wiped or
+         acc.flags * {IsNew, CodeChanged, NonceOrBalanceChanged} != {}:
+      rec.writes.addAccount(address)
+    for slot in acc.overlayStorage.keys:
+      rec.writes.addSlot(address, slot)
+
 func multiKeys(slots: HashSet[UInt256]): MultikeysRef =
   if slots.len == 0: return
   new result
@@ -524,26 +874,22 @@ proc makeMultiKeys*(ac: AccountsCache): MultikeysRef =
   result.sort()
 
 proc accessList*(ac: var AccountsCache, address: EthAddress) {.inline.} =
-  ac.savePoint.accessList.add(address)
+  if address notin ac.accList:
+    ac.accList.add(address)
+    ac.journal.add JournalEntry(kind: ForgetAddress, address: address)
 
 proc accessList*(ac: var AccountsCache, address: EthAddress, slot: UInt256) {.inline.} =
-  ac.savePoint.accessList.add(address, slot)
+  if address notin ac.accList:
+    ac.accessList(address)
+  if not ac.accList.contains(address, slot):
+    ac.accList.add(address, slot)
+    ac.journal.add JournalEntry(kind: ForgetSlot, address: address, slot: slot)
 
 func inAccessList*(ac: AccountsCache, address: EthAddress): bool =
-  var sp = ac.savePoint
-  while sp != nil:
-    result = sp.accessList.contains(address)
-    if result:
-      return
-    sp = sp.parentSavepoint
+  ac.accList.contains(address)
 
 func inAccessList*(ac: AccountsCache, address: EthAddress, slot: UInt256): bool =
-  var sp = ac.savePoint
-  while sp != nil:
-    result = sp.accessList.contains(address, slot)
-    if result:
-      return
-    sp = sp.parentSavepoint
+  ac.accList.contains(address, slot)
 
 proc rootHash*(db: ReadOnlyStateDB): KeccakHash {.borrow.}
 proc getCodeHash*(db: ReadOnlyStateDB, address: EthAddress): Hash256 {.borrow.}
@@ -0,0 +1,246 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Log Bloom Bits Index
+## ====================
+##
+## Bit-transposed index of the block log blooms, similar to geth's
+## `bloombits`. The chain is split into sections of `bloomSectionSize`
+## blocks. For each section and each of the 2048 bloom bits there is a row
+## with one bit per block of the section, set if the block bloom has that
+## bit set. A query for an address or a topic needs to read three such rows
+## per section rather than one header per block.
+##
+## Rows are stored sparse (as a list of 16 bit block offsets) when fewer than
+## 256 blocks of the section have that bit set, and as a bitmap otherwise.
+## All-zero rows are not stored at all.
+##
+## A section is indexed when its last block is persisted. The hash of that
+## block is stored with the section. If it does not match the canonical
+## chain anymore (e.g. after a reorg), or the section was never indexed, the
+## query falls back to the header blooms for that section.
+
+import
+  std/[bitops, tables],
+  eth/[common, rlp], eth/trie/db,
+  nimcrypto, stew/endians2, stint,
+  ./db_chain, ./storage_types
+
+type
+  BloomRow* = seq[uint64]
+    ## One bit per block of a section
+
+  BloomBits* = array[3, int]
+    ## Bloom filter bit positions of a single address or topic
+
+  BloomQuery* = seq[seq[BloomBits]] ##\
+    ## Conjunction of criteria, each criterion is a disjunction of bit
+    ## triples (e.g. a list of alternative addresses.) An empty query matches
+    ## every block.
+
+const
+  bloomSectionSize* = 4096
+    ## Number of blocks per index section
+
+  bloomBitLength = 2048
+  rowWords = bloomSectionSize div 64
+  rowBytes = bloomSectionSize div 8
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+template setBit(row: var BloomRow; n: int) =
+  row[n shr 6] = row[n shr 6] or (1'u64 shl (n and 63))
+
+proc testBit*(row: BloomRow; n: int): bool {.inline.} =
+  ((row[n shr 6] shr (n and 63)) and 1'u64) != 0
+
+proc isZero(row: BloomRow): bool =
+  for w in row:
+    if w != 0:
+      return false
+  true
+
+proc newRow(): BloomRow {.inline.} =
+  newSeq[uint64](rowWords)
+
+proc encodeRow(row: BloomRow): seq[byte] =
+  var count = 0
+  for w in row:
+    count += countSetBits(w)
+  if count * 2 < rowBytes:
+    result = newSeqOfCap[byte](count * 2)
+    for n in 0 ..< bloomSectionSize:
+      if row.testBit(n):
+        result.add n.uint16.toBytesBE
+  else:
+    result = newSeq[byte](rowBytes)
+    for n in 0 ..< rowWords:
+      result[n * 8 ..< n * 8 + 8] = row[n].toBytesLE
+
+proc decodeRow(data: openArray[byte]): BloomRow =
+  result = newRow()
+  if data.len == rowBytes:
+    for n in 0 ..< rowWords:
+      result[n] = uint64.fromBytesLE(data.toOpenArray(n * 8, n * 8 + 7))
+  else:
+    for n in countup(0, data.len - 2, 2):
+      result.setBit(uint16.fromBytesBE(data.toOpenArray(n, n + 1)).int)
+
+proc hasBit(bloom: BloomFilter; bit: int): bool {.inline.} =
+  ## Bit numbering as used by `eth/bloom`, i.e. big endian
+  (bloom[255 - (bit shr 3)] and (1'u8 shl (bit and 7))) != 0
+
+proc sectionBounds(section: uint64): (BlockNumber, BlockNumber) =
+  let first = section.toBlockNumber * bloomSectionSize.u256
+  (first, first + (bloomSectionSize - 1).u256)
+
+proc isIndexed(db: BaseChainDB; section: uint64): bool =
+  ## Section has an index consistent with the canonical chain
+  let data = db.db.get(bloomSectionHeadKey(section).toOpenArray)
+  if data.len == 0:
+    return false
+  var hash: Hash256
+  if not db.getBlockHash(section.sectionBounds[1], hash):
+    return false
+  try:
+    return rlp.decode(data, Hash256) == hash
+  except RlpError:
+    return false
+
+proc getRow(db: BaseChainDB; rows: var Table[int,BloomRow];
+            section: uint64; bit: int): BloomRow =
+  rows.withValue(bit, val) do:
+    return val[]
+  let data = db.db.get(bloomBitsKey(section, bit).toOpenArray)
+  result = if data.len == 0: newRow() else: data.decodeRow
+  rows[bit] = result
+
+proc matchSection(db: BaseChainDB; section: uint64;
+                  query: BloomQuery): BloomRow =
+  var rows: Table[int,BloomRow]
+  result = newRow()
+  for w in result.mitems:
+    w = not 0'u64
+  for criterion in query:
+    var acc = newRow()
+    for bits in criterion:
+      let
+        r0 = db.getRow(rows, section, bits[0])
+        r1 = db.getRow(rows, section, bits[1])
+        r2 = db.getRow(rows, section, bits[2])
+      for n in 0 ..< rowWords:
+        acc[n] = acc[n] or (r0[n] and r1[n] and r2[n])
+    for n in 0 ..< rowWords:
+      result[n] = result[n] and acc[n]
+    if result.isZero:
+      break
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc bloomBits*(data: openArray[byte]): BloomBits =
+  ## Bloom filter bit positions for an address or topic, same as `eth/bloom`
+  let h = keccak256.digest(data)
+  for n in 0 .. 2:
+    result[n] = ((h.data[2*n].int shl 8) or h.data[2*n+1].int) and
+                  (bloomBitLength - 1)
+
+proc matches*(bloom: BloomFilter; query: BloomQuery): bool =
+  ## Test a single block or receipt bloom against `query`
+  for criterion in query:
+    var found = false
+    for bits in criterion:
+      if bloom.hasBit(bits[0]) and bloom.hasBit(bits[1]) and
+         bloom.hasBit(bits[2]):
+        found = true
+        break
+    if not found:
+      return false
+  true
+
+proc updateBloomBits*(db: BaseChainDB; header: BlockHeader;
+                      receipts: openArray[Receipt]) =
+  ## To be called after the `receipts` of block `header` were persisted. If
+  ## `header` completes an index section, the section is (re-)built from the
+  ## `header` ancestry.
+  let num = header.blockNumber
+  if (num mod bloomSectionSize.u256) != (bloomSectionSize - 1).u256:
+    return
+
+  var
+    rows = newSeq[BloomRow](bloomBitLength)
+    blooms = newSeq[BloomFilter](bloomSectionSize)
+    parent = header.parentHash
+
+  for rec in receipts:
+    for n in 0 ..< rec.bloom.len:
+      blooms[^1][n] = blooms[^1][n] or rec.bloom[n]
+  for n in countdown(bloomSectionSize - 2, 0):
+    var h: BlockHeader
+    if not db.getBlockHeader(parent, h):
+      return # chain has gaps, leave unindexed
+    blooms[n] = h.bloom
+    parent = h.parentHash
+
+  for n, bloom in blooms:
+    for i, b in bloom:
+      if b != 0:
+        for k in 0 .. 7:
+          if (b and (1'u8 shl k)) != 0:
+            let bit = (255 - i) * 8 + k
+            if rows[bit].len == 0:
+              rows[bit] = newRow()
+            rows[bit].setBit(n)
+
+  let section = (num div bloomSectionSize.u256).truncate(uint64)
+  for bit, row in rows:
+    let key = bloomBitsKey(section, bit)
+    if row.len == 0:
+      db.db.del(key.toOpenArray) # might be left over from a reorg
+    else:
+      db.db.put(key.toOpenArray, row.encodeRow)
+  db.db.put(bloomSectionHeadKey(section).toOpenArray,
+            rlp.encode(header.blockHash))
+
+iterator candidateBlocks*(db: BaseChainDB; fromBlock, toBlock: BlockNumber;
+                          query: BloomQuery): BlockNumber =
+  ## Canonical blocks within `[fromBlock,toBlock]` whose bloom matches
+  ## `query`. False positives are possible, so the receipt logs must still
+  ## be checked by the caller.
+  if fromBlock <= toBlock:
+    let
+      firstSection = (fromBlock div bloomSectionSize.u256).truncate(uint64)
+      lastSection = (toBlock div bloomSectionSize.u256).truncate(uint64)
+    for section in firstSection .. lastSection:
+      let
+        (first, last) = section.sectionBounds
+        lo = if first < fromBlock: fromBlock else: first
+        hi = if toBlock < last: toBlock else: last
+      if db.isIndexed(section):
+        let matched = db.matchSection(section, query)
+        for n in (lo - first).truncate(int) .. (hi - first).truncate(int):
+          if matched.testBit(n):
+            yield first + n.toBlockNumber
+      else:
+        var num = lo
+        while num <= hi:
+          var h: BlockHeader
+          if not db.getBlockHeader(num, h):
+            break # beyond the canonical head
+          if h.bloom.matches(query):
+            yield num
+          num += 1.u256
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
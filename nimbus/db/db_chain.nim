@@ -9,7 +9,8 @@ import
   sequtils, algorithm,
   stew/[byteutils], eth/trie/[hexary, db],
   eth/[common, rlp, p2p], chronicles,
-  ../errors,  ../constants, ./storage_types,
+  ../errors,  ../constants, ./header_cache, ./stack_trie, ./storage_types,
+  ./select_backend,
   ../utils, ../config, ../chain_config
 
 type
@@ -17,7 +18,15 @@ type
     db*       : TrieDatabaseRef
     pruneTrie*: bool
     config*   : ChainConfig
+    stateSnapshot*: bool ##\
+      ## Maintain and read from the flat state snapshot, see `state_snapshot`
+    backend*: ChainDB ##\
+      ## Persistent store underneath `db` for batched writes, `nil` for
+      ## memory databases
     networkId*: NetworkId
+    headerCache: HeaderCacheRef ##\
+      ## Decoded headers and canonical hashes, see `header_cache`. Created
+      ## on demand.
 
     # startingBlock, currentBlock, and highestBlock
     # are progress indicator
@@ -39,13 +48,45 @@ proc newBaseChainDB*(db: TrieDatabaseRef, pruneTrie: bool = true, id: NetworkId
 proc `$`*(db: BaseChainDB): string =
   result = "BaseChainDB"
 
+proc cache(self: BaseChainDB): HeaderCacheRef {.inline.} =
+  if self.headerCache.isNil:
+    self.headerCache = newHeaderCache()
+  self.headerCache
+
+template cacheable(n: BlockNumber): bool =
+  n <= high(uint64).toBlockNumber
+
+proc resetHeaderCache*(self: BaseChainDB) =
+  ## Needs to be called after rolling back a `db` transaction that stored
+  ## headers or canonical hashes
+  if not self.headerCache.isNil:
+    self.headerCache.clear
+
+proc beginWriteBatch*(self: BaseChainDB) =
+  ## Collect backend writes (e.g. while committing a `db` transaction) in a
+  ## single atomic batch, ignored for memory databases
+  if not self.backend.isNil:
+    self.backend.beginBatch()
+
+proc commitWriteBatch*(self: BaseChainDB) =
+  if not self.backend.isNil:
+    self.backend.commitBatch()
+
+proc disposeWriteBatch*(self: BaseChainDB) =
+  ## Discard uncommitted batch, if any
+  if not self.backend.isNil:
+    self.backend.rollbackBatch()
+
 proc exists*(self: BaseChainDB, hash: Hash256): bool =
   self.db.contains(hash.data)
 
 proc getBlockHeader*(self: BaseChainDB; blockHash: Hash256, output: var BlockHeader): bool =
+  if self.cache.getHeader(blockHash, output):
+    return true
   let data = self.db.get(genericHashKey(blockHash).toOpenArray)
   if data.len != 0:
     output = rlp.decode(data, BlockHeader)
+    self.cache.putHeader(blockHash, output)
     result = true
 
 proc getBlockHeader*(self: BaseChainDB, blockHash: Hash256): BlockHeader =
@@ -77,13 +118,20 @@ proc populateProgress*(self: BaseChainDB) =
   self.currentBlock = self.startingBlock
   self.highestBlock = self.startingBlock
 
-proc getBlockHash*(self: BaseChainDB, n: BlockNumber, output: var Hash256): bool {.inline.} =
+proc getBlockHash*(self: BaseChainDB, n: BlockNumber, output: var Hash256): bool =
   ## Return the block hash for the given block number.
-  self.getHash(blockNumberToHashKey(n), output)
+  if not n.cacheable:
+    return self.getHash(blockNumberToHashKey(n), output)
+  let num = n.truncate(uint64)
+  if self.cache.getHash(num, output):
+    return true
+  if self.getHash(blockNumberToHashKey(n), output):
+    self.cache.putHash(num, output)
+    result = true
 
 proc getBlockHash*(self: BaseChainDB, n: BlockNumber): Hash256 {.inline.} =
   ## Return the block hash for the given block number.
-  if not self.getHash(blockNumberToHashKey(n), result):
+  if not self.getBlockHash(n, result):
     raise newException(BlockNotFound, "No block hash for number " & $n)
 
 proc getBlockHeader*(self: BaseChainDB; n: BlockNumber, output: var BlockHeader): bool =
@@ -127,15 +175,19 @@ iterator findNewAncestors(self: BaseChainDB; header: BlockHeader): BlockHeader =
       h = self.getBlockHeader(h.parentHash)
 
 proc addBlockNumberToHashLookup*(self: BaseChainDB; header: BlockHeader) =
+  let hash = header.hash
   self.db.put(blockNumberToHashKey(header.blockNumber).toOpenArray,
-              rlp.encode(header.hash))
+              rlp.encode(hash))
+  if header.blockNumber.cacheable:
+    self.cache.setCanonical(header.blockNumber.truncate(uint64), hash)
 
 proc persistTransactions*(self: BaseChainDB, blockNumber:
                           BlockNumber, transactions: openArray[Transaction]): Hash256 =
-  var trie = initHexaryTrie(self.db)
-  for idx, tx in transactions:
+  var trie: StackTrie
+  trie.initStackTrie(self.db)
+  for idx in indexKeys(transactions.len):
     let
-      encodedTx = rlp.encode(tx)
+      encodedTx = rlp.encode(transactions[idx])
       txHash = keccakHash(encodedTx)
       txKey: TransactionKey = (blockNumber, idx)
     trie.put(rlp.encode(idx), encodedTx)
@@ -267,18 +319,18 @@ proc setHead*(self: BaseChainDB, header: BlockHeader, writeHeader = false) =
   var headerHash = rlpHash(header)
   if writeHeader:
     self.db.put(genericHashKey(headerHash).toOpenArray, rlp.encode(header))
+    self.cache.putHeader(headerHash, header)
   self.addBlockNumberToHashLookup(header)
   self.db.put(canonicalHeadHashKey().toOpenArray, rlp.encode(headerHash))
 
 proc headerExists*(self: BaseChainDB; blockHash: Hash256): bool =
   ## Returns True if the header with the given block hash is in our DB.
-  self.db.contains(genericHashKey(blockHash).toOpenArray)
+  var header: BlockHeader
+  self.cache.getHeader(blockHash, header) or
+    self.db.contains(genericHashKey(blockHash).toOpenArray)
 
 proc persistReceipts*(self: BaseChainDB, receipts: openArray[Receipt]): Hash256 =
-  var trie = initHexaryTrie(self.db)
-  for idx, rec in receipts:
-    trie.put(rlp.encode(idx), rlp.encode(rec))
-  trie.rootHash
+  orderedTrieRoot(receipts, self.db)
 
 iterator getReceipts*(self: BaseChainDB; receiptRoot: Hash256): Receipt =
   var receiptDb = initHexaryTrie(self.db, receiptRoot)
@@ -299,6 +351,7 @@ proc persistHeaderToDb*(self: BaseChainDB; header: BlockHeader): seq[BlockHeader
     raise newException(ParentNotFound, "Cannot persist block header " &
         $headerHash & " with unknown parent " & $header.parentHash)
   self.db.put(genericHashKey(headerHash).toOpenArray, rlp.encode(header))
+  self.cache.putHeader(headerHash, header)
 
   let score = if isGenesis: header.difficulty
               else: self.getScore(header.parentHash) + header.difficulty
@@ -0,0 +1,149 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Header And Canonical Hash Cache
+## ===============================
+##
+## In-memory front end for `BaseChainDB` header lookups:
+##
+## * LRU cache of decoded headers indexed by block hash
+## * LRU cache of canonical block hashes indexed by block number
+## * ring buffer with the canonical hashes of the latest `ancestorRingSize`
+##   blocks, updated as number to hash lookups are written. This covers
+##   the `BLOCKHASH` op code look ups while executing blocks.
+##
+## The cache knows nothing about database transactions. After a rolled back
+## transaction that wrote headers or canonical hashes, the cache must be
+## cleared.
+
+import
+  eth/common,
+  ../utils/lru_cache
+
+const
+  ancestorRingSize* = 256
+    ## Number of canonical block hashes held in the ring, as needed for the
+    ## `BLOCKHASH` op code
+
+  headerCacheMaxItems* = 2048
+  hashCacheMaxItems* = 8192
+
+type
+  HeaderLru = LruCache[Hash256,Hash256,BlockHeader,void]
+  HashLru = LruCache[uint64,uint64,Hash256,void]
+
+  HeaderCacheRef* = ref object
+    headers: HeaderLru
+    hashes: HashLru
+    ring: array[ancestorRingSize,Hash256] ## Indexed by block number modulo
+    ringTop: uint64                       ## Block number of latest entry
+    ringLen: int                          ## Number of valid ring entries
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+proc initHeaderLru(lru: var HeaderLru; maxItems: int) =
+  var
+    toKey: LruKey[Hash256,Hash256] =
+      proc(hash: Hash256): Hash256 = hash
+    toValue: LruValue[Hash256,BlockHeader,void] =
+      proc(hash: Hash256): Result[BlockHeader,void] = err()
+  lru.initCache(toKey, toValue, maxItems)
+
+proc initHashLru(lru: var HashLru; maxItems: int) =
+  var
+    toKey: LruKey[uint64,uint64] =
+      proc(number: uint64): uint64 = number
+    toValue: LruValue[uint64,Hash256,void] =
+      proc(number: uint64): Result[Hash256,void] = err()
+  lru.initCache(toKey, toValue, maxItems)
+
+proc inRing(hc: HeaderCacheRef; number: uint64): bool {.inline.} =
+  0 < hc.ringLen and number <= hc.ringTop and
+    hc.ringTop - number < hc.ringLen.uint64
+
+# ------------------------------------------------------------------------------
+# Public constructor
+# ------------------------------------------------------------------------------
+
+proc newHeaderCache*(maxHeaders = headerCacheMaxItems;
+                     maxHashes = hashCacheMaxItems): HeaderCacheRef =
+  new result
+  result.headers.initHeaderLru(maxHeaders)
+  result.hashes.initHashLru(maxHashes)
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc clear*(hc: HeaderCacheRef) =
+  ## Flush everything, e.g. after a database rollback
+  hc.headers.clearCache
+  hc.hashes.clearCache
+  hc.ringLen = 0
+
+proc getHeader*(hc: HeaderCacheRef; hash: Hash256;
+                header: var BlockHeader): bool =
+  try:
+    let rc = hc.headers.getItem(hash)
+    if rc.isOk:
+      header = rc.value
+      return true
+  except CatchableError:
+    discard
+
+proc putHeader*(hc: HeaderCacheRef; hash: Hash256; header: BlockHeader) =
+  try:
+    hc.headers.putItem(hash, header)
+  except CatchableError:
+    discard
+
+proc getHash*(hc: HeaderCacheRef; number: uint64; hash: var Hash256): bool =
+  ## Canonical block hash for `number`
+  if hc.inRing(number):
+    hash = hc.ring[number mod ancestorRingSize]
+    return true
+  try:
+    let rc = hc.hashes.getItem(number)
+    if rc.isOk:
+      hash = rc.value
+      return true
+  except CatchableError:
+    discard
+
+proc putHash*(hc: HeaderCacheRef; number: uint64; hash: Hash256) =
+  ## Cache canonical block hash as read from the database
+  try:
+    hc.hashes.putItem(number, hash)
+  except CatchableError:
+    discard
+
+proc setCanonical*(hc: HeaderCacheRef; number: uint64; hash: Hash256) =
+  ## Register canonical block hash as written to the database. Canonical
+  ## blocks are written in increasing order, a lower number (e.g. due to a
+  ## reorg) invalidates the ring entries above.
+  hc.putHash(number, hash)
+  if hc.ringLen == 0 or number + hc.ringLen.uint64 <= hc.ringTop or
+      hc.ringTop + 1 < number:
+    # not adjacent to the ring entries, restart
+    hc.ringLen = 1
+  elif number <= hc.ringTop:
+    hc.ringLen -= (hc.ringTop - number).int
+  elif hc.ringLen < ancestorRingSize:
+    hc.ringLen.inc
+  hc.ringTop = number
+  hc.ring[number mod ancestorRingSize] = hash
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -15,45 +15,438 @@ const
   nimbus_db_backend* {.strdefine.} = "rocksdb"
   dbBackend = parseEnum[DbBackend](nimbus_db_backend)
 
+type
+  DbCompactionStyle* {.pure.} = enum
+    ## FIFO compaction is not offered, it deletes the oldest data
+    Level = 0      ## RocksDB default
+    Universal = 1
+
+  DbOptions* = object
+    ## Database tuning, only supported by the RocksDB backend
+    blockCacheMB*: int              ## LRU block cache, 0 for library default
+    bloomBitsPerKey*: int           ## Bloom filter bits per key, 0 to disable
+    compaction*: DbCompactionStyle
+    maxOpenFiles*: int              ## Max open files, -1 for unlimited
+    writeBufferMB*: int             ## Memtable size, 0 for library default
+    columnFamilies*: bool           ## Separate key spaces, see `DbFamily`
+
+  DbFamily = enum
+    ## Column families a key is stored in (if enabled). Transaction and
+    ## receipt lists are stored as trie nodes, they share the `trie` family.
+    dbfDefault = "default"          ## Everything else
+    dbfTrie = "trie"                ## Trie nodes
+    dbfHeaders = "headers"          ## Headers, uncles and canonical index
+    dbfTxIndex = "txindex"          ## Transaction and log (bloom bits) index
+    dbfState = "state"              ## Contract code, slot preimages, flat
+                                    ## state snapshot and pruner journal
+
+const
+  defaultDbOptions* = DbOptions(
+    maxOpenFiles: 512,              # same as `kvstore_rocksdb`
+    compaction: DbCompactionStyle.Level)
+
+when dbBackend == sqlite:
+  import eth/db/kvstore_sqlite3 as database_backend
+elif dbBackend == rocksdb:
+  import
+    os, osproc,
+    chronicles,
+    rocksdb/librocksdb,
+    ./storage_types
+elif dbBackend == lmdb:
+  # TODO This implementation has several issues on restricted platforms, possibly
+  #      due to mmap restrictions - see:
+  #      https://github.com/status-im/nim-beacon-chain/issues/732
+  #      https://github.com/status-im/nim-beacon-chain/issues/688
+  # It also has other issues, including exception safety:
+  #      https://github.com/status-im/nim-beacon-chain/pull/809
+
+  {.error: "lmdb deprecated, needs reimplementing".}
+
 type
   ChainDB* = ref object of RootObj
-    kv: KvStoreRef
+    when dbBackend == rocksdb:
+      # RocksDB is accessed directly (rather than via `KvStore`) for column
+      # family and `WriteBatch` support
+      rdb: rocksdb_t
+      readOptions: rocksdb_readoptions_t
+      writeOptions: rocksdb_writeoptions_t
+      families: array[DbFamily,rocksdb_column_family_handle_t] ##\
+        ## All `nil` unless column families are enabled
+      batch: rocksdb_writebatch_t      ## Pending batch, `nil` unless active
+      batchOptions: rocksdb_writeoptions_t
+      readOnly: bool                   ## Reader created from a `ChainDBHandle`
+      snapshot: rocksdb_snapshot_t     ## Reads are pinned, see `pinReads()`
+    else:
+      kv: KvStoreRef
+
+  ChainDBHandle* = object
+    ## Raw handles of an open database for readers on other threads, see
+    ## `newChainDB(ChainDBHandle)`. Only supported by the RocksDB backend.
+    when dbBackend == rocksdb:
+      rdb: rocksdb_t
+      families: array[DbFamily,rocksdb_column_family_handle_t]
+
+const
+  sharedReaders* = dbBackend == rocksdb
+    ## True if `handle()` is supported
+  dbCheckpoints* = dbBackend == rocksdb
+    ## True if `checkpoint()` is supported
+
+when dbBackend == rocksdb:
+  template bytesPtr(data: openArray[byte]): cstring =
+    if data.len == 0: nil else: cast[cstring](unsafeAddr data[0])
+
+  template checkErrors(errors: cstring) =
+    if not errors.isNil:
+      let msg = $errors
+      rocksdb_free(errors)
+      raiseAssert "working database: " & msg
+
+  proc family(db: ChainDB, key: openArray[byte]): rocksdb_column_family_handle_t =
+    ## Column family for `key`, `nil` for the single key space layout
+    if db.families[dbfDefault].isNil:
+      return nil
+    if key.len == 32:
+      return db.families[dbfTrie]
+    if key.len == 0:
+      return db.families[dbfDefault]
+    let fam = case key[0].int
+      of ord(genericHash), ord(blockNumberToHash), ord(blockHashToScore),
+         ord(canonicalHeadHash):
+        dbfHeaders
+      of ord(transactionHashToBlock), ord(bloomBits), ord(bloomSectionHead):
+        dbfTxIndex
+      of ord(slotHashToSlot), ord(contractHash), ord(snapshotRoot),
+         ord(snapshotAccount), ord(snapshotStorage), ord(snapshotDiff),
+         ord(trieNodeRefs), ord(pruneJournal), ord(pruneTail):
+        dbfState
+      else:
+        dbfDefault
+    db.families[fam]
 
 # TODO KvStore is a virtual interface and TrieDB is a virtual interface - one
 #      will be enough eventually - unless the TrieDB interface gains operations
 #      that are not typical to KvStores
 proc get*(db: ChainDB, key: openArray[byte]): seq[byte] =
-  var res: seq[byte]
-  proc onData(data: openArray[byte]) = res = @data
-  if db.kv.get(key, onData).expect("working database"):
-    return res
+  when dbBackend == rocksdb:
+    var
+      errors: cstring
+      len: csize_t
+    let
+      cf = db.family(key)
+      data = if cf.isNil:
+               rocksdb_get(db.rdb, db.readOptions,
+                 key.bytesPtr, key.len.csize_t, len.addr, errors.addr)
+             else:
+               rocksdb_get_cf(db.rdb, db.readOptions, cf,
+                 key.bytesPtr, key.len.csize_t, len.addr, errors.addr)
+    checkErrors(errors)
+    if not data.isNil:
+      result = newSeq[byte](len.int)
+      if 0 < len:
+        copyMem(result[0].addr, data, len.int)
+      rocksdb_free(data)
+  else:
+    var res: seq[byte]
+    proc onData(data: openArray[byte]) = res = @data
+    if db.kv.get(key, onData).expect("working database"):
+      return res
 
 proc put*(db: ChainDB, key, value: openArray[byte]) =
-  db.kv.put(key, value).expect("working database")
+  when dbBackend == rocksdb:
+    doAssert not db.readOnly
+    let cf = db.family(key)
+    if not db.batch.isNil:
+      if cf.isNil:
+        db.batch.rocksdb_writebatch_put(
+          key.bytesPtr, key.len.csize_t, value.bytesPtr, value.len.csize_t)
+      else:
+        db.batch.rocksdb_writebatch_put_cf(cf,
+          key.bytesPtr, key.len.csize_t, value.bytesPtr, value.len.csize_t)
+    else:
+      var errors: cstring
+      if cf.isNil:
+        rocksdb_put(db.rdb, db.writeOptions, key.bytesPtr, key.len.csize_t,
+          value.bytesPtr, value.len.csize_t, errors.addr)
+      else:
+        rocksdb_put_cf(db.rdb, db.writeOptions, cf, key.bytesPtr,
+          key.len.csize_t, value.bytesPtr, value.len.csize_t, errors.addr)
+      checkErrors(errors)
+  else:
+    db.kv.put(key, value).expect("working database")
 
 proc contains*(db: ChainDB, key: openArray[byte]): bool =
-  db.kv.contains(key).expect("working database")
+  when dbBackend == rocksdb:
+    # the C API has no plain existence check without `key_may_exist`
+    # callbacks, a point lookup is good enough here
+    var
+      errors: cstring
+      len: csize_t
+    let
+      cf = db.family(key)
+      data = if cf.isNil:
+               rocksdb_get(db.rdb, db.readOptions,
+                 key.bytesPtr, key.len.csize_t, len.addr, errors.addr)
+             else:
+               rocksdb_get_cf(db.rdb, db.readOptions, cf,
+                 key.bytesPtr, key.len.csize_t, len.addr, errors.addr)
+    checkErrors(errors)
+    if not data.isNil:
+      rocksdb_free(data)
+      return true
+  else:
+    db.kv.contains(key).expect("working database")
 
 proc del*(db: ChainDB, key: openArray[byte]) =
-  db.kv.del(key).expect("working database")
+  when dbBackend == rocksdb:
+    doAssert not db.readOnly
+    let cf = db.family(key)
+    if not db.batch.isNil:
+      if cf.isNil:
+        db.batch.rocksdb_writebatch_delete(key.bytesPtr, key.len.csize_t)
+      else:
+        db.batch.rocksdb_writebatch_delete_cf(cf, key.bytesPtr, key.len.csize_t)
+    else:
+      var errors: cstring
+      if cf.isNil:
+        rocksdb_delete(db.rdb, db.writeOptions,
+          key.bytesPtr, key.len.csize_t, errors.addr)
+      else:
+        rocksdb_delete_cf(db.rdb, db.writeOptions, cf,
+          key.bytesPtr, key.len.csize_t, errors.addr)
+      checkErrors(errors)
+  else:
+    db.kv.del(key).expect("working database")
+
+# ------------------------------------------------------------------------------
+# Write batch
+# ------------------------------------------------------------------------------
+
+# While a batch is active, `put()` and `del()` are collected and written
+# atomically by `commitBatch()`. Reads do not see the pending writes, so a
+# batch is meant to wrap the flush of a `TrieDatabaseRef` transaction (which
+# keeps its own read-your-writes layer.) Backends other than RocksDB write
+# through.
+
+proc setBatchOptions*(db: ChainDB; disableWAL = false; sync = false) =
+  ## Write options applied to `commitBatch()`. Disabling the write ahead log
+  ## speeds up bulk import at the expense of losing the most recent batches
+  ## on a crash (the database stays consistent), see `flush()`.
+  when dbBackend == rocksdb:
+    db.batchOptions.rocksdb_writeoptions_disable_WAL(disableWAL.cint)
+    db.batchOptions.rocksdb_writeoptions_set_sync(sync.uint8)
+  else:
+    discard
+
+proc inBatch*(db: ChainDB): bool =
+  when dbBackend == rocksdb:
+    not db.batch.isNil
+  else:
+    false
+
+proc beginBatch*(db: ChainDB) =
+  ## Start collecting writes, no-op if there is an active batch already
+  when dbBackend == rocksdb:
+    if db.batch.isNil:
+      db.batch = rocksdb_writebatch_create()
+
+proc commitBatch*(db: ChainDB) =
+  ## Atomically write the pending batch and stop collecting
+  when dbBackend == rocksdb:
+    if not db.batch.isNil:
+      let batch = db.batch
+      db.batch = nil
+      var errors: cstring
+      if 0 < batch.rocksdb_writebatch_count:
+        rocksdb_write(db.rdb, db.batchOptions, batch, errors.addr)
+      batch.rocksdb_writebatch_destroy
+      checkErrors(errors)
+
+proc rollbackBatch*(db: ChainDB) =
+  ## Discard the pending batch, if any
+  when dbBackend == rocksdb:
+    if not db.batch.isNil:
+      db.batch.rocksdb_writebatch_destroy
+      db.batch = nil
+
+proc flush*(db: ChainDB) =
+  ## Flush memory tables to disk, needed before the process exits without
+  ## closing the database if the write ahead log was disabled.
+  when dbBackend == rocksdb:
+    let options = rocksdb_flushoptions_create()
+    options.rocksdb_flushoptions_set_wait(1)
+    var errors: cstring
+    if db.families[dbfDefault].isNil:
+      rocksdb_flush(db.rdb, options, errors.addr)
+    else:
+      for cf in db.families:
+        rocksdb_flush_cf(db.rdb, options, cf, errors.addr)
+        if not errors.isNil:
+          break
+    options.rocksdb_flushoptions_destroy
+    checkErrors(errors)
+
+# ------------------------------------------------------------------------------
+# Readers on other threads
+# ------------------------------------------------------------------------------
+
+# RocksDB handles are thread safe. A reader `ChainDB` on another thread is a
+# separate object (so no GC reference crosses threads) sharing the handles of
+# the database opened by the main thread, which must stay open while there
+# are readers. Readers cannot write.
+
+when dbBackend == rocksdb:
+  proc handle*(db: ChainDB): ChainDBHandle =
+    ChainDBHandle(rdb: db.rdb, families: db.families)
+
+  proc newChainDB*(handle: ChainDBHandle): ChainDB =
+    ## Read only database for the calling thread
+    ChainDB(
+      rdb:         handle.rdb,
+      families:    handle.families,
+      readOptions: rocksdb_readoptions_create(),
+      readOnly:    true)
+
+  proc pinReads*(db: ChainDB) =
+    ## Read from a snapshot of the current database state until
+    ## `unpinReads()`, later writes by other threads are not visible.
+    if db.snapshot.isNil:
+      db.snapshot = rocksdb_create_snapshot(db.rdb)
+      db.readOptions.rocksdb_readoptions_set_snapshot(db.snapshot)
+
+  proc unpinReads*(db: ChainDB) =
+    if not db.snapshot.isNil:
+      db.readOptions.rocksdb_readoptions_set_snapshot(nil)
+      rocksdb_release_snapshot(db.rdb, db.snapshot)
+      db.snapshot = nil
+
+  proc close*(db: ChainDB) =
+    ## Release a reader, the database stays open
+    doAssert db.readOnly
+    db.unpinReads
+    db.readOptions.rocksdb_readoptions_destroy
+    db.readOptions = nil
+
+# ------------------------------------------------------------------------------
+# Checkpoint
+# ------------------------------------------------------------------------------
+
+when dbBackend == rocksdb:
+  proc checkpoint*(db: ChainDB, path: string) =
+    ## Consistent copy of the database that can be opened with
+    ## `newChainDB(path)`. Table files are immutable and hard linked where the
+    ## file system allows it (copied otherwise), so the checkpoint is cheap and
+    ## writing to it leaves the original unchanged. There must be no database
+    ## at `path` yet.
+    let dataDir = path / "nimbus" / "data"
+    try:
+      createDir(dataDir.parentDir)
+    except OSError, IOError:
+      raiseAssert "working database: cannot create checkpoint directory"
+
+    var errors: cstring
+    let cp = rocksdb_checkpoint_object_create(db.rdb, errors.addr)
+    checkErrors(errors)
+    # a log size of 0 flushes the memory tables first
+    rocksdb_checkpoint_create(cp, dataDir.cstring, 0'u64, errors.addr)
+    cp.rocksdb_checkpoint_object_destroy
+    checkErrors(errors)
+
+# ------------------------------------------------------------------------------
+# Constructor
+# ------------------------------------------------------------------------------
+
+when dbBackend == rocksdb:
+  proc newOptions(opts: DbOptions): rocksdb_options_t =
+    result = rocksdb_options_create()
+    result.rocksdb_options_increase_parallelism(countProcessors().cint)
+    result.rocksdb_options_set_create_if_missing(1)
+    result.rocksdb_options_set_create_missing_column_families(1)
+    result.rocksdb_options_set_max_open_files(opts.maxOpenFiles.cint)
+    result.rocksdb_options_set_compaction_style(opts.compaction.ord.cint)
+    if 0 < opts.writeBufferMB:
+      result.rocksdb_options_set_write_buffer_size(
+        csize_t(opts.writeBufferMB) shl 20)
+
+    if 0 < opts.blockCacheMB or 0 < opts.bloomBitsPerKey:
+      # The table factory copies the table options, which share the cache
+      # and own the filter policy. Only the wrappers are destroyed here.
+      let tableOptions = rocksdb_block_based_options_create()
+      if 0 < opts.blockCacheMB:
+        let cache = rocksdb_cache_create_lru(csize_t(opts.blockCacheMB) shl 20)
+        tableOptions.rocksdb_block_based_options_set_block_cache(cache)
+        cache.rocksdb_cache_destroy
+      if 0 < opts.bloomBitsPerKey:
+        tableOptions.rocksdb_block_based_options_set_filter_policy(
+          rocksdb_filterpolicy_create_bloom(opts.bloomBitsPerKey.cint))
+      result.rocksdb_options_set_block_based_table_factory(tableOptions)
+      tableOptions.rocksdb_block_based_options_destroy
+
+  proc hasFamilies(options: rocksdb_options_t; path: string): bool =
+    ## True if there is a database at `path` with more than the default
+    ## column family
+    var
+      errors: cstring
+      count: csize_t
+    let list = rocksdb_list_column_families(
+      options, path.cstring, count.addr, errors.addr)
+    if not errors.isNil:
+      # no database yet
+      rocksdb_free(errors)
+      return false
+    result = 1 < count
+    rocksdb_list_column_families_destroy(list, count)
 
 when dbBackend == sqlite:
-  import eth/db/kvstore_sqlite3 as database_backend
-  proc newChainDB*(path: string): ChainDB =
+  proc newChainDB*(path: string; opts = defaultDbOptions): ChainDB =
     let db = SqStoreRef.init(path, "nimbus").expect("working database")
     ChainDB(kv: kvStore db.openKvStore().expect("working database"))
 elif dbBackend == rocksdb:
-  import eth/db/kvstore_rocksdb as database_backend
-  proc newChainDB*(path: string): ChainDB =
-    ChainDB(kv: kvStore RocksStoreRef.init(path, "nimbus").tryGet())
-elif dbBackend == lmdb:
-  # TODO This implementation has several issues on restricted platforms, possibly
-  #      due to mmap restrictions - see:
-  #      https://github.com/status-im/nim-beacon-chain/issues/732
-  #      https://github.com/status-im/nim-beacon-chain/issues/688
-  # It also has other issues, including exception safety:
-  #      https://github.com/status-im/nim-beacon-chain/pull/809
+  proc newChainDB*(path: string; opts = defaultDbOptions): ChainDB =
+    ## Open the database, same directory layout as for
+    ## `RocksStoreRef.init(path, "nimbus")`
+    let dataDir = path / "nimbus" / "data"
+    try:
+      createDir(dataDir)
+    except OSError, IOError:
+      raiseAssert "working database: cannot create database directory"
 
-  {.error: "lmdb deprecated, needs reimplementing".}
+    let options = opts.newOptions
+    result = ChainDB(
+      readOptions:  rocksdb_readoptions_create(),
+      writeOptions: rocksdb_writeoptions_create(),
+      batchOptions: rocksdb_writeoptions_create())
+
+    let
+      isFresh = not fileExists(dataDir / "CURRENT")
+      useFamilies = options.hasFamilies(dataDir) or
+                    (opts.columnFamilies and isFresh)
+    var
+      errors: cstring
 
-export database_backend
+    if opts.columnFamilies and not useFamilies:
+      # Data of an existing database would become unreachable
+      warn "Database was created without column families, option ignored",
+        dataDir
+
+    if useFamilies:
+      var
+        names: array[DbFamily,cstring]
+        famOptions: array[DbFamily,rocksdb_options_t]
+      for fam in DbFamily:
+        names[fam] = ($fam).cstring
+        famOptions[fam] = options
+      result.rdb = rocksdb_open_column_families(
+        options, dataDir.cstring, DbFamily.high.ord.cint + 1,
+        cast[cstringArray](names[DbFamily.low].addr),
+        famOptions[DbFamily.low].addr,
+        result.families[DbFamily.low].addr, errors.addr)
+    else:
+      result.rdb = rocksdb_open(options, dataDir.cstring, errors.addr)
+    # copied by the database
+    options.rocksdb_options_destroy
+    checkErrors(errors)
+
+when dbBackend == sqlite:
+  export database_backend
@@ -0,0 +1,317 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Stack Trie
+## ==========
+##
+## Root hash calculator for a hexary trie whose keys are inserted in strictly
+## increasing order, along the lines of geth's `StackTrie`. A sub-trie left
+## of the key just inserted cannot change anymore, so it is hashed right
+## away and its nodes are recycled. Only the right-most path of the trie is
+## held in memory.
+##
+## If a database is given, every finished node is written to it exactly
+## once, so the result can be read back with `initHexaryTrie(db, root)`.
+## Unlike building a `HexaryTrie`, no intermediate node versions are stored.
+
+import
+  eth/[common, rlp], eth/trie/[db, trie_defs],
+  nimcrypto
+
+type
+  NodeKind = enum
+    nkEmpty
+    nkBranch
+    nkExt
+    nkLeaf
+    nkHashed                          ## Reference only, see `refData`
+
+  StackNode = object
+    kind: NodeKind
+    key: array[64,byte]               ## Nibbles of leaf or extension path
+    keyLen: int
+    value: seq[byte]                  ## Leaf payload
+    refData: array[32,byte]           ## Node hash, or node itself if short
+    refLen: int
+    children: array[16,int]           ## Node indices, `-1` if unused
+
+  StackTrie* = object
+    nodes: seq[StackNode]             ## Node arena, root is `nodes[0]`
+    free: seq[int]                    ## Recycled `nodes[]` entries
+    db: TrieDatabaseRef               ## Optional sink for finished nodes
+    lastKey: seq[byte]                ## Most recent key, for order check
+    count: int                        ## Number of keys inserted
+
+  Nibbles = array[64,byte]
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+proc toNibbles(key: openArray[byte]; nibbles: var Nibbles): int =
+  doAssert key.len <= 32, "stack trie keys are limited to 32 bytes"
+  for n, b in key:
+    nibbles[2*n] = b shr 4
+    nibbles[2*n+1] = b and 15
+  2 * key.len
+
+proc isLess(a, b: openArray[byte]): bool =
+  for n in 0 ..< min(a.len, b.len):
+    if a[n] != b[n]:
+      return a[n] < b[n]
+  a.len < b.len
+
+proc newNode(st: var StackTrie; kind: NodeKind): int =
+  if 0 < st.free.len:
+    result = st.free.pop
+  else:
+    result = st.nodes.len
+    st.nodes.setLen(result + 1)
+  st.nodes[result].kind = kind
+  st.nodes[result].keyLen = 0
+  st.nodes[result].refLen = 0
+  for n in 0 .. 15:
+    st.nodes[result].children[n] = -1
+
+proc freeNode(st: var StackTrie; i: int) =
+  st.nodes[i].value.setLen(0)
+  st.free.add i
+
+proc newLeaf(st: var StackTrie; key: openArray[byte];
+             value: openArray[byte]): int =
+  result = st.newNode(nkLeaf)
+  st.nodes[result].keyLen = key.len
+  for n, nibble in key:
+    st.nodes[result].key[n] = nibble
+  st.nodes[result].value = @value
+
+proc newExt(st: var StackTrie; key: openArray[byte]; child: int): int =
+  result = st.newNode(nkExt)
+  st.nodes[result].keyLen = key.len
+  for n, nibble in key:
+    st.nodes[result].key[n] = nibble
+  st.nodes[result].children[0] = child
+
+proc hexPrefix(st: StackTrie; i: int; leaf: bool): seq[byte] =
+  ## Compact (hex prefix) encoding of the node path
+  let
+    keyLen = st.nodes[i].keyLen
+    odd = (keyLen and 1) == 1
+  let flag = (if leaf: 0x20'u8 else: 0'u8)
+  result = newSeq[byte](keyLen div 2 + 1)
+  var pos = 0
+  if odd:
+    result[0] = flag or 0x10 or st.nodes[i].key[0]
+    pos = 1
+  else:
+    result[0] = flag
+  for n in 1 ..< result.len:
+    result[n] = (st.nodes[i].key[pos] shl 4) or st.nodes[i].key[pos+1]
+    pos += 2
+
+proc appendRef(w: var RlpWriter; st: StackTrie; i: int) =
+  if st.nodes[i].refLen == 32:
+    w.append st.nodes[i].refData.toOpenArray(0, 31)
+  else:
+    w.appendRawBytes st.nodes[i].refData.toOpenArray(0, st.nodes[i].refLen - 1)
+
+proc hash(st: var StackTrie; i: int) =
+  ## Turn node `i` and its sub-trie into a reference, children are recycled
+  var w: RlpWriter
+  case st.nodes[i].kind
+  of nkHashed, nkEmpty:
+    return
+  of nkLeaf:
+    w = initRlpList(2)
+    w.append st.hexPrefix(i, leaf = true)
+    w.append st.nodes[i].value
+  of nkExt:
+    let child = st.nodes[i].children[0]
+    st.hash(child)
+    w = initRlpList(2)
+    w.append st.hexPrefix(i, leaf = false)
+    w.appendRef(st, child)
+    st.freeNode(child)
+  of nkBranch:
+    w = initRlpList(17)
+    for n in 0 .. 15:
+      let child = st.nodes[i].children[n]
+      if child < 0:
+        w.append ""
+      else:
+        st.hash(child)
+        w.appendRef(st, child)
+        st.freeNode(child)
+    w.append ""
+
+  let encoded = w.finish
+  if encoded.len < 32:
+    st.nodes[i].refData[0 ..< encoded.len] = encoded
+    st.nodes[i].refLen = encoded.len
+  else:
+    let h = keccak256.digest(encoded)
+    st.nodes[i].refData = h.data
+    st.nodes[i].refLen = 32
+    if not st.db.isNil:
+      st.db.put(h.data, encoded)
+  st.nodes[i].kind = nkHashed
+  st.nodes[i].value.setLen(0)
+  for n in 0 .. 15:
+    st.nodes[i].children[n] = -1
+
+proc diffIndex(st: StackTrie; i: int; key: openArray[byte]): int =
+  for n in 0 ..< st.nodes[i].keyLen:
+    doAssert n < key.len, "stack trie keys must not be prefixes of each other"
+    if st.nodes[i].key[n] != key[n]:
+      return n
+  st.nodes[i].keyLen
+
+proc insert(st: var StackTrie; i: int; key, value: openArray[byte]) =
+  case st.nodes[i].kind
+  of nkEmpty:
+    st.nodes[i].kind = nkLeaf
+    st.nodes[i].keyLen = key.len
+    for n, nibble in key:
+      st.nodes[i].key[n] = nibble
+    st.nodes[i].value = @value
+
+  of nkBranch:
+    let idx = key[0].int
+    # Siblings to the left are complete
+    for n in countdown(idx - 1, 0):
+      let child = st.nodes[i].children[n]
+      if 0 <= child:
+        st.hash(child)
+        break
+    let child = st.nodes[i].children[idx]
+    if child < 0:
+      let leaf = st.newLeaf(key.toOpenArray(1, key.high), value)
+      st.nodes[i].children[idx] = leaf
+    else:
+      st.insert(child, key.toOpenArray(1, key.high), value)
+
+  of nkExt:
+    let diff = st.diffIndex(i, key)
+    if diff == st.nodes[i].keyLen:
+      st.insert(st.nodes[i].children[0], key.toOpenArray(diff, key.high), value)
+      return
+    let
+      nodeKey = st.nodes[i].key
+      keyLen = st.nodes[i].keyLen
+    # The part of the extension that is left of the new key is complete
+    var left: int
+    if diff < keyLen - 1:
+      left = st.newExt(nodeKey.toOpenArray(diff + 1, keyLen - 1),
+                       st.nodes[i].children[0])
+    else:
+      left = st.nodes[i].children[0]
+    st.hash(left)
+    var branch: int
+    if diff == 0:
+      st.nodes[i].kind = nkBranch
+      st.nodes[i].children[0] = -1
+      branch = i
+    else:
+      branch = st.newNode(nkBranch)
+      st.nodes[i].children[0] = branch
+    let right = st.newLeaf(key.toOpenArray(diff + 1, key.high), value)
+    st.nodes[branch].children[nodeKey[diff]] = left
+    st.nodes[branch].children[key[diff]] = right
+    st.nodes[i].keyLen = diff
+
+  of nkLeaf:
+    let diff = st.diffIndex(i, key)
+    doAssert diff < st.nodes[i].keyLen, "stack trie key inserted twice"
+    let
+      nodeKey = st.nodes[i].key
+      keyLen = st.nodes[i].keyLen
+      nodeValue = move st.nodes[i].value
+    var branch: int
+    if diff == 0:
+      st.nodes[i].kind = nkBranch
+      branch = i
+    else:
+      st.nodes[i].kind = nkExt
+      branch = st.newNode(nkBranch)
+      st.nodes[i].children[0] = branch
+    let left = st.newLeaf(nodeKey.toOpenArray(diff + 1, keyLen - 1), nodeValue)
+    st.hash(left)
+    st.nodes[branch].children[nodeKey[diff]] = left
+    let right = st.newLeaf(key.toOpenArray(diff + 1, key.high), value)
+    st.nodes[branch].children[key[diff]] = right
+    st.nodes[i].keyLen = diff
+
+  of nkHashed:
+    doAssert false, "stack trie keys must be inserted in increasing order"
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc initStackTrie*(st: var StackTrie; db: TrieDatabaseRef = nil) =
+  ## Start an empty trie. Finished nodes are written to `db` unless `nil`.
+  st.nodes.setLen(0)
+  st.free.setLen(0)
+  st.lastKey.setLen(0)
+  st.count = 0
+  st.db = db
+  discard st.newNode(nkEmpty)
+
+proc put*(st: var StackTrie; key, value: openArray[byte]) =
+  ## Add a key, keys must be strictly increasing in lexicographical order.
+  ## An empty `value` is not allowed (it would delete the key in a
+  ## `HexaryTrie`.)
+  doAssert 0 < value.len, "stack trie values must not be empty"
+  doAssert st.count == 0 or st.lastKey.isLess(key),
+    "stack trie keys must be inserted in increasing order"
+  var nibbles: Nibbles
+  let len = key.toNibbles(nibbles)
+  st.insert(0, nibbles.toOpenArray(0, len - 1), value)
+  st.lastKey = @key
+  st.count.inc
+
+proc rootHash*(st: var StackTrie): Hash256 =
+  ## Finish the trie and return its root hash, no more keys can be added
+  ## afterwards.
+  if st.nodes[0].kind == nkEmpty:
+    return emptyRlpHash
+  st.hash(0)
+  if st.nodes[0].refLen == 32:
+    result.data = st.nodes[0].refData
+  else:
+    # The root is always referenced by hash, even if it is short
+    let encoded = st.nodes[0].refData[0 ..< st.nodes[0].refLen]
+    result = keccak256.digest(encoded)
+    if not st.db.isNil:
+      st.db.put(result.data, encoded)
+
+iterator indexKeys*(count: int): int =
+  ## Indices `0 ..< count` in the order of their RLP encoded keys, i.e.
+  ## `1 .. 127`, then `0`, then `128 ..< count`
+  for n in 1 ..< min(count, 128):
+    yield n
+  if 0 < count:
+    yield 0
+  for n in 128 ..< count:
+    yield n
+
+proc orderedTrieRoot*[T](items: openArray[T];
+                         db: TrieDatabaseRef = nil): Hash256 =
+  ## Root of the trie with `rlp.encode(items[n])` stored under key
+  ## `rlp.encode(n)`, the layout used for transactions and receipts
+  var st: StackTrie
+  st.initStackTrie(db)
+  for n in indexKeys(items.len):
+    st.put(rlp.encode(n), rlp.encode(items[n]))
+  st.rootHash
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
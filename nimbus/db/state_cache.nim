@@ -0,0 +1,205 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Cross-Block State Cache
+## =======================
+##
+## Size bounded LRU cache of committed accounts, storage slots and contract
+## code which survives the `AccountsCache` of a single block. The entries
+## describe the state at `root`, committed writes from `AccountsCache.persist()`
+## are written through so the cache follows the state root from block to
+## block.
+##
+## Storage slots of all accounts share one LRU queue bounded in bytes, hot
+## slots of one contract may push out cold slots of another. The slots of an
+## account are only valid while the account itself is cached: each cached
+## account gets a fresh slot generation, so slots of evicted, deleted or
+## wiped accounts are never found again and age out of the queue.
+##
+## When an `AccountsCache` is attached at a state root different from the
+## cached one (e.g. after a failed and rolled back block), the account and
+## slot part of the cache is flushed. Contract code is indexed by code hash
+## and stays valid regardless.
+
+import
+  hashes,
+  eth/common,
+  ../utils/lru_cache
+
+type
+  CachedAccount* = ref object
+    exists*: bool                   ## `false` for a known non-existing account
+    account*: Account
+    slotGen: uint64                 ## Generation of the cached slots
+
+  SlotKey = object
+    gen: uint64                     ## `slotGen` of the account
+    slot: UInt256
+
+  AccountLru = LruCache[EthAddress,EthAddress,CachedAccount,void]
+  SlotLru = LruCache[SlotKey,SlotKey,UInt256,void]
+  CodeLru = LruCache[Hash256,Hash256,seq[byte],void]
+
+  StateCacheRef* = ref object
+    root: Hash256                   ## State root of the cached entries
+    accounts: AccountLru
+    slots: SlotLru                  ## Committed slot values of all accounts
+    code: CodeLru
+    nextGen: uint64                 ## Next unused slot generation
+
+const
+  slotItemSize = 3 * sizeof(SlotKey) + sizeof(UInt256) + sizeof(int)
+    ## Approximate memory used by a cached slot: the table entry holds the
+    ## hash, the key and the LRU links (two more keys) next to the value
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+proc initAccountLru(lru: var AccountLru; maxItems: int) =
+  var
+    toKey: LruKey[EthAddress,EthAddress] =
+      proc(address: EthAddress): EthAddress = address
+    toValue: LruValue[EthAddress,CachedAccount,void] =
+      proc(address: EthAddress): Result[CachedAccount,void] = err()
+  lru.initCache(toKey, toValue, maxItems)
+
+proc hash(key: SlotKey): Hash =
+  var h = key.gen.hash
+  h = h !& key.slot.hash
+  !$h
+
+proc initSlotLru(lru: var SlotLru; maxItems: int) =
+  var
+    toKey: LruKey[SlotKey,SlotKey] =
+      proc(key: SlotKey): SlotKey = key
+    toValue: LruValue[SlotKey,UInt256,void] =
+      proc(key: SlotKey): Result[UInt256,void] = err()
+  # the table grows on demand rather than being preallocated for the budget
+  lru.initCache(toKey, toValue, maxItems, cacheInitSize = 1024)
+
+proc newSlotGen(sc: StateCacheRef): uint64 =
+  result = sc.nextGen
+  sc.nextGen.inc
+
+proc initCodeLru(lru: var CodeLru; maxItems: int) =
+  var
+    toKey: LruKey[Hash256,Hash256] =
+      proc(codeHash: Hash256): Hash256 = codeHash
+    toValue: LruValue[Hash256,seq[byte],void] =
+      proc(codeHash: Hash256): Result[seq[byte],void] = err()
+  lru.initCache(toKey, toValue, maxItems)
+
+# ------------------------------------------------------------------------------
+# Public constructor
+# ------------------------------------------------------------------------------
+
+proc newStateCache*(maxAccounts = 50_000; maxCodes = 2_000;
+                    maxSlotBytes = 64 * 1024 * 1024): StateCacheRef =
+  ## Constructor, `maxSlotBytes` limits the memory used by the cached storage
+  ## slots of all accounts together (approximately, the least recently used
+  ## slots are evicted when exceeded.)
+  result = StateCacheRef()
+  result.accounts.initAccountLru(maxAccounts)
+  result.slots.initSlotLru(max(maxSlotBytes div slotItemSize, 1))
+  result.code.initCodeLru(maxCodes)
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc root*(sc: StateCacheRef): Hash256 {.inline.} =
+  ## State root the cached accounts and slots belong to
+  sc.root
+
+proc attach*(sc: StateCacheRef; root: Hash256) =
+  ## Prepare the cache for an `AccountsCache` based on state `root`
+  if sc.root != root:
+    sc.accounts.clearCache
+    sc.slots.clearCache(cacheInitSize = 1024)
+    sc.root = root
+
+proc commit*(sc: StateCacheRef; root: Hash256) {.inline.} =
+  ## Declare written through changes to result in state `root`
+  sc.root = root
+
+proc getAccount*(sc: StateCacheRef; address: EthAddress): CachedAccount =
+  ## Returns `nil` unless cached
+  try:
+    let rc = sc.accounts.getItem(address)
+    if rc.isOk:
+      return rc.value
+  except CatchableError:
+    discard
+
+proc putAccount*(sc: StateCacheRef; address: EthAddress;
+                 exists: bool; account: Account) =
+  ## Insert or update committed account, cached slots are kept
+  let cached = sc.getAccount(address)
+  if cached.isNil:
+    try:
+      sc.accounts.putItem(address, CachedAccount(
+        exists: exists,
+        account: account,
+        slotGen: sc.newSlotGen))
+    except CatchableError:
+      discard
+  else:
+    cached.exists = exists
+    cached.account = account
+
+proc getSlot*(sc: StateCacheRef; address: EthAddress;
+              slot: UInt256; value: var UInt256): bool =
+  let cached = sc.getAccount(address)
+  if not cached.isNil:
+    try:
+      let rc = sc.slots.getItem(SlotKey(gen: cached.slotGen, slot: slot))
+      if rc.isOk:
+        value = rc.value
+        return true
+    except CatchableError:
+      discard
+
+proc putSlot*(sc: StateCacheRef; address: EthAddress; slot, value: UInt256) =
+  ## Cache committed slot value, ignored unless the account is cached
+  let cached = sc.getAccount(address)
+  if not cached.isNil:
+    try:
+      sc.slots.putItem(SlotKey(gen: cached.slotGen, slot: slot), value)
+    except CatchableError:
+      discard
+
+proc wipeSlots*(sc: StateCacheRef; address: EthAddress) =
+  ## Forget all slots, needed for deleted accounts or cleared storage
+  let cached = sc.getAccount(address)
+  if not cached.isNil:
+    # the old slots are left to age out of the queue
+    cached.slotGen = sc.newSlotGen
+
+proc getCode*(sc: StateCacheRef; codeHash: Hash256; code: var seq[byte]): bool =
+  try:
+    let rc = sc.code.getItem(codeHash)
+    if rc.isOk:
+      code = rc.value
+      return true
+  except CatchableError:
+    discard
+
+proc putCode*(sc: StateCacheRef; codeHash: Hash256; code: seq[byte]) =
+  try:
+    sc.code.putItem(codeHash, code)
+  except CatchableError:
+    discard
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
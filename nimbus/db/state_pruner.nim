@@ -0,0 +1,205 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## State Trie Pruner
+## =================
+##
+## Reference counting garbage collector for the state trie nodes of a full
+## (non-archive) node, keeping the states of the last `history` blocks.
+##
+## The reference count of a state trie node is the number of counted nodes
+## referring to it (branch and extension children and the storage roots of
+## account leaves) plus the number of times it is pinned as a state root.
+## The counts are stored next to the trie nodes, so they follow the database
+## transaction of the block.
+##
+## * `pinState()` is called for each imported block. It walks the trie below
+##   the new state root, descending only into nodes that are not counted yet,
+##   so its cost is proportional to the number of new nodes. The root is
+##   added to the journal entry of the block number.
+## * `pruneStep()` unpins the state roots of the oldest journal entry once it
+##   is more than `history` blocks behind the head. Nodes whose count drops
+##   to zero are deleted and release their children in turn. It does not need
+##   a database transaction and is meant to be run between block imports.
+##
+## The first pinned state is walked completely, so pruning is meant to be
+## enabled on a fresh database. Nodes written before are never counted and
+## never deleted. Contract code is not reference counted and always kept.
+
+import
+  std/tables,
+  chronicles,
+  eth/[common, rlp], eth/trie/[db, nibbles, trie_defs],
+  stew/endians2,
+  ./storage_types
+
+type
+  NodeRef = object
+    key: Hash256
+    storage: bool ## Storage trie node, leaves hold slot values
+
+  StatePruner* = ref object
+    db: TrieDatabaseRef
+    history: uint64 ## Number of most recent states kept
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+proc refCount(db: TrieDatabaseRef; key: Hash256): uint64 =
+  let data = db.get(trieNodeRefsKey(key).toOpenArray)
+  if data.len == 8:
+    result = uint64.fromBytesBE(data)
+
+proc setRefCount(db: TrieDatabaseRef; key: Hash256; count: uint64) =
+  if count == 0:
+    db.del(trieNodeRefsKey(key).toOpenArray)
+  else:
+    db.put(trieNodeRefsKey(key).toOpenArray, count.toBytesBE)
+
+proc getTail(db: TrieDatabaseRef): (bool, uint64) =
+  let data = db.get(pruneTailKey().toOpenArray)
+  if data.len == 8:
+    result = (true, uint64.fromBytesBE(data))
+
+proc setTail(db: TrieDatabaseRef; blockNumber: uint64) =
+  db.put(pruneTailKey().toOpenArray, blockNumber.toBytesBE)
+
+proc getJournal(db: TrieDatabaseRef; blockNumber: uint64): seq[Hash256]
+    {.raises: [Defect, RlpError].} =
+  let data = db.get(pruneJournalKey(blockNumber).toOpenArray)
+  if data.len != 0:
+    result = rlp.decode(data, seq[Hash256])
+
+proc addChild(refs: var seq[NodeRef]; elem: Rlp; storage: bool)
+    {.raises: [Defect, RlpError].}
+
+proc addRefs(refs: var seq[NodeRef]; r: Rlp; storage: bool)
+    {.raises: [Defect, RlpError].} =
+  ## Add the hash references of the node `r`
+  case r.listLen
+  of 2:
+    let (isLeaf, _) = hexPrefixDecode r.listElem(0).toBytes
+    if not isLeaf:
+      refs.addChild(r.listElem(1), storage)
+    elif not storage:
+      let acc = rlp.decode(r.listElem(1).toBytes, Account)
+      if acc.storageRoot != emptyRlpHash:
+        refs.add NodeRef(key: acc.storageRoot, storage: true)
+  of 17:
+    for i in 0 ..< 16:
+      refs.addChild(r.listElem(i), storage)
+  else:
+    discard
+
+proc addChild(refs: var seq[NodeRef]; elem: Rlp; storage: bool)
+    {.raises: [Defect, RlpError].} =
+  if elem.isList:
+    # embedded short node
+    refs.addRefs(elem, storage)
+  elif not elem.isEmpty:
+    let data = elem.toBytes
+    if data.len == 32:
+      var key: Hash256
+      key.data[0 .. 31] = data
+      refs.add NodeRef(key: key, storage: storage)
+
+proc addRefs(refs: var seq[NodeRef]; db: TrieDatabaseRef; node: NodeRef)
+    {.raises: [Defect, RlpError].} =
+  let data = db.get(node.key.data)
+  if data.len != 0:
+    refs.addRefs(rlpFromBytes(data), node.storage)
+
+# ------------------------------------------------------------------------------
+# Public constructor
+# ------------------------------------------------------------------------------
+
+proc newStatePruner*(db: TrieDatabaseRef; history: uint64): StatePruner =
+  ## The `history` must be at least one, the state of the head is kept.
+  doAssert(0 < history)
+  StatePruner(db: db, history: history)
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc isInitialised*(db: TrieDatabaseRef): bool =
+  ## True if the reference counts were maintained for the states stored in
+  ## `db`, i.e. if pruning has been enabled from the start.
+  db.getTail()[0]
+
+proc pinState*(p: StatePruner; blockNumber: BlockNumber; root: Hash256)
+    {.raises: [Defect, RlpError].} =
+  ## Count the trie nodes below `root` and keep them until the block is more
+  ## than `history` blocks behind the head. To be called inside the database
+  ## transaction that persists the state.
+  let number = blockNumber.truncate(uint64)
+  if not p.db.getTail()[0]:
+    p.db.setTail(number)
+
+  var stack = @[NodeRef(key: root)]
+  while 0 < stack.len:
+    let node = stack.pop
+    let count = p.db.refCount(node.key)
+    p.db.setRefCount(node.key, count + 1)
+    if count == 0:
+      stack.addRefs(p.db, node)
+
+  var roots = p.db.getJournal(number)
+  roots.add root
+  p.db.put(pruneJournalKey(number).toOpenArray, rlp.encode(roots))
+
+proc pruneStep*(p: StatePruner; head: BlockNumber): bool
+    {.raises: [Defect, RlpError].} =
+  ## Release the state roots of the oldest journal entry if it is more than
+  ## `history` blocks behind `head`. Returns `true` if an entry was processed
+  ## and there might be more to do.
+  let (ok, tail) = p.db.getTail()
+  if not ok or head.truncate(uint64) < tail + p.history:
+    return false
+
+  var
+    counts: Table[Hash256,uint64]  # updated counts, written at the end
+    deleted: seq[Hash256]
+    stack: seq[NodeRef]
+  for root in p.db.getJournal(tail):
+    stack.add NodeRef(key: root)
+  while 0 < stack.len:
+    let node = stack.pop
+    var count = counts.getOrDefault(node.key, high(uint64))
+    if count == high(uint64):
+      count = p.db.refCount(node.key)
+    if count == 0:
+      # not counted (should not happen)
+      continue
+    dec count
+    counts[node.key] = count
+    if count == 0:
+      deleted.add node.key
+      stack.addRefs(p.db, node)
+
+  # Drop the journal entry first, so an interruption leaks nodes rather
+  # than releasing them twice.
+  p.db.del(pruneJournalKey(tail).toOpenArray)
+  p.db.setTail(tail + 1)
+  for key, count in counts:
+    p.db.setRefCount(key, count)
+  for key in deleted:
+    p.db.del(key.data)
+
+  if 0 < deleted.len:
+    trace "State trie nodes pruned", blockNumber = tail, nodes = deleted.len
+  true
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
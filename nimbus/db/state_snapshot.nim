@@ -0,0 +1,283 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Flat State Snapshot
+## ===================
+##
+## Flat key-value view of the state trie for a single state root, so that
+## account and storage reads need one database lookup rather than a walk
+## down the hexary trie. The layout is
+##
+## * `keccak(address)                 -> rlp(Account)`
+## * `keccak(address) ++ keccak(slot) -> rlp(value)`
+##
+## with both keys prefixed by a generation number. Rebuilding the snapshot
+## starts a new generation, the entries of the previous generation become
+## unreachable (the `KvStore` has no range deletion.)
+##
+## The snapshot lives in the same `TrieDatabaseRef` as the trie so writes are
+## subject to the same database transactions, i.e. a rolled back block also
+## rolls back the snapshot.
+##
+## Each `commit()` to a new state root also stores the entries it changed,
+## with their values before and after, for the last `maxSnapshotDiffs` state
+## transitions. `syncTo()` uses them to move the snapshot to any of those
+## roots, down to the common ancestor and up again on the other branch, so
+## the snapshot follows a reorg without being rebuilt.
+
+import
+  tables,
+  eth/[common, rlp], eth/trie/[hexary, db, trie_defs],
+  ./storage_types
+
+type
+  SnapshotLink = object
+    root: Hash256
+    parent: Hash256                 ## Root before the transition
+
+  SnapshotRecord = object
+    root: Hash256
+    gen: uint64
+    diffs: seq[SnapshotLink]        ## Stored transitions, oldest first
+
+  SnapshotDiff = object
+    gen: uint64
+    keys: seq[seq[byte]]
+    before: seq[seq[byte]]          ## Empty for a missing entry
+    after: seq[seq[byte]]
+
+  SnapshotChange = object
+    before: seq[byte]
+    after: seq[byte]
+
+  StateSnapshot* = object
+    db: TrieDatabaseRef
+    rec: SnapshotRecord
+    changes: Table[seq[byte],SnapshotChange] ## Since the last `commit()`
+
+const
+  maxSnapshotDiffs* = 128
+    ## State transitions `syncTo()` can walk back and forth
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+proc record(snap: var StateSnapshot; key, value: openArray[byte]) =
+  ## Remember the change of `key` for the diff of the next `commit()`, the
+  ## value before costs one extra read per key and transition
+  let k = @key
+  snap.changes.withValue(k, change) do:
+    change.after = @value
+  do:
+    snap.changes[k] = SnapshotChange(before: snap.db.get(key), after: @value)
+
+proc write(snap: StateSnapshot; key, value: openArray[byte]) =
+  if value.len == 0: snap.db.del(key)
+  else: snap.db.put(key, value)
+
+proc saveRecord(snap: StateSnapshot) =
+  snap.db.put(snapshotRootKey().toOpenArray, rlp.encode(snap.rec))
+
+proc saveDiff(snap: var StateSnapshot; root: Hash256) =
+  var diff = SnapshotDiff(gen: snap.rec.gen)
+  for key, change in snap.changes:
+    diff.keys.add key
+    diff.before.add change.before
+    diff.after.add change.after
+  snap.db.put(snapshotDiffKey(root).toOpenArray, rlp.encode(diff))
+
+  for n in 0 ..< snap.rec.diffs.len:
+    if snap.rec.diffs[n].root == root:
+      # state root seen before, the new transition replaces the old one
+      snap.rec.diffs.delete(n)
+      break
+  snap.rec.diffs.add SnapshotLink(root: root, parent: snap.rec.root)
+  if maxSnapshotDiffs < snap.rec.diffs.len:
+    snap.db.del(snapshotDiffKey(snap.rec.diffs[0].root).toOpenArray)
+    snap.rec.diffs.delete(0)
+
+proc loadDiff(snap: StateSnapshot; root: Hash256; diff: var SnapshotDiff): bool =
+  let data = snap.db.get(snapshotDiffKey(root).toOpenArray)
+  if data.len == 0:
+    return false
+  try:
+    diff = rlp.decode(data, SnapshotDiff)
+  except RlpError:
+    return false
+  diff.gen == snap.rec.gen and
+    diff.keys.len == diff.before.len and diff.keys.len == diff.after.len
+
+# ------------------------------------------------------------------------------
+# Public constructor
+# ------------------------------------------------------------------------------
+
+proc init*(T: type StateSnapshot; db: TrieDatabaseRef): T =
+  ## Load snapshot descriptor from the database. If there is no snapshot,
+  ## the root is zero and will never match any state root.
+  result.db = db
+  let data = db.get(snapshotRootKey().toOpenArray)
+  if data.len != 0:
+    try:
+      result.rec = rlp.decode(data, SnapshotRecord)
+    except RlpError:
+      # record without transitions, keep the generation so that a rebuild
+      # does not see stale entries
+      try:
+        let legacy = rlp.decode(data, (Hash256, uint64))
+        result.rec = SnapshotRecord(root: legacy[0], gen: legacy[1])
+      except RlpError:
+        result.rec = SnapshotRecord()
+
+proc rebuild*(T: type StateSnapshot; db: TrieDatabaseRef;
+              root: Hash256): T =
+  ## Create a new snapshot generation from the state trie at `root`
+  result = T.init(db)
+  result.rec.gen.inc
+  # the transitions of the previous generation do not apply any more
+  for link in result.rec.diffs:
+    db.del(snapshotDiffKey(link.root).toOpenArray)
+  result.rec.diffs.setLen(0)
+
+  var trie = initHexaryTrie(db, root)
+  for addrKey, value in trie:
+    if addrKey.len != 32: continue
+    var addrHash: Hash256
+    addrHash.data[0 .. 31] = addrKey
+    db.put(snapshotAccountKey(result.rec.gen, addrHash).toOpenArray, value)
+
+    let acc = rlp.decode(value, Account)
+    if acc.storageRoot != emptyRlpHash:
+      var storageTrie = initHexaryTrie(db, acc.storageRoot)
+      for slotHash, slotValue in storageTrie:
+        if slotHash.len != 32: continue
+        db.put(snapshotStorageKey(
+          result.rec.gen, addrHash, slotHash).toOpenArray, slotValue)
+
+  result.rec.root = root
+  result.saveRecord()
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc root*(snap: StateSnapshot): Hash256 {.inline.} =
+  ## State root the snapshot is consistent with
+  snap.rec.root
+
+proc isValidFor*(snap: StateSnapshot; root: Hash256): bool {.inline.} =
+  not snap.db.isNil and snap.rec.root == root
+
+proc getAccount*(snap: StateSnapshot; addrHash: Hash256): seq[byte] =
+  ## Returns the RLP encoded account, an empty `seq` if it does not exist
+  snap.db.get(snapshotAccountKey(snap.rec.gen, addrHash).toOpenArray)
+
+proc getStorage*(snap: StateSnapshot;
+                 addrHash: Hash256; slotHash: Hash256): seq[byte] =
+  ## Returns the RLP encoded slot value, an empty `seq` if it is zero
+  snap.db.get(snapshotStorageKey(
+    snap.rec.gen, addrHash, slotHash.data).toOpenArray)
+
+proc putAccount*(snap: var StateSnapshot; addrHash: Hash256;
+                 data: openArray[byte]) =
+  let key = snapshotAccountKey(snap.rec.gen, addrHash)
+  snap.record(key.toOpenArray, data)
+  snap.db.put(key.toOpenArray, data)
+
+proc delAccount*(snap: var StateSnapshot; addrHash: Hash256) =
+  let key = snapshotAccountKey(snap.rec.gen, addrHash)
+  snap.record(key.toOpenArray, newSeq[byte]())
+  snap.db.del(key.toOpenArray)
+
+proc putStorage*(snap: var StateSnapshot;
+                 addrHash: Hash256; slotHash: Hash256; data: openArray[byte]) =
+  let key = snapshotStorageKey(snap.rec.gen, addrHash, slotHash.data)
+  snap.record(key.toOpenArray, data)
+  snap.db.put(key.toOpenArray, data)
+
+proc delStorage*(snap: var StateSnapshot; addrHash: Hash256; slotHash: Hash256) =
+  let key = snapshotStorageKey(snap.rec.gen, addrHash, slotHash.data)
+  snap.record(key.toOpenArray, newSeq[byte]())
+  snap.db.del(key.toOpenArray)
+
+proc wipeStorage*(snap: var StateSnapshot; addrHash: Hash256;
+                  storageRoot: Hash256) =
+  ## Remove all slots of the storage trie `storageRoot` from the snapshot,
+  ## needed when an account is deleted or its storage is cleared.
+  if storageRoot == emptyRlpHash:
+    return
+  var storageTrie = initHexaryTrie(snap.db, storageRoot)
+  for slotHash, _ in storageTrie:
+    if slotHash.len != 32: continue
+    let key = snapshotStorageKey(snap.rec.gen, addrHash, slotHash)
+    snap.record(key.toOpenArray, newSeq[byte]())
+    snap.db.del(key.toOpenArray)
+
+proc commit*(snap: var StateSnapshot; root: Hash256) =
+  ## Declare the snapshot consistent with state root `root`, the changes
+  ## since the last commit are kept as the transition to `root`
+  if snap.rec.root != root:
+    snap.saveDiff(root)
+    snap.rec.root = root
+    snap.saveRecord()
+  snap.changes.clear
+
+proc syncTo*(snap: var StateSnapshot; root: Hash256): bool =
+  ## Move the snapshot to state `root` using the stored transitions, e.g.
+  ## after a reorg. Returns `false` and leaves the snapshot as it is if
+  ## `root` cannot be reached that way.
+  if snap.db.isNil:
+    return false
+  if snap.rec.root == root:
+    return true
+
+  var parents: Table[Hash256,Hash256]
+  for link in snap.rec.diffs:
+    parents[link.root] = link.parent
+
+  # ancestors of the current root, then the branch up to `root`
+  var down = @[snap.rec.root]
+  while down[^1] in parents and down.len <= maxSnapshotDiffs:
+    down.add parents[down[^1]]
+  var
+    up: seq[Hash256]
+    node = root
+  while node notin down:
+    if node notin parents or maxSnapshotDiffs <= up.len:
+      return false
+    up.add node
+    node = parents[node]
+  let fork = down.find(node)
+
+  # load everything first, a partial walk would leave a broken snapshot
+  var undo, redo: seq[SnapshotDiff]
+  for n in 0 ..< fork:
+    undo.add SnapshotDiff()
+    if not snap.loadDiff(down[n], undo[^1]):
+      return false
+  for n in countdown(up.high, 0):
+    redo.add SnapshotDiff()
+    if not snap.loadDiff(up[n], redo[^1]):
+      return false
+
+  for diff in undo:
+    for n in 0 ..< diff.keys.len:
+      snap.write(diff.keys[n], diff.before[n])
+  for diff in redo:
+    for n in 0 ..< diff.keys.len:
+      snap.write(diff.keys[n], diff.after[n])
+  snap.rec.root = root
+  snap.saveRecord()
+  snap.changes.clear
+  true
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -1,5 +1,5 @@
 import
-  hashes, eth/common
+  hashes, eth/common, stew/endians2
 
 type
   DBKeyKind* = enum
@@ -11,12 +11,26 @@ type
     slotHashToSlot
     contractHash
     cliqueSnapshot
+    snapshotRoot
+    snapshotAccount
+    snapshotStorage
+    bloomBits
+    bloomSectionHead
+    trieNodeRefs
+    pruneJournal
+    pruneTail
+    snapshotDiff
 
   DbKey* = object
     # The first byte stores the key type. The rest are key-specific values
     data*: array[33, byte]
     dataEndPos*: uint8 # the last populated position in the data
 
+  SnapshotKey* = object
+    # Same as `DbKey` with room for the longer flat snapshot keys
+    data*: array[73, byte]
+    dataEndPos*: uint8
+
 proc genericHashKey*(h: Hash256): DbKey {.inline.} =
   result.data[0] = byte ord(genericHash)
   result.data[1 .. 32] = h.data
@@ -58,9 +72,62 @@ proc cliqueSnapshotKey*(h: Hash256): DbKey {.inline.} =
   result.data[1 .. 32] = h.data
   result.dataEndPos = uint8 32
 
+proc snapshotRootKey*(): DbKey {.inline.} =
+  result.data[0] = byte ord(snapshotRoot)
+  result.dataEndPos = 1
+
+proc snapshotAccountKey*(gen: uint64, addrHash: Hash256): SnapshotKey {.inline.} =
+  result.data[0] = byte ord(snapshotAccount)
+  result.data[1 .. 8] = gen.toBytesBE
+  result.data[9 .. 40] = addrHash.data
+  result.dataEndPos = uint8 40
+
+proc snapshotStorageKey*(gen: uint64, addrHash: Hash256,
+                         slotHash: openArray[byte]): SnapshotKey {.inline.} =
+  doAssert(slotHash.len == 32)
+  result.data[0] = byte ord(snapshotStorage)
+  result.data[1 .. 8] = gen.toBytesBE
+  result.data[9 .. 40] = addrHash.data
+  result.data[41 .. 72] = slotHash
+  result.dataEndPos = uint8 72
+
+proc bloomBitsKey*(section: uint64, bit: int): DbKey {.inline.} =
+  doAssert(0 <= bit and bit < 2048)
+  result.data[0] = byte ord(bloomBits)
+  result.data[1 .. 8] = section.toBytesBE
+  result.data[9 .. 10] = bit.uint16.toBytesBE
+  result.dataEndPos = uint8 10
+
+proc bloomSectionHeadKey*(section: uint64): DbKey {.inline.} =
+  result.data[0] = byte ord(bloomSectionHead)
+  result.data[1 .. 8] = section.toBytesBE
+  result.dataEndPos = uint8 8
+
+proc trieNodeRefsKey*(h: Hash256): DbKey {.inline.} =
+  result.data[0] = byte ord(trieNodeRefs)
+  result.data[1 .. 32] = h.data
+  result.dataEndPos = uint8 32
+
+proc pruneJournalKey*(blockNumber: uint64): DbKey {.inline.} =
+  result.data[0] = byte ord(pruneJournal)
+  result.data[1 .. 8] = blockNumber.toBytesBE
+  result.dataEndPos = uint8 8
+
+proc pruneTailKey*(): DbKey {.inline.} =
+  result.data[0] = byte ord(pruneTail)
+  result.dataEndPos = 1
+
+proc snapshotDiffKey*(root: Hash256): DbKey {.inline.} =
+  result.data[0] = byte ord(snapshotDiff)
+  result.data[1 .. 32] = root.data
+  result.dataEndPos = uint8 32
+
 template toOpenArray*(k: DbKey): openarray[byte] =
   k.data.toOpenArray(0, int(k.dataEndPos))
 
+template toOpenArray*(k: SnapshotKey): openarray[byte] =
+  k.data.toOpenArray(0, int(k.dataEndPos))
+
 proc hash*(k: DbKey): Hash =
   result = hash(k.toOpenArray)
 
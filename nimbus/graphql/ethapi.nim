@@ -8,7 +8,7 @@
 # those terms.
 
 import
-  std/[strutils, times],
+  std/[strutils, tables, times],
   stew/[results, byteutils], stint,
   eth/[common, rlp], chronos,
   graphql, graphql/graphql as context,
@@ -34,8 +34,24 @@ type
     ethMutation     = "Mutation"
     ethAccessTuple  = "AccessTuple"
 
-  HeaderNode = ref object of Node
+  BlockPart = enum
+    bpTxs, bpUncles, bpScore
+
+  BlockData = ref object
+    ## Block data loaded on demand and memoised. It is shared by all the
+    ## nodes of a query result derived from the same block, so each part
+    ## is decoded and each state trie is opened once per block per query.
     header: BlockHeader
+    loaded: set[BlockPart]
+    txs: seq[Transaction]
+    receipts: seq[Receipt]
+    uncles: seq[BlockHeader]
+    score: UInt256
+    stateDB: ReadOnlyStateDB
+    accounts: Table[EthAddress, Account]
+
+  HeaderNode = ref object of Node
+    blk: BlockData
 
   AccountNode = ref object of Node
     address: EthAddress
@@ -45,7 +61,7 @@ type
   TxNode = ref object of Node
     tx: Transaction
     index: int
-    blockNumber: BlockNumber
+    blk: BlockData
     receipt: Receipt
     gasUsed: GasInt
 
@@ -69,14 +85,20 @@ proc toHash(n: Node): Hash256 =
 proc toBlockNumber(n: Node): BlockNumber =
   result = parse(n.intVal, UInt256, radix = 10)
 
-proc headerNode(ctx: GraphqlContextRef, header: BlockHeader): Node =
+template header(h: HeaderNode): BlockHeader =
+  h.blk.header
+
+proc headerNode(ctx: GraphqlContextRef, blk: BlockData): Node =
   HeaderNode(
     kind: nkMap,
     typeName: ctx.ids[ethBlock],
     pos: Pos(),
-    header: header
+    blk: blk
   )
 
+proc headerNode(ctx: GraphqlContextRef, header: BlockHeader): Node =
+  headerNode(ctx, BlockData(header: header))
+
 proc accountNode(ctx: GraphqlContextRef, acc: Account, address: EthAddress, db: ReadOnlyStateDB): Node =
   AccountNode(
     kind: nkMap,
@@ -87,14 +109,14 @@ proc accountNode(ctx: GraphqlContextRef, acc: Account, address: EthAddress, db:
     db: db
   )
 
-proc txNode(ctx: GraphqlContextRef, tx: Transaction, index: int, blockNumber: BlockNumber): Node =
+proc txNode(ctx: GraphqlContextRef, tx: Transaction, index: int, blk: BlockData): Node =
   TxNode(
     kind: nkMap,
     typeName: ctx.ids[ethTransaction],
     pos: Pos(),
     tx: tx,
     index: index,
-    blockNumber: blockNumber
+    blk: blk
   )
 
 proc logNode(ctx: GraphqlContextRef, log: Log, index: int, tx: TxNode): Node =
@@ -121,6 +143,56 @@ proc getAccountDb(chainDB: BaseChainDB, header: BlockHeader): ReadOnlyStateDB =
   let ac = newAccountStateDB(chainDB.db, header.stateRoot, chainDB.pruneTrie)
   ReadOnlyStateDB(ac)
 
+# ------------------------------------------------------------------------------
+# Block data loader
+# ------------------------------------------------------------------------------
+
+proc loadTxs(ctx: GraphqlContextRef, blk: BlockData) =
+  ## Transactions and receipts are loaded together, the transaction nodes
+  ## need both.
+  if bpTxs in blk.loaded:
+    return
+  var txs: seq[Transaction]
+  for n in getBlockTransactionData(ctx.chainDB, blk.header.txRoot):
+    txs.add rlp.decode(n, Transaction)
+  var receipts = newSeqOfCap[Receipt](txs.len)
+  for r in getReceipts(ctx.chainDB, blk.header.receiptRoot):
+    receipts.add r
+  blk.txs = system.move(txs)
+  blk.receipts = system.move(receipts)
+  blk.loaded.incl bpTxs
+
+proc loadUncles(ctx: GraphqlContextRef, blk: BlockData) =
+  if bpUncles notin blk.loaded:
+    blk.uncles = getUncles(ctx.chainDB, blk.header.ommersHash)
+    blk.loaded.incl bpUncles
+
+proc loadScore(ctx: GraphqlContextRef, blk: BlockData) =
+  if bpScore notin blk.loaded:
+    blk.score = getScore(ctx.chainDB, blk.header.blockHash)
+    blk.loaded.incl bpScore
+
+proc accountDb(ctx: GraphqlContextRef, blk: BlockData): ReadOnlyStateDB =
+  if AccountStateDB(blk.stateDB).isNil:
+    blk.stateDB = getAccountDb(ctx.chainDB, blk.header)
+  blk.stateDB
+
+proc getAccount(ctx: GraphqlContextRef, blk: BlockData, address: EthAddress): Account =
+  blk.accounts.withValue(address, acc):
+    return acc[]
+  result = ctx.accountDb(blk).getAccount(address)
+  blk.accounts[address] = result
+
+proc txNodeAt(ctx: GraphqlContextRef, blk: BlockData, index: int): TxNode =
+  ## Transaction node with the receipt data, `loadTxs()` must be done
+  result = TxNode(ctx.txNode(blk.txs[index], index, blk))
+  if index < blk.receipts.len:
+    let prevUsed =
+      if index == 0: 0.GasInt
+      else: blk.receipts[index-1].cumulativeGasUsed
+    result.receipt = blk.receipts[index]
+    result.gasUsed = result.receipt.cumulativeGasUsed - prevUsed
+
 proc getBlockByNumber(ctx: GraphqlContextRef, number: Node): RespResult =
   try:
     ok(headerNode(ctx, getBlockHeader(ctx.chainDB, toBlockNumber(number))))
@@ -151,9 +223,11 @@ proc getLatestBlock(ctx: GraphqlContextRef): RespResult =
   except CatchableError as e:
     err("can't get latest block: " & e.msg)
 
-proc getTxCount(ctx: GraphqlContextRef, txRoot: Hash256): RespResult =
+proc getTxCount(ctx: GraphqlContextRef, blk: BlockData): RespResult =
   try:
-    ok(resp(getTransactionCount(ctx.chainDB, txRoot)))
+    if bpTxs in blk.loaded:
+      return ok(resp(blk.txs.len))
+    ok(resp(getTransactionCount(ctx.chainDB, blk.header.txRoot)))
   except CatchableError as e:
     err("can't get txcount: " & e.msg)
   except Exception as em:
@@ -204,92 +278,69 @@ proc resp(hash: Hash256): RespResult =
 proc resp(data: openArray[byte]): RespResult =
   ok(resp("0x" & data.toHex))
 
-proc getTotalDifficulty(ctx: GraphqlContextRef, blockHash: Hash256): RespResult =
+proc getTotalDifficulty(ctx: GraphqlContextRef, blk: BlockData): RespResult =
   try:
-    bigIntNode(getScore(ctx.chainDB, blockHash))
+    ctx.loadScore(blk)
+    bigIntNode(blk.score)
   except CatchableError as e:
     err("can't get total difficulty: " & e.msg)
 
-proc getOmmerCount(ctx: GraphqlContextRef, ommersHash: Hash256): RespResult =
+proc getOmmerCount(ctx: GraphqlContextRef, blk: BlockData): RespResult =
   try:
-    ok(resp(getUnclesCount(ctx.chainDB, ommersHash)))
+    if bpUncles in blk.loaded:
+      return ok(resp(blk.uncles.len))
+    ok(resp(getUnclesCount(ctx.chainDB, blk.header.ommersHash)))
   except CatchableError as e:
     err("can't get ommers count: " & e.msg)
   except Exception as em:
     err("can't get ommers count: " & em.msg)
 
-proc getOmmers(ctx: GraphqlContextRef, ommersHash: Hash256): RespResult =
+proc getOmmers(ctx: GraphqlContextRef, blk: BlockData): RespResult =
   try:
-    let uncles = getUncles(ctx.chainDB, ommersHash)
+    ctx.loadUncles(blk)
     when false:
       # EIP 1767 says no ommers == null
       # but hive test case want empty array []
-      if uncles.len == 0:
+      if blk.uncles.len == 0:
         return ok(respNull())
     var list = respList()
-    for n in uncles:
+    for n in blk.uncles:
       list.add headerNode(ctx, n)
     ok(list)
   except CatchableError as e:
     err("can't get ommers: " & e.msg)
 
-proc getOmmerAt(ctx: GraphqlContextRef, ommersHash: Hash256, index: int): RespResult =
+proc getOmmerAt(ctx: GraphqlContextRef, blk: BlockData, index: int): RespResult =
   try:
-    let uncles = getUncles(ctx.chainDB, ommersHash)
-    if uncles.len == 0:
+    ctx.loadUncles(blk)
+    if blk.uncles.len == 0:
       return ok(respNull())
-    if index < 0 or index >= uncles.len:
+    if index < 0 or index >= blk.uncles.len:
       return ok(respNull())
-    ok(headerNode(ctx, uncles[index]))
+    ok(headerNode(ctx, blk.uncles[index]))
   except CatchableError as e:
     err("can't get ommer: " & e.msg)
 
-proc getTxs(ctx: GraphqlContextRef, header: BlockHeader): RespResult =
+proc getTxs(ctx: GraphqlContextRef, blk: BlockData): RespResult =
   try:
-    let txCount = getTransactionCount(ctx.chainDB, header.txRoot)
-    if txCount == 0:
+    ctx.loadTxs(blk)
+    if blk.txs.len == 0:
       return ok(respNull())
     var list = respList()
-    var index = 0
-    for n in getBlockTransactionData(ctx.chainDB, header.txRoot):
-      let tx = rlp.decode(n, Transaction)
-      list.add txNode(ctx, tx, index, header.blockNumber)
-      inc index
-
-    index = 0
-    var prevUsed = 0.GasInt
-    for r in getReceipts(ctx.chainDB, header.receiptRoot):
-      let tx = TxNode(list.sons[index])
-      tx.receipt = r
-      tx.gasUsed = r.cumulativeGasUsed - prevUsed
-      prevUsed = r.cumulativeGasUsed
-      inc index
-
+    for index in 0 ..< blk.txs.len:
+      list.add ctx.txNodeAt(blk, index)
     ok(list)
   except CatchableError as e:
     err("can't get transactions: " & e.msg)
   except Exception as em:
     err("can't get transactions: " & em.msg)
 
-proc getTxAt(ctx: GraphqlContextRef, header: BlockHeader, index: int): RespResult =
+proc getTxAt(ctx: GraphqlContextRef, blk: BlockData, index: int): RespResult =
   try:
-    var tx: Transaction
-    if getTransaction(ctx.chainDB, header.txRoot, index, tx):
-      let txn = txNode(ctx, tx, index, header.blockNumber)
-
-      var i = 0
-      var prevUsed = 0.GasInt
-      for r in getReceipts(ctx.chainDB, header.receiptRoot):
-        if i == index:
-          let tx = TxNode(txn)
-          tx.receipt = r
-          tx.gasUsed = r.cumulativeGasUsed - prevUsed
-        prevUsed = r.cumulativeGasUsed
-        inc i
-
-      ok(txn)
-    else:
-      ok(respNull())
+    ctx.loadTxs(blk)
+    if index < 0 or index >= blk.txs.len:
+      return ok(respNull())
+    ok(ctx.txNodeAt(blk, index))
   except CatchableError as e:
     err("can't get transaction by index '$1': $2" % [$index, e.msg])
   except Exception as em:
@@ -299,20 +350,20 @@ proc getTxByHash(ctx: GraphqlContextRef, hash: Hash256): RespResult =
   try:
     let (blockNumber, index) = getTransactionKey(ctx.chainDB, hash)
     let header = getBlockHeader(ctx.chainDB, blockNumber)
-    getTxAt(ctx, header, index)
+    getTxAt(ctx, BlockData(header: header), index)
   except CatchableError as e:
     err("can't get transaction by hash '$1': $2" % [hash.data.toHex, e.msg])
   except Exception as em:
     err("can't get transaction by hash '$1': $2" % [hash.data.toHex, em.msg])
 
-proc accountNode(ctx: GraphqlContextRef, header: BlockHeader, address: EthAddress): RespResult =
-  let db = getAccountDb(ctx.chainDB, header)
+proc accountNode(ctx: GraphqlContextRef, blk: BlockData, address: EthAddress): RespResult =
+  let db = ctx.accountDb(blk)
   when false:
     # EIP 1767 unclear about non existent account
     # but hive test case demand something
     if not db.accountExists(address):
       return ok(respNull())
-  let acc = db.getAccount(address)
+  let acc = ctx.getAccount(blk, address)
   ok(accountNode(ctx, acc, address, db))
 
 proc parseU64(node: Node): uint64 =
@@ -514,11 +565,7 @@ proc logAccount(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma
   let ctx = GraphqlContextRef(ud)
   let log = LogNode(parent)
 
-  let hres = ctx.getBlockByNumber(log.tx.blockNumber)
-  if hres.isErr:
-    return hres
-  let h = HeaderNode(hres.get())
-  ctx.accountNode(h.header, log.log.address)
+  ctx.accountNode(log.tx.blk, log.log.address)
 
 proc logTopics(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -570,11 +617,7 @@ proc txFrom(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   var sender: EthAddress
   if not getSender(tx.tx, sender):
     return ok(respNull())
-  let hres = ctx.getBlockByNumber(tx.blockNumber)
-  if hres.isErr:
-    return hres
-  let h = HeaderNode(hres.get())
-  ctx.accountNode(h.header, sender)
+  ctx.accountNode(tx.blk, sender)
 
 proc txTo(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   # TODO: with block param
@@ -582,11 +625,7 @@ proc txTo(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let tx = TxNode(parent)
   if tx.tx.contractCreation:
     return ok(respNull())
-  let hres = ctx.getBlockByNumber(tx.blockNumber)
-  if hres.isErr:
-    return hres
-  let h = HeaderNode(hres.get())
-  ctx.accountNode(h.header, tx.tx.to.get())
+  ctx.accountNode(tx.blk, tx.tx.to.get())
 
 proc txValue(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -611,7 +650,7 @@ proc txInputData(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragm
 proc txBlock(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let tx = TxNode(parent)
-  ctx.getBlockByNumber(tx.blockNumber)
+  ok(ctx.headerNode(tx.blk))
 
 proc txStatus(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -641,13 +680,8 @@ proc txCreatedContract(ud: RootRef, params: Args, parent: Node): RespResult {.ap
   if not tx.tx.contractCreation:
     return ok(respNull())
 
-  let hres = getBlockByNumber(ctx, tx.blockNumber)
-  if hres.isErr:
-    return hres
-  let h = HeaderNode(hres.get())
-  let db = getAccountDb(ctx.chainDB, h.header)
   let contractAddress = generateAddress(sender, tx.tx.nonce)
-  ctx.accountNode(h.header, contractAddress)
+  ctx.accountNode(tx.blk, contractAddress)
 
 proc txLogs(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -756,7 +790,7 @@ proc blockTransactionsRoot(ud: RootRef, params: Args, parent: Node): RespResult
 proc blockTransactionCount(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
-  ctx.getTxCount(h.header.txRoot)
+  ctx.getTxCount(h.blk)
 
 proc blockStateRoot(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -771,7 +805,7 @@ proc blockReceiptsRoot(ud: RootRef, params: Args, parent: Node): RespResult {.ap
 proc blockMiner(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
-  ctx.accountNode(h.header, h.header.coinbase)
+  ctx.accountNode(h.blk, h.header.coinbase)
 
 proc blockExtraData(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -811,24 +845,23 @@ proc blockDifficulty(ud: RootRef, params: Args, parent: Node): RespResult {.apiP
 proc blockTotalDifficulty(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
-  let hash = blockHash(h.header)
-  getTotalDifficulty(ctx, hash)
+  getTotalDifficulty(ctx, h.blk)
 
 proc blockOmmerCount(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
-  getOmmerCount(ctx, h.header.ommersHash)
+  getOmmerCount(ctx, h.blk)
 
 proc blockOmmers(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
-  getOmmers(ctx, h.header.ommersHash)
+  getOmmers(ctx, h.blk)
 
 proc blockOmmerAt(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
   let index = parseU64(params[0].val)
-  getOmmerAt(ctx, h.header.ommersHash, index.int)
+  getOmmerAt(ctx, h.blk, index.int)
 
 proc blockOmmerHash(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -838,13 +871,13 @@ proc blockOmmerHash(ud: RootRef, params: Args, parent: Node): RespResult {.apiPr
 proc blockTransactions(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
-  getTxs(ctx, h.header)
+  getTxs(ctx, h.blk)
 
 proc blockTransactionAt(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
   let index = parseU64(params[0].val)
-  getTxAt(ctx, h.header, index.int)
+  getTxAt(ctx, h.blk, index.int)
 
 proc blockLogs(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -855,7 +888,7 @@ proc blockAccount(ud: RootRef, params: Args, parent: Node): RespResult {.apiPrag
   let ctx = GraphqlContextRef(ud)
   let h = HeaderNode(parent)
   let address = hexToByteArray[20](params[0].val.stringVal)
-  ctx.accountNode(h.header, address)
+  ctx.accountNode(h.blk, address)
 
 proc toCallData(n: Node): (RpcCallData, bool) =
   # phew, probably need to use macro here :)
@@ -1043,7 +1076,7 @@ proc queryAccount(ud: RootRef, params: Args, parent: Node): RespResult {.apiPrag
   if hres.isErr:
     return hres
   let h = HeaderNode(hres.get())
-  accountNode(ctx, h.header, address)
+  accountNode(ctx, h.blk, address)
 
 proc queryBlock(ud: RootRef, params: Args, parent: Node): RespResult {.apiPragma.} =
   let ctx = GraphqlContextRef(ud)
@@ -12,12 +12,15 @@ import
 
 import
   os, strutils, net, options,
-  eth/keys, db/[storage_types, db_chain, select_backend],
+  eth/keys,
+  db/[storage_types, db_chain, select_backend, state_snapshot, state_pruner],
   eth/common as eth_common, eth/p2p as eth_p2p,
   chronos, json_rpc/rpcserver, chronicles,
   eth/p2p/rlpx_protocols/[eth_protocol, les_protocol],
   eth/p2p/blockchain_sync, eth/net/nat, eth/p2p/peer_pool,
-  config, genesis, rpc/[common, p2p, debug, key_storage], p2p/chain,
+  config, genesis, rpc/[common, p2p, debug, key_storage, call_pool],
+  p2p/chain,
+  p2p/validate/epoch_hash_cache,
   eth/trie/db, metrics, metrics/[chronos_httpserver, chronicles_support],
   graphql/ethapi, utils, ./conf_utils
 
@@ -38,6 +41,7 @@ type
     ethNode*: EthereumNode
     state*: NimbusState
     graphqlServer*: GraphqlHttpServerRef
+    callPool*: CallPool
 
 proc start(nimbus: NimbusNode) =
   var conf = getConfiguration()
@@ -49,20 +53,36 @@ proc start(nimbus: NimbusNode) =
     discard defaultChroniclesStream.output.open(conf.debug.logFile, fmAppend)
 
   createDir(conf.dataDir)
-  let trieDB = trieDB newChainDb(conf.dataDir)
+  let backend = newChainDb(conf.dataDir, conf.db)
+  let trieDB = trieDB backend
   var chainDB = newBaseChainDB(trieDB,
-    conf.prune == PruneMode.Full,
+    conf.pruneTrie,
     conf.net.networkId
     )
+  chainDB.backend = backend
   chainDB.populateProgress()
 
   if canonicalHeadHashKey().toOpenArray notin trieDB:
     initializeEmptyDb(chainDb)
     doAssert(canonicalHeadHashKey().toOpenArray in trieDB)
 
+  if conf.snapshot:
+    let stateRoot = chainDB.getCanonicalHead().stateRoot
+    var snap = StateSnapshot.init(trieDB)
+    if not snap.syncTo(stateRoot):
+      info "Rebuilding flat state snapshot", stateRoot
+      discard StateSnapshot.rebuild(trieDB, stateRoot)
+    chainDB.stateSnapshot = true
+
   if conf.importFile.len > 0:
+    # Every batch is atomic and the import can be repeated, so the write
+    # ahead log is not needed. The database is flushed before quitting.
+    backend.setBatchOptions(disableWAL = true)
+    # PoW seals are verified by the decoding workers
+    let ok = importRlpBlock(conf.importFile, chainDB, checkSeal = true)
+    backend.flush()
     # success or not, we quit after importing blocks
-    if not importRlpBlock(conf.importFile, chainDB):
+    if not ok:
       quit(QuitFailure)
     else:
       quit(QuitSuccess)
@@ -118,7 +138,30 @@ proc start(nimbus: NimbusNode) =
   if ProtocolFlags.Les in conf.net.protocols:
     nimbus.ethNode.addCapability les
 
-  nimbus.ethNode.chain = newChain(chainDB)
+  let chain = newChain(chainDB, extraValidation = conf.ethashDag)
+  if conf.ethashDag:
+    chain.cacheByEpoch.enableFullDag(conf.dataDir / "ethash")
+  chain.txConflictStats = conf.txConflictStats
+  nimbus.ethNode.chain = chain
+
+  if conf.prune == PruneMode.Full and 0 < conf.stateHistory:
+    if trieDB.isInitialised or chainDB.currentBlock == 0.toBlockNumber:
+      let pruner = newStatePruner(trieDB, conf.stateHistory.uint64)
+      chain.pruner = pruner
+      # A few journal entries per tick, between block imports
+      var pruneStates: proc(udata: pointer) {.gcsafe, raises: [Defect].}
+      pruneStates = proc(udata: pointer) =
+        try:
+          for _ in 0 ..< 16:
+            if not pruner.pruneStep(chainDB.currentBlock):
+              break
+        except CatchableError as e:
+          error "State pruning failed", msg = e.msg
+          return
+        discard setTimer(Moment.fromNow(100.milliseconds), pruneStates)
+      discard setTimer(Moment.fromNow(100.milliseconds), pruneStates)
+    else:
+      warn "State pruning disabled, the database was not pruned from genesis"
 
   ## Creating RPC Server
   if RpcFlags.Enabled in conf.rpc.flags:
@@ -127,9 +170,14 @@ proc start(nimbus: NimbusNode) =
 
   # Enable RPC APIs based on RPC flags and protocol flags
   if RpcFlags.Eth in conf.rpc.flags and ProtocolFlags.Eth in conf.net.protocols:
-    setupEthRpc(nimbus.ethNode, chainDB, nimbus.rpcServer)
+    # `nil` unless enabled and supported by the database backend
+    nimbus.callPool = newCallPool(chainDB, conf.rpc.callWorkers)
+    setupEthRpc(nimbus.ethNode, chainDB, nimbus.rpcServer, nimbus.callPool)
   if RpcFlags.Debug in conf.rpc.flags:
-    setupDebugRpc(chainDB, nimbus.rpcServer)
+    let traceDir =
+      if conf.rpc.traceDir.len > 0: conf.rpc.traceDir
+      else: conf.dataDir / "traces"
+    setupDebugRpc(chainDB, nimbus.rpcServer, traceDir, conf.rpc.traceFiles)
 
   ## Starting servers
   if RpcFlags.Enabled in conf.rpc.flags:
@@ -177,6 +225,7 @@ proc stop*(nimbus: NimbusNode) {.async, gcsafe.} =
   var conf = getConfiguration()
   if RpcFlags.Enabled in conf.rpc.flags:
     nimbus.rpcServer.stop()
+  nimbus.callPool.close()
   if conf.graphql.enabled:
     await nimbus.graphqlServer.stop()
 
@@ -10,7 +10,7 @@
 
 import
   ../../chain_config,
-  ../../db/db_chain,
+  ../../db/[db_chain, state_cache, state_pruner],
   ../../genesis,
   ../../utils,
   ../clique,
@@ -48,6 +48,19 @@ type
     cacheByEpoch: EpochHashCache ##\
       ## Objects cache to speed up lookup in validation functions.
 
+    stateCache: StateCacheRef ##\
+      ## Accounts, storage and code cache shared by the `AccountsCache`
+      ## descriptors of consecutive blocks in `persistBlocks()`.
+
+    txConflictStats: bool ##\
+      ## Diagnostics: collect the state accessed by each transaction in
+      ## `persistBlocks()` and export how many would conflict under
+      ## optimistic parallel execution, see `executor/tx_conflicts`.
+
+    pruner: StatePruner ##\
+      ## Reference counts the state of each block in `persistBlocks()`, or
+      ## `nil` for keeping all states.
+
     poa: Clique ##\
       ## For non-PoA networks (when `db.config.poaEngine` is `false`),
       ## this descriptor is ignored.
@@ -138,6 +151,9 @@ proc newChain*(db: BaseChainDB; poa: Clique; extraValidation = false):
   # unless `extraValidation` is set `true`.
   result.cacheByEpoch.initEpochHashCache
 
+  # The state cache lives across `persistBlocks()` batches.
+  result.stateCache = newStateCache()
+
 
 proc newChain*(db: BaseChainDB, extraValidation = false):
                Chain {.gcsafe, raises: [Defect,CatchableError].} =
@@ -175,6 +191,10 @@ proc cacheByEpoch*(c: Chain): var EpochHashCache {.inline.} =
   ## Getter
   c.cacheByEpoch
 
+proc stateCache*(c: Chain): StateCacheRef {.inline.} =
+  ## Getter
+  c.stateCache
+
 proc db*(c: Chain): auto {.inline.} =
   ## Getter
   c.db
@@ -187,6 +207,26 @@ proc forkIds*(c: Chain): auto {.inline.} =
   ## Getter
   c.forkIds
 
+proc txConflictStats*(c: Chain): bool {.inline.} =
+  ## Getter
+  c.txConflictStats
+
+proc pruner*(c: Chain): StatePruner {.inline.} =
+  ## Getter
+  c.pruner
+
+# ------------------------------------------------------------------------------
+# Public `Chain` setters
+# ------------------------------------------------------------------------------
+
+proc `txConflictStats=`*(c: Chain; enable: bool) {.inline.} =
+  ## Setter, enable transaction conflict statistics
+  c.txConflictStats = enable
+
+proc `pruner=`*(c: Chain; pruner: StatePruner) {.inline.} =
+  ## Setter, keep only the recent states (see `db/state_pruner`)
+  c.pruner = pruner
+
 # ------------------------------------------------------------------------------
 # End
 # ------------------------------------------------------------------------------
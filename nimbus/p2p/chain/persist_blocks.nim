@@ -9,9 +9,11 @@
 # according to those terms.
 
 import
-  ../../db/db_chain,
+  ../../db/[accounts_cache, bloombits, db_chain, state_pruner, state_snapshot],
   ../../utils,
+  ../../utils/[evm_profiler, import_timer],
   ../../vm_state,
+  ../../vm_types,
   ../clique,
   ../executor,
   ../validate,
@@ -46,21 +48,61 @@ proc persistBlocksImpl(c: Chain; headers: openarray[BlockHeader];
   let transaction = c.db.db.beginTransaction()
   defer: transaction.dispose()
 
+  # Headers and canonical hashes cached by `c.db` since the start of the
+  # transaction must go if it is rolled back
+  var committed = false
+  defer:
+    if not committed:
+      c.db.resetHeaderCache()
+
+  # Recover tx senders on the worker threads while executing the blocks
+  var pipeline: SenderPipeline
+  pipeline.initSenderPipeline(bodies)
+  defer: pipeline.dispose()
+
   trace "Persisting blocks",
     fromBlock = headers[0].blockNumber,
     toBlock = headers[^1].blockNumber
 
   for i in 0 ..< headers.len:
+    let blockStart = getMonoTime()
+    timePhase(ipSenders):
+      let recovered = pipeline.senders(bodies, i)
     let
       (header, body) = (headers[i], bodies[i])
       parentHeader = c.db.getBlockHeader(header.parentHash)
-      vmState = newBaseVMState(parentHeader.stateRoot, header, c.db)
 
+    if c.db.stateSnapshot:
+      # after a reorg, move the flat snapshot over to the new branch
+      var snap = StateSnapshot.init(c.db.db)
+      if not snap.syncTo(parentHeader.stateRoot):
+        debug "Flat state snapshot not available for block",
+          blockNumber = header.blockNumber,
+          snapshotRoot = snap.root
+
+    let vmState = newBaseVMState(parentHeader.stateRoot, header, c.db)
+
+    # Hot accounts and storage of the previous blocks are kept in the
+    # shared cache (which is flushed if `parentHeader.stateRoot` does not
+    # match, e.g. after a failed block.)
+    vmState.accountDb.attachStateCache(c.stateCache)
+
+    # Update the tries once per block rather than once per transaction
+    vmState.accountDb.deferredCommit = true
+
+    if c.txConflictStats:
+      vmState.flags.incl RecordTxAccess
+
+    let
       # The following processing function call will update the PoA state which
       # is passed as second function argument. The PoA state is ignored for
       # non-PoA networks (in which case `vmState.processBlock(header,body)`
       # would also be correct but not vice versa.)
-      validationResult = vmState.processBlock(c.clique, header, body)
+      #
+      # Upon failed sender recovery, the `senders` list is empty and the
+      # block processor will locate and report the bad transaction.
+      validationResult = vmState.processBlock(
+        c.clique, header, body, recovered.senders)
 
     when not defined(release):
       if validationResult == ValidationResult.Error and
@@ -75,22 +117,34 @@ proc persistBlocksImpl(c: Chain; headers: openarray[BlockHeader];
       let res = c.db.validateHeaderAndKinship(
         header,
         body,
-        checkSealOK = false, # TODO: how to checkseal from here
+        # PoW seals are checked only with the full ethash dataset enabled,
+        # the light verification is too slow for bulk import
+        checkSealOK = c.cacheByEpoch.fullDagEnabled and
+                      not c.db.config.poaEngine,
         c.cacheByEpoch
       )
       if res.isErr:
         debug "block validation error", msg = res.error
         return ValidationResult.Error
 
-    discard c.db.persistHeaderToDb(header)
-    discard c.db.persistTransactions(header.blockNumber, body.transactions)
-    discard c.db.persistReceipts(vmState.receipts)
+    if not c.pruner.isNil:
+      c.pruner.pinState(header.blockNumber, header.stateRoot)
+
+    timePhase(ipDbWrite):
+      discard c.db.persistHeaderToDb(header)
+      discard c.db.persistTransactions(header.blockNumber, body.transactions)
+      discard c.db.persistReceipts(vmState.receipts)
+      c.db.updateBloomBits(header, vmState.receipts)
 
     # update currentBlock *after* we persist it
     # so the rpc return consistent result
     # between eth_blockNumber and eth_syncing
     c.db.currentBlock = header.blockNumber
 
+    # export op code/precompile counters, no-op unless `-d:evm_profiler`
+    flushProfiler()
+    addBlockTime(blockStart)
+
   if c.db.config.poaEngine:
     if c.clique.cliqueSnapshot(headers[^1]).isErr:
       debug "PoA signer snapshot failed"
@@ -99,7 +153,14 @@ proc persistBlocksImpl(c: Chain; headers: openarray[BlockHeader];
       #echo &"*** {list.len} trusted signer(s): ", list.join(" ")
       discard
 
-  transaction.commit()
+  # Flush trie nodes, headers, transactions and receipts of the whole block
+  # range as a single backend write batch
+  c.db.beginWriteBatch()
+  defer: c.db.disposeWriteBatch()
+  timePhase(ipDbWrite):
+    transaction.commit()
+    c.db.commitWriteBatch()
+  committed = true
 
 # ------------------------------------------------------------------------------
 # Public `AbstractChainDB` overload method
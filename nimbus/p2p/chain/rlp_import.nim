@@ -0,0 +1,357 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## RLP Block Import Pipeline
+## =========================
+##
+## Streaming import of an exported chain, a file of consecutive RLP encoded
+## `[header, transactions, uncles]` blocks. The main thread reads the file
+## block by block and groups the blocks into batches. Each batch is decoded
+## by a `threadpool` worker which also checks the PoW seals if asked to. Up
+## to `lookAhead` batches are in flight while the main thread persists the
+## decoded batches in file order with `persistBlocks()`, so the memory use
+## does not depend on the file size.
+##
+## Batches do not cross an epoch boundary when seals are checked, so each
+## worker needs the epoch cache of one epoch only. The caches are owned by
+## the main thread and shared with the workers until their batches are done.
+
+import
+  std/[cpuinfo, deques, threadpool],
+  ../../db/db_chain,
+  ../validate,
+  ./chain_desc,
+  ./persist_blocks,
+  chronicles,
+  eth/[common, rlp],
+  ethash
+
+type
+  # trick the rlp decoder
+  # so we can separate the body and header
+  EthHeader = object
+    header: BlockHeader
+
+  EpochCacheRef = ref object
+    epoch: uint64
+    digest: EpochHashDigest
+
+  DecodedBatch = object
+    headers: seq[BlockHeader]
+    bodies: seq[BlockBody]
+    badSeals: seq[int]        ## Indices of the blocks failing the seal check
+    rlpError: string          ## Decoding stopped after `headers.len` blocks
+
+  Batch = ref object
+    raw: seq[Blob]            ## Encoded blocks, in file order
+    offset: int64             ## File offset of the first block
+    cache: EpochCacheRef      ## For the seal checks, `nil` if not needed
+    decoded: FlowVar[DecodedBatch]
+
+  RlpImport = object
+    chain: Chain
+    file: File
+    path: string
+    offset: int64             ## File offset after the last block read
+    eof: bool
+    readError: string         ## Reason if reading stopped before the end
+    next: Blob                ## Block read ahead, starting the next batch
+    head: BlockNumber         ## Blocks up to the canonical head are skipped
+    checkSeal: bool
+    cache: EpochCacheRef      ## Cache for the latest epoch seen
+    inFlight: Deque[Batch]
+    errorCount: int
+
+const
+  batchBlocks = 256
+    ## Maximal number of blocks per batch
+
+  batchBytes = 8 * 1024 * 1024
+    ## Batches are closed after this many bytes of encoded blocks
+
+  maxBlockBytes = 64 * 1024 * 1024
+    ## Larger items are considered corrupt
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private worker functions
+# ------------------------------------------------------------------------------
+
+proc decodeBatch(raw: ptr seq[Blob]; cache: ptr EpochHashDigest):
+                 DecodedBatch {.gcsafe, raises: [Defect].} =
+  ## Worker task, the arguments are owned by the main thread which waits for
+  ## the result before releasing them.
+  for n in 0 ..< raw[].len:
+    try:
+      var rlp = rlpFromBytes(raw[][n])
+      let
+        header = rlp.read(EthHeader).header
+        body = rlp.readRecordType(BlockBody, false)
+      if not cache.isNil and header.validateSealLight(cache[]).isErr:
+        result.badSeals.add n
+      result.headers.add header
+      result.bodies.add body
+    except CatchableError as e:
+      result.rlpError = e.msg
+      return
+
+# ------------------------------------------------------------------------------
+# Private reader functions
+# ------------------------------------------------------------------------------
+
+proc readBlock(imp: var RlpImport; data: var Blob): bool
+    {.raises: [Defect,IOError,RlpError].} =
+  ## Read the next top level RLP item, `false` at the end of the file
+  var prefix: array[9, byte]
+  if imp.file.readBuffer(prefix[0].addr, 1) != 1:
+    return false
+
+  var
+    prefixLen = 1
+    itemLen = 0
+    lenLen = 0
+  case prefix[0]
+  of 0x00'u8 .. 0x7f'u8: discard
+  of 0x80'u8 .. 0xb7'u8: itemLen = prefix[0].int - 0x80
+  of 0xb8'u8 .. 0xbf'u8: lenLen = prefix[0].int - 0xb7
+  of 0xc0'u8 .. 0xf7'u8: itemLen = prefix[0].int - 0xc0
+  of 0xf8'u8 .. 0xff'u8: lenLen = prefix[0].int - 0xf7
+
+  if 0 < lenLen:
+    if 4 < lenLen or
+       imp.file.readBuffer(prefix[1].addr, lenLen) != lenLen:
+      raise newException(MalformedRlpError,
+        "bad item length at offset " & $imp.offset)
+    for n in 1 .. lenLen:
+      itemLen = (itemLen shl 8) or prefix[n].int
+    prefixLen += lenLen
+  if maxBlockBytes < itemLen:
+    raise newException(MalformedRlpError,
+      "item too large at offset " & $imp.offset)
+
+  data.setLen(prefixLen + itemLen)
+  for n in 0 ..< prefixLen:
+    data[n] = prefix[n]
+  if 0 < itemLen and
+     imp.file.readBuffer(data[prefixLen].addr, itemLen) != itemLen:
+    raise newException(MalformedRlpError,
+      "truncated block at offset " & $imp.offset)
+  imp.offset += data.len
+  true
+
+proc blockNumber(data: Blob): BlockNumber
+    {.raises: [Defect,RlpError].} =
+  ## Peek at the header without decoding the block
+  var field = rlpFromBytes(data).listElem(0).listElem(8)
+  field.read(BlockNumber)
+
+proc epochCache(imp: var RlpImport; epoch: uint64): EpochCacheRef
+    {.raises: [Defect,CatchableError].} =
+  if imp.cache.isNil or imp.cache.epoch != epoch:
+    # A copy, the chain cache is not to be shared with the workers
+    imp.cache = EpochCacheRef(
+      epoch: epoch,
+      digest: imp.chain.cacheByEpoch.getEpochHash(epoch * EPOCH_LENGTH))
+  imp.cache
+
+proc readBatch(imp: var RlpImport): Batch
+    {.raises: [Defect,CatchableError].} =
+  ## Next batch of blocks beyond the canonical head, `nil` at the end. A read
+  ## error ends the file after the blocks read so far.
+  var
+    bytes = 0
+    epoch = 0'u64
+  while not imp.eof:
+    var number: BlockNumber
+    try:
+      if imp.next.len == 0:
+        var data: Blob
+        if not imp.readBlock(data):
+          imp.eof = true
+          break
+        imp.next = move(data)
+      number = imp.next.blockNumber
+    except IOError as e:
+      imp.readError = e.msg
+      imp.eof = true
+      break
+    except RlpError as e:
+      imp.readError = e.msg
+      imp.eof = true
+      break
+
+    let blockEpoch = number.truncate(uint64) div EPOCH_LENGTH
+    if number <= imp.head:
+      imp.next.setLen(0)
+      continue
+
+    if result.isNil:
+      result = Batch(offset: imp.offset - imp.next.len)
+      epoch = blockEpoch
+      if imp.checkSeal:
+        result.cache = imp.epochCache(epoch)
+    elif batchBlocks <= result.raw.len or batchBytes <= bytes or
+         (imp.checkSeal and blockEpoch != epoch):
+      break
+
+    bytes += imp.next.len
+    result.raw.add move(imp.next)
+    imp.next = @[]
+
+proc dispatch(imp: var RlpImport; lookAhead: int)
+    {.raises: [Defect,CatchableError].} =
+  ## Keep `lookAhead` batches in flight
+  while imp.inFlight.len < lookAhead:
+    let batch = imp.readBatch
+    if batch.isNil:
+      return
+    var cache: ptr EpochHashDigest
+    if not batch.cache.isNil:
+      cache = batch.cache.digest.addr
+    try:
+      batch.decoded = spawn decodeBatch(batch.raw.addr, cache)
+    except Exception as e:
+      raise newException(CatchableError, "dispatch(): " & e.msg)
+    imp.inFlight.addLast batch
+
+proc wait(batch: Batch): DecodedBatch {.raises: [Defect,CatchableError].} =
+  ## Each `FlowVar` can be read only once
+  try:
+    result = ^batch.decoded
+    batch.decoded = nil
+  except Exception as e:
+    raise newException(CatchableError, "wait(): " & e.msg)
+
+proc dispose(imp: var RlpImport) =
+  ## Workers must not read released batches
+  while 0 < imp.inFlight.len:
+    let batch = imp.inFlight.popFirst
+    if not batch.decoded.isNil:
+      try:
+        discard batch.wait
+      except CatchableError:
+        discard
+  imp.file.close
+
+# ------------------------------------------------------------------------------
+# Private persist functions
+# ------------------------------------------------------------------------------
+
+proc persist(imp: var RlpImport; headers: openArray[BlockHeader];
+             bodies: openArray[BlockBody]; single = false) =
+  ## Persist a batch in one go, or block by block if that fails so the blocks
+  ## before a bad one are kept.
+  if headers.len == 0:
+    return
+  try:
+    if imp.chain.persistBlocks(headers, bodies) != ValidationResult.Error:
+      return
+  except CatchableError as e:
+    error "import error",
+      fileName = imp.path,
+      msg = e.msg,
+      exception = e.name
+  if single or headers.len == 1:
+    # register one more error and continue
+    imp.errorCount.inc
+    return
+  for n in 0 ..< headers.len:
+    imp.persist([headers[n]], [bodies[n]], single = true)
+
+proc persist(imp: var RlpImport; decoded: DecodedBatch) =
+  ## Persist the runs of blocks between those with bad seals
+  var first = 0
+  for bad in decoded.badSeals:
+    imp.persist(decoded.headers.toOpenArray(first, bad - 1),
+                decoded.bodies.toOpenArray(first, bad - 1))
+    error "seal check failed",
+      fileName = imp.path,
+      blockNumber = decoded.headers[bad].blockNumber
+    imp.errorCount.inc
+    first = bad + 1
+  imp.persist(decoded.headers.toOpenArray(first, decoded.headers.high),
+              decoded.bodies.toOpenArray(first, decoded.bodies.high))
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc importRlpBlocks*(c: Chain; path: string; checkSeal = false;
+                      lookAhead = 0): bool =
+  ## Import the blocks of file `path` beyond the canonical head. If
+  ## `checkSeal` is set, the PoW seals are verified by the decoding workers
+  ## (unless `persistBlocks()` does it already, see `enableFullDag()`.) The
+  ## default `lookAhead` is one batch per processor.
+  ##
+  ## The import stops at the first decoding error and returns `false`,
+  ## otherwise it continues and returns `false` if any block failed.
+  var imp = RlpImport(
+    chain: c,
+    path: path,
+    checkSeal: checkSeal and not c.db.config.poaEngine and
+               not c.cacheByEpoch.fullDagEnabled,
+    inFlight: initDeque[Batch]())
+  let lookAhead =
+    if 0 < lookAhead: lookAhead
+    else: max(2, countProcessors())
+
+  try:
+    imp.head = c.db.getCanonicalHead().blockNumber
+    if not imp.file.open(path):
+      error "failed to import",
+        fileName = path
+      return false
+  except CatchableError as e:
+    error "failed to import",
+      fileName = path,
+      msg = e.msg
+    return false
+  defer: imp.dispose()
+
+  while true:
+    var decoded: DecodedBatch
+    try:
+      imp.dispatch(lookAhead)
+      if imp.inFlight.len == 0:
+        break
+      decoded = imp.inFlight.peekFirst.wait
+    except CatchableError as e:
+      error "import error",
+        fileName = path,
+        msg = e.msg,
+        exception = e.name
+      return false
+
+    let batch = imp.inFlight.popFirst
+    imp.persist(decoded)
+
+    if 0 < decoded.rlpError.len:
+      # terminate if there was a decoding error
+      error "rlp error",
+        fileName = path,
+        offset = batch.offset,
+        blockIndex = decoded.headers.len,
+        msg = decoded.rlpError
+      return false
+
+  if 0 < imp.readError.len:
+    # terminate if the file cannot be read, after the blocks before
+    error "rlp error",
+      fileName = path,
+      offset = imp.offset,
+      msg = imp.readError
+    return false
+
+  return imp.errorCount == 0
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -19,7 +19,7 @@
 ##
 
 import
-  std/[sequtils, strformat],
+  std/[sequtils],
   ../../db/db_chain,
   ../../utils,
   ./clique_cfg,
@@ -113,8 +113,6 @@ proc findSnapshot(d: var LocalSnaps): bool
     if d.c.recents.hasLruSnaps(hash):
       let rc = d.c.recents.getLruSnaps(hash)
       if rc.isOK:
-        # we made sure that this is not a blind entry (currently no reason
-        # why there should be any, though)
         d.value.snaps = rc.value
         # d.say "findSnapshot cached #",number," <", d.value.trail.len
         debug "Found recently cached voting snapshot",
@@ -122,15 +120,18 @@ proc findSnapshot(d: var LocalSnaps): bool
           blockHash = hash
         return true
 
-    # If an on-disk checkpoint snapshot can be found, use that
-    if d.isCheckPoint(number) and
-       d.value.snaps.loadSnapshot(d.c.cfg, hash).isOK:
-      d.say "findSnapshot disked #",number," <",d.value.trail.len
-      trace "Loaded voting snapshot from disk",
-        blockNumber = number,
-        blockHash = hash
-      # clique/clique.go(386): snap = s
-      return true
+    # If an on-disk checkpoint snapshot can be found, use that (it is cached
+    # by the LRU from now on)
+    if d.isCheckPoint(number):
+      let rc = d.c.recents.getLruSnaps(hash)
+      if rc.isOK:
+        d.value.snaps = rc.value
+        d.say "findSnapshot disked #",number," <",d.value.trail.len
+        trace "Loaded voting snapshot from disk",
+          blockNumber = number,
+          blockHash = hash
+        # clique/clique.go(386): snap = s
+        return true
 
     # Note that epoch is a restart and sync point. Eip-225 requires that the
     # epoch header contains the full list of currently authorised signers.
@@ -138,6 +139,7 @@ proc findSnapshot(d: var LocalSnaps): bool
       # clique/clique.go(395): checkpoint := chain.GetHeaderByNumber [..]
       d.value.snaps.initSnapshot(d.c.cfg, header)
       if d.value.snaps.storeSnapshot.isOK:
+        d.c.recents.setLruSnaps(d.value.snaps)
         d.say "findSnapshot <epoch> #",number," <",d.value.trail.len
         info "Stored voting snapshot to disk",
           blockNumber = number,
@@ -190,6 +192,7 @@ proc applyTrail(d: var LocalSnaps; snaps: var Snapshot;
     var rc = snaps.storeSnapshot
     if rc.isErr:
       return err(rc.error)
+    d.c.recents.setLruSnaps(snaps)
 
     d.say "updateSnapshot <disk> chechkpoint #", snaps.blockNumber
     trace "Stored voting snapshot to disk",
@@ -244,11 +247,8 @@ proc updateSnapshot(c: Clique; header: Blockheader;
     return err(snaps.error)
 
   # clique/clique.go(438): c.recents.Add(snap.Hash, snap)
-  if c.recents.setLruSnaps(snaps.value):
-    return ok(snaps.value)
-
-  # someting went seriously wrong -- lol
-  err((errSetLruSnaps, &"block #{snaps.value.blockNumber}"))
+  c.recents.setLruSnaps(snaps.value)
+  ok(snaps.value)
 
 # ------------------------------------------------------------------------------
 # Public functions
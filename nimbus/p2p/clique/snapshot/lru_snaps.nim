@@ -17,7 +17,10 @@
 ## and
 ## `go-ethereum <https://github.com/ethereum/EIPs/blob/master/EIPS/eip-225.md>`_
 ##
-## Caveat: Not supporting RLP serialisation encode()/decode()
+## The LRU is a front cache for the snapshots stored on disk (see
+## `storeSnapshot()`.) A snapshot missing in memory is loaded lazily by
+## block hash from the database, a snapshot that is not on disk either is
+## not cached (so no blind entries push out real ones.)
 ##
 
 import
@@ -36,10 +39,10 @@ type
     array[32, byte]
 
   LruSnapsResult* =
-    Result[Snapshot,void]
+    Result[Snapshot,CliqueError]
 
   LruSnaps* =
-    LruCache[Hash256,SnapsKey,LruSnapsResult,CliqueError]
+    LruCache[Hash256,SnapsKey,Snapshot,CliqueError]
 
 {.push raises: [Defect].}
 
@@ -47,37 +50,43 @@ type
 # Public functions
 # ------------------------------------------------------------------------------
 
-proc initLruSnaps*(rs: var LruSnaps) {.gcsafe,raises: [Defect].} =
+proc initLruSnaps*(rs: var LruSnaps; cfg: CliqueCfg)
+                  {.gcsafe,raises: [Defect].} =
 
   var toKey: LruKey[Hash256,SnapsKey] =
     proc(h: Hash256): SnapsKey =
       h.data
 
-  var toValue: LruValue[Hash256,LruSnapsResult,CliqueError] =
-    proc(h: Hash256): Result[LruSnapsResult,CliqueError] =
-      ## blind value, use `setLruSnaps()` to update
-      ok(err(LruSnapsResult))
+  var toValue: LruValue[Hash256,Snapshot,CliqueError] =
+    proc(h: Hash256): Result[Snapshot,CliqueError] =
+      ## cache miss, try the database
+      var snaps: Snapshot
+      let rc = snaps.loadSnapshot(cfg, h)
+      if rc.isErr:
+        return err(rc.error)
+      ok(snaps)
 
   rs.initCache(toKey, toValue, INMEMORY_SNAPSHOTS)
 
 proc initLruSnaps*(cfg: CliqueCfg): LruSnaps {.gcsafe,raises: [Defect].} =
-  result.initLruSnaps
+  result.initLruSnaps(cfg)
 
 
 proc hasLruSnaps*(rs: var LruSnaps; hash: Hash256): bool {.inline.} =
-  ## Check whether a particular snapshot exists in the cache
+  ## Check whether a particular snapshot exists in the cache (the database
+  ## is not looked up)
   rs.hasKey(hash)
 
-proc setLruSnaps*(rs: var LruSnaps; snaps: var Snapshot): bool
+proc setLruSnaps*(rs: var LruSnaps; snaps: var Snapshot)
                          {.gcsafe, inline, raises: [Defect,CatchableError].} =
   ## Cache/overwite particular snapshot
-  rs.setItem(snaps.blockHash, ok(LruSnapsResult,snaps))
+  rs.putItem(snaps.blockHash, snaps)
 
 proc getLruSnaps*(rs: var LruSnaps; hash: Hash256): LruSnapsResult
                      {.gcsafe, raises: [Defect,CatchableError].} =
-  ## Get snapshot from cache, store/return placeholder if there was no cached
-  ## snapshot. Use `setLruSnaps()` for updating that entry.
-  rs.getItem(hash).value
+  ## Get snapshot from cache, or from the database if it was stored there.
+  ## A snapshot loaded from the database is cached.
+  rs.getItem(hash)
 
 # ------------------------------------------------------------------------------
 # End
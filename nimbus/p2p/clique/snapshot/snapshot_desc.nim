@@ -202,10 +202,11 @@ proc loadSnapshot*(s: var Snapshot; cfg: CliqueCfg;
            hash: Hash256): CliqueOkResult {.gcsafe, raises: [Defect].} =
   ## Load an existing snapshot from the database.
   try:
+    let data = cfg.db.db.get(hash.cliqueSnapshotKey.toOpenArray)
+    if data.len == 0:
+      return err((errSnapshotLoad,"not stored"))
     s.cfg = cfg
-    s.data = s.cfg.db.db
-       .get(hash.cliqueSnapshotKey.toOpenArray)
-       .decode(SnapshotData)
+    s.data = data.decode(SnapshotData)
     s.data.ballot.debug = s.cfg.debug
   except CatchableError as e:
     return err((errSnapshotLoad,e.msg))
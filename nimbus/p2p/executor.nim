@@ -13,12 +13,14 @@ import
   ./executor/[
     executor_helpers,
     process_block,
-    process_transaction]
+    process_transaction,
+    recover_senders]
 
 export
   executor_helpers.createBloom,
   process_block,
-  process_transaction
+  process_transaction,
+  recover_senders
 
 
 #[
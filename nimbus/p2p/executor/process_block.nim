@@ -13,6 +13,7 @@ import
   ../../db/[db_chain, accounts_cache],
   ../../transaction,
   ../../utils,
+  ../../utils/import_timer,
   ../../vm_state,
   ../../vm_types,
   ../clique,
@@ -20,6 +21,7 @@ import
   ./calculate_reward,
   ./executor_helpers,
   ./process_transaction,
+  ./tx_conflicts,
   ./update_poastate,
   chronicles,
   eth/[common, trie/db],
@@ -32,7 +34,8 @@ import
 # ------------------------------------------------------------------------------
 
 proc procBlkPreamble(vmState: BaseVMState; dbTx: DbTransaction;
-                     header: BlockHeader, body: BlockBody): bool
+                     header: BlockHeader, body: BlockBody;
+                     senders: openArray[EthAddress]): bool
                        {.gcsafe, raises: [Defect,CatchableError].} =
   if vmState.chainDB.config.daoForkSupport and
      vmState.chainDB.config.daoForkBlock == header.blockNumber:
@@ -55,15 +58,24 @@ proc procBlkPreamble(vmState: BaseVMState; dbTx: DbTransaction;
         blockHash = header.blockHash
       vmState.receipts = newSeq[Receipt](body.transactions.len)
       vmState.cumulativeGasUsed = 0
-      for txIndex, tx in body.transactions:
-        var sender: EthAddress
-        if tx.getSender(sender):
+      # Pre-recovered senders are used only if there is one for each tx
+      let haveSenders = senders.len == body.transactions.len
+      vmState.txAccess.setLen(0)
+      timePhase(ipEvm):
+        for txIndex, tx in body.transactions:
+          var sender: EthAddress
+          if haveSenders:
+            sender = senders[txIndex]
+          elif not tx.getSender(sender):
+            debug "Could not get sender",
+              txIndex, tx
+            return false
           discard tx.processTransaction(sender, vmState)
-        else:
-          debug "Could not get sender",
-            txIndex, tx
-          return false
-        vmState.receipts[txIndex] = vmState.makeReceipt(tx.txType)
+          vmState.receipts[txIndex] = vmState.makeReceipt(tx.txType)
+      if RecordTxAccess in vmState.flags:
+        # empty before Berlin, see `collectAccess()`
+        let stats = vmState.txAccess.analyseTxConflicts
+        stats.exportTxConflicts(header.blockNumber)
 
   if vmState.cumulativeGasUsed != header.gasUsed:
     debug "gasUsed neq cumulativeGasUsed",
@@ -84,17 +96,18 @@ proc procBlkEpilogue(vmState: BaseVMState; dbTx: DbTransaction;
                      header: BlockHeader, body: BlockBody): bool
                        {.gcsafe, raises: [Defect,RlpError].} =
   # Reward beneficiary
-  vmState.mutateStateDB:
-    if vmState.generateWitness:
-      db.collectWitnessData()
-    db.persist(ClearCache in vmState.flags)
+  timePhase(ipStateRoot):
+    vmState.mutateStateDB:
+      if vmState.generateWitness:
+        db.collectWitnessData()
+      db.persist(ClearCache in vmState.flags)
+    let stateRoot = vmState.accountDb.rootHash
 
-  let stateDb = vmState.accountDb
-  if header.stateRoot != stateDb.rootHash:
+  if header.stateRoot != stateRoot:
     debug "wrong state root in block",
       blockNumber = header.blockNumber,
       expected = header.stateRoot,
-      actual = stateDb.rootHash,
+      actual = stateRoot,
       arrivedFrom = vmState.chainDB.getCanonicalHead().stateRoot
     return false
 
@@ -131,7 +144,7 @@ proc processBlock*(vmState: BaseVMState;
   var dbTx = vmState.chainDB.db.beginTransaction()
   defer: dbTx.dispose()
 
-  if not vmState.procBlkPreamble(dbTx, header, body):
+  if not vmState.procBlkPreamble(dbTx, header, body, []):
     return ValidationResult.Error
 
   vmState.calculateReward(header, body)
@@ -148,10 +161,14 @@ proc processBlock*(vmState: BaseVMState;
 
 
 proc processBlock*(vmState: BaseVMState; poa: Clique;
-                   header: BlockHeader, body: BlockBody): ValidationResult
+                   header: BlockHeader, body: BlockBody;
+                   senders: openArray[EthAddress]): ValidationResult
                      {.gcsafe, raises: [Defect,CatchableError].} =
   ## Generalised function to processes `(header,body)` pair for any network,
-  ## regardless of PoA or not
+  ## regardless of PoA or not. The argument `senders` holds the recovered
+  ## sender addresses for `body.transactions` (e.g. from a `SenderPipeline`.)
+  ## They are used if there is exactly one entry per transaction, otherwise
+  ## the argument is ignored and the senders are recovered on the fly.
 
   # Process PoA state transition first so there is no need to re-wind on error.
   if vmState.chainDB.config.poaEngine and
@@ -162,7 +179,7 @@ proc processBlock*(vmState: BaseVMState; poa: Clique;
   var dbTx = vmState.chainDB.db.beginTransaction()
   defer: dbTx.dispose()
 
-  if not vmState.procBlkPreamble(dbTx, header, body):
+  if not vmState.procBlkPreamble(dbTx, header, body, senders):
     return ValidationResult.Error
 
   if not vmState.chainDB.config.poaEngine:
@@ -173,6 +190,14 @@ proc processBlock*(vmState: BaseVMState; poa: Clique;
 
   dbTx.commit(applyDeletes = false)
 
+
+proc processBlock*(vmState: BaseVMState; poa: Clique;
+                   header: BlockHeader, body: BlockBody): ValidationResult
+                     {.gcsafe, raises: [Defect,CatchableError].} =
+  ## Generalised function to processes `(header,body)` pair for any network,
+  ## regardless of PoA or not
+  vmState.processBlock(poa, header, body, [])
+
 # ------------------------------------------------------------------------------
 # End
 # ------------------------------------------------------------------------------
@@ -80,6 +80,9 @@ proc processTransactionImpl(tx: Transaction, sender: EthAddress,
 
   if vmState.generateWitness:
     vmState.accountDb.collectWitnessData()
+  if RecordTxAccess in vmState.flags and fork >= FkBerlin:
+    vmState.txAccess.add newAccessRecorder()
+    vmState.accountDb.collectAccess(vmState.txAccess[^1], miner)
   vmState.accountDb.persist(clearCache = false)
 
 # ------------------------------------------------------------------------------
@@ -0,0 +1,131 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Sender Recovery Pipeline
+## ========================
+##
+## ECDSA public key recovery for the transactions of a batch of block bodies,
+## run on the `threadpool` workers ahead of block execution. The consumer
+## (typically `persistBlocks()`) asks for the senders of block `n` just
+## before executing it while the blocks after `n` are recovered in the
+## background.
+
+import
+  std/[threadpool],
+  ../../transaction,
+  eth/common
+
+type
+  SenderRecovery* = object
+    ok*: bool         ## `true` if all senders could be recovered
+    badTx*: int       ## Index of the first failing transaction unless `ok`
+    senders*: seq[EthAddress]
+
+  SenderPipeline* = object ##\
+    ## Look ahead descriptor, each `FlowVar` can be read only once.
+    pending: seq[FlowVar[SenderRecovery]]
+    spawned: int      ## Blocks `[0,spawned)` were dispatched already
+    lookAhead: int    ## Maximal number of blocks kept in flight
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private functions
+# ------------------------------------------------------------------------------
+
+proc recoverSendersImpl(txs: seq[Transaction]): SenderRecovery {.gcsafe.} =
+  result.ok = true
+  result.senders.setLen(txs.len)
+  for n in 0 ..< txs.len:
+    var ok = false
+    try:
+      ok = txs[n].getSender(result.senders[n])
+    except CatchableError:
+      discard
+    if not ok:
+      result.ok = false
+      result.badTx = n
+      result.senders.setLen(0)
+      return
+
+proc dispatch(sp: var SenderPipeline; bodies: openArray[BlockBody]; last: int)
+    # wildcard exception from `spawn`, wrapped by caller
+    {.raises: [Exception].} =
+  ## Dispatch blocks up to and including `last` unless the pool is busy
+  while sp.spawned <= last and sp.spawned < bodies.len and preferSpawn():
+    let n = sp.spawned
+    if 0 < bodies[n].transactions.len:
+      sp.pending[n] = spawn recoverSendersImpl(bodies[n].transactions)
+    sp.spawned.inc
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc recoverSenders*(txs: openArray[Transaction]): SenderRecovery
+    {.gcsafe, raises: [Defect].} =
+  ## Serial version, run on the current thread
+  recoverSendersImpl(@txs)
+
+proc initSenderPipeline*(sp: var SenderPipeline;
+                         bodies: openArray[BlockBody]; lookAhead = 16)
+    {.raises: [Defect,CatchableError].} =
+  ## Start recovering senders for the first `lookAhead` argument `bodies`.
+  sp.pending.setLen(bodies.len)
+  sp.spawned = 0
+  sp.lookAhead = max(1, lookAhead)
+  try:
+    sp.dispatch(bodies, sp.lookAhead - 1)
+  except CatchableError as e:
+    raise e
+  except Defect as e:
+    raise e
+  except Exception as e:
+    raise newException(CatchableError, "initSenderPipeline(): " & e.msg)
+
+proc senders*(sp: var SenderPipeline; bodies: openArray[BlockBody];
+              n: int): SenderRecovery
+    {.raises: [Defect,CatchableError].} =
+  ## Return the senders for block body `bodies[n]`, blocking until they are
+  ## available. The argument `bodies` must be the same list as the one passed
+  ## to `initSenderPipeline()` and this function must be called once, only,
+  ## per block (in increasing order of `n`.)
+  try:
+    sp.dispatch(bodies, n + sp.lookAhead)
+    if n < sp.spawned:
+      if sp.pending[n].isNil:
+        return SenderRecovery(ok: true)
+      result = ^sp.pending[n]
+      sp.pending[n] = nil
+    else:
+      # Pool was busy all along, do it here
+      result = recoverSendersImpl(bodies[n].transactions)
+      sp.spawned = n + 1
+  except CatchableError as e:
+    raise e
+  except Defect as e:
+    raise e
+  except Exception as e:
+    raise newException(CatchableError, "senders(): " & e.msg)
+
+proc dispose*(sp: var SenderPipeline) {.raises: [Defect].} =
+  ## Wait for outstanding workers before the bodies go out of scope.
+  try:
+    for n in 0 ..< min(sp.spawned, sp.pending.len):
+      if not sp.pending[n].isNil:
+        discard ^sp.pending[n]
+        sp.pending[n] = nil
+  except Exception:
+    discard
+  sp.pending.setLen(0)
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
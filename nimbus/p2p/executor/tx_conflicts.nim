@@ -0,0 +1,97 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Transaction Conflict Analysis
+## =============================
+##
+## Statistics only, there is no parallel executor: blocks are executed
+## serially, and this module estimates how their transactions would fare
+## under optimistic parallel execution. There, each transaction would run
+## speculatively against the pre-block state, then the results would be
+## validated in block order. A transaction is valid if nothing it read was
+## written by an earlier transaction of the block, otherwise it is
+## re-executed on top of its predecessors. Miner fees are recorded as
+## credits, they only conflict with transactions reading the miner account.
+##
+## The analysis uses the read/write sets collected from the `AccountsCache`
+## after each transaction of the serially executed block, see
+## `collectAccess()`. A valid transaction would read the same values
+## speculatively, so its sets are the same either way. The reads come from
+## the EIP-2929 access list: blocks before Berlin are not analysed, and
+## reads within reverted call frames are missed, so the numbers are a lower
+## bound for the conflicts.
+
+import
+  ../../db/access_recorder,
+  chronicles,
+  eth/common,
+  metrics
+
+type
+  TxConflictStats* = object
+    txs*: int           ## Number of transactions
+    reExecuted*: int    ## Transactions invalidated by an earlier one
+    criticalPath*: int  ## Longest chain of read-after-write dependencies
+
+declareCounter tx_conflict_txs,
+  "Transactions analysed for optimistic parallel execution"
+declareCounter tx_conflict_reexecuted,
+  "Transactions that would be re-executed after speculative execution"
+declareHistogram tx_conflict_speedup,
+  "Transactions per block divided by the dependency critical path",
+  buckets = [1.0, 1.5, 2.0, 4.0, 8.0, 16.0, 32.0, 64.0, Inf]
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc analyseTxConflicts*(access: openArray[AccessRecorder]): TxConflictStats =
+  ## Analyse the read/write sets `access` of the transactions of a block,
+  ## in block order.
+  var
+    written: AccessSet          # writes of all earlier transactions
+    depth = newSeq[int](access.len)
+  result.txs = access.len
+  for i in 0 ..< access.len:
+    if written.overlaps(access[i].reads):
+      result.reExecuted.inc
+      # quadratic, only the dependent transactions pay for it
+      for j in 0 ..< i:
+        if depth[i] < depth[j] and
+           access[j].writes.overlaps(access[i].reads):
+          depth[i] = depth[j]
+    depth[i].inc
+    result.criticalPath = max(result.criticalPath, depth[i])
+    written.merge(access[i].writes)
+
+proc speedup*(stats: TxConflictStats): float64 =
+  ## Upper bound for the parallel speedup with unlimited workers
+  if stats.criticalPath == 0: 1.0
+  else: stats.txs.float64 / stats.criticalPath.float64
+
+proc exportTxConflicts*(stats: TxConflictStats; blockNumber: BlockNumber)
+    {.gcsafe.} =
+  if stats.txs == 0:
+    return
+  {.gcsafe.}:
+    tx_conflict_txs.inc(stats.txs)
+    tx_conflict_reexecuted.inc(stats.reExecuted)
+    tx_conflict_speedup.observe(stats.speedup)
+  debug "Transaction conflicts",
+    blockNumber,
+    txs = stats.txs,
+    reExecuted = stats.reExecuted,
+    criticalPath = stats.criticalPath
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -33,6 +33,9 @@ from stew/byteutils
 
 export
   epoch_hash_cache.EpochHashCache,
+  epoch_hash_cache.EpochHashDigest,
+  epoch_hash_cache.fullDagEnabled,
+  epoch_hash_cache.getEpochHash,
   epoch_hash_cache.initEpochHashCache,
   results
 
@@ -110,10 +113,8 @@ proc checkPOW(blockNumber: Uint256; miningHash, mixHash: Hash256;
               hashCache: var EpochHashCache): Result[void,string] =
   let
     blockNumber = blockNumber.truncate(uint64)
-    cache = hashCache.getEpochHash(blockNumber)
-    size = getDataSize(blockNumber)
-    miningOutput = hashimotoLight(
-      size, cache, miningHash, uint64.fromBytesBE(nonce))
+    miningOutput = hashCache.hashimoto(
+      blockNumber, miningHash, uint64.fromBytesBE(nonce))
 
   if miningOutput.mixDigest != mixHash:
     debug "mixHash mismatch",
@@ -123,8 +124,8 @@ proc checkPOW(blockNumber: Uint256; miningHash, mixHash: Hash256;
       miningHash = miningHash,
       nonce = nonce.toHex,
       difficulty = difficulty,
-      size = size,
-      cachedHash = cacheHash(cache)
+      size = getDataSize(blockNumber),
+      cachedHash = cacheHash(hashCache.getEpochHash(blockNumber))
     return err("mixHash mismatch")
 
   let value = Uint256.fromBytesBE(miningOutput.value.data)
@@ -373,6 +374,29 @@ proc validateHeaderAndKinship*(chainDB: BaseChainDB; ethBlock: EthBlock;
   chainDB.validateHeaderAndKinship(
     ethBlock.header, ethBlock.uncles, ethBlock.txs.len, checkSealOK, hashCache)
 
+
+proc validateSealLight*(header: BlockHeader;
+                        cache: EpochHashDigest): Result[void,string] =
+  ## PoW seal check against the epoch cache `cache` of the block without any
+  ## shared state, so it can run on a worker thread (while the caller keeps
+  ## `cache` alive.)
+  if header.difficulty.isZero:
+    return err("mining difficulty error")
+  let
+    blockNumber = header.blockNumber.truncate(uint64)
+    miningHash = header.toMiningHeader.hash
+    light = hashimotoLight(getDataSize(blockNumber), cache, miningHash,
+                           uint64.fromBytesBE(header.nonce))
+
+  if light.mixDigest != header.mixDigest:
+    return err("mixHash mismatch")
+
+  let value = Uint256.fromBytesBE(light.value.data)
+  if value > Uint256.high div header.difficulty:
+    return err("mining difficulty error")
+
+  result = ok()
+
 # ------------------------------------------------------------------------------
 # End
 # ------------------------------------------------------------------------------
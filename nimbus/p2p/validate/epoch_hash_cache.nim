@@ -12,18 +12,77 @@
 ## ==========
 ##
 ## provide LRU hash, indexed by epoch
+##
+## The cache for the epoch following the latest one asked for is generated
+## ahead of time on a `threadpool` worker, so crossing an epoch boundary does
+## not stall block validation.
+##
+## Optionally (see `enableFullDag()`), the full ethash dataset of the latest
+## epoch is generated in the background into a memory mapped file. Once
+## complete, `hashimoto()` reads the dataset rather than re-computing the
+## dataset items from the cache for every seal check. The dataset of the
+## following epoch is then generated ahead, while the current one is used.
 
 import
+  std/[memfiles, os, strutils, threadpool],
   ../../utils/lru_cache,
+  chronicles,
   ethash,
   nimcrypto,
+  stew/endians2,
   tables
 
 type
   BlockEpoch = distinct uint64
 
   EpochHashDigest* = seq[MDigest[512]]
-  EpochHashCache* = LruCache[uint64,BlockEpoch,EpochHashDigest,void]
+
+  EpochHashLru = LruCache[uint64,BlockEpoch,EpochHashDigest,void]
+
+  EpochMining* = tuple
+    mixDigest, value: MDigest[256]
+
+  DagItems = ptr UncheckedArray[MDigest[512]]
+
+  DagState = enum
+    dagNone                           ## No dataset, yet
+    dagBuilding                       ## Chunks are generated by workers
+    dagReady                          ## Dataset complete and mapped
+
+  DagFile = ref object
+    ## Dataset of one epoch
+    state: DagState
+    epoch: uint64
+    file: MemFile
+    items: int                        ## Number of 64 byte dataset items
+    path: string
+    cache: DagItems                   ## Shared copy of the epoch cache while
+    cacheLen: int                     ## building, `nil` otherwise
+    chunks: seq[FlowVar[bool]]
+    dispatched: int                   ## Number of chunks handed to workers
+    completed: int                    ## Number of chunks finished
+
+  FullDag = ref object
+    dir: string                       ## Location of the dataset files
+    current: DagFile                  ## Used for the seal checks if ready
+    next: DagFile                     ## Generated ahead, `nil` if none
+
+  EpochHashCache* = object
+    lru: EpochHashLru
+    prefetch: FlowVar[EpochHashDigest] ## Cache for `prefetchEpoch`
+    prefetchEpoch: uint64
+    dag: FullDag                      ## `nil` unless enabled
+
+const
+  dagChunkItems = 1 shl 16
+    ## Dataset items generated per worker task (4MiB)
+
+  dagRevision = 23
+  fnvPrime = 0x01000193'u32
+  hashWords = 16                      ## 32 bit words per dataset item
+  mixWords = 32                       ## 32 bit words of the mix
+  accesses = 64
+  datasetParents = 256
 
 {.push raises: [Defect,CatchableError].}
 
@@ -34,6 +93,266 @@ type
 # needed for table key to work
 proc `==`(a,b: BlockEpoch): bool {.borrow.}
 
+proc mkEpochCache(epoch: uint64): EpochHashDigest {.gcsafe, raises: [Defect].} =
+  let top = epoch * EPOCH_LENGTH
+  mkcache(getCacheSize(top), getSeedhash(top))
+
+proc schedulePrefetch(cache: var EpochHashCache; epoch: uint64)
+    {.raises: [Defect].} =
+  ## Generate the cache for argument `epoch` in the background unless there
+  ## is one already.
+  if cache.prefetch.isNil and
+     not cache.lru.hasKey(epoch * EPOCH_LENGTH):
+    try:
+      if preferSpawn():
+        cache.prefetch = spawn mkEpochCache(epoch)
+        cache.prefetchEpoch = epoch
+    except Exception as e:
+      debug "Epoch cache prefetch failed", epoch, error = e.msg
+
+proc collectPrefetch(cache: var EpochHashCache; epoch: uint64)
+    {.raises: [Defect].} =
+  ## Move a prefetched cache into the LRU. This blocks if the worker has not
+  ## finished, yet (which is still faster than starting over.)
+  if not cache.prefetch.isNil and cache.prefetchEpoch == epoch:
+    try:
+      let digest = ^cache.prefetch
+      cache.lru.putItem(epoch * EPOCH_LENGTH, digest)
+    except Exception as e:
+      debug "Epoch cache prefetch lost", epoch, error = e.msg
+    cache.prefetch = nil
+
+proc epochCache(cache: var EpochHashCache; epoch: uint64): EpochHashDigest =
+  ## Cache for argument `epoch`, without prefetching the following one
+  cache.collectPrefetch(epoch)
+  cache.lru.getItem(epoch * EPOCH_LENGTH).value
+
+# ------------------------------------------------------------------------------
+# Private full dataset functions
+# ------------------------------------------------------------------------------
+
+proc fnv(a, b: uint32): uint32 {.inline.} =
+  (a * fnvPrime) xor b
+
+proc word(item: MDigest[512]; n: int): uint32 {.inline.} =
+  uint32.fromBytesLE(item.data.toOpenArray(4*n, 4*n + 3))
+
+proc dagFileName(epoch: uint64): string =
+  let seed = getSeedhash(epoch * EPOCH_LENGTH)
+  "full-R" & $dagRevision & "-" & $epoch & "-" &
+    seed.data.toOpenArray(0, 7).toHex(true)
+
+proc dagItems(f: DagFile): DagItems {.inline.} =
+  cast[DagItems](f.file.mem)
+
+proc datasetItem(cache: DagItems; cacheLen, i: int): MDigest[512]
+    {.gcsafe, raises: [Defect].} =
+  ## Same as `ethash.calcDatasetItem()` but reading a cache in shared memory
+  var mix = cache[i mod cacheLen]
+  mix.data[0 ..< 4] = (mix.word(0) xor i.uint32).toBytesLE
+  mix = keccak512.digest(mix.data)
+
+  var words: array[hashWords, uint32]
+  for n in 0 ..< hashWords:
+    words[n] = mix.word(n)
+  for j in 0 ..< datasetParents:
+    let parent = fnv(i.uint32 xor j.uint32, words[j mod hashWords]) mod
+                   cacheLen.uint32
+    for n in 0 ..< hashWords:
+      words[n] = fnv(words[n], cache[parent].word(n))
+
+  var data: array[64, byte]
+  for n in 0 ..< hashWords:
+    data[4*n ..< 4*n + 4] = words[n].toBytesLE
+  keccak512.digest(data)
+
+proc genChunk(items, cache: DagItems; cacheLen, first, last: int): bool
+    {.gcsafe, raises: [Defect].} =
+  ## Worker task, the target slots and the `cache` copy are owned by the
+  ## caller who waits for all chunks before releasing them.
+  for n in first ..< last:
+    items[n] = datasetItem(cache, cacheLen, n)
+  true
+
+proc hashimotoDag(f: DagFile; miningHash: MDigest[256];
+                  nonce: uint64): EpochMining =
+  ## Same as `ethash.hashimotoFull()` but reading the mapped dataset
+  var seedData: array[40, byte]
+  seedData[0 ..< 32] = miningHash.data
+  seedData[32 ..< 40] = nonce.toBytesLE
+  let seed = keccak512.digest(seedData)
+
+  var
+    s: array[hashWords, uint32]
+    mix: array[mixWords, uint32]
+  for n in 0 ..< hashWords:
+    s[n] = seed.word(n)
+  for n in 0 ..< mixWords:
+    mix[n] = s[n mod hashWords]
+
+  let
+    items = f.dagItems
+    pages = (f.items div 2).uint32
+  for i in 0 ..< accesses:
+    let p = (fnv(i.uint32 xor s[0], mix[i mod mixWords]) mod pages).int * 2
+    for n in 0 ..< hashWords:
+      mix[n] = fnv(mix[n], items[p].word(n))
+      mix[n + hashWords] = fnv(mix[n + hashWords], items[p + 1].word(n))
+
+  var tail: array[96, byte]
+  tail[0 ..< 64] = seed.data
+  for n in 0 ..< mixWords div 4:
+    let c = fnv(fnv(fnv(mix[4*n], mix[4*n+1]), mix[4*n+2]), mix[4*n+3])
+    result.mixDigest.data[4*n ..< 4*n + 4] = c.toBytesLE
+  tail[64 ..< 96] = result.mixDigest.data
+  result.value = keccak256.digest(tail)
+
+proc selfTest(f: DagFile; cache: EpochHashDigest): bool =
+  ## Compare the mapped dataset against the light computation, this catches
+  ## stale or truncated files
+  let
+    size = f.items * 64
+    probe = keccak256.digest(f.path)
+    light = hashimotoLight(size, cache, probe, f.epoch)
+    full = f.hashimotoDag(probe, f.epoch)
+  light.mixDigest == full.mixDigest and light.value == full.value and
+    f.dagItems[f.items - 1] == calcDatasetItem(cache, f.items - 1)
+
+proc waitChunks(f: DagFile) {.raises: [Defect].} =
+  ## Workers must not write to a closed mapping or read a released cache
+  for n in 0 ..< f.dispatched:
+    if not f.chunks[n].isNil:
+      try:
+        discard ^f.chunks[n]
+      except Exception:
+        discard
+      f.chunks[n] = nil
+
+proc closeDag(f: DagFile) {.raises: [Defect].} =
+  f.waitChunks
+  if f.state != dagNone:
+    try:
+      f.file.close
+    except OSError as e:
+      debug "Closing ethash dataset failed", path = f.path, error = e.msg
+  f.state = dagNone
+  if not f.cache.isNil:
+    f.cache.deallocShared
+    f.cache = nil
+  f.chunks.setLen(0)
+  f.dispatched = 0
+
+proc openDag(dir: string; epoch: uint64; cache: EpochHashDigest): DagFile =
+  ## Map an existing dataset file or start generating a new one
+  result = DagFile(
+    epoch: epoch,
+    items: getDataSize(epoch * EPOCH_LENGTH).int div 64,
+    path:  dir / epoch.dagFileName)
+
+  if result.path.fileExists and
+     result.path.getFileSize == result.items * 64:
+    result.file = memfiles.open(result.path)
+    result.state = dagReady
+    if result.selfTest(cache):
+      info "Ethash dataset mapped", epoch, path = result.path
+      return
+    warn "Ethash dataset corrupt, regenerating", epoch, path = result.path
+    result.closeDag
+
+  createDir(dir)
+  result.file = memfiles.open(
+    result.path & ".tmp", mode = fmReadWrite, newFileSize = result.items * 64)
+  result.state = dagBuilding
+
+  # the workers read a copy outside the GC heap
+  result.cacheLen = cache.len
+  result.cache = cast[DagItems](allocShared(cache.len * sizeof(MDigest[512])))
+  for n in 0 ..< cache.len:
+    result.cache[n] = cache[n]
+
+  result.chunks.setLen((result.items + dagChunkItems - 1) div dagChunkItems)
+  info "Generating ethash dataset", epoch, items = result.items
+
+proc finishDag(f: DagFile; cache: EpochHashDigest) =
+  f.file.flush
+  f.file.close
+  moveFile(f.path & ".tmp", f.path)
+  f.file = memfiles.open(f.path)
+  f.state = dagReady
+  f.cache.deallocShared
+  f.cache = nil
+  if not f.selfTest(cache):
+    # Do not try again, something is wrong with the dataset reader
+    f.closeDag
+    removeFile(f.path)
+    raise newException(CatchableError, "dataset verification failed")
+  info "Ethash dataset ready", epoch = f.epoch, path = f.path
+
+proc advanceDag(f: DagFile; cache: var EpochHashCache) =
+  ## Collect finished chunks and hand out new ones to idle workers
+  for n in 0 ..< f.dispatched:
+    if not f.chunks[n].isNil and f.chunks[n].isReady:
+      try:
+        discard ^f.chunks[n]
+      except Exception as e:
+        raise newException(CatchableError, "advanceDag(): " & e.msg)
+      f.chunks[n] = nil
+      f.completed.inc
+
+  try:
+    while f.dispatched < f.chunks.len and preferSpawn():
+      let
+        first = f.dispatched * dagChunkItems
+        last = min(first + dagChunkItems, f.items)
+      f.chunks[f.dispatched] =
+        spawn genChunk(f.dagItems, f.cache, f.cacheLen, first, last)
+      f.dispatched.inc
+  except Exception as e:
+    raise newException(CatchableError, "advanceDag(): " & e.msg)
+
+  if f.completed == f.chunks.len:
+    f.finishDag(cache.epochCache(f.epoch))
+
+proc removeStale(dag: FullDag) =
+  ## Keep the disk usage bounded, older datasets are not needed anymore
+  for kind, path in walkDir(dag.dir):
+    if kind == pcFile and path.extractFilename.startsWith("full-R") and
+       (dag.current.isNil or path != dag.current.path) and
+       (dag.next.isNil or not path.startsWith(dag.next.path)):
+      discard tryRemoveFile(path)
+
+proc closeAll(dag: FullDag) {.raises: [Defect].} =
+  if not dag.current.isNil:
+    dag.current.closeDag
+    dag.current = nil
+  if not dag.next.isNil:
+    dag.next.closeDag
+    dag.next = nil
+
+proc update(dag: FullDag; cache: var EpochHashCache; epoch: uint64) =
+  ## Generate the dataset of the epoch after the current one ahead of time
+  ## and switch over when the chain gets there. The current dataset is kept
+  ## until then.
+  let next = dag.next
+  if not next.isNil and next.state == dagBuilding:
+    next.advanceDag(cache)
+  if not next.isNil and next.state == dagReady and next.epoch <= epoch:
+    if not dag.current.isNil:
+      dag.current.closeDag
+    dag.current = next
+    dag.next = nil
+    dag.removeStale
+
+  let target =
+    if not dag.current.isNil and dag.current.epoch == epoch: epoch + 1
+    else: epoch
+  if not dag.next.isNil and dag.next.epoch < target:
+    # the chain jumped ahead, start over
+    dag.next.closeDag
+    dag.next = nil
+  if dag.next.isNil:
+    dag.next = dag.dir.openDag(target, cache.epochCache(target))
+
 # ------------------------------------------------------------------------------
 # Public functions
 # ------------------------------------------------------------------------------
@@ -50,16 +369,53 @@ proc initEpochHashCache*(cache: var EpochHashCache; cacheMaxItems = 10) =
 
   var toValue: LruValue[uint64,EpochHashDigest,void] =
     proc(blockNumber: uint64): Result[EpochHashDigest,void] =
-      let top = blockNumber.bnToEpoch.uint64 * EPOCH_LENGTH
-      ok( mkcache( getCacheSize(top), getSeedhash(top)))
+      ok(mkEpochCache(blockNumber.bnToEpoch.uint64))
 
-  cache.initCache(toKey, toValue, cacheMaxItems)
+  cache.lru.initCache(toKey, toValue, cacheMaxItems)
+
+
+proc enableFullDag*(cache: var EpochHashCache; dir: string) =
+  ## Maintain the full dataset of the latest epoch seen in directory `dir`,
+  ## and the one of the following epoch. Each needs more than 1GiB of disk
+  ## space, growing with the epoch.
+  cache.dag = FullDag(dir: dir)
+
+proc fullDagEnabled*(cache: var EpochHashCache): bool {.inline.} =
+  not cache.dag.isNil
 
 
 proc getEpochHash*(cache: var EpochHashCache;
-                   blockNumber: uint64): auto {.inline.} =
+                   blockNumber: uint64): EpochHashDigest =
   ## Return hash list, indexed by epoch of argument `blockNumber`
-  cache.getItem(blockNumber).value
+  let epoch = blockNumber div EPOCH_LENGTH
+  result = cache.epochCache(epoch)
+  cache.schedulePrefetch(epoch + 1)
+
+
+proc hashimoto*(cache: var EpochHashCache; blockNumber: uint64;
+                miningHash: MDigest[256]; nonce: uint64): EpochMining =
+  ## Mining output for the seal check of block `blockNumber`, computed from
+  ## the full dataset if available and from the epoch cache otherwise.
+  let
+    epoch = blockNumber div EPOCH_LENGTH
+    dag = cache.dag
+  if not dag.isNil:
+    try:
+      dag.update(cache, epoch)
+    except CatchableError as e:
+      # A disk problem must not fail the seal check, fall back to the cache
+      warn "Ethash dataset disabled", error = e.msg
+      dag.closeAll
+      cache.dag = nil
+    let current = dag.current
+    if not current.isNil and current.state == dagReady and
+       current.epoch == epoch:
+      return current.hashimotoDag(miningHash, nonce)
+
+  let light = hashimotoLight(getDataSize(blockNumber),
+                             cache.getEpochHash(blockNumber),
+                             miningHash, nonce)
+  (light.mixDigest, light.value)
 
 # ------------------------------------------------------------------------------
 # End
@@ -0,0 +1,266 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+# at your option.
+# This file may not be copied, modified, or distributed except according to
+# those terms.
+
+## Read-Only Call Executor Pool
+## ============================
+##
+## `eth_call` and `eth_estimateGas` run on a fixed set of worker threads so
+## that slow calls neither block the event loop nor each other. The header
+## is resolved by the RPC handler, the worker executes against a RocksDB
+## snapshot taken when it picks up the job, so concurrent block imports do
+## not change the state under a running call.
+##
+## Every worker has its own `BaseChainDB` on a read-only `ChainDB` sharing
+## the database handles of the main thread (see `select_backend`), and its
+## own `StateCacheRef` which stays warm from call to call. Jobs and replies
+## are copied through channels, no GC reference crosses threads. A worker
+## writes a byte to a pipe after each reply, which wakes up the event loop
+## to collect the replies.
+
+import
+  std/tables,
+  chronicles, chronos,
+  eth/[common, trie/db],
+  ../chain_config,
+  ../db/[db_chain, select_backend, state_cache],
+  ../transaction/call_evm,
+  hexstrings
+
+when defined(windows):
+  import std/winlean
+else:
+  import std/posix
+
+type
+  CallJobKind = enum
+    cjStop
+    cjCall
+    cjEstimateGas
+
+  CallJob = object
+    id: int
+    kind: CallJobKind
+    call: RpcCallData
+    header: BlockHeader
+    haveGasLimit: bool
+
+  CallReply = object
+    id: int
+    output: string              ## `eth_call` result
+    gasUsed: GasInt             ## `eth_estimateGas` result
+    error: string               ## Set if the call raised an exception
+
+  WorkerArgs = object
+    ## Plain data only, copied into the thread descriptor
+    handle: ChainDBHandle
+    config: ChainConfig
+    networkId: NetworkId
+    pruneTrie: bool
+    stateSnapshot: bool
+    jobs: ptr Channel[CallJob]
+    replies: ptr Channel[CallReply]
+    wakeFd: AsyncFD                 ## Write end of the wake up pipe
+
+  CallPool* = ref object
+    workers: seq[Thread[WorkerArgs]]
+    jobs: ptr Channel[CallJob]
+    replies: ptr Channel[CallReply]
+    wake: StreamTransport           ## Read end of the wake up pipe
+    wakeFd: AsyncFD
+    pending: Table[int,Future[CallReply]]
+    nextId: int
+    polling: bool
+
+const
+  workerSlotBytes = 16 * 1024 * 1024
+    ## Slot cache budget of each worker, the workers do not share their caches
+
+# ------------------------------------------------------------------------------
+# Private worker functions
+# ------------------------------------------------------------------------------
+
+proc wakeUp(fd: AsyncFD) =
+  ## The pipe is non-blocking, a full pipe has a wake up pending anyway
+  var b = 1'u8
+  when defined(windows):
+    var written: int32
+    discard writeFile(Handle(fd), b.addr, 1, written.addr, nil)
+  else:
+    discard posix.write(cint(fd), b.addr, 1)
+
+proc closeFd(fd: AsyncFD) =
+  when defined(windows):
+    discard closeHandle(Handle(fd))
+  else:
+    discard posix.close(cint(fd))
+
+when sharedReaders:
+  proc runJob(job: CallJob; chainDB: BaseChainDB;
+              sc: StateCacheRef): CallReply =
+    result.id = job.id
+    try:
+      {.gcsafe.}:
+        case job.kind
+        of cjCall:
+          result.output = rpcDoCall(job.call, job.header, chainDB, sc).string
+        of cjEstimateGas:
+          result.gasUsed = rpcEstimateGas(
+            job.call, job.header, chainDB, job.haveGasLimit, sc)
+        of cjStop:
+          discard
+    except CatchableError as e:
+      # reported to the RPC client
+      result.error = e.msg
+
+  proc worker(args: WorkerArgs) {.thread.} =
+    let
+      backend = newChainDB(args.handle)
+      chainDB = newBaseChainDB(trieDB backend, args.pruneTrie, args.networkId)
+      sc = newStateCache(maxSlotBytes = workerSlotBytes)
+    chainDB.config = args.config
+    chainDB.stateSnapshot = args.stateSnapshot
+
+    while true:
+      let job = args.jobs[].recv
+      if job.kind == cjStop:
+        break
+      backend.pinReads
+      let reply = job.runJob(chainDB, sc)
+      backend.unpinReads
+      args.replies[].send reply
+      args.wakeFd.wakeUp
+
+    backend.close
+
+# ------------------------------------------------------------------------------
+# Private event loop functions
+# ------------------------------------------------------------------------------
+
+proc collect(pool: CallPool) =
+  ## Complete the futures of the replies received
+  while true:
+    let (ok, reply) = pool.replies[].tryRecv
+    if not ok:
+      return
+    var fut: Future[CallReply]
+    if pool.pending.pop(reply.id, fut):
+      fut.complete(reply)
+
+proc poll(pool: CallPool) {.async.} =
+  ## Collect the replies until no jobs are pending. A reply is sent before
+  ## the wake up byte, so none is missed.
+  var buf: array[64, byte]
+  while true:
+    pool.collect
+    if pool.pending.len == 0:
+      break
+    try:
+      if await(pool.wake.readOnce(buf[0].addr, buf.len)) == 0:
+        break
+    except CatchableError:
+      # closed by `close()`
+      break
+  pool.polling = false
+
+proc submit(pool: CallPool; job: CallJob): Future[CallReply] =
+  var job = job
+  job.id = pool.nextId
+  pool.nextId.inc
+  result = newFuture[CallReply]("CallPool.submit")
+  pool.pending[job.id] = result
+  pool.jobs[].send job
+  if not pool.polling:
+    pool.polling = true
+    asyncCheck pool.poll()
+
+proc checked(reply: CallReply): CallReply =
+  if 0 < reply.error.len:
+    raise newException(ValueError, reply.error)
+  reply
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc newCallPool*(chainDB: BaseChainDB; workers: int): CallPool =
+  ## Start `workers` threads reading the database of `chainDB`. Returns `nil`
+  ## (calls are run on the main thread) if the database cannot be shared.
+  when sharedReaders:
+    if workers <= 0 or chainDB.backend.isNil:
+      return nil
+    result = CallPool(
+      workers: newSeq[Thread[WorkerArgs]](workers),
+      jobs:    cast[ptr Channel[CallJob]](
+                 allocShared0(sizeof(Channel[CallJob]))),
+      replies: cast[ptr Channel[CallReply]](
+                 allocShared0(sizeof(Channel[CallReply]))))
+    result.jobs[].open
+    result.replies[].open
+    let (readFd, writeFd) = createAsyncPipe()
+    if readFd == asyncInvalidPipe:
+      raiseAssert "cannot create the call worker pipe"
+    result.wake = fromPipe(readFd)
+    result.wakeFd = writeFd
+    let args = WorkerArgs(
+      handle:        chainDB.backend.handle,
+      config:        chainDB.config,
+      networkId:     chainDB.networkId,
+      pruneTrie:     chainDB.pruneTrie,
+      stateSnapshot: chainDB.stateSnapshot,
+      jobs:          result.jobs,
+      replies:       result.replies,
+      wakeFd:        writeFd)
+    # `workers` is not resized, the thread descriptors must not move
+    for n in 0 ..< workers:
+      try:
+        createThread(result.workers[n], worker, args)
+      except ResourceExhaustedError as e:
+        raiseAssert "cannot start call workers: " & e.msg
+    info "Started call workers", workers
+  else:
+    if 0 < workers:
+      warn "Call workers need the RocksDB backend, running calls inline"
+
+proc call*(pool: CallPool; data: RpcCallData;
+           header: BlockHeader): Future[HexDataStr] {.async.} =
+  ## `rpcDoCall()` on a worker
+  let reply = await pool.submit(CallJob(
+    kind: cjCall, call: data, header: header))
+  return reply.checked.output.HexDataStr
+
+proc estimateGas*(pool: CallPool; data: RpcCallData; header: BlockHeader;
+                  haveGasLimit: bool): Future[GasInt] {.async.} =
+  ## `rpcEstimateGas()` on a worker
+  let reply = await pool.submit(CallJob(
+    kind: cjEstimateGas, call: data, header: header,
+    haveGasLimit: haveGasLimit))
+  return reply.checked.gasUsed
+
+proc close*(pool: CallPool) =
+  ## Stop the workers after the jobs in flight, before the database is closed
+  if pool.isNil or pool.workers.len == 0:
+    return
+  for _ in 0 ..< pool.workers.len:
+    pool.jobs[].send CallJob(kind: cjStop)
+  joinThreads(pool.workers)
+  pool.workers.setLen(0)
+
+  # the replies are all in, complete the futures still pending
+  pool.collect
+  pool.wake.close
+  pool.wakeFd.closeFd
+
+  pool.jobs[].close
+  pool.replies[].close
+  deallocShared(pool.jobs)
+  deallocShared(pool.replies)
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -8,7 +8,7 @@
 # those terms.
 
 import
-  strutils, json, options,
+  os, strutils, json, options, algorithm, times,
   json_rpc/rpcserver, rpc_utils, eth/common,
   hexstrings, ../tracer, ../vm_types,
   ../db/[db_chain]
@@ -20,6 +20,14 @@ type
     disableStack: Option[bool]
     disableState: Option[bool]
     disableStateDiff: Option[bool]
+    tracer: Option[string]
+
+  TraceFiles = ref object
+    ## Output of the `debug_*ToFile` methods. Only the newest `maxFiles`
+    ## trace files in `dir` are kept.
+    dir: string
+    maxFiles: int
+    seqNo: int
 
 proc isTrue(x: Option[bool]): bool =
   result = x.isSome and x.get() == true
@@ -32,8 +40,56 @@ proc traceOptionsToFlags(options: Option[TraceOptions]): set[TracerFlags] =
     if opts.disableStack.isTrue  : result.incl TracerFlags.DisableStack
     if opts.disableState.isTrue  : result.incl TracerFlags.DisableState
     if opts.disableStateDiff.isTrue: result.incl TracerFlags.DisableStateDiff
-
-proc setupDebugRpc*(chainDB: BaseChainDB, rpcsrv: RpcServer) =
+    if opts.tracer.isSome:
+      if opts.tracer.get != "callTracer":
+        raise newException(ValueError, "Unsupported tracer: " & opts.tracer.get)
+      result.incl TracerFlags.CallTracer
+
+proc newFileName(tf: TraceFiles, prefix: string): string =
+  ## Unique name for a new trace file, traces of the same transaction or
+  ## block do not overwrite each other
+  createDir(tf.dir)
+  while true:
+    inc tf.seqNo
+    result = tf.dir / prefix & "-" & $getTime().toUnix & "-" & $tf.seqNo & ".jsonl"
+    if not fileExists(result):
+      return
+
+proc cleanup(tf: TraceFiles) =
+  ## Delete the oldest trace files beyond `maxFiles`
+  var files: seq[(Time, string)]
+  for path in walkFiles(tf.dir / "trace-*.jsonl"):
+    files.add((getLastModificationTime(path), path))
+  if files.len <= tf.maxFiles:
+    return
+  files.sort(system.cmp)
+  for n in 0 ..< files.len - tf.maxFiles:
+    discard tryRemoveFile(files[n][1])
+
+template traceToFile(tf: TraceFiles, prefix: string, body: untyped): string =
+  ## Run `body` with `output` open for writing to a new trace file, and
+  ## return the name of the file. The file is deleted if `body` fails.
+  let fileName = tf.newFileName(prefix)
+  var output {.inject.}: File
+  if not output.open(fileName, fmWrite):
+    raise newException(IOError, "Cannot create " & fileName)
+  var done = false
+  try:
+    body
+    done = true
+  finally:
+    output.close()
+    if not done:
+      discard tryRemoveFile(fileName)
+  tf.cleanup()
+  fileName
+
+proc setupDebugRpc*(chainDB: BaseChainDB, rpcsrv: RpcServer;
+                    traceDir: string; traceFiles = 16) =
+  ## The `debug_*ToFile` methods write to `traceDir` on the node's file
+  ## system, keeping the newest `traceFiles` files. They are meant for
+  ## operators running the node locally, not for a public RPC endpoint.
+  let traces = TraceFiles(dir: traceDir, maxFiles: max(traceFiles, 1))
 
   rpcsrv.rpc("debug_traceTransaction") do(data: EthHashStr, options: Option[TraceOptions]) -> JsonNode:
     ## The traceTransaction debugging method will attempt to run the transaction in the exact
@@ -48,6 +104,8 @@ proc setupDebugRpc*(chainDB: BaseChainDB, rpcsrv: RpcServer) =
     ## * disableMemory: BOOL. Setting this to true will disable memory capture (default = false).
     ## * disableStack: BOOL. Setting this to true will disable stack capture (default = false).
     ## * disableState: BOOL. Setting this to true will disable state trie capture (default = false).
+    ## * tracer: STRING. "callTracer" records the CALL and CREATE frames only, instead of
+    ##   a log entry for each op code.
     let
       txHash = toHash(data)
       txDetails = chainDB.getTransactionKey(txHash)
@@ -114,6 +172,42 @@ proc setupDebugRpc*(chainDB: BaseChainDB, rpcsrv: RpcServer) =
 
     result = traceBlock(chainDB, header, body, flags)
 
+  rpcsrv.rpc("debug_traceTransactionToFile") do(data: EthHashStr, options: Option[TraceOptions]) -> string:
+    ## Same as debug_traceTransaction, but the struct logs (or call frames) are streamed to a
+    ## file on the node, one JSON object per line, followed by a summary line. Returns the
+    ## name of the file.
+    ##
+    ## Local operator API: files go to the trace directory (`--rpctracedir`), each call
+    ## creates a new file and only the newest ones are kept (`--rpctracefiles`).
+    ##
+    ## options: see debug_traceTransaction, the state and state diff are not written.
+    let
+      txHash = toHash(data)
+      txDetails = chainDB.getTransactionKey(txHash)
+      blockHeader = chainDB.getBlockHeader(txDetails.blockNumber)
+      blockHash = chainDB.getBlockHash(txDetails.blockNumber)
+      blockBody = chainDB.getBlockBody(blockHash)
+      flags = traceOptionsToFlags(options) + {DisableState, DisableStateDiff}
+
+    result = traces.traceToFile("trace-tx-" & ($txHash).toLowerAscii):
+      discard traceTransaction(chainDB, blockHeader, blockBody, txDetails.index, flags, output)
+
+  rpcsrv.rpc("debug_traceBlockByHashToFile") do(data: EthHashStr, options: Option[TraceOptions]) -> string:
+    ## Same as debug_traceBlockByHash, but streamed to a file like debug_traceTransactionToFile,
+    ## in the same trace directory. Returns the name of the file.
+    ##
+    ## data: Hash of a block.
+    ## options: see debug_traceTransaction
+    let
+      h = data.toHash
+      header = chainDB.getBlockHeader(h)
+      blockHash = chainDB.getBlockHash(header.blockNumber)
+      body = chainDB.getBlockBody(blockHash)
+      flags = traceOptionsToFlags(options) + {DisableState}
+
+    result = traces.traceToFile("trace-block-" & ($h).toLowerAscii):
+      discard traceBlock(chainDB, header, body, flags, output)
+
   rpcsrv.rpc("debug_setHead") do(quantityTag: string):
     ## Sets the current head of the local chain by block number.
     ## Note, this is a destructive action and may severely damage your chain.
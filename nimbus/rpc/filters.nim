@@ -0,0 +1,253 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE))
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT))
+# at your option.
+# This file may not be copied, modified, or distributed except according to
+# those terms.
+
+## Log queries and installed filters for `eth_getLogs`, `eth_newFilter` and
+## friends. Block ranges are narrowed down with the bloom bits index (see
+## `db/bloombits`), receipts are read for candidate blocks only.
+
+import
+  std/[json, options, tables, times],
+  eth/common, stint,
+  json_rpc/rpcserver,
+  ../db/[bloombits, db_chain],
+  hexstrings, rpc_types, rpc_utils
+
+type
+  FilterKind = enum
+    fltLogs
+    fltBlocks
+
+  InstalledFilter = object
+    kind: FilterKind
+    options: FilterOptions
+    lastBlock: BlockNumber          ## Highest block reported, so far
+    lastPoll: Time
+
+  FilterRegistry* = ref object
+    ## Filters installed via RPC, indexed by filter ID
+    filters: Table[int,InstalledFilter]
+    nextId: int
+
+const
+  filterTimeout* = initDuration(minutes = 5)
+    ## Filters not polled for that long are uninstalled
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+proc toBloomQuery(opts: FilterOptions): BloomQuery =
+  if 0 < opts.address.len:
+    var criterion: seq[BloomBits]
+    for address in opts.address:
+      criterion.add address.bloomBits
+    result.add criterion
+  for topic in opts.topics:
+    if topic.isSome and 0 < topic.get.len:
+      var criterion: seq[BloomBits]
+      for hash in topic.get:
+        criterion.add hash.data.bloomBits
+      result.add criterion
+
+proc matches(log: Log; opts: FilterOptions): bool =
+  if 0 < opts.address.len and log.address notin opts.address:
+    return false
+  for n, topic in opts.topics:
+    if topic.isSome and 0 < topic.get.len:
+      if log.topics.len <= n or log.topics[n] notin topic.get:
+        return false
+  true
+
+proc collectLogs(chain: BaseChainDB; header: BlockHeader;
+                 opts: FilterOptions; logs: var seq[FilterLog]) =
+  var
+    txHashes: seq[Hash256]
+    logIndex = 0
+    txIndex = 0
+  let blockHash = header.blockHash
+  for receipt in chain.getReceipts(header.receiptRoot):
+    for log in receipt.logs:
+      if log.matches(opts):
+        if txHashes.len == 0:
+          for txHash in chain.getBlockTransactionHashes(header):
+            txHashes.add txHash
+        logs.add FilterLog(
+          logIndex:         some(encodeQuantity(logIndex.uint)),
+          transactionIndex: some(encodeQuantity(txIndex.uint)),
+          transactionHash:  some(txHashes[txIndex]),
+          blockHash:        some(blockHash),
+          blockNumber:      some(encodeQuantity(header.blockNumber)),
+          address:          log.address,
+          data:             log.data,
+          topics:           log.topics)
+      logIndex.inc
+    txIndex.inc
+
+proc blockRange(chain: BaseChainDB;
+                opts: FilterOptions): (BlockNumber, BlockNumber) =
+  let
+    fromTag = if opts.fromBlock.isSome: opts.fromBlock.get else: "latest"
+    toTag = if opts.toBlock.isSome: opts.toBlock.get else: "latest"
+  (chain.headerFromTag(fromTag).blockNumber,
+   chain.headerFromTag(toTag).blockNumber)
+
+proc getLogsImpl(chain: BaseChainDB; opts: FilterOptions;
+                 fromBlock, toBlock: BlockNumber): seq[FilterLog] =
+  let query = opts.toBloomQuery
+  for num in chain.candidateBlocks(fromBlock, toBlock, query):
+    let header = chain.getBlockHeader(num)
+    chain.collectLogs(header, opts, result)
+
+proc expire(reg: FilterRegistry) =
+  let now = getTime()
+  var stale: seq[int]
+  for id, flt in reg.filters:
+    if filterTimeout < now - flt.lastPoll:
+      stale.add id
+  for id in stale:
+    reg.filters.del id
+
+proc install(reg: FilterRegistry; flt: InstalledFilter): int =
+  reg.expire
+  reg.nextId.inc
+  reg.filters[reg.nextId] = flt
+  reg.nextId
+
+template withFilter(reg: FilterRegistry; id: int; flt, body: untyped) =
+  reg.expire
+  reg.filters.withValue(id, flt) do:
+    flt.lastPoll = getTime()
+    body
+  do:
+    raise newException(ValueError, "filter not found")
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc fromJson*(n: JsonNode; argName: string; result: var FilterOptions) =
+  ## Parse the filter object. Unlike the generic object parser this accepts
+  ## a single address or a list of addresses, and `null`, a single hash or a
+  ## list of hashes for each topic position.
+  n.kind.expect(JObject, argName)
+  for field in ["fromBlock", "toBlock"]:
+    if n.hasKey(field) and n[field].kind != JNull:
+      n[field].kind.expect(JString, field)
+      if field == "fromBlock":
+        result.fromBlock = some(n[field].getStr)
+      else:
+        result.toBlock = some(n[field].getStr)
+  if n.hasKey("blockHash") and n["blockHash"].kind != JNull:
+    var hash: Hash256
+    fromJson(n["blockHash"], "blockHash", hash)
+    if result.fromBlock.isSome or result.toBlock.isSome:
+      raise newException(ValueError,
+        "blockHash cannot be combined with fromBlock or toBlock")
+    result.blockHash = some(hash)
+  if n.hasKey("address"):
+    let node = n["address"]
+    case node.kind
+    of JNull:
+      discard
+    of JArray:
+      for item in node:
+        var address: EthAddress
+        fromJson(item, "address", address)
+        result.address.add address
+    else:
+      var address: EthAddress
+      fromJson(node, "address", address)
+      result.address.add address
+  if n.hasKey("topics") and n["topics"].kind != JNull:
+    n["topics"].kind.expect(JArray, "topics")
+    for item in n["topics"]:
+      case item.kind
+      of JNull:
+        result.topics.add none(seq[Hash256])
+      of JArray:
+        var list: seq[Hash256]
+        for sub in item:
+          var hash: Hash256
+          fromJson(sub, "topics", hash)
+          list.add hash
+        result.topics.add some(list)
+      else:
+        var hash: Hash256
+        fromJson(item, "topics", hash)
+        result.topics.add some(@[hash])
+
+proc getLogs*(chain: BaseChainDB; opts: FilterOptions): seq[FilterLog] =
+  ## Logs of the canonical chain matching `opts`
+  if opts.blockHash.isSome:
+    let header = chain.getBlockHeader(opts.blockHash.get)
+    chain.collectLogs(header, opts, result)
+  else:
+    let (fromBlock, toBlock) = chain.blockRange(opts)
+    result = chain.getLogsImpl(opts, fromBlock, toBlock)
+
+proc newFilterRegistry*(): FilterRegistry =
+  FilterRegistry(filters: initTable[int,InstalledFilter]())
+
+proc installLogFilter*(reg: FilterRegistry; chain: BaseChainDB;
+                       opts: FilterOptions): int =
+  ## Returns the filter ID. Changes are reported for blocks after the
+  ## current canonical head.
+  reg.install InstalledFilter(
+    kind:      fltLogs,
+    options:   opts,
+    lastBlock: chain.getCanonicalHead.blockNumber,
+    lastPoll:  getTime())
+
+proc installBlockFilter*(reg: FilterRegistry; chain: BaseChainDB): int =
+  reg.install InstalledFilter(
+    kind:      fltBlocks,
+    lastBlock: chain.getCanonicalHead.blockNumber,
+    lastPoll:  getTime())
+
+proc uninstall*(reg: FilterRegistry; id: int): bool =
+  reg.expire
+  if reg.filters.hasKey(id):
+    reg.filters.del id
+    return true
+
+proc filterChanges*(reg: FilterRegistry; chain: BaseChainDB;
+                    id: int): JsonNode =
+  ## New logs (or block hashes for a block filter) since the last poll
+  let head = chain.getCanonicalHead.blockNumber
+  reg.withFilter(id, flt):
+    case flt.kind
+    of fltBlocks:
+      var
+        hashes: seq[Hash256]
+        num = flt.lastBlock + 1.u256
+      while num <= head:
+        hashes.add chain.getBlockHash(num)
+        num += 1.u256
+      result = %hashes
+    of fltLogs:
+      var (fromBlock, toBlock) = chain.blockRange(flt.options)
+      if fromBlock <= flt.lastBlock:
+        fromBlock = flt.lastBlock + 1.u256
+      if head < toBlock or flt.options.toBlock.isNone:
+        toBlock = head
+      result = %chain.getLogsImpl(flt.options, fromBlock, toBlock)
+    if flt.lastBlock < head:
+      flt.lastBlock = head
+
+proc filterLogs*(reg: FilterRegistry; chain: BaseChainDB;
+                 id: int): seq[FilterLog] =
+  ## All logs matching the log filter `id`
+  reg.withFilter(id, flt):
+    if flt.kind != fltLogs:
+      raise newException(ValueError, "not a log filter")
+    result = chain.getLogs(flt.options)
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
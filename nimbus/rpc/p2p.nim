@@ -14,7 +14,7 @@ import
   eth/p2p/rlpx_protocols/eth_protocol,
   ../transaction, ../config, ../vm_state, ../constants,
   ../utils, ../db/[db_chain, state_db],
-  rpc_types, rpc_utils,
+  rpc_types, rpc_utils, filters, call_pool,
   ../transaction/call_evm
 
 #[
@@ -26,7 +26,11 @@ import
       type cast to avoid extra processing.
 ]#
 
-proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer) =
+proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer,
+                  callPool: CallPool = nil) =
+  ## Calls are executed by `callPool` unless `nil`, on the main thread otherwise
+
+  let filterRegistry = newFilterRegistry()
 
   proc getAccountDb(header: BlockHeader): ReadOnlyStateDB =
     ## Retrieves the account db from canonical head
@@ -263,7 +267,10 @@ proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer) =
     let
       header   = headerFromTag(chain, quantityTag)
       callData = callData(call, true, chain)
-    result = rpcDoCall(callData, header, chain)
+    if callPool.isNil:
+      result = rpcDoCall(callData, header, chain)
+    else:
+      result = await callPool.call(callData, header)
 
   server.rpc("eth_estimateGas") do(call: EthCall, quantityTag: string) -> HexQuantityStr:
     ## Generates and returns an estimate of how much gas is necessary to allow the transaction to complete.
@@ -276,7 +283,11 @@ proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer) =
     let
       header   = chain.headerFromTag(quantityTag)
       callData = callData(call, false, chain)
-      gasUsed  = rpcEstimateGas(callData, header, chain, call.gas.isSome)
+      gasUsed  =
+        if callPool.isNil:
+          rpcEstimateGas(callData, header, chain, call.gas.isSome)
+        else:
+          await callPool.estimateGas(callData, header, call.gas.isSome)
     result = encodeQuantity(gasUsed.uint64)
 
   server.rpc("eth_getBlockByHash") do(data: EthHashStr, fullTransactions: bool) -> Option[BlockObject]:
@@ -412,7 +423,6 @@ proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer) =
     uncle.totalDifficulty = encodeQuantity(chain.getScore(header.hash))
     result = some(uncle)
 
-#[
   server.rpc("eth_newFilter") do(filterOptions: FilterOptions) -> int:
     ## Creates a filter object, based on filter options, to notify when the state changes (logs).
     ## To check if the state has changed, call eth_getFilterChanges.
@@ -425,21 +435,14 @@ proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer) =
     ##
     ## filterOptions: settings for this filter.
     ## Returns integer filter id.
-    discard
+    result = filterRegistry.installLogFilter(chain, filterOptions)
 
   server.rpc("eth_newBlockFilter") do() -> int:
     ## Creates a filter in the node, to notify when a new block arrives.
     ## To check if the state has changed, call eth_getFilterChanges.
     ##
     ## Returns integer filter id.
-    discard
-
-  server.rpc("eth_newPendingTransactionFilter") do() -> int:
-    ## Creates a filter in the node, to notify when a new block arrives.
-    ## To check if the state has changed, call eth_getFilterChanges.
-    ##
-    ## Returns integer filter id.
-    discard
+    result = filterRegistry.installBlockFilter(chain)
 
   server.rpc("eth_uninstallFilter") do(filterId: int) -> bool:
     ## Uninstalls a filter with given id. Should always be called when watch is no longer needed.
@@ -447,23 +450,32 @@ proc setupEthRpc*(node: EthereumNode, chain: BaseChainDB , server: RpcServer) =
     ##
     ## filterId: The filter id.
     ## Returns true if the filter was successfully uninstalled, otherwise false.
-    discard
+    result = filterRegistry.uninstall(filterId)
 
-  server.rpc("eth_getFilterChanges") do(filterId: int) -> seq[FilterLog]:
+  server.rpc("eth_getFilterChanges") do(filterId: int) -> JsonNode:
     ## Polling method for a filter, which returns an list of logs which occurred since last poll.
+    ## For a block filter, the list contains the hashes of the new blocks.
     ##
     ## filterId: the filter id.
-    result = @[]
+    result = filterRegistry.filterChanges(chain, filterId)
 
   server.rpc("eth_getFilterLogs") do(filterId: int) -> seq[FilterLog]:
     ## filterId: the filter id.
     ## Returns a list of all logs matching filter with given id.
-    result = @[]
+    result = filterRegistry.filterLogs(chain, filterId)
 
   server.rpc("eth_getLogs") do(filterOptions: FilterOptions) -> seq[FilterLog]:
     ## filterOptions: settings for this filter.
     ## Returns a list of all logs matching a given filter object.
-    result = @[]
+    result = chain.getLogs(filterOptions)
+
+#[
+  server.rpc("eth_newPendingTransactionFilter") do() -> int:
+    ## Creates a filter in the node, to notify when a new block arrives.
+    ## To check if the state has changed, call eth_getFilterChanges.
+    ##
+    ## Returns integer filter id.
+    discard
 
   server.rpc("eth_getWork") do() -> array[3, UInt256]:
     ## Returns the hash of the current block, the seedHash, and the boundary condition to be met ("target").
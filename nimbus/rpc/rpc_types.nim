@@ -81,17 +81,17 @@ type
 
   FilterLog* = object
     # Returned to user
-    removed*: bool                      # true when the log was removed, due to a chain reorganization. false if its a valid log.
-    logIndex*: Option[int]              # integer of the log index position in the block. null when its pending log.
-    transactionIndex*: Option[int]      # integer of the transactions index position log was created from. null when its pending log.
-    transactionHash*: Option[Hash256]   # hash of the transactions this log was created from. null when its pending log.
-    blockHash*: Option[Hash256]         # hash of the block where this log was in. null when its pending. null when its pending log.
-    blockNumber*: Option[BlockNumber]   # the block number where this log was in. null when its pending. null when its pending log.
-    address*: EthAddress                # address from which this log originated.
-    data*: seq[Hash256]                 # contains one or more 32 Bytes non-indexed arguments of the log.
-    topics*: array[4, Hash256]          # array of 0 to 4 32 Bytes DATA of indexed log arguments.
-                                        # (In solidity: The first topic is the hash of the signature of the event.
-                                        # (e.g. Deposit(address,bytes32,uint256)), except you declared the event with the anonymous specifier.)
+    removed*: bool                          # true when the log was removed, due to a chain reorganization. false if its a valid log.
+    logIndex*: Option[HexQuantityStr]       # integer of the log index position in the block. null when its pending log.
+    transactionIndex*: Option[HexQuantityStr] # integer of the transactions index position log was created from. null when its pending log.
+    transactionHash*: Option[Hash256]       # hash of the transactions this log was created from. null when its pending log.
+    blockHash*: Option[Hash256]             # hash of the block where this log was in. null when its pending. null when its pending log.
+    blockNumber*: Option[HexQuantityStr]    # the block number where this log was in. null when its pending. null when its pending log.
+    address*: EthAddress                    # address from which this log originated.
+    data*: seq[byte]                        # contains one or more 32 Bytes non-indexed arguments of the log.
+    topics*: seq[Hash256]                   # array of 0 to 4 32 Bytes DATA of indexed log arguments.
+                                            # (In solidity: The first topic is the hash of the signature of the event.
+                                            # (e.g. Deposit(address,bytes32,uint256)), except you declared the event with the anonymous specifier.)
 
   ReceiptObject* = object
     # A transaction receipt object, or null when no receipt was found:
@@ -109,17 +109,10 @@ type
     root*: Option[Hash256]                # post-transaction stateroot (pre Byzantium).
     status*: Option[int]                  # 1 = success, 0 = failure.
 
-  FilterDataKind* = enum fkItem, fkList
-  FilterData* = object
-    # Difficult to process variant objects in input data, as kind is immutable.
-    # TODO: This might need more work to handle "or" options
-    kind*: FilterDataKind
-    items*: seq[FilterData]
-    item*: UInt256
-
   FilterOptions* = object
-    # Parameter from user
+    # Parameter from user, parsed by `filters.fromJson()`
     fromBlock*: Option[string]            # (optional, default: "latest") integer block number, or "latest" for the last mined block or "pending", "earliest" for not yet mined transactions.
     toBlock*: Option[string]              # (optional, default: "latest") integer block number, or "latest" for the last mined block or "pending", "earliest" for not yet mined transactions.
-    address*: Option[EthAddress]          # (optional) contract address or a list of addresses from which logs should originate.
-    topics*: Option[seq[FilterData]]      # (optional) list of DATA topics. Topics are order-dependent. Each topic can also be a list of DATA with "or" options.
+    blockHash*: Option[Hash256]           # (optional) restrict to a single block, excludes fromBlock and toBlock (EIP-234).
+    address*: seq[EthAddress]             # (optional) contract address or a list of addresses from which logs should originate.
+    topics*: seq[Option[seq[Hash256]]]    # (optional) list of DATA topics. Topics are order-dependent. Each topic can also be null or a list of DATA with "or" options.
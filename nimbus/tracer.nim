@@ -70,6 +70,28 @@ proc dumpMemoryDB*(node: JsonNode, memoryDB: TrieDatabaseRef) =
     n[k.toHex(false)] = %v
   node["state"] = n
 
+proc streamTo(vmState: BaseVMState, output: File) =
+  ## Write struct logs (or call frames with `CallTracer`) to `output` as
+  ## they are recorded, one JSON object per line, rather than collecting
+  ## them in the tracing result
+  vmState.tracer.stream = output
+
+proc finishStream(res: JsonNode, vmState: BaseVMState, output: File) =
+  # The traced entries are in `output` already, a summary line goes last
+  if output.isNil:
+    return
+  if not vmState.tracer.pending.isNil:
+    output.writeLine($vmState.tracer.pending)
+    vmState.tracer.pending = nil
+  for key in ["structLogs", "calls"]:
+    if res.hasKey(key):
+      res.delete(key)
+  output.writeLine($(%{
+    "gas": res["gas"],
+    "failed": res["failed"],
+    "returnValue": res["returnValue"]}))
+  output.flushFile()
+
 const
   senderName = "sender"
   recipientName = "recipient"
@@ -78,7 +100,10 @@ const
   internalTxName = "internalTx"
 
 proc traceTransaction*(chainDB: BaseChainDB, header: BlockHeader,
-                       body: BlockBody, txIndex: int, tracerFlags: set[TracerFlags] = {}): JsonNode =
+                       body: BlockBody, txIndex: int, tracerFlags: set[TracerFlags] = {},
+                       output: File = nil): JsonNode =
+  ## Trace the transaction at `txIndex`. If `output` is given, the struct
+  ## logs (or call frames) are written to it instead of the result.
   let
     parent = chainDB.getParentHeader(header)
     # we add a memory layer between backend/lower layer db
@@ -89,6 +114,7 @@ proc traceTransaction*(chainDB: BaseChainDB, header: BlockHeader,
     captureChainDB = newBaseChainDB(captureTrieDB, false, chainDB.networkId) # prune or not prune?
     vmState = newBaseVMState(parent.stateRoot, header, captureChainDB, tracerFlags + {EnableAccount})
 
+  vmState.streamTo(output)
   var stateDb = vmState.accountDb
 
   if header.txRoot == BLANK_ROOT_HASH: return newJNull()
@@ -139,6 +165,7 @@ proc traceTransaction*(chainDB: BaseChainDB, header: BlockHeader,
 
   result = vmState.getTracingResult()
   result["gas"] = %gasUsed
+  result.finishStream(vmState, output)
 
   if TracerFlags.DisableStateDiff notin tracerFlags:
     result["stateDiff"] = stateDiff
@@ -204,7 +231,10 @@ proc dumpBlockState*(db: BaseChainDB, header: BlockHeader, body: BlockBody, dump
   if dumpState:
     result.dumpMemoryDB(memoryDB)
 
-proc traceBlock*(chainDB: BaseChainDB, header: BlockHeader, body: BlockBody, tracerFlags: set[TracerFlags] = {}): JsonNode =
+proc traceBlock*(chainDB: BaseChainDB, header: BlockHeader, body: BlockBody,
+                 tracerFlags: set[TracerFlags] = {}, output: File = nil): JsonNode =
+  ## Trace all transactions of the block, see `traceTransaction()` for
+  ## `output`
   let
     parent = chainDB.getParentHeader(header)
     memoryDB = newMemoryDB()
@@ -214,6 +244,7 @@ proc traceBlock*(chainDB: BaseChainDB, header: BlockHeader, body: BlockBody, tra
     vmState = newBaseVMState(parent.stateRoot, header, captureChainDB, tracerFlags + {EnableTracing})
 
   if header.txRoot == BLANK_ROOT_HASH: return newJNull()
+  vmState.streamTo(output)
   doAssert(body.transactions.calcTxRoot == header.txRoot)
   doAssert(body.transactions.len != 0)
 
@@ -225,6 +256,7 @@ proc traceBlock*(chainDB: BaseChainDB, header: BlockHeader, body: BlockBody, tra
 
   result = vmState.getTracingResult()
   result["gas"] = %gasUsed
+  result.finishStream(vmState, output)
 
   if TracerFlags.DisableState notin tracerFlags:
     result.dumpMemoryDB(memoryDB)
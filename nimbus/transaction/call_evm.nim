@@ -9,10 +9,18 @@
 import
   eth/common/eth_types, stint, options, stew/byteutils,
   ".."/[vm_types, vm_state, vm_internals, vm_gas_costs, forks],
-  ".."/[db/db_chain, db/accounts_cache, transaction], eth/trie/db,
+  ".."/[db/db_chain, db/accounts_cache, db/state_cache, transaction],
+  eth/trie/db,
   ".."/[config, utils, rpc/hexstrings],
   ./call_common
 
+const
+  estimateGasErrorRatio = 0.015
+    ## `rpcEstimateGas()` stops when the gas limit is known within this ratio
+
+  callStipend = 2300
+    ## Gas passed with a value transfer, may be needed beyond the gas used
+
 type
   RpcCallData* = object
     source*: EthAddress
@@ -45,13 +53,16 @@ proc rpcRunComputation(vmState: BaseVMState, rpc: RpcCallData,
     noRefund:     not forEstimateGas    # Don't apply gas refund/burn rule.
   ))
 
-proc rpcDoCall*(call: RpcCallData, header: BlockHeader, chain: BaseChainDB): HexDataStr =
+proc rpcDoCall*(call: RpcCallData, header: BlockHeader, chain: BaseChainDB,
+                sc: StateCacheRef = nil): HexDataStr =
+  ## Optional `sc` is a cross-call state cache, e.g. of a worker thread
   # TODO: handle revert and error
   # TODO: handle contract ABI
   # we use current header stateRoot, unlike block validation
   # which use previous block stateRoot
   # TODO: ^ Check it's correct to use current header stateRoot, not parent
   let vmState    = newBaseVMState(header.stateRoot, header, chain)
+  vmState.accountDb.attachStateCache(sc)
   let callResult = rpcRunComputation(vmState, call, call.gas)
   return hexDataStr(callResult.output)
 
@@ -82,7 +93,12 @@ func rpcValidateCall(call: RpcCallData, vmState: BaseVMState, gasLimit: GasInt,
     return false
   return true
 
-proc rpcEstimateGas*(call: RpcCallData, header: BlockHeader, chain: BaseChainDB, haveGasLimit: bool): GasInt =
+proc rpcEstimateGas*(call: RpcCallData, header: BlockHeader, chain: BaseChainDB,
+                     haveGasLimit: bool, sc: StateCacheRef = nil): GasInt =
+  ## Lowest gas limit the call succeeds with, within `estimateGasErrorRatio`.
+  ## If it fails with all the available gas, the gas used is returned as
+  ## before. Optional `sc` is a cross-call state cache, a temporary one is
+  ## used otherwise so that the search runs against warm state.
   # TODO: handle revert and error
   var
     # we use current header stateRoot, unlike block validation
@@ -109,8 +125,42 @@ proc rpcEstimateGas*(call: RpcCallData, header: BlockHeader, chain: BaseChainDB,
   var dbTx = chain.db.beginTransaction()
   defer: dbTx.dispose()
 
+  let cache = if sc.isNil: newStateCache() else: sc
+  vmState.accountDb.attachStateCache(cache)
+
+  proc succeeds(gas: GasInt): bool =
+    # Each run starts from the state at `header`, the committed state read
+    # by the previous runs is served by `cache`.
+    let vmState = newBaseVMState(header.stateRoot, header, chain)
+    vmState.accountDb.attachStateCache(cache)
+    not rpcRunComputation(vmState, call, gas, some(fork), true).isError
+
   let callResult = rpcRunComputation(vmState, call, gasLimit, some(fork), true)
-  return callResult.gasUsed
+  if callResult.isError:
+    return callResult.gasUsed
+
+  # Like Geth, search `(lo,hi]` with `lo` failing and `hi` succeeding. The
+  # gas used is a lower bound, and the common answer unless refunds or the
+  # 63/64 rule of EIP-150 (reserving gas for the caller) get in the way.
+  var
+    lo = callResult.gasUsed - 1
+    hi = gasLimit
+  if callResult.gasUsed < hi:
+    if succeeds(callResult.gasUsed):
+      return callResult.gasUsed
+    lo = callResult.gasUsed
+  let optimistic = (callResult.gasUsed + callStipend) * 64 div 63
+  if lo < optimistic and optimistic < hi:
+    if succeeds(optimistic): hi = optimistic
+    else: lo = optimistic
+
+  while lo + 1 < hi and
+      estimateGasErrorRatio < (hi - lo).float / hi.float:
+    # Bisect, but not too far above a failing `lo`
+    let mid = min((lo + hi) div 2, lo * 2)
+    if succeeds(mid): hi = mid
+    else: lo = mid
+  return hi
 
 proc txCallEvm*(tx: Transaction, sender: EthAddress, vmState: BaseVMState, fork: Fork): GasInt =
   var call = CallParams(
@@ -1,14 +1,12 @@
 import
   os, tables, json, ./config, stew/[results, byteutils],
-  eth/trie/db, eth/[trie, rlp, common, keyfile], nimcrypto
+  eth/trie/db, eth/[trie, rlp, common, keyfile], nimcrypto,
+  ./db/stack_trie
 
 export nimcrypto.`$`
 
 proc calcRootHash[T](items: openArray[T]): Hash256 =
-  var tr = initHexaryTrie(newMemoryDB())
-  for i, t in items:
-    tr.put(rlp.encode(i), rlp.encode(t))
-  return tr.rootHash
+  orderedTrieRoot(items)
 
 template calcTxRoot*(transactions: openArray[Transaction]): Hash256 =
   calcRootHash(transactions)
@@ -0,0 +1,249 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## BLAKE2b SIMD Compression
+## ========================
+##
+## SSE4.1 and AVX2 kernels of the BLAKE2b compression function `F` with a
+## variable number of rounds (EIP-152), for the `blake2b_f` precompile. The
+## four columns (and diagonals) of the state are mixed in parallel, one
+## state row per AVX2 register or per pair of SSE registers.
+##
+## The kernels are C functions compiled for their instruction set with the
+## GCC/Clang `target` attribute, so the rest of the binary does not need
+## any `-m` flags. The best kernel is selected at run time by the CPU
+## features. Elsewhere, or with `-d:blake2b_scalar`, `blake2bKernel()` is
+## always `bkScalar` and the caller uses its scalar code.
+
+type
+  Blake2bKernel* = enum
+    bkScalar = "scalar"
+    bkSse41 = "sse4.1"
+    bkAvx2 = "avx2"
+
+const
+  blake2bSimdEnabled* = defined(amd64) and
+                        (defined(gcc) or defined(clang)) and
+                        not defined(blake2b_scalar)
+
+{.push raises: [Defect].}
+
+when blake2bSimdEnabled:
+  {.emit: """/*INCLUDESECTION*/
+#include <stdint.h>
+#include <immintrin.h>
+""".}
+
+  {.emit: """/*TYPESECTION*/
+static const uint8_t nimbus_b2b_sigma[10][16] = {
+  { 0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15},
+  {14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3},
+  {11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4},
+  { 7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8},
+  { 9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13},
+  { 2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9},
+  {12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11},
+  {13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10},
+  { 6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5},
+  {10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0}
+};
+
+static const uint64_t nimbus_b2b_iv[8] = {
+  0x6A09E667F3BCC908ULL, 0xBB67AE8584CAA73BULL,
+  0x3C6EF372FE94F82BULL, 0xA54FF53A5F1D36F1ULL,
+  0x510E527FADE682D1ULL, 0x9B05688C2B3E6C1FULL,
+  0x1F83D9ABFB41BD6BULL, 0x5BE0CD19137E2179ULL
+};
+
+/* rows a, b, c, d hold v[0..3], v[4..7], v[8..11], v[12..15] */
+#define NIMBUS_B2B_G(W, add, xor, ror32, ror24, ror16, ror63, a, b, c, d, x, y) \
+  a = add(add(a, b), x); d = ror32(xor(d, a));  \
+  c = add(c, d);         b = ror24(xor(b, c));  \
+  a = add(add(a, b), y); d = ror16(xor(d, a));  \
+  c = add(c, d);         b = ror63(xor(b, c));
+
+#define NIMBUS_AVX2_ROR32(x) _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1))
+#define NIMBUS_AVX2_ROR24(x) _mm256_shuffle_epi8(x, r24)
+#define NIMBUS_AVX2_ROR16(x) _mm256_shuffle_epi8(x, r16)
+#define NIMBUS_AVX2_ROR63(x) \
+  _mm256_or_si256(_mm256_srli_epi64(x, 63), _mm256_add_epi64(x, x))
+
+__attribute__((target("avx2")))
+static void nimbus_blake2b_avx2(uint64_t *h, const uint64_t *m,
+                                uint64_t t0, uint64_t t1,
+                                int last, uint32_t rounds) {
+  const __m256i r16 = _mm256_setr_epi8(
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9,
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  const __m256i r24 = _mm256_setr_epi8(
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10,
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  __m256i a = _mm256_loadu_si256((const __m256i *)&h[0]);
+  __m256i b = _mm256_loadu_si256((const __m256i *)&h[4]);
+  __m256i c = _mm256_loadu_si256((const __m256i *)&nimbus_b2b_iv[0]);
+  __m256i d = _mm256_setr_epi64x(
+    nimbus_b2b_iv[4] ^ t0, nimbus_b2b_iv[5] ^ t1,
+    last ? ~nimbus_b2b_iv[6] : nimbus_b2b_iv[6], nimbus_b2b_iv[7]);
+  __m256i x, y;
+
+  for (uint32_t i = 0; i < rounds; i++) {
+    const uint8_t *s = nimbus_b2b_sigma[i % 10];
+
+    x = _mm256_setr_epi64x(m[s[0]], m[s[2]], m[s[4]], m[s[6]]);
+    y = _mm256_setr_epi64x(m[s[1]], m[s[3]], m[s[5]], m[s[7]]);
+    NIMBUS_B2B_G(256, _mm256_add_epi64, _mm256_xor_si256,
+                 NIMBUS_AVX2_ROR32, NIMBUS_AVX2_ROR24,
+                 NIMBUS_AVX2_ROR16, NIMBUS_AVX2_ROR63, a, b, c, d, x, y)
+
+    /* diagonalise */
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));
+
+    x = _mm256_setr_epi64x(m[s[8]], m[s[10]], m[s[12]], m[s[14]]);
+    y = _mm256_setr_epi64x(m[s[9]], m[s[11]], m[s[13]], m[s[15]]);
+    NIMBUS_B2B_G(256, _mm256_add_epi64, _mm256_xor_si256,
+                 NIMBUS_AVX2_ROR32, NIMBUS_AVX2_ROR24,
+                 NIMBUS_AVX2_ROR16, NIMBUS_AVX2_ROR63, a, b, c, d, x, y)
+
+    b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));
+    c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));
+    d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));
+  }
+
+  a = _mm256_xor_si256(a, c);
+  b = _mm256_xor_si256(b, d);
+  _mm256_storeu_si256((__m256i *)&h[0],
+    _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&h[0]), a));
+  _mm256_storeu_si256((__m256i *)&h[4],
+    _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&h[4]), b));
+}
+
+#define NIMBUS_SSE_ROR32(x) _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1))
+#define NIMBUS_SSE_ROR24(x) _mm_shuffle_epi8(x, r24)
+#define NIMBUS_SSE_ROR16(x) _mm_shuffle_epi8(x, r16)
+#define NIMBUS_SSE_ROR63(x) \
+  _mm_or_si128(_mm_srli_epi64(x, 63), _mm_add_epi64(x, x))
+
+/* rows are split into low (lanes 0, 1) and high (lanes 2, 3) halves */
+#define NIMBUS_SSE_G(x0, x1, y0, y1) \
+  NIMBUS_B2B_G(128, _mm_add_epi64, _mm_xor_si128, NIMBUS_SSE_ROR32, \
+               NIMBUS_SSE_ROR24, NIMBUS_SSE_ROR16, NIMBUS_SSE_ROR63, \
+               al, bl, cl, dl, x0, y0) \
+  NIMBUS_B2B_G(128, _mm_add_epi64, _mm_xor_si128, NIMBUS_SSE_ROR32, \
+               NIMBUS_SSE_ROR24, NIMBUS_SSE_ROR16, NIMBUS_SSE_ROR63, \
+               ah, bh, ch, dh, x1, y1)
+
+__attribute__((target("sse4.1")))
+static void nimbus_blake2b_sse41(uint64_t *h, const uint64_t *m,
+                                 uint64_t t0, uint64_t t1,
+                                 int last, uint32_t rounds) {
+  const __m128i r16 = _mm_setr_epi8(
+    2, 3, 4, 5, 6, 7, 0, 1, 10, 11, 12, 13, 14, 15, 8, 9);
+  const __m128i r24 = _mm_setr_epi8(
+    3, 4, 5, 6, 7, 0, 1, 2, 11, 12, 13, 14, 15, 8, 9, 10);
+  __m128i al = _mm_loadu_si128((const __m128i *)&h[0]);
+  __m128i ah = _mm_loadu_si128((const __m128i *)&h[2]);
+  __m128i bl = _mm_loadu_si128((const __m128i *)&h[4]);
+  __m128i bh = _mm_loadu_si128((const __m128i *)&h[6]);
+  __m128i cl = _mm_loadu_si128((const __m128i *)&nimbus_b2b_iv[0]);
+  __m128i ch = _mm_loadu_si128((const __m128i *)&nimbus_b2b_iv[2]);
+  __m128i dl = _mm_set_epi64x(nimbus_b2b_iv[5] ^ t1, nimbus_b2b_iv[4] ^ t0);
+  __m128i dh = _mm_set_epi64x(
+    nimbus_b2b_iv[7], last ? ~nimbus_b2b_iv[6] : nimbus_b2b_iv[6]);
+  __m128i x0, x1, y0, y1, t;
+
+  for (uint32_t i = 0; i < rounds; i++) {
+    const uint8_t *s = nimbus_b2b_sigma[i % 10];
+
+    x0 = _mm_set_epi64x(m[s[2]], m[s[0]]);
+    x1 = _mm_set_epi64x(m[s[6]], m[s[4]]);
+    y0 = _mm_set_epi64x(m[s[3]], m[s[1]]);
+    y1 = _mm_set_epi64x(m[s[7]], m[s[5]]);
+    NIMBUS_SSE_G(x0, x1, y0, y1)
+
+    /* diagonalise */
+    t = _mm_alignr_epi8(bh, bl, 8); bh = _mm_alignr_epi8(bl, bh, 8); bl = t;
+    t = cl; cl = ch; ch = t;
+    t = _mm_alignr_epi8(dl, dh, 8); dh = _mm_alignr_epi8(dh, dl, 8); dl = t;
+
+    x0 = _mm_set_epi64x(m[s[10]], m[s[8]]);
+    x1 = _mm_set_epi64x(m[s[14]], m[s[12]]);
+    y0 = _mm_set_epi64x(m[s[11]], m[s[9]]);
+    y1 = _mm_set_epi64x(m[s[15]], m[s[13]]);
+    NIMBUS_SSE_G(x0, x1, y0, y1)
+
+    t = _mm_alignr_epi8(bl, bh, 8); bh = _mm_alignr_epi8(bh, bl, 8); bl = t;
+    t = cl; cl = ch; ch = t;
+    t = _mm_alignr_epi8(dh, dl, 8); dh = _mm_alignr_epi8(dl, dh, 8); dl = t;
+  }
+
+  _mm_storeu_si128((__m128i *)&h[0], _mm_xor_si128(
+    _mm_loadu_si128((const __m128i *)&h[0]), _mm_xor_si128(al, cl)));
+  _mm_storeu_si128((__m128i *)&h[2], _mm_xor_si128(
+    _mm_loadu_si128((const __m128i *)&h[2]), _mm_xor_si128(ah, ch)));
+  _mm_storeu_si128((__m128i *)&h[4], _mm_xor_si128(
+    _mm_loadu_si128((const __m128i *)&h[4]), _mm_xor_si128(bl, dl)));
+  _mm_storeu_si128((__m128i *)&h[6], _mm_xor_si128(
+    _mm_loadu_si128((const __m128i *)&h[6]), _mm_xor_si128(bh, dh)));
+}
+
+static int nimbus_blake2b_level = -1;
+
+static int nimbus_blake2b_detect(void) {
+  if (nimbus_blake2b_level < 0) {
+    __builtin_cpu_init();
+    nimbus_blake2b_level = __builtin_cpu_supports("avx2") ? 2 :
+                           __builtin_cpu_supports("sse4.1") ? 1 : 0;
+  }
+  return nimbus_blake2b_level;
+}
+
+static void nimbus_blake2b_compress(int kernel, uint64_t *h,
+                                    const uint64_t *m,
+                                    uint64_t t0, uint64_t t1,
+                                    int last, uint32_t rounds) {
+  if (kernel == 2)
+    nimbus_blake2b_avx2(h, m, t0, t1, last, rounds);
+  else
+    nimbus_blake2b_sse41(h, m, t0, t1, last, rounds);
+}
+""".}
+
+  proc nimbus_blake2b_detect(): cint
+    {.importc, nodecl, cdecl, gcsafe, raises: [].}
+  proc nimbus_blake2b_compress(kernel: cint; h, m: ptr uint64;
+                               t0, t1: uint64; last: cint; rounds: uint32)
+    {.importc, nodecl, cdecl, gcsafe, raises: [].}
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc blake2bKernel*(): Blake2bKernel =
+  ## Best kernel supported by the CPU
+  when blake2bSimdEnabled:
+    Blake2bKernel(nimbus_blake2b_detect())
+  else:
+    bkScalar
+
+proc blake2bCompress*(kernel: Blake2bKernel; h: var array[8, uint64];
+                      m: array[16, uint64]; t0, t1: uint64; last: bool;
+                      rounds: uint32) =
+  ## Compression function `F` with a SIMD kernel, which must be supported by
+  ## the CPU (i.e. not better than `blake2bKernel()`.)
+  doAssert(kernel != bkScalar and kernel <= blake2bKernel())
+  when blake2bSimdEnabled:
+    nimbus_blake2b_compress(kernel.cint, h[0].addr, m[0].unsafeAddr,
+                            t0, t1, last.cint, rounds)
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -0,0 +1,157 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## EVM Execution Profiler
+## ======================
+##
+## Compile time optional counters for op code and precompile execution and
+## state database reads. Enable with `-d:evm_profiler`, otherwise all the
+## templates below expand to their body only.
+##
+## Counters are collected in plain arrays while executing, and exported to
+## the metrics registry by `flushProfiler()` after each block:
+##
+## * `evm_op_calls`, `evm_op_nanoseconds`, `evm_op_gas` by op code
+## * `evm_precompile_calls`, `evm_precompile_nanoseconds`,
+##   `evm_precompile_gas` by precompile address
+## * `evm_block_db_reads` histogram of database reads per block, by kind
+##
+## The gas of a call or create op code includes the gas passed on to the
+## child computation, its execution time does not.
+
+import
+  ../vm2/interpreter/op_codes
+
+export
+  op_codes
+
+const
+  evmProfilerEnabled* = defined(evm_profiler)
+
+type
+  DbReadKind* = enum
+    drAccount = "account"
+    drStorage = "storage"
+    drCode = "code"
+
+  ProfCounter* = object
+    count*: int64
+    nanos*: int64
+    gas*: int64
+
+when evmProfilerEnabled:
+  import
+    std/monotimes,
+    metrics
+
+  declareCounter evm_op_calls,
+    "Number of executed op codes", labels = ["op"]
+  declareCounter evm_op_nanoseconds,
+    "Time spent executing op codes", labels = ["op"]
+  declareCounter evm_op_gas,
+    "Gas charged for op codes", labels = ["op"]
+  declareCounter evm_precompile_calls,
+    "Number of precompile calls", labels = ["address"]
+  declareCounter evm_precompile_nanoseconds,
+    "Time spent in precompiles", labels = ["address"]
+  declareCounter evm_precompile_gas,
+    "Gas charged by precompiles", labels = ["address"]
+  declareHistogram evm_block_db_reads,
+    "State database reads per block", labels = ["kind"],
+    buckets = [10.0, 100.0, 1000.0, 10000.0, 100000.0, Inf]
+
+  var
+    opStats: array[Op,ProfCounter]
+    precompileStats: array[byte,ProfCounter]
+    dbReads: array[DbReadKind,int64]
+
+  proc add(c: var ProfCounter; nanos, gas: int64) {.inline.} =
+    c.count.inc
+    c.nanos += nanos
+    c.gas += gas
+
+  template nowNanos: int64 =
+    getMonoTime().ticks
+
+# ------------------------------------------------------------------------------
+# Public templates, to be used in the execution hot paths
+# ------------------------------------------------------------------------------
+
+template profileOp*(op: Op; gasMeter: untyped; fixedGas: untyped;
+                    body: untyped) =
+  ## Account for op code execution. The `fixedGas` is added to the gas
+  ## consumed by `body`, it is non-zero if the op code gas was charged
+  ## ahead for the basic block.
+  when evmProfilerEnabled:
+    let
+      profGasBefore = gasMeter.gasRemaining
+      profStart = nowNanos()
+    body
+    opStats[op].add(nowNanos() - profStart,
+                    int64(profGasBefore - gasMeter.gasRemaining + fixedGas))
+  else:
+    body
+
+template profilePrecompile*(address: byte; gasMeter: untyped; body: untyped) =
+  ## Account for a precompile call
+  when evmProfilerEnabled:
+    let
+      profGasBefore = gasMeter.gasRemaining
+      profStart = nowNanos()
+    body
+    precompileStats[address].add(nowNanos() - profStart,
+                                 int64(profGasBefore - gasMeter.gasRemaining))
+  else:
+    body
+
+template profileDbRead*(kind: DbReadKind) =
+  ## Account for a state database read (i.e. a cache miss)
+  when evmProfilerEnabled:
+    dbReads[kind].inc
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc opProfile*(op: Op): ProfCounter =
+  ## Counters since the last `flushProfiler()`
+  when evmProfilerEnabled:
+    {.gcsafe.}:
+      result = opStats[op]
+
+proc flushProfiler*() =
+  ## Export and reset the counters, to be called after each block
+  when evmProfilerEnabled:
+    {.gcsafe.}:
+      for op in Op:
+        let c = opStats[op]
+        if 0 < c.count:
+          evm_op_calls.inc(c.count, labelValues = [$op])
+          evm_op_nanoseconds.inc(c.nanos, labelValues = [$op])
+          evm_op_gas.inc(c.gas, labelValues = [$op])
+          opStats[op].reset
+
+      for address in byte.low .. byte.high:
+        let c = precompileStats[address]
+        if 0 < c.count:
+          let label = $address.int
+          evm_precompile_calls.inc(c.count, labelValues = [label])
+          evm_precompile_nanoseconds.inc(c.nanos, labelValues = [label])
+          evm_precompile_gas.inc(c.gas, labelValues = [label])
+          precompileStats[address].reset
+
+      for kind in DbReadKind:
+        evm_block_db_reads.observe(dbReads[kind].float64,
+                                   labelValues = [$kind])
+        dbReads[kind] = 0
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
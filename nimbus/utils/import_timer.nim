@@ -0,0 +1,76 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Block Import Timer
+## ==================
+##
+## Wall clock time spent in the phases of `persistBlocks()` and the latency
+## of each block, for benchmarking block import (see `premix/bench.nim`.)
+## Nothing is recorded unless enabled with `startImportTimer()`, the state is
+## thread local.
+
+import
+  std/[monotimes, times]
+
+export
+  monotimes
+
+type
+  ImportPhase* = enum
+    ipSenders = "senders"       ## Waiting for the sender recovery pipeline
+    ipEvm = "evm"               ## Executing the transactions
+    ipStateRoot = "stateRoot"   ## Account cache persist and state root
+    ipDbWrite = "dbWrite"       ## Writing headers, receipts and the batch
+
+  ImportTimes* = object
+    phaseNanos*: array[ImportPhase,int64]
+    blockNanos*: seq[int64]     ## Per block, without the final batch write
+
+var
+  timerOn {.threadvar.}: bool
+  importTimes {.threadvar.}: ImportTimes
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc startImportTimer*() =
+  ## Reset and start recording
+  importTimes = ImportTimes()
+  timerOn = true
+
+proc stopImportTimer*(): ImportTimes =
+  ## Stop recording and return the times since `startImportTimer()`
+  timerOn = false
+  result = move importTimes
+
+proc importTimerOn*(): bool {.inline.} =
+  timerOn
+
+proc addPhaseTime*(phase: ImportPhase; start: MonoTime) =
+  importTimes.phaseNanos[phase] += (getMonoTime() - start).inNanoseconds
+
+proc addBlockTime*(start: MonoTime) =
+  ## Record the latency of a block started at `start`
+  if timerOn:
+    importTimes.blockNanos.add (getMonoTime() - start).inNanoseconds
+
+template timePhase*(phase: ImportPhase; body: untyped) =
+  ## Add the time spent in `body` to `phase`
+  let phaseStart = if importTimerOn(): getMonoTime() else: MonoTime()
+  body
+  if importTimerOn():
+    addPhaseTime(phase, phaseStart)
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
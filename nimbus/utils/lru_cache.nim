@@ -72,6 +72,53 @@ proc `==`[K,V](a, b: var LruData[K,V]): bool =
     a.last == b.last and
     a.tab == b.tab
 
+proc relinkLast[T,K,V,E](lru: var LruCache[T,K,V,E]; key: K)
+                    {.gcsafe, raises: [Defect,KeyError].} =
+  ## Move cached `key` item to the end of the LRU queue
+  if key == lru.data.last:
+    return
+  let lruItem = lru.data.tab[key]
+
+  # Unlink key Item
+  if key == lru.data.first:
+    lru.data.first = lruItem.nxt
+  else:
+    lru.data.tab[lruItem.prv].nxt = lruItem.nxt
+    lru.data.tab[lruItem.nxt].prv = lruItem.prv
+
+  # Append key item
+  lru.data.tab[lru.data.last].nxt = key
+  lru.data.tab[key].prv = lru.data.last
+  lru.data.last = key
+
+proc appendItem[T,K,V,E](lru: var LruCache[T,K,V,E]; key: K; value: V)
+                    {.gcsafe, raises: [Defect,KeyError].} =
+  ## Append new `key` item to the end of the LRU queue, possibly dropping the
+  ## first item.
+
+  # Limit number of cached items
+  if lru.data.maxItems <= lru.data.tab.len:
+    # Delete oldest/first entry
+    var nextKey = lru.data.tab[lru.data.first].nxt
+    lru.data.tab.del(lru.data.first)
+    lru.data.first = nextKey
+
+  # Add cache entry
+  var tabItem: LruItem[K,V]
+
+  # Initialise empty queue
+  if lru.data.tab.len == 0:
+    lru.data.first = key
+    lru.data.last = key
+  else:
+    # Append queue item
+    lru.data.tab[lru.data.last].nxt = key
+    tabItem.prv = lru.data.last
+    lru.data.last = key
+
+  tabItem.value = value
+  lru.data.tab[key] = tabItem
+
 # ------------------------------------------------------------------------------
 # Public constructor and reset
 # ------------------------------------------------------------------------------
@@ -124,49 +171,14 @@ proc getItem*[T,K,V,E](lru: var LruCache[T,K,V,E];
   # Relink item if already in the cache => move to last position
   if lru.data.tab.hasKey(key):
     let lruItem = lru.data.tab[key]
-
-    if peekOk or key == lru.data.last:
-      # Nothing to do
-      return ok(lruItem.value)
-
-    # Unlink key Item
-    if key == lru.data.first:
-      lru.data.first = lruItem.nxt
-    else:
-      lru.data.tab[lruItem.prv].nxt = lruItem.nxt
-      lru.data.tab[lruItem.nxt].prv = lruItem.prv
-
-    # Append key item
-    lru.data.tab[lru.data.last].nxt = key
-    lru.data.tab[key].prv = lru.data.last
-    lru.data.last = key
+    if not peekOk:
+      lru.relinkLast(key)
     return ok(lruItem.value)
 
   # Calculate value, pass through error unless OK
   let rcValue = ? lru.toValue(arg)
 
-  # Limit number of cached items
-  if lru.data.maxItems <= lru.data.tab.len:
-    # Delete oldest/first entry
-    var nextKey = lru.data.tab[lru.data.first].nxt
-    lru.data.tab.del(lru.data.first)
-    lru.data.first = nextKey
-
-  # Add cache entry
-  var tabItem: LruItem[K,V]
-
-  # Initialise empty queue
-  if lru.data.tab.len == 0:
-    lru.data.first = key
-    lru.data.last = key
-  else:
-    # Append queue item
-    lru.data.tab[lru.data.last].nxt = key
-    tabItem.prv = lru.data.last
-    lru.data.last = key
-
-  tabItem.value = rcValue
-  lru.data.tab[key] = tabItem
+  lru.appendItem(key, rcValue)
   result = ok(rcValue)
 
 # ------------------------------------------------------------------------------
@@ -215,7 +227,21 @@ proc setItem*[T,K,V,E](lru: var LruCache[T,K,V,E]; arg: T; value: V): bool
   if lru.data.tab.hasKey(key):
     lru.data.tab[key].value = value
     return true
- 
+
+
+proc putItem*[T,K,V,E](lru: var LruCache[T,K,V,E]; arg: T; value: V)
+                    {.gcsafe, raises: [Defect,CatchableError].} =
+  ## Insert or update the entry with key `lru.toKey(arg)` by `value` without
+  ## invoking the `toValue()` handler. The entry is moved to the end of the
+  ## LRU queue. This allows for using the LRU cache as a write-through cache
+  ## where `toValue()` only reports a cache miss.
+  let key = lru.toKey(arg)
+  if lru.data.tab.hasKey(key):
+    lru.data.tab[key].value = value
+    lru.relinkLast(key)
+  else:
+    lru.appendItem(key, value)
+
 
 proc delItem*[T,K,V,E](lru: var LruCache[T,K,V,E]; arg: T): bool
                      {.gcsafe, discardable, raises: [Defect,KeyError].} =
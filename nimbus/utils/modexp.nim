@@ -0,0 +1,218 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## Montgomery Modular Exponentiation
+## =================================
+##
+## Modular exponentiation for odd moduli, used by the MODEXP precompile
+## (EIP-198). Numbers are arrays of 32 bit limbs with the limb count `N` as a
+## static parameter, so there is one instance per size class with constant
+## loop bounds and no heap allocation in the multiplication.
+##
+## The size class is picked by the significant length of the modulus, not
+## by the declared length of the call data. Exponents of up to 64 bits
+## (e.g. 3 or 65537 for RSA signature verification) use plain square and
+## multiply, longer ones a fixed 4 bit window.
+
+import
+  std/bitops
+
+type
+  Limbs[N: static int] = array[N, uint32] ## Least significant limb first
+
+  MontCtx[N: static int] = object
+    m: Limbs[N]       ## Modulus, odd
+    m0inv: uint32     ## `-1/m mod 2^32`
+    one: Limbs[N]     ## `R mod m`, the Montgomery form of 1
+    r2: Limbs[N]      ## `R^2 mod m`, with `R = 2^(32*N)`
+
+const
+  smallExpBits = 64
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+func sigBytes(x: openArray[byte]): int =
+  ## Number of bytes without the leading zeros
+  result = x.len
+  for b in x:
+    if b != 0:
+      break
+    dec result
+
+func expBits(x: openArray[byte]): int =
+  let n = x.sigBytes
+  if n == 0:
+    return 0
+  var top = x[x.len - n]
+  result = 8 * (n - 1)
+  while top != 0:
+    inc result
+    top = top shr 1
+
+func expBit(x: openArray[byte]; i: int): bool {.inline.} =
+  ((x[x.high - i div 8] shr (i mod 8)) and 1) == 1
+
+func fromBytesBE[N: static int](data: openArray[byte]): Limbs[N] =
+  ## The bytes beyond `4*N` must be zero
+  for i in 0 ..< min(data.len, 4*N):
+    result[i div 4] =
+      result[i div 4] or (data[data.high - i].uint32 shl (8 * (i mod 4)))
+
+func toBytesBE[N: static int](x: Limbs[N]): seq[byte] =
+  result = newSeq[byte](4*N)
+  for i in 0 ..< 4*N:
+    result[result.high - i] = byte((x[i div 4] shr (8 * (i mod 4))) and 0xff)
+
+func geq[N: static int](a, b: Limbs[N]): bool =
+  for i in countdown(N-1, 0):
+    if a[i] != b[i]:
+      return b[i] < a[i]
+  true
+
+func sub[N: static int](a: var Limbs[N]; b: Limbs[N]) =
+  ## Modulo `2^(32*N)`
+  var borrow = 0'u64
+  for i in 0 ..< N:
+    let d = uint64(a[i]) - uint64(b[i]) - borrow
+    a[i] = uint32(d and 0xffff_ffff'u64)
+    borrow = d shr 63
+
+func double[N: static int](ctx: MontCtx[N]; a: var Limbs[N]) =
+  ## `a = 2*a mod m` for `a < m`
+  var carry = 0'u32
+  for i in 0 ..< N:
+    let top = a[i] shr 31
+    a[i] = (a[i] shl 1) or carry
+    carry = top
+  if carry != 0 or a.geq(ctx.m):
+    a.sub(ctx.m)
+
+func montMul[N: static int](ctx: MontCtx[N]; a, b: Limbs[N]): Limbs[N] =
+  ## `a*b/R mod m`, coarsely integrated operand scanning (CIOS)
+  var t: array[N+2, uint32]
+  for i in 0 ..< N:
+    let bi = uint64(b[i])
+    var c = 0'u64
+    for j in 0 ..< N:
+      let s = uint64(t[j]) + uint64(a[j]) * bi + c
+      t[j] = uint32(s and 0xffff_ffff'u64)
+      c = s shr 32
+    var s = uint64(t[N]) + c
+    t[N] = uint32(s and 0xffff_ffff'u64)
+    t[N+1] = uint32(s shr 32)
+
+    let m = uint64(t[0] * ctx.m0inv)
+    c = (uint64(t[0]) + m * uint64(ctx.m[0])) shr 32
+    for j in 1 ..< N:
+      s = uint64(t[j]) + m * uint64(ctx.m[j]) + c
+      t[j-1] = uint32(s and 0xffff_ffff'u64)
+      c = s shr 32
+    s = uint64(t[N]) + c
+    t[N-1] = uint32(s and 0xffff_ffff'u64)
+    t[N] = t[N+1] + uint32(s shr 32)
+
+  for i in 0 ..< N:
+    result[i] = t[i]
+  if t[N] != 0 or result.geq(ctx.m):
+    result.sub(ctx.m)
+
+func init[N: static int](ctx: var MontCtx[N]; modulus: openArray[byte]) =
+  ctx.m = fromBytesBE[N](modulus)
+
+  # Newton iteration, each step doubles the number of correct low bits
+  # starting with 3 for an odd `m[0]`
+  var inv = ctx.m[0]
+  for _ in 0 ..< 4:
+    inv = inv * (2'u32 - ctx.m[0] * inv)
+  ctx.m0inv = 0'u32 - inv
+
+  # `R mod m` by doubling the top bit of `m`, which is less than `m`
+  var topBit = 32*N - 1
+  while (ctx.m[topBit div 32] shr (topBit mod 32)) == 0:
+    dec topBit
+  ctx.one[topBit div 32] = 1'u32 shl (topBit mod 32)
+  for _ in topBit ..< 32*N:
+    ctx.double(ctx.one)
+
+  # `R^2 mod m` is the Montgomery form of `2^(32*N)`
+  var two = ctx.one
+  ctx.double(two)
+  ctx.r2 = ctx.one
+  const k = 32*N
+  for i in countdown(fastLog2(k), 0):
+    ctx.r2 = ctx.montMul(ctx.r2, ctx.r2)
+    if ((k shr i) and 1) == 1:
+      ctx.r2 = ctx.montMul(ctx.r2, two)
+
+func powModImpl[N: static int](base, exponent, modulus: openArray[byte]):
+                               seq[byte] =
+  var ctx: MontCtx[N]
+  ctx.init(modulus)
+  let
+    x = ctx.montMul(fromBytesBE[N](base), ctx.r2)
+    bits = exponent.expBits
+  var acc = ctx.one
+
+  if bits <= smallExpBits:
+    for i in countdown(bits - 1, 0):
+      acc = ctx.montMul(acc, acc)
+      if exponent.expBit(i):
+        acc = ctx.montMul(acc, x)
+  else:
+    var table: array[16, Limbs[N]]
+    table[0] = ctx.one
+    for i in 1 ..< 16:
+      table[i] = ctx.montMul(table[i-1], x)
+    for i in countdown((bits - 1) div 4, 0):
+      let nibble = (exponent[exponent.high - i div 2] shr (4 * (i mod 2))) and 15
+      for _ in 0 ..< 4:
+        acc = ctx.montMul(acc, acc)
+      if nibble != 0:
+        acc = ctx.montMul(acc, table[nibble])
+
+  var one: Limbs[N]
+  one[0] = 1
+  ctx.montMul(acc, one).toBytesBE
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+func powModOdd*(base, exponent, modulus: openArray[byte]): seq[byte] =
+  ## `base^exponent mod modulus` for big-endian numbers with an odd `modulus`
+  ## greater than one. `base` may be greater than the modulus if it fits the
+  ## size class, the conversion to Montgomery form reduces it. The result has
+  ## the length of the size class used, at least as many bytes as the
+  ## significant part of the modulus.
+  doAssert(0 < modulus.len and (modulus[^1] and 1) == 1)
+  let limbs = (modulus.sigBytes + 3) div 4
+  doAssert(base.sigBytes <= 4*limbs)
+  case limbs
+  of 0 .. 4: powModImpl[4](base, exponent, modulus)
+  of 5 .. 8: powModImpl[8](base, exponent, modulus)
+  of 9 .. 12: powModImpl[12](base, exponent, modulus)
+  of 13 .. 16: powModImpl[16](base, exponent, modulus)
+  of 17 .. 24: powModImpl[24](base, exponent, modulus)
+  of 25 .. 32: powModImpl[32](base, exponent, modulus)
+  of 33 .. 48: powModImpl[48](base, exponent, modulus)
+  of 49 .. 64: powModImpl[64](base, exponent, modulus)
+  of 65 .. 96: powModImpl[96](base, exponent, modulus)
+  of 97 .. 128: powModImpl[128](base, exponent, modulus)
+  of 129 .. 192: powModImpl[192](base, exponent, modulus)
+  of 193 .. 256: powModImpl[256](base, exponent, modulus)
+  else: raiseAssert "modulus too large for powModOdd"
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
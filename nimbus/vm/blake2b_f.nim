@@ -1,4 +1,6 @@
-import nimcrypto/utils
+import nimcrypto/utils, ../utils/blake2b_simd
+
+export Blake2bKernel, blake2bKernel
 
 # Blake2 `F` compression function
 # taken from nimcrypto with modification
@@ -55,10 +57,24 @@ template B2BROUND(v, m, n: untyped) =
   B2B_G(v, 2, 7,  8, 13, m[Sigma[n][12]], m[Sigma[n][13]])
   B2B_G(v, 3, 4,  9, 14, m[Sigma[n][14]], m[Sigma[n][15]])
 
-proc blake2Transform(ctx: var Blake2bContext, input: openArray[byte], last: bool, rounds: uint32) {.inline.} =
+proc blake2Transform(ctx: var Blake2bContext, input: openArray[byte], last: bool, rounds: uint32, kernel: Blake2bKernel) {.inline.} =
   var v: array[16, uint64]
   var m: array[16, uint64]
 
+  m[0] = leLoad64(input, 0); m[1] = leLoad64(input, 8)
+  m[2] = leLoad64(input, 16); m[3] = leLoad64(input, 24)
+  m[4] = leLoad64(input, 32); m[5] = leLoad64(input, 40)
+  m[6] = leLoad64(input, 48); m[7] = leLoad64(input, 56)
+  m[8] = leLoad64(input, 64); m[9] = leLoad64(input, 72)
+  m[10] = leLoad64(input, 80); m[11] = leLoad64(input, 88)
+  m[12] = leLoad64(input, 96); m[13] = leLoad64(input, 104)
+  m[14] = leLoad64(input, 112); m[15] = leLoad64(input, 120)
+
+  # SSE4.1/AVX2 kernels if the CPU supports them, see `blake2b_simd`
+  if kernel != bkScalar:
+    blake2bCompress(kernel, ctx.h, m, ctx.t[0], ctx.t[1], last, rounds)
+    return
+
   v[0] = ctx.h[0]; v[1] = ctx.h[1]
   v[2] = ctx.h[2]; v[3] = ctx.h[3]
   v[4] = ctx.h[4]; v[5] = ctx.h[5]
@@ -73,15 +89,6 @@ proc blake2Transform(ctx: var Blake2bContext, input: openArray[byte], last: bool
   if last:
     v[14] = not(v[14])
 
-  m[0] = leLoad64(input, 0); m[1] = leLoad64(input, 8)
-  m[2] = leLoad64(input, 16); m[3] = leLoad64(input, 24)
-  m[4] = leLoad64(input, 32); m[5] = leLoad64(input, 40)
-  m[6] = leLoad64(input, 48); m[7] = leLoad64(input, 56)
-  m[8] = leLoad64(input, 64); m[9] = leLoad64(input, 72)
-  m[10] = leLoad64(input, 80); m[11] = leLoad64(input, 88)
-  m[12] = leLoad64(input, 96); m[13] = leLoad64(input, 104)
-  m[14] = leLoad64(input, 112); m[15] = leLoad64(input, 120)
-
   for i in 0..<rounds:
     B2BROUND(v, m, i mod 10)
 
@@ -101,7 +108,9 @@ const
 
 # input should exactly 213 bytes
 # output needs to accomodate 64 bytes
-proc blake2b_F*(input: openArray[byte], output: var openArray[byte]): bool =
+# kernel defaults to the best one supported by the CPU
+proc blake2b_F*(input: openArray[byte], output: var openArray[byte],
+                kernel = blake2bKernel()): bool =
   # Make sure the input is valid (correct length and final flag)
   if input.len != blake2FInputLength:
     return false
@@ -128,7 +137,7 @@ proc blake2b_F*(input: openArray[byte], output: var openArray[byte]): bool =
   ctx.t[1] = leLoad64(input, 204)
 
   # Execute the compression function, extract and return the result
-  blake2Transform(ctx, input.toOpenArray(68, 195), final, rounds)
+  blake2Transform(ctx, input.toOpenArray(68, 195), final, rounds, kernel)
 
   leStore64(output, 0, ctx.h[0])
   leStore64(output, 8, ctx.h[1])
@@ -320,17 +320,24 @@ proc afterExecCreate(c: Computation) =
     c.rollback()
 
 proc beforeExec(c: Computation): bool {.noinline.} =
+  let tracing = EnableTracing in c.vmState.tracer.flags
+  if tracing:
+    c.vmState.tracer.traceCallStarted(c)
   if not c.msg.isCreate:
     c.beforeExecCall()
     false
   else:
-    c.beforeExecCreate()
+    result = c.beforeExecCreate()
+    if result and tracing:
+      c.vmState.tracer.traceCallEnded(c)
 
 proc afterExec(c: Computation) {.noinline.} =
   if not c.msg.isCreate:
     c.afterExecCall()
   else:
     c.afterExecCreate()
+  if EnableTracing in c.vmState.tracer.flags:
+    c.vmState.tracer.traceCallEnded(c)
 
 template chainTo*(c: Computation, toChild: typeof(c.child), after: untyped) =
   c.child = toChild
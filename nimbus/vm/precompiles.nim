@@ -2,7 +2,8 @@ import
   ./types, ../forks,
   ./interpreter/[gas_meter, gas_costs, utils/utils_numeric],
   ../errors, stint, eth/[keys, common], chronicles, tables, macros,
-  math, nimcrypto, bncurve/[fields, groups], ./blake2b_f, ./blscurve
+  math, nimcrypto, bncurve/[fields, groups], ./blake2b_f, ./blscurve,
+  ../utils/modexp
 
 type
   PrecompileAddresses* = enum
@@ -150,6 +151,9 @@ proc identity*(computation: Computation) =
   computation.output = computation.msg.data
   trace "Identity precompile", output = computation.output.toHex
 
+func isOddModulus(x: StUint): bool =
+  (x.truncate(uint64) and 1) == 1
+
 proc modExpInternal(computation: Computation, baseLen, expLen, modLen: int, T: type StUint) =
   template data: untyped {.dirty.} =
     computation.msg.data
@@ -175,13 +179,18 @@ proc modExpInternal(computation: Computation, baseLen, expLen, modLen: int, T: t
   let output = if modulo <= 1:
                   # If m == 0: EVM returns 0.
                   # If m == 1: we can shortcut that to 0 as well
-                  zero()
+                  @(zero())
               elif exp.isZero():
                   # If 0^0: EVM returns 1
                   # For all x != 0, x^0 == 1 as well
-                  one()
+                  @(one())
+              elif modulo.isOddModulus:
+                  # Montgomery engine sized by the modulus, `utils/modexp`
+                  let x = if base < modulo: base else: base mod modulo
+                  powModOdd(x.toByteArrayBE, exp.toByteArrayBE,
+                            modulo.toByteArrayBE)
               else:
-                  powmod(base, exp, modulo).toByteArrayBE
+                  @(powmod(base, exp, modulo).toByteArrayBE)
 
   # maximum output len is the same as modLen
   # if it less than modLen, it will be zero padded at left
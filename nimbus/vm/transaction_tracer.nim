@@ -19,10 +19,15 @@ proc initTracer*(tracer: var TransactionTracer, flags: set[TracerFlags] = {}) =
   tracer.trace["failed"] = %false
   tracer.trace["returnValue"] = %""
 
-  tracer.trace["structLogs"] = newJArray()
+  if TracerFlags.CallTracer in flags:
+    tracer.trace["calls"] = newJArray()
+  else:
+    tracer.trace["structLogs"] = newJArray()
   tracer.flags = flags
   tracer.accounts = initHashSet[EthAddress]()
   tracer.storageKeys = @[]
+  tracer.pending = nil
+  tracer.calls.setLen(0)
 
 proc prepare*(tracer: var TransactionTracer, compDepth: int) =
   # this uncommon arragement is intentional
@@ -44,12 +49,52 @@ iterator storage(tracer: TransactionTracer, compDepth: int): Uint256 =
   for key in tracer.storageKeys[compDepth]:
     yield key
 
+proc flushPending(tracer: var TransactionTracer) =
+  # With a stream, only the most recent struct log is kept. It is written
+  # when the next op code starts, so a late `traceError()` still applies.
+  if not tracer.pending.isNil:
+    tracer.stream.writeLine($tracer.pending)
+    tracer.pending = nil
+
+proc structLog(tracer: var TransactionTracer, lastIndex: int): JsonNode =
+  if not tracer.stream.isNil:
+    tracer.pending
+  elif lastIndex >= 0:
+    tracer.trace["structLogs"].elems[lastIndex]
+  else:
+    nil
+
 proc traceOpCodeStarted*(tracer: var TransactionTracer, c: Computation, op: Op): int =
   if unlikely tracer.trace.isNil:
     tracer.initTracer()
 
+  if TracerFlags.EnableAccount in tracer.flags:
+    case op
+    of Call, CallCode, DelegateCall, StaticCall:
+      if c.stack.values.len > 2:
+        tracer.accounts.incl c.stack[^2, EthAddress]
+    of ExtCodeCopy, ExtCodeSize, Balance, SelfDestruct:
+      if c.stack.values.len > 1:
+        tracer.accounts.incl c.stack[^1, EthAddress]
+    else:
+      discard
+
+  if TracerFlags.DisableStorage notin tracer.flags:
+    if op == Sstore:
+      if c.stack.values.len > 1:
+        tracer.rememberStorageKey(c.msg.depth, c.stack[^1, Uint256])
+
+  result = -1
+  if TracerFlags.CallTracer in tracer.flags:
+    return
+
   let j = newJObject()
-  tracer.trace["structLogs"].add(j)
+  if tracer.stream.isNil:
+    tracer.trace["structLogs"].add(j)
+    result = tracer.trace["structLogs"].len - 1
+  else:
+    tracer.flushPending()
+    tracer.pending = j
 
   j["op"] = %(($op).toUpperAscii)
   j["pc"] = %(c.code.pc - 1)
@@ -72,26 +117,12 @@ proc traceOpCodeStarted*(tracer: var TransactionTracer, c: Computation, op: Op):
       mem.add(%c.memory.bytes.toOpenArray(i * chunkLen, (i + 1) * chunkLen - 1).toHex())
     j["memory"] = mem
 
-  if TracerFlags.EnableAccount in tracer.flags:
-    case op
-    of Call, CallCode, DelegateCall, StaticCall:
-      if c.stack.values.len > 2:
-        tracer.accounts.incl c.stack[^2, EthAddress]
-    of ExtCodeCopy, ExtCodeSize, Balance, SelfDestruct:
-      if c.stack.values.len > 1:
-        tracer.accounts.incl c.stack[^1, EthAddress]
-    else:
-      discard
-
-  if TracerFlags.DisableStorage notin tracer.flags:
-    if op == Sstore:
-      if c.stack.values.len > 1:
-        tracer.rememberStorageKey(c.msg.depth, c.stack[^1, Uint256])
-
-  result = tracer.trace["structLogs"].len - 1
-
 proc traceOpCodeEnded*(tracer: var TransactionTracer, c: Computation, op: Op, lastIndex: int) =
-  let j = tracer.trace["structLogs"].elems[lastIndex]
+  let j = tracer.structLog(lastIndex)
+  if j.isNil:
+    if op in {Return, Revert}:
+      tracer.trace["returnValue"] = %("0x" & toHex(c.output, true))
+    return
 
   # TODO: figure out how to get storage
   # when contract execution interrupted by exception
@@ -115,8 +146,13 @@ proc traceOpCodeEnded*(tracer: var TransactionTracer, c: Computation, op: Op, la
   trace "Op", json = j.pretty()
 
 proc traceError*(tracer: var TransactionTracer, c: Computation) =
-  if tracer.trace["structLogs"].elems.len > 0:
-    let j = tracer.trace["structLogs"].elems[^1]
+  let j =
+    if not tracer.stream.isNil: tracer.pending
+    elif tracer.trace.hasKey("structLogs") and
+         tracer.trace["structLogs"].elems.len > 0:
+      tracer.trace["structLogs"].elems[^1]
+    else: nil
+  if not j.isNil:
     j["error"] = %(c.error.info)
     trace "Error", json = j.pretty()
 
@@ -127,3 +163,50 @@ proc traceError*(tracer: var TransactionTracer, c: Computation) =
     j["gasCost"] = %(gasRemaining - c.gasMeter.gasRemaining)
 
   tracer.trace["failed"] = %true
+
+proc callType(msg: Message): string =
+  case msg.kind
+  of evmcCall:
+    if msg.flags == emvcStatic: "STATICCALL" else: "CALL"
+  of evmcDelegateCall: "DELEGATECALL"
+  of evmcCallCode: "CALLCODE"
+  of evmcCreate: "CREATE"
+  of evmcCreate2: "CREATE2"
+
+proc traceCallStarted*(tracer: var TransactionTracer, c: Computation) =
+  if TracerFlags.CallTracer notin tracer.flags:
+    return
+  if unlikely tracer.trace.isNil:
+    tracer.initTracer(tracer.flags)
+
+  let f = newJObject()
+  f["type"] = %c.msg.callType
+  f["from"] = %("0x" & c.msg.sender.toHex(true))
+  f["to"] = %("0x" & c.msg.contractAddress.toHex(true))
+  if c.msg.kind != evmcDelegateCall and c.msg.flags != emvcStatic:
+    f["value"] = %("0x" & c.msg.value.toHex)
+  f["gas"] = %c.msg.gas
+  f["input"] = %("0x" & toHex(c.msg.data, true))
+  tracer.calls.add f
+
+proc traceCallEnded*(tracer: var TransactionTracer, c: Computation) =
+  if TracerFlags.CallTracer notin tracer.flags or tracer.calls.len == 0:
+    return
+
+  let f = tracer.calls.pop()
+  f["gasUsed"] = %(c.msg.gas - c.gasMeter.gasRemaining)
+  f["output"] = %("0x" & toHex(c.output, true))
+  if not c.error.isNil:
+    f["error"] = %(c.error.info)
+    if c.msg.depth == 0:
+      tracer.trace["failed"] = %true
+
+  if tracer.calls.len > 0:
+    let parent = tracer.calls[^1]
+    if not parent.hasKey("calls"):
+      parent["calls"] = newJArray()
+    parent["calls"].add f
+  elif not tracer.stream.isNil:
+    tracer.stream.writeLine($f)
+  else:
+    tracer.trace["calls"].add f
@@ -0,0 +1,242 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or
+#    http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or
+#    http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except
+# according to those terms.
+
+## EVM Code Analysis
+## =================
+##
+## Bytecode is analysed once per code hash. The result is kept in a per
+## thread LRU cache so that a contract called over and over again (within a
+## block or across blocks) is neither re-loaded from the database nor
+## re-analysed.
+##
+## The analysis provides packed bitmaps for opcode positions (i.e. not part
+## of `PUSH` data) and valid `JUMP`/`JUMPI` destinations.
+##
+## On demand, the bytecode is also split into basic blocks, each with the
+## sum of its fixed gas costs and its stack height requirements. This allows
+## the dispatcher to charge gas and check the stack once per block. A block
+## ends with any instruction that changes the control flow or that observes
+## the remaining gas (e.g. `GAS`, `SSTORE`, or the `CALL` family), so that
+## pre-charging the fixed gas of a block cannot be noticed by the code.
+
+import
+  strutils, tables,
+  eth/common,
+  ../forks,
+  ../utils/lru_cache,
+  ./interpreter/[gas_costs, op_codes]
+
+type
+  CodeBitmap* = seq[uint64]
+
+  BasicBlock* = object
+    lastPos*: int             ## Position of the last instruction
+    gas*: GasInt              ## Sum of fixed gas costs for this block
+    stackReq*: int            ## Minimal stack height needed on entry
+    stackMax*: int            ## Maximal stack growth relative to entry
+
+  CodeAnalysisRef* = ref object
+    code*: seq[byte]          ## Analysed bytecode, must not be modified
+    codeBits: CodeBitmap      ## Opcode positions (not `PUSH` data)
+    jumpDests: CodeBitmap     ## Valid `JUMPDEST` positions
+    blocks: Table[int,BasicBlock] ## Basic blocks indexed by start position
+    blocksFork: Fork          ## Fork the block gas costs were calculated for
+    blocksOk: bool            ## `blocks` and `blocksFork` are valid
+
+  CodeCache = LruCache[Hash256,Hash256,CodeAnalysisRef,void]
+
+const
+  codeCacheMaxItems* = 1024
+    ## Number of analysed contracts kept in the per-thread cache
+
+  undefinedOps = block:
+    var rc: set[Op]
+    for op in Op:
+      if ($op).startsWith("Nop"):
+        rc.incl op
+    rc
+
+  blockEndOps = {
+    Stop, Jump, JumpI, BeginSub, ReturnSub, JumpSub,
+    Return, Revert, Invalid, SelfDestruct,
+    Gas, Sstore, Create, Create2, Call, CallCode, DelegateCall, StaticCall
+  } + undefinedOps
+    ## Op codes terminating a basic block
+
+var
+  codeCache {.threadvar.}: CodeCache
+
+{.push raises: [Defect].}
+
+# ------------------------------------------------------------------------------
+# Private helpers
+# ------------------------------------------------------------------------------
+
+template setBit(bits: var CodeBitmap; pos: int) =
+  bits[pos shr 6] = bits[pos shr 6] or (1'u64 shl (pos and 63))
+
+template testBit(bits: CodeBitmap; pos: int): bool =
+  ((bits[pos shr 6] shr (pos and 63)) and 1'u64) != 0
+
+proc stackEffect(op: Op): (int,int) =
+  ## Number of stack items (popped, pushed) by op code `op`
+  case op
+  of Stop, JumpDest, BeginSub, ReturnSub, Invalid:
+    (0, 0)
+  of Add, Mul, Sub, Div, Sdiv, Mod, Smod, Exp, SignExtend,
+     Lt, Gt, Slt, Sgt, Eq, And, Or, Xor, Byte, Shl, Shr, Sar, Sha3:
+    (2, 1)
+  of Addmod, Mulmod:
+    (3, 1)
+  of IsZero, Not, Balance, CallDataLoad, ExtCodeSize, ExtCodeHash,
+     Blockhash, Mload, Sload:
+    (1, 1)
+  of Address, Origin, Caller, CallValue, CallDataSize, CodeSize, GasPrice,
+     ReturnDataSize, Coinbase, Timestamp, Number, Difficulty, GasLimit,
+     ChainIdOp, SelfBalance, BaseFee, Pc, Msize, Gas, Push1 .. Push32:
+    (0, 1)
+  of CallDataCopy, CodeCopy, ReturnDataCopy:
+    (3, 0)
+  of ExtCodeCopy:
+    (4, 0)
+  of Pop, Jump, JumpSub, SelfDestruct:
+    (1, 0)
+  of Mstore, Mstore8, Sstore, JumpI, Return, Revert:
+    (2, 0)
+  of Dup1 .. Dup16:
+    let n = op.int - Dup1.int + 1
+    (n, n + 1)
+  of Swap1 .. Swap16:
+    let n = op.int - Swap1.int + 2
+    (n, n)
+  of Log0 .. Log4:
+    (op.int - Log0.int + 2, 0)
+  of Create:
+    (3, 1)
+  of Create2:
+    (4, 1)
+  of Call, CallCode:
+    (7, 1)
+  of DelegateCall, StaticCall:
+    (6, 1)
+  else:
+    (0, 0) # undefined op code, terminates the block
+
+proc analyseBlocks(ca: CodeAnalysisRef; fork: Fork; gasCosts: GasCosts) =
+  ca.blocks.clear
+  var
+    start = 0
+    blk: BasicBlock
+    height = 0
+    pos = 0
+  while pos < ca.code.len:
+    let op = Op(ca.code[pos])
+    if op == JumpDest and start < pos:
+      # close previous block, a jump destination starts a new one
+      ca.blocks[start] = blk
+      (start, blk, height) = (pos, BasicBlock(), 0)
+
+    let (pops, pushes) = op.stackEffect
+    blk.stackReq = max(blk.stackReq, pops - height)
+    height += pushes - pops
+    blk.stackMax = max(blk.stackMax, height)
+    if BaseGasCosts[op].kind == GckFixed:
+      # same selection as for the dispatcher
+      blk.gas += gasCosts[op].cost
+    blk.lastPos = pos
+
+    if PUSH1 <= op and op <= PUSH32:
+      pos += op.int - PUSH1.int + 1
+    inc pos
+
+    if op in blockEndOps:
+      ca.blocks[start] = blk
+      (start, blk, height) = (pos, BasicBlock(), 0)
+
+  if start < ca.code.len:
+    ca.blocks[start] = blk
+
+  ca.blocksFork = fork
+  ca.blocksOk = true
+
+proc initCodeCache() =
+  var
+    toKey: LruKey[Hash256,Hash256] =
+      proc(codeHash: Hash256): Hash256 = codeHash
+    toValue: LruValue[Hash256,CodeAnalysisRef,void] =
+      proc(codeHash: Hash256): Result[CodeAnalysisRef,void] = err()
+  codeCache.initCache(toKey, toValue, codeCacheMaxItems)
+
+# ------------------------------------------------------------------------------
+# Public functions
+# ------------------------------------------------------------------------------
+
+proc newCodeAnalysis*(code: seq[byte]): CodeAnalysisRef =
+  ## Analyse bytecode, not cached
+  new result
+  shallowCopy(result.code, code)
+  let words = (code.len + 63) shr 6
+  result.codeBits = newSeq[uint64](words)
+  result.jumpDests = newSeq[uint64](words)
+
+  var pos = 0
+  while pos < code.len:
+    let op = Op(code[pos])
+    result.codeBits.setBit(pos)
+    if op == JUMPDEST:
+      result.jumpDests.setBit(pos)
+    elif PUSH1 <= op and op <= PUSH32:
+      pos += op.int - PUSH1.int + 1
+    inc pos
+
+proc isCodePos*(ca: CodeAnalysisRef; pos: int): bool {.inline.} =
+  ## True if `pos` is an opcode position rather than `PUSH` data
+  0 <= pos and pos < ca.code.len and ca.codeBits.testBit(pos)
+
+proc isJumpDest*(ca: CodeAnalysisRef; pos: int): bool {.inline.} =
+  ## True if `pos` is a valid `JUMP`/`JUMPI` destination
+  0 <= pos and pos < ca.code.len and ca.jumpDests.testBit(pos)
+
+proc basicBlock*(ca: CodeAnalysisRef; pos: int; fork: Fork;
+                 gasCosts: GasCosts; blk: var BasicBlock): bool =
+  ## Retrieve the basic block starting at `pos`. The argument `gasCosts` must
+  ## be the gas cost table for `fork`. If there is no block starting at `pos`,
+  ## `false` is returned.
+  if not ca.blocksOk or ca.blocksFork != fork:
+    ca.analyseBlocks(fork, gasCosts)
+  ca.blocks.withValue(pos, val) do:
+    blk = val[]
+    return true
+
+proc getCodeAnalysis*(codeHash: Hash256): CodeAnalysisRef {.gcsafe.} =
+  ## Look up cached analysis, returns `nil` unless found
+  if codeCache.maxLen == 0:
+    initCodeCache()
+  try:
+    let rc = codeCache.getItem(codeHash)
+    if rc.isOk:
+      return rc.value
+  except CatchableError:
+    discard
+
+proc putCodeAnalysis*(codeHash: Hash256;
+                      code: seq[byte]): CodeAnalysisRef {.gcsafe.} =
+  ## Analyse `code` and store the result under `codeHash`
+  result = newCodeAnalysis(code)
+  if codeCache.maxLen == 0:
+    initCodeCache()
+  try:
+    codeCache.putItem(codeHash, result)
+  except CatchableError:
+    discard
+
+# ------------------------------------------------------------------------------
+# End
+# ------------------------------------------------------------------------------
@@ -6,9 +6,14 @@
 # at your option. This file may not be copied, modified, or distributed except according to those terms.
 
 import
-  chronicles, strformat, strutils, sequtils, parseutils, sets, macros,
+  chronicles, strformat, strutils, sequtils, parseutils, macros,
   eth/common,
-  ./interpreter/op_codes
+  ../forks,
+  ./code_analysis,
+  ./interpreter/[gas_costs, op_codes]
+
+export
+  BasicBlock
 
 logScope:
   topics = "vm code_stream"
@@ -16,22 +21,24 @@ logScope:
 type
   CodeStream* = ref object
     bytes*: seq[byte]
-    depthProcessed: int
-    invalidPositions: HashSet[int]
+    analysis: CodeAnalysisRef
     pc*: int
     cached: seq[(int, Op, string)]
 
 proc `$`*(b: byte): string =
   $(b.int)
 
-proc newCodeStream*(codeBytes: seq[byte]): CodeStream =
+proc newCodeStream*(analysis: CodeAnalysisRef): CodeStream =
+  ## Code stream for pre-analysed (and possibly cached) bytecode
   new(result)
-  shallowCopy(result.bytes, codeBytes)
+  shallowCopy(result.bytes, analysis.code)
+  result.analysis = analysis
   result.pc = 0
-  result.invalidPositions = initHashSet[int]()
-  result.depthProcessed = 0
   result.cached = @[]
 
+proc newCodeStream*(codeBytes: seq[byte]): CodeStream =
+  newCodeStream(newCodeAnalysis(codeBytes))
+
 proc newCodeStream*(codeBytes: string): CodeStream =
   newCodeStream(codeBytes.mapIt(it.byte))
 
@@ -102,30 +109,18 @@ when false:
     finally:
       cs.pc = anchorPc
 
-proc isValidOpcode*(c: CodeStream, position: int): bool =
-  if position >= len(c):
-    return false
-  if position in c.invalidPositions:
-    return false
-  if position <= c.depthProcessed:
-    return true
-  else:
-    var i = c.depthProcessed
-    while i <= position:
-      var opcode = Op(c[i])
-      if opcode >= Op.PUSH1 and opcode <= Op.PUSH32:
-        var leftBound = (i + 1)
-        var rightBound = leftBound + (opcode.int - 95)
-        for z in leftBound ..< rightBound:
-          c.invalidPositions.incl(z)
-        i = rightBound
-      else:
-        c.depthProcessed = i
-        i += 1
-    if position in c.invalidPositions:
-      return false
-    else:
-      return true
+proc isValidOpcode*(c: CodeStream, position: int): bool {.inline.} =
+  ## True if `position` is an opcode rather than `PUSH` data
+  c.analysis.isCodePos(position)
+
+proc isValidJumpDest*(c: CodeStream, position: int): bool {.inline.} =
+  ## True if `position` is a `JUMPDEST` opcode (not `PUSH` data)
+  c.analysis.isJumpDest(position)
+
+proc basicBlock*(c: CodeStream, position: int, fork: Fork,
+                 gasCosts: GasCosts, blk: var BasicBlock): bool {.inline.} =
+  ## Fetch the basic block starting at `position`, if any
+  c.analysis.basicBlock(position, fork, gasCosts, blk)
 
 proc decompile*(original: var CodeStream): seq[(int, Op, string)] =
   # behave as https://etherscan.io/opcode-tool
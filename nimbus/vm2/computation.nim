@@ -12,6 +12,7 @@ import
   ../constants, ../forks,
   ../db/accounts_cache,
   ../utils,
+  ./code_analysis,
   ./code_stream,
   ./interpreter/[gas_meter, gas_costs, op_codes],
   ./memory,
@@ -122,8 +123,15 @@ proc newComputation*(vmState: BaseVMState,
     result.code = newCodeStream(message.data)
     message.data = @[]
   else:
-    result.code = newCodeStream(
-      vmState.readOnlyStateDb.getCode(message.codeAddress))
+    # bytecode and its analysis are cached by code hash
+    let
+      db = vmState.readOnlyStateDb
+      codeAddress = message.codeAddress
+      codeHash = db.getCodeHash(codeAddress)
+    var analysis = getCodeAnalysis(codeHash)
+    if analysis.isNil:
+      analysis = putCodeAnalysis(codeHash, db.getCode(codeAddress))
+    result.code = newCodeStream(analysis)
 
 template gasCosts*(c: Computation): untyped =
   c.vmState.gasCosts
@@ -156,6 +164,11 @@ proc commit*(c: Computation) =
 proc dispose*(c: Computation) {.inline.} =
   c.vmState.accountDb.safeDispose(c.savePoint)
   c.savePoint = nil
+  # The stack of a nested call is recycled. The one of the top level
+  # computation is kept as it might be inspected by the caller.
+  if c.msg.depth > 0 and not c.stack.isNil:
+    c.stack.releaseStack
+    c.stack = nil
 
 proc rollback*(c: Computation) =
   c.vmState.accountDb.rollback(c.savePoint)
@@ -254,6 +267,12 @@ proc traceError*(c: Computation) {.inline.} =
 proc prepareTracer*(c: Computation) {.inline.} =
   c.vmState.tracer.prepare(c.msg.depth)
 
+proc traceCallStarted*(c: Computation) {.inline.} =
+  c.vmState.tracer.traceCallStarted(c)
+
+proc traceCallEnded*(c: Computation) {.inline.} =
+  c.vmState.tracer.traceCallEnded(c)
+
 # ------------------------------------------------------------------------------
 # End
 # ------------------------------------------------------------------------------
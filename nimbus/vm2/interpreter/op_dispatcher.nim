@@ -18,6 +18,7 @@ import
   ../code_stream,
   ../computation,
   ../../forks,
+  ../../utils/evm_profiler,
   ./gas_costs,
   ./gas_meter,
   ./op_codes,
@@ -47,8 +48,11 @@ template handleFixedGasCostsDirective(fork: Fork; op: Op; k: var Vm2Ctx) =
     if k.cpt.tracingEnabled:
       k.cpt.opIndex = k.cpt.traceOpCodeStarted(op)
 
-    k.cpt.gasMeter.consumeGas(k.cpt.gasCosts[op].cost, reason = $op)
-    vmOpHandlers[fork][op].run(k)
+    profileOp(op, k.cpt.gasMeter,
+              (if k.gasPaid: k.cpt.gasCosts[op].cost else: 0)):
+      if not k.gasPaid:
+        k.cpt.gasMeter.consumeGas(k.cpt.gasCosts[op].cost, reason = $op)
+      vmOpHandlers[fork][op].run(k)
 
     if k.cpt.tracingEnabled:
       k.cpt.traceOpCodeEnded(op, k.cpt.opIndex)
@@ -58,7 +62,8 @@ template handleOtherDirective(fork: Fork; op: Op; k: var Vm2Ctx) =
     if k.cpt.tracingEnabled:
       k.cpt.opIndex = k.cpt.traceOpCodeStarted(op)
 
-    vmOpHandlers[fork][op].run(k)
+    profileOp(op, k.cpt.gasMeter, 0):
+      vmOpHandlers[fork][op].run(k)
 
     if k.cpt.tracingEnabled:
       k.cpt.traceOpCodeEnded(op, k.cpt.opIndex)
@@ -156,7 +156,8 @@ proc execSubCall(k: var Vm2Ctx; childMsg: Message; memPos, memLen: int) =
       c.merge(child)
       c.stack.top(1)
 
-    c.returnData = child.output
+    # the child is done, so its output buffer can be shared rather than copied
+    shallowCopy(c.returnData, child.output)
     let actualOutputSize = min(memLen, child.output.len)
     if actualOutputSize > 0:
       c.memory.write(memPos, child.output.toOpenArray(0, actualOutputSize - 1))
@@ -22,6 +22,7 @@ type
   Vm2Ctx* = tuple
     cpt: Computation          ## computation text
     rc: int                   ## return code from op handler
+    gasPaid: bool             ## fixed gas cost was charged with basic block
 
   Vm2OpFn* =                  ## general op handler, return codes are passed
                               ## back via argument descriptor ``k``
@@ -26,7 +26,6 @@ import
   ./oph_defs,
   ./oph_helpers,
   eth/common,
-  sequtils,
   stint,
   strformat
 
@@ -40,18 +39,18 @@ proc writePaddedResult(mem: var Memory,
                        paddingValue = 0.byte) =
 
   mem.extend(memPos, len)
-  let dataEndPosition = dataPos.int64 + len - 1
-  let sourceBytes =
-    data[min(dataPos, data.len) .. min(data.len - 1, dataEndPosition)]
+  let
+    dataStart = min(dataPos, data.len)
+    dataLen = min(data.len - dataStart, len)
 
-  mem.write(memPos, sourceBytes)
+  if 0 < dataLen:
+    mem.write(memPos, data.toOpenArray(dataStart, dataStart + dataLen - 1))
 
   # Don't duplicate zero-padding of mem.extend
-  let paddingOffset = min(memPos + sourceBytes.len, mem.len)
-  let numPaddingBytes = min(mem.len - paddingOffset, len - sourceBytes.len)
+  let paddingOffset = min(memPos + dataLen, mem.len)
+  let numPaddingBytes = min(mem.len - paddingOffset, len - dataLen)
   if numPaddingBytes > 0:
-    # TODO: avoid unnecessary memory allocation
-    mem.write(paddingOffset, repeat(paddingValue, numPaddingBytes))
+    mem.fill(paddingOffset, numPaddingBytes, paddingValue)
 
 # ------------------------------------------------------------------------------
 # Private, op handlers implementation
@@ -66,15 +66,10 @@ proc jumpImpl(c: Computation; jumpTarget: UInt256) =
   let jt = jumpTarget.truncate(int)
   c.code.pc = jt
 
-  let nextOpcode = c.code.peek
-  if nextOpcode != JUMPDEST:
+  # single bit test on the pre-analysed jump destinations
+  if not c.code.isValidJumpDest(jt):
     raise newException(InvalidJumpDestination, "Invalid Jump Destination")
 
-  # TODO: next check seems redundant
-  if not c.code.isValidOpcode(jt):
-    raise newException(
-      InvalidInstruction, "Jump resulted in invalid instruction")
-
 # ------------------------------------------------------------------------------
 # Private, op handlers implementation
 # ------------------------------------------------------------------------------
@@ -95,7 +90,7 @@ const
 
     k.cpt.memory.extend(memPos, 32)
     k.cpt.stack.push:
-      k.cpt.memory.read(memPos, 32)
+      UInt256.fromBytesBE(k.cpt.memory.view(memPos, 32))
 
 
   mstoreOp: Vm2OpFn = proc (k: var Vm2Ctx) =
@@ -121,7 +116,7 @@ const
       reason = "MSTORE8: GasVeryLow + memory expansion")
 
     k.cpt.memory.extend(memPos, 1)
-    k.cpt.memory.write(memPos, [value.toByteArrayBE[31]])
+    k.cpt.memory.fill(memPos, 1, value.truncate(byte))
 
   # -------
 
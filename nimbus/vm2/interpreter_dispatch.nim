@@ -16,11 +16,13 @@ const
 import
   ../constants,
   ../db/accounts_cache,
+  ../errors,
   ./code_stream,
   ./computation,
   ./interpreter/op_dispatcher,
   ./message,
   ./precompiles,
+  ./stack,
   ./state,
   ./types,
   chronicles,
@@ -44,17 +46,44 @@ const
 # Private functions
 # ------------------------------------------------------------------------------
 
+proc enterBasicBlock(c: Computation, blk: BasicBlock) =
+  ## Charge fixed gas and verify stack bounds for a whole basic block
+  if c.stack.len < blk.stackReq:
+    raise newException(InsufficientStack,
+      &"Stack underflow: expected {blk.stackReq} elements, " &
+      &"got {c.stack.len} instead.")
+  if stackMaxItems < c.stack.len + blk.stackMax:
+    raise newException(FullStack, "Stack limit reached")
+  c.gasMeter.consumeGas(blk.gas, reason = "basic block fixed gas")
+
 proc selectVM(c: Computation, fork: Fork) {.gcsafe.} =
   ## Op code execution handler main loop.
-  var desc: Vm2Ctx
+  var
+    desc: Vm2Ctx
+    blk: BasicBlock
+    inBlock = false
   desc.cpt = c
 
-  if c.tracingEnabled:
+  # The tracer needs gas accounting per op code
+  let useBlocks = not c.tracingEnabled
+  if not useBlocks:
     c.prepareTracer()
 
   while true:
+    let pos = c.code.pc
     c.instr = c.code.next()
 
+    # Execution enters a basic block only at its start, either sequentially
+    # or by a jump. If there is none at `pos` (e.g. `JUMPSUB` to a `BEGINSUB`
+    # in push data), op codes are charged one at a time.
+    if useBlocks and not inBlock:
+      inBlock = c.code.basicBlock(pos, fork, c.gasCosts, blk)
+      if inBlock:
+        c.enterBasicBlock(blk)
+    desc.gasPaid = inBlock
+    if inBlock and pos == blk.lastPos:
+      inBlock = false
+
     # Note Mamy's observation in opTableToCaseStmt() from original VM
     # regarding computed goto
     #
@@ -171,17 +200,23 @@ proc afterExecCreate(c: Computation) =
 
 
 proc beforeExec(c: Computation): bool =
+  if c.tracingEnabled:
+    c.traceCallStarted()
   if not c.msg.isCreate:
     c.beforeExecCall()
     false
   else:
-    c.beforeExecCreate()
+    result = c.beforeExecCreate()
+    if result and c.tracingEnabled:
+      c.traceCallEnded()
 
 proc afterExec(c: Computation) =
   if not c.msg.isCreate:
     c.afterExecCall()
   else:
     c.afterExecCreate()
+  if c.tracingEnabled:
+    c.traceCallEnded()
 
 # ------------------------------------------------------------------------------
 # Public functions
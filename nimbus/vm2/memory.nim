@@ -6,7 +6,6 @@
 # at your option. This file may not be copied, modified, or distributed except according to those terms.
 
 import
-  sequtils,
   chronicles, eth/common/eth_types,
   ../errors, ../validation,
   ./interpreter/utils/utils_numeric
@@ -31,26 +30,51 @@ proc extend*(memory: var Memory; startPos: Natural; size: Natural) =
   var newSize = ceil32(startPos + size)
   if newSize <= len(memory):
     return
-  var sizeToExtend = newSize - len(memory)
-  memory.bytes = memory.bytes.concat(repeat(0.byte, sizeToExtend))
+  # The seq capacity grows geometrically and the new tail is zeroed in place,
+  # so repeated expansion is amortised O(1) per byte.
+  memory.bytes.setLen(newSize)
 
 proc newMemory*(size: Natural): Memory =
   result = newMemory()
   result.extend(0, size)
 
 proc read*(memory: var Memory, startPos: Natural, size: Natural): seq[byte] =
-  # TODO: use an openarray[byte]
+  ## Returns a copy of the memory range, see `view()` for a zero-copy variant
   result = memory.bytes[startPos ..< (startPos + size)]
 
+proc viewFirst(memory: Memory, startPos: Natural, size: Natural): int {.inline.} =
+  # An empty view may start anywhere, so it is anchored at zero
+  if size == 0: 0 else: startPos
+
+template view*(memory: Memory, startPos: Natural, size: Natural): untyped =
+  ## Zero-copy `openArray[byte]` view of the memory range. The range must have
+  ## been made available with `extend()` and the view must not be used beyond
+  ## the next `extend()` (which might move the underlying buffer.)
+  memory.bytes.toOpenArray(
+    memory.viewFirst(startPos, size),
+    memory.viewFirst(startPos, size) + size.int - 1)
+
+proc readPtr*(memory: var Memory, startPos: Natural): ptr byte =
+  ## Pointer into the memory buffer, `nil` if out of range. The same lifetime
+  ## restrictions as for `view()` apply.
+  if memory.bytes.len == 0 or startPos >= memory.bytes.len: return
+  result = memory.bytes[startPos].addr
+
 proc write*(memory: var Memory, startPos: Natural, value: openarray[byte]) =
   let size = value.len
   if size == 0:
     return
-  #echo size
-  #echo startPos
   validateLte(startPos + size, memory.len)
-  if memory.len < startPos + size:
-    memory.bytes = memory.bytes.concat(repeat(0.byte, memory.len - (startPos + size))) # TODO: better logarithmic scaling?
+  # `value` might be a view into the memory itself
+  moveMem(memory.bytes[startPos].addr, value[0].unsafeAddr, size)
 
-  for z, b in value:
-    memory.bytes[z + startPos] = b
+proc fill*(memory: var Memory, startPos: Natural, size: Natural, value = 0.byte) =
+  ## Set the memory range in place, the range must have been extended already
+  if size == 0:
+    return
+  validateLte(startPos + size, memory.len)
+  if value == 0:
+    zeroMem(memory.bytes[startPos].addr, size)
+  else:
+    for n in startPos ..< startPos + size:
+      memory.bytes[n] = value
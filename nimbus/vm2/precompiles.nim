@@ -12,7 +12,8 @@ import
   ./types, ../forks,
   ./interpreter/[gas_meter, gas_costs, utils/utils_numeric],
   ../errors, stint, eth/[keys, common], chronicles, tables, macros,
-  math, nimcrypto, bncurve/[fields, groups], ./blake2b_f, ./blscurve
+  math, nimcrypto, bncurve/[fields, groups], ./blake2b_f, ./blscurve,
+  ../utils/[evm_profiler, modexp]
 
 type
   PrecompileAddresses* = enum
@@ -160,6 +161,9 @@ proc identity*(computation: Computation) =
   computation.output = computation.msg.data
   trace "Identity precompile", output = computation.output.toHex
 
+func isOddModulus(x: StUint): bool =
+  (x.truncate(uint64) and 1) == 1
+
 proc modExpInternal(computation: Computation, baseLen, expLen, modLen: int, T: type StUint) =
   template data: untyped {.dirty.} =
     computation.msg.data
@@ -185,13 +189,18 @@ proc modExpInternal(computation: Computation, baseLen, expLen, modLen: int, T: t
   let output = if modulo <= 1:
                   # If m == 0: EVM returns 0.
                   # If m == 1: we can shortcut that to 0 as well
-                  zero()
+                  @(zero())
               elif exp.isZero():
                   # If 0^0: EVM returns 1
                   # For all x != 0, x^0 == 1 as well
-                  one()
+                  @(one())
+              elif modulo.isOddModulus:
+                  # Montgomery engine sized by the modulus, `utils/modexp`
+                  let x = if base < modulo: base else: base mod modulo
+                  powModOdd(x.toByteArrayBE, exp.toByteArrayBE,
+                            modulo.toByteArrayBE)
               else:
-                  powmod(base, exp, modulo).toByteArrayBE
+                  @(powmod(base, exp, modulo).toByteArrayBE)
 
   # maximum output len is the same as modLen
   # if it less than modLen, it will be zero padded at left
@@ -694,34 +703,35 @@ proc execPrecompiles*(computation: Computation, fork: Fork): bool {.inline.} =
     result = true
     let precompile = PrecompileAddresses(lb)
     trace "Call precompile", precompile = precompile, codeAddr = computation.msg.codeAddress
-    try:
-      case precompile
-      of paEcRecover: ecRecover(computation)
-      of paSha256: sha256(computation)
-      of paRipeMd160: ripeMd160(computation)
-      of paIdentity: identity(computation)
-      of paModExp: modExp(computation, fork)
-      of paEcAdd: bn256ecAdd(computation, fork)
-      of paEcMul: bn256ecMul(computation, fork)
-      of paPairing: bn256ecPairing(computation, fork)
-      of paBlake2bf: blake2bf(computation)
-      # EIP 2537: disabled
-      # reason: not included in berlin
-      # of paBlsG1Add: blsG1Add(computation)
-      # of paBlsG1Mul: blsG1Mul(computation)
-      # of paBlsG1MultiExp: blsG1MultiExp(computation)
-      # of paBlsG2Add: blsG2Add(computation)
-      # of paBlsG2Mul: blsG2Mul(computation)
-      # of paBlsG2MultiExp: blsG2MultiExp(computation)
-      # of paBlsPairing: blsPairing(computation)
-      # of paBlsMapG1: blsMapG1(computation)
-      # of paBlsMapG2: blsMapG2(computation)
-    except OutOfGas as e:
-      # cannot use setError here, cyclic dependency
-      computation.error = Error(info: e.msg, burnsGas: true)
-    except CatchableError as e:
-      if fork >= FKByzantium and precompile > paIdentity:
+    profilePrecompile(lb, computation.gasMeter):
+      try:
+        case precompile
+        of paEcRecover: ecRecover(computation)
+        of paSha256: sha256(computation)
+        of paRipeMd160: ripeMd160(computation)
+        of paIdentity: identity(computation)
+        of paModExp: modExp(computation, fork)
+        of paEcAdd: bn256ecAdd(computation, fork)
+        of paEcMul: bn256ecMul(computation, fork)
+        of paPairing: bn256ecPairing(computation, fork)
+        of paBlake2bf: blake2bf(computation)
+        # EIP 2537: disabled
+        # reason: not included in berlin
+        # of paBlsG1Add: blsG1Add(computation)
+        # of paBlsG1Mul: blsG1Mul(computation)
+        # of paBlsG1MultiExp: blsG1MultiExp(computation)
+        # of paBlsG2Add: blsG2Add(computation)
+        # of paBlsG2Mul: blsG2Mul(computation)
+        # of paBlsG2MultiExp: blsG2MultiExp(computation)
+        # of paBlsPairing: blsPairing(computation)
+        # of paBlsMapG1: blsMapG1(computation)
+        # of paBlsMapG2: blsMapG2(computation)
+      except OutOfGas as e:
+        # cannot use setError here, cyclic dependency
         computation.error = Error(info: e.msg, burnsGas: true)
-      else:
-        # swallow any other precompiles errors
-        debug "execPrecompiles validation error", msg=e.msg
+      except CatchableError as e:
+        if fork >= FKByzantium and precompile > paIdentity:
+          computation.error = Error(info: e.msg, burnsGas: true)
+        else:
+          # swallow any other precompiles errors
+          debug "execPrecompiles validation error", msg=e.msg
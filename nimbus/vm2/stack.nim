@@ -14,12 +14,24 @@ logScope:
 
 type
   Stack* = ref object of RootObj
-    values*: seq[StackElement]
+    values*: seq[StackElement] ## Capacity preallocated to `stackMaxItems`
 
   StackElement = UInt256
 
+const
+  stackMaxItems* = 1024
+    ## EVM stack limit, also the preallocated capacity of the stack
+
+  stackPoolMaxItems = 16
+    ## Released stacks kept per thread (32KiB each), deeper call chains
+    ## allocate the remaining stacks
+
+var
+  stackPool {.threadvar.}: seq[Stack]
+    ## Released stacks, recycled by `newStack()`
+
 template ensureStackLimit: untyped =
-  if len(stack.values) > 1023:
+  if len(stack.values) >= stackMaxItems:
     raise newException(FullStack, "Stack limit reached")
 
 proc len*(stack: Stack): int {.inline.} =
@@ -40,10 +52,12 @@ proc toStackElement(v: openarray[byte], elem: var StackElement) {.inline.} =
   validateStackItem(v) # This is necessary to pass stack tests
   elem.initFromBytesBE(v)
 
-proc pushAux[T](stack: var Stack, value: T) =
+proc pushAux[T](stack: var Stack, value: T) {.inline.} =
   ensureStackLimit()
-  stack.values.setLen(stack.values.len + 1)
-  toStackElement(value, stack.values[^1])
+  let top = stack.values.len
+  # no re-allocation, the capacity is preset to `stackMaxItems`
+  stack.values.setLen(top + 1)
+  toStackElement(value, stack.values[top])
 
 proc push*(stack: var Stack, value: uint | int | GasInt | UInt256 | EthAddress | Hash256) {.inline.} =
   pushAux(stack, value)
@@ -59,10 +73,11 @@ proc ensurePop(elements: Stack, a: int) =
     raise newException(InsufficientStack,
       &"Stack underflow: expected {expected} elements, got {num} instead.")
 
-proc popAux[T](stack: var Stack, value: var T) =
+proc popAux[T](stack: var Stack, value: var T) {.inline.} =
   ensurePop(stack, 1)
-  fromStackElement(stack.values[^1], value)
-  stack.values.setLen(stack.values.len - 1)
+  let top = stack.values.high
+  fromStackElement(stack.values[top], value)
+  stack.values.setLen(top)
 
 proc internalPopTuple(stack: var Stack, v: var tuple, tupleLen: static[int]) =
   ensurePop(stack, tupleLen)
@@ -92,14 +107,70 @@ proc popTopic*(stack: var Stack): Topic {.inline.} =
   popAux(stack, result)
 
 proc newStack*(): Stack =
-  new(result)
-  result.values = @[]
+  ## Returns an empty stack, recycled from the pool of released stacks if
+  ## possible.
+  if 0 < stackPool.len:
+    result = stackPool.pop
+    result.values.setLen(0)
+  else:
+    new(result)
+    result.values = newSeqOfCap[StackElement](stackMaxItems)
+
+proc releaseStack*(stack: Stack) =
+  ## Hand back a stack no longer used, so it can be recycled by `newStack()`.
+  ## The argument `stack` must not be accessed afterwards.
+  if not stack.isNil and stackPool.len < stackPoolMaxItems:
+    stackPool.add stack
+
+# ------------------------------------------------------------------------------
+# Unchecked fast paths
+# ------------------------------------------------------------------------------
+
+# The functions below require the caller to have verified the stack depth,
+# as done for a whole basic block by `enterBasicBlock()` of the dispatcher.
+# Missing underflow checks are caught by assertions in debug builds only.
+# The `stackMaxItems` limit is checked in all builds, exceeding it would
+# not be memory unsafe but silently break consensus.
+
+proc pushUnchecked*(stack: var Stack, value: UInt256) {.inline.} =
+  ## Push, only checking for a stack overflow
+  ensureStackLimit()
+  let top = stack.values.len
+  stack.values.setLen(top + 1)
+  stack.values[top] = value
+
+proc popUnchecked*(stack: var Stack): UInt256 {.inline.} =
+  ## Pop without checking for a stack underflow
+  when not defined(release):
+    doAssert 0 < stack.values.len
+  let top = stack.values.high
+  result = stack.values[top]
+  stack.values.setLen(top)
+
+proc swapUnchecked*(stack: var Stack, position: int) {.inline.} =
+  ## SWAP operation without checking the stack depth
+  let top = stack.values.high
+  when not defined(release):
+    doAssert position <= top
+  swap(stack.values[top], stack.values[top - position])
+
+proc dupUnchecked*(stack: var Stack, position: int) {.inline.} =
+  ## DUP operation, only checking for a stack overflow
+  ensureStackLimit()
+  let top = stack.values.len
+  when not defined(release):
+    doAssert position in 1 .. top
+  stack.values.setLen(top + 1)
+  stack.values[top] = stack.values[top - position]
+
+# ------------------------------------------------------------------------------
+# Checked operations
+# ------------------------------------------------------------------------------
 
 proc swap*(stack: var Stack, position: int) =
   ##  Perform a SWAP operation on the stack
-  var idx = position + 1
-  if idx < len(stack) + 1:
-    (stack.values[^1], stack.values[^idx]) = (stack.values[^idx], stack.values[^1])
+  if 0 <= position and position < len(stack):
+    stack.swapUnchecked(position)
   else:
     raise newException(InsufficientStack,
                       &"Insufficient stack items for SWAP{position}")
@@ -110,7 +181,7 @@ proc dup*(stack: var Stack, position: int | UInt256) =
   ## Perform a DUP operation on the stack
   let position = position.getInt
   if position in 1 .. stack.len:
-    stack.push(stack.values[^position])
+    stack.dupUnchecked(position)
   else:
     raise newException(InsufficientStack,
                       &"Insufficient stack items for DUP{position}")
@@ -133,3 +204,4 @@ proc peekInt*(stack: Stack): UInt256 =
 
 proc top*(stack: Stack, value: uint | int | GasInt | UInt256 | EthAddress | Hash256) {.inline.} =
   toStackElement(value, stack.values[^1])
+
@@ -40,7 +40,8 @@ proc init*(self: BaseVMState, prevStateRoot: Hash256, header: BlockHeader,
   self.chaindb = chainDB
   self.tracer.initTracer(tracerFlags)
   self.logEntries = @[]
-  self.accountDb = AccountsCache.init(chainDB.db, prevStateRoot, chainDB.pruneTrie)
+  self.accountDb = AccountsCache.init(chainDB.db, prevStateRoot,
+    chainDB.pruneTrie, chainDB.stateSnapshot)
   self.touchedAccounts = initHashSet[EthAddress]()
   {.gcsafe.}:
     self.minerAddress = self.getMinerAddress()
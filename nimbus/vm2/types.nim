@@ -21,6 +21,7 @@ type
     ExecutionOK
     GenerateWitness
     ClearCache
+    RecordTxAccess      # Collect transaction read/write sets, see `tx_conflicts`
 
   BaseVMState* = ref object of RootObj
     prevHeaders*   : seq[BlockHeader]
@@ -41,6 +42,7 @@ type
     gasCosts*      : GasCosts
     fork*          : Fork
     minerAddress*  : EthAddress
+    txAccess*      : seq[AccessRecorder] # see `RecordTxAccess`
 
   AccessLogs* = ref object
     reads*: Table[string, string]
@@ -54,12 +56,16 @@ type
     DisableState
     DisableStateDiff
     EnableAccount
+    CallTracer          # Record CALL/CREATE frames only, no struct logs
 
   TransactionTracer* = object
     trace*: JsonNode
     flags*: set[TracerFlags]
     accounts*: HashSet[EthAddress]
     storageKeys*: seq[HashSet[Uint256]]
+    stream*: File       # Struct logs or call frames go here unless nil
+    pending*: JsonNode  # Struct log of the op code being executed
+    calls*: seq[JsonNode]
 
   Computation* = ref object
     # The execution computation
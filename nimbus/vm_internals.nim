@@ -28,6 +28,11 @@ export
 when defined(evmc_enabled):
   export
     vmm.readPtr
+elif defined(vm2_enabled):
+  export
+    vmm.fill,
+    vmm.readPtr,
+    vmm.view
 
 
 when defined(evmc_enabled) or not defined(vm2_enabled):
@@ -149,4 +154,12 @@ else:
     hStk.swap,
     hStk.top
 
+when not defined(evmc_enabled) and defined(vm2_enabled):
+  export
+    hStk.dupUnchecked,
+    hStk.popUnchecked,
+    hStk.pushUnchecked,
+    hStk.releaseStack,
+    hStk.swapUnchecked
+
 # End
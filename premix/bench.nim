@@ -0,0 +1,193 @@
+# use this module to benchmark block import against an already persisted
+# database, see `readme.md`
+
+import
+  std/[algorithm, json, monotimes, os, strformat, strutils, times],
+  eth/common, stint,
+  configuration,
+  eth/trie/db
+
+import
+  ../nimbus/db/[db_chain, select_backend],
+  ../nimbus/p2p/chain,
+  ../nimbus/utils/import_timer
+
+type
+  BenchResult = object
+    blocks: int
+    txs: int
+    gasUsed: float64
+    totalNanos: int64
+    timer: ImportTimes
+
+proc percentile(sorted: openArray[int64]; q: float64): int64 =
+  if sorted.len == 0:
+    return 0
+  sorted[min(sorted.high, int(q * sorted.len.float64))]
+
+proc toMillis(nanos: int64): float64 =
+  nanos.float64 / 1_000_000.0
+
+proc importBlocks(chain: Chain; chainDB: BaseChainDB;
+                  conf: PremixConfiguration): BenchResult =
+  var
+    headers = newSeqOfCap[BlockHeader](conf.numCommits)
+    bodies  = newSeqOfCap[BlockBody](conf.numCommits)
+    blockNumber = conf.head
+
+  startImportTimer()
+  let start = getMonoTime()
+
+  while result.blocks < conf.maxBlocks:
+    headers.setLen(0)
+    bodies.setLen(0)
+    for n in 0 ..< min(conf.numCommits, conf.maxBlocks - result.blocks):
+      let header = chainDB.getBlockHeader(blockNumber)
+      headers.add header
+      bodies.add chainDB.getBlockBody(header.blockHash)
+      result.txs += bodies[^1].transactions.len
+      result.gasUsed += header.gasUsed.float64
+      blockNumber += 1.u256
+
+    if chain.persistBlocks(headers, bodies) != ValidationResult.OK:
+      raise newException(ValueError,
+        "block validation error, range starting at " &
+        $headers[0].blockNumber)
+
+    result.blocks += headers.len
+    stdout.write blockNumber
+    stdout.write "\r"
+
+  result.totalNanos = (getMonoTime() - start).inNanoseconds
+  result.timer = stopImportTimer()
+
+proc toJson(r: BenchResult; conf: PremixConfiguration): JsonNode =
+  let sorted = r.timer.blockNanos.sorted
+  var phases = newJObject()
+  var accounted = 0'i64
+  for phase in ImportPhase:
+    phases[$phase] = %r.timer.phaseNanos[phase].toMillis
+    accounted += r.timer.phaseNanos[phase]
+  phases["other"] = %(r.totalNanos - accounted).toMillis
+
+  let seconds = r.totalNanos.float64 / 1e9
+  %*{
+    "head": $conf.head,
+    "blocks": r.blocks,
+    "txs": r.txs,
+    "batchSize": conf.numCommits,
+    "seconds": seconds,
+    "blocksPerSecond": r.blocks.float64 / seconds,
+    "mgasPerSecond": r.gasUsed / 1e6 / seconds,
+    "blockLatencyMs": {
+      "p50": sorted.percentile(0.50).toMillis,
+      "p99": sorted.percentile(0.99).toMillis,
+      "max": sorted.percentile(1.0).toMillis
+    },
+    "phasesMs": phases
+  }
+
+proc report(r: BenchResult; conf: PremixConfiguration) =
+  let
+    sorted = r.timer.blockNanos.sorted
+    seconds = r.totalNanos.float64 / 1e9
+    total = max(r.totalNanos, 1).float64
+
+  echo &"blocks {conf.head} .. {conf.head + (r.blocks - 1).u256}, " &
+    &"{r.txs} txs, batch size {conf.numCommits}"
+  echo &"  time        {seconds:>10.3f} s"
+  echo &"  blocks/s    {r.blocks.float64 / seconds:>10.2f}"
+  echo &"  Mgas/s      {r.gasUsed / 1e6 / seconds:>10.2f}"
+  echo &"  latency p50 {sorted.percentile(0.50).toMillis:>10.3f} ms"
+  echo &"  latency p99 {sorted.percentile(0.99).toMillis:>10.3f} ms"
+
+  var accounted = 0'i64
+  for phase in ImportPhase:
+    let nanos = r.timer.phaseNanos[phase]
+    accounted += nanos
+    echo &"  {$phase:<11} {nanos.toMillis:>10.1f} ms " &
+      &"{100.0 * nanos.float64 / total:>5.1f}%"
+  let
+    other = r.totalNanos - accounted
+    label = "other"
+  echo &"  {label:<11} {other.toMillis:>10.1f} ms " &
+    &"{100.0 * other.float64 / total:>5.1f}%"
+
+proc canonicalDir(path: string): string =
+  ## Absolute path without `.`/`..` parts, symlinks resolved if it exists
+  result = path.absolutePath.normalizedPath
+  if dirExists(result):
+    result = result.expandFilename
+  result.removeSuffix({DirSep, AltSep})
+
+proc overlaps(a, b: string): bool =
+  ## True if `a` and `b` are the same directory or one contains the other
+  let
+    a = a.canonicalDir
+    b = b.canonicalDir
+  a == b or a.startsWith(b & DirSep) or b.startsWith(a & DirSep)
+
+proc copyDatabase(conf: PremixConfiguration): string =
+  ## Every run imports into a fresh copy of the database and commits each
+  ## batch, the original stays unchanged for the next run.
+  result =
+    if conf.benchDir.len > 0: conf.benchDir
+    else: conf.dataDir.strip(leading = false, chars = {'/', '\\'}) & "-bench"
+  if overlaps(result, conf.dataDir):
+    # the scratch directory is removed below
+    raise newException(ValueError,
+      &"bench directory {result} overlaps data directory {conf.dataDir}")
+  if dirExists(result):
+    removeDir(result)
+
+  when dbCheckpoints:
+    echo &"checkpointing {conf.dataDir} to {result}"
+    newChainDb(conf.dataDir).checkpoint(result)
+  else:
+    echo &"copying {conf.dataDir} to {result}"
+    copyDir(conf.dataDir, result)
+
+proc main() {.used.} =
+  let conf = configuration.getConfiguration()
+  if conf.head == 0.u256:
+    raise newException(ValueError,
+      "please set the first block number with --head: blockNumber")
+  if conf.maxBlocks == 0:
+    raise newException(ValueError,
+      "please set the number of blocks with --maxBlocks: count")
+
+  let
+    db = newChainDb(conf.copyDatabase)
+    trieDB = trieDB db
+    chainDB = newBaseChainDB(trieDB, false, conf.netId)
+
+  let head = chainDB.getCanonicalHead()
+  if head.blockNumber < conf.head + (conf.maxBlocks - 1).u256:
+    raise newException(ValueError,
+      &"blocks up to {conf.head + (conf.maxBlocks - 1).u256} " &
+      &"needed, database head is {head.blockNumber}")
+
+  let
+    chain = newChain(chainDB)
+    res = chain.importBlocks(chainDB, conf)
+
+  res.report(conf)
+  if conf.jsonFile.len > 0:
+    writeFile(conf.jsonFile, res.toJson(conf).pretty)
+
+when isMainModule:
+  var message: string
+
+  ## Processing command line arguments
+  if configuration.processArguments(message) != Success:
+    echo message
+    quit(QuitFailure)
+  else:
+    if len(message) > 0:
+      echo message
+      quit(QuitSuccess)
+
+  try:
+    main()
+  except:
+    echo getCurrentExceptionMsg()
@@ -21,6 +21,8 @@ type
     maxBlocks*: int
     numCommits*: int
     netId*: NetworkId
+    jsonFile*: string
+    benchDir*: string
 
 var premixConfig {.threadvar.}: PremixConfiguration
 
@@ -95,6 +97,8 @@ proc processArguments*(msg: var string): ConfigStatus =
         config.numCommits = max(config.numCommits, 512)
       of "netid":
         checkArgument(processNetId, config.netId, value)
+      of "json": config.jsonFile = value
+      of "benchdir": config.benchDir = value
       else:
         msg = "Unknown option " & key
         if value.len > 0: msg = msg & " : " & value
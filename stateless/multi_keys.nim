@@ -97,6 +97,16 @@ proc add*(m: MultikeysRef, slot: StorageSlot) =
 proc sort*(m: MultikeysRef) =
   m.keys.sort(cmpHash)
 
+func isSubsetOf*(a, b: MultikeysRef): bool =
+  # both sorted, every key of `a` must be in `b`
+  var j = 0
+  for kd in a.keys:
+    while j < b.keys.len and cmpHash(b.keys[j].hash, kd.hash) < 0:
+      inc j
+    if j >= b.keys.len or b.keys[j].hash != kd.hash:
+      return false
+  result = true
+
 func initGroup*(m: MultikeysRef): Group =
   type T = type result.last
   result = Group(first: 0.T, last: (m.keys.len - 1).T)
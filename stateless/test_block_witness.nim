@@ -1,7 +1,7 @@
 import
   unittest2, os, json, strutils,
   eth/[common, rlp], eth/trie/[hexary, db, trie_defs],
-  stew/byteutils, faststreams/inputs,
+  stew/byteutils,
   ../tests/[test_helpers, test_config],
   ../nimbus/db/accounts_cache, ./witness_types,
   ../stateless/[witness_from_tree, tree_from_witness],
@@ -21,11 +21,7 @@ proc testGetBranch(tester: Tester, rootHash: KeccakHash, testStatusIMPL: var Tes
     var witness = wb.buildWitness(tester.keys)
 
     var db = newMemoryDB()
-    when defined(useInputStream):
-      var input = memoryInput(witness)
-      var tb = initTreeBuilder(input, db, flags)
-    else:
-      var tb = initTreeBuilder(witness, db, flags)
+    var tb = initTreeBuilder(witness, db, flags)
 
     var root = tb.buildTree()
     check root.data == rootHash.data
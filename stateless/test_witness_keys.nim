@@ -1,5 +1,5 @@
 import
-  randutils, random, unittest2, stew/byteutils, os,
+  randutils, random, unittest2, stew/byteutils, os, memfiles,
   eth/[common, rlp], eth/trie/[hexary, db, trie_defs, nibbles],
   faststreams/inputs, nimcrypto/sysrand,
   ../stateless/[witness_from_tree, tree_from_witness],
@@ -94,11 +94,7 @@ proc runTest(numPairs: int, testStatusIMPL: var TestStatus,
   var wb = initWitnessBuilder(memDB, rootHash, {wfEIP170})
   var witness = wb.buildWitness(mkeys)
   var db = newMemoryDB()
-  when defined(useInputStream):
-    var input = memoryInput(witness)
-    var tb = initTreeBuilder(input, db, {wfEIP170})
-  else:
-    var tb = initTreeBuilder(witness, db, {wfEIP170})
+  var tb = initTreeBuilder(witness, db, {wfEIP170})
   let root = tb.buildTree()
   check root.data == rootHash.data
 
@@ -122,6 +118,82 @@ proc runTest(numPairs: int, testStatusIMPL: var TestStatus,
     for kd in mkeys.keys:
       check kd.visited == true
 
+proc runInputTest(numPairs: int, testStatusIMPL: var TestStatus) =
+  var memDB = newMemoryDB()
+  var trie = initSecureHexaryTrie(memDB)
+  var addrs = newSeq[AccountKey](numPairs)
+
+  for i in 0..<numPairs:
+    let acc  = randAccount(memDB)
+    addrs[i] = AccountKey(address: randAddress(), codeTouched: acc.codeTouched, storageKeys: acc.storageKeys)
+    trie.put(addrs[i].address, rlp.encode(acc.account))
+
+  var mkeys = newMultiKeys(addrs)
+  let rootHash = trie.rootHash
+  var wb = initWitnessBuilder(memDB, rootHash, {wfEIP170})
+  let witness = wb.buildWitness(mkeys)
+
+  # faststreams input
+  var input = memoryInput(witness)
+  var tb = initTreeBuilder(input, newMemoryDB(), {wfEIP170})
+  check tb.buildTree().data == rootHash.data
+
+  # memory mapped file
+  let fileName = getTempDir() / "witness_input_test.bin"
+  writeFile(fileName, witness)
+  var mf = memfiles.open(fileName)
+  tb = initTreeBuilder(mf, newMemoryDB(), {wfEIP170})
+  check tb.buildTree().data == rootHash.data
+  mf.close()
+  removeFile(fileName)
+
+proc runRangeTest(numPairs, numBlocks: int, testStatusIMPL: var TestStatus) =
+  var memDB = newMemoryDB()
+  var trie = initSecureHexaryTrie(memDB)
+  var addrs = newSeq[AccountKey](numPairs)
+  var accs = newSeq[Account](numPairs)
+
+  for i in 0..<numPairs:
+    let acc  = randAccount(memDB)
+    addrs[i] = AccountKey(address: randAddress(), codeTouched: acc.codeTouched, storageKeys: acc.storageKeys)
+    accs[i]  = acc.account
+    trie.put(addrs[i].address, rlp.encode(accs[i]))
+
+  # every block touches a random subset, and changes one account
+  var roots: seq[KeccakHash]
+  var keys: seq[MultikeysRef]
+  var singleSize = 0
+  for n in 0..<numBlocks:
+    var touched: seq[AccountKey]
+    for i in 0..<numPairs:
+      if rand(0..2) != 0:
+        touched.add addrs[i]
+    if touched.len == 0:
+      touched.add addrs[0]
+    roots.add trie.rootHash
+    var wb = initWitnessBuilder(memDB, trie.rootHash, {wfEIP170})
+    singleSize += wb.buildWitness(newMultiKeys(touched)).len
+    keys.add newMultiKeys(touched)
+
+    let i = rand(0..<numPairs)
+    accs[i].balance = randU256()
+    trie.put(addrs[i].address, rlp.encode(accs[i]))
+
+  let witnesses = buildRangeWitness(memDB, roots, keys, {wfEIP170})
+  var rangeSize = 0
+  var db = newMemoryDB()
+  for n, witness in witnesses:
+    rangeSize += witness.len
+    var tb = initTreeBuilder(witness, db, {wfEIP170})
+    let root = tb.buildTree()
+    check root.data == roots[n].data
+
+    let newTrie = initSecureHexaryTrie(db, root)
+    for kd in keys[n].keys:
+      check newTrie.get(kd.address).len > 0
+
+  check rangeSize <= singleSize
+
 proc initMultiKeys(keys: openArray[string], storageMode: bool = false): MultikeysRef =
   result.new
   if storageMode:
@@ -158,6 +230,14 @@ proc witnessKeysMain*() =
       let rlpBytes = rlp.encode(acc)
       check rlpBytes.len > 32
 
+    test "stream and memory mapped input":
+      for i in 0..<10:
+        runInputTest(rand(1..30), testStatusIMPL)
+
+    test "block range witness":
+      for i in 0..<10:
+        runRangeTest(rand(2..30), rand(2..5), testStatusIMPL)
+
     test "invalid address ignored":
       runTest(rand(1..30), testStatusIMPL, false, addInvalidKeys = true)
 
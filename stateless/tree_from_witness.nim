@@ -1,7 +1,7 @@
 import
-  typetraits,
+  typetraits, memfiles, options, times, std/monotimes,
   faststreams/inputs, eth/[common, rlp], stint, stew/endians2,
-  eth/trie/[db, trie_defs], nimcrypto/[keccak, hash],
+  eth/trie/[db, trie_defs], nimcrypto/[keccak, hash], metrics,
   ./witness_types, stew/byteutils, ../nimbus/constants
 
 type
@@ -17,43 +17,69 @@ type
     slots*: seq[StorageSlot]
 
   TreeBuilder = object
-    when defined(useInputStream):
-      input: InputStream
-    else:
-      input: seq[byte]
-      pos: int
+    input: ptr UncheckedArray[byte] # borrowed, see `initTreeBuilder()`
+    inputLen: int
+    pos: int
+    owned: ref seq[byte]            # keeps drained stream data alive
     db: DB
     root: KeccakHash
     flags: WitnessFlags
     keys: seq[AccountAndSlots]
 
+declareCounter witness_decoded_bytes,
+  "Number of block witness bytes decoded"
+declareCounter witness_decoded_nodes,
+  "Number of trie nodes rebuilt from block witnesses"
+declareHistogram witness_decode_seconds,
+  "Time spent decoding a block witness",
+  buckets = [0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1.0, 5.0, Inf]
+
 # this TreeBuilder support short node parsing
 # but a block witness should not contains short node
 # for account trie. Short rlp node only appears in
 # storage trie with depth >= 9
 
-# the InputStream still unstable
-# when using large dataset for testing
-# or run longer
-
-when defined(useInputStream):
-  proc initTreeBuilder*(input: InputStream, db: DB, flags: WitnessFlags): TreeBuilder =
-    result.input = input
-    result.db = db
-    result.root = emptyRlpHash
-    result.flags = flags
-
-  proc initTreeBuilder*(input: openArray[byte], db: DB, flags: WitnessFlags): TreeBuilder =
-    result.input = memoryInput(input)
-    result.db = db
-    result.root = emptyRlpHash
-    result.flags = flags
-else:
-  proc initTreeBuilder*(input: openArray[byte], db: DB, flags: WitnessFlags): TreeBuilder =
-    result.input = @input
-    result.db = db
-    result.root = emptyRlpHash
-    result.flags = flags
+# the witness is decoded in place, the TreeBuilder only
+# holds a view into the input buffer. Slices of the input
+# (addresses, slots, code, hashes) are hashed and stored
+# without intermediate copies.
+
+proc init(t: var TreeBuilder, input: pointer, len: int, db: DB, flags: WitnessFlags) =
+  if len > 0:
+    t.input = cast[ptr UncheckedArray[byte]](input)
+    t.inputLen = len
+  t.db = db
+  t.root = emptyRlpHash
+  t.flags = flags
+
+proc initTreeBuilder*(input: openArray[byte], db: DB, flags: WitnessFlags): TreeBuilder =
+  ## The input is not copied, it must stay alive and unchanged
+  ## as long as the TreeBuilder is in use
+  let data = if input.len > 0: unsafeAddr input[0] else: nil
+  result.init(data, input.len, db, flags)
+
+proc initTreeBuilder*(input: MemFile, db: DB, flags: WitnessFlags): TreeBuilder =
+  ## Decode a memory mapped witness file, the file must stay
+  ## open as long as the TreeBuilder is in use
+  result.init(input.mem, input.size, db, flags)
+
+proc initTreeBuilder*(input: InputStream, db: DB, flags: WitnessFlags): TreeBuilder =
+  ## The witness is consumed from the stream up front, nodes
+  ## can straddle the stream buffer pages
+  const chunkSize = 64 * 1024
+  let owned = new(seq[byte])
+  let known = input.len
+  if known.isSome:
+    owned[] = newSeqOfCap[byte](known.get)
+  while input.readable:
+    # copy whole buffer pages rather than byte by byte
+    let start = owned[].len
+    owned[].setLen(start + chunkSize)
+    let n = input.readIntoEx(owned[].toOpenArray(start, start + chunkSize - 1))
+    owned[].setLen(start + n)
+  let data = if owned[].len > 0: addr owned[][0] else: nil
+  result.init(data, owned[].len, db, flags)
+  result.owned = owned
 
 func rootHash*(t: TreeBuilder): KeccakHash {.inline.} =
   t.root
@@ -61,41 +87,39 @@ func rootHash*(t: TreeBuilder): KeccakHash {.inline.} =
 func getDB*(t: TreeBuilder): DB {.inline.} =
   t.db
 
-when defined(useInputStream):
-  template readByte(t: var TreeBuilder): byte =
-    t.input.read
-
-  template len(t: TreeBuilder): int =
-    t.input.len
-
-  template read(t: var TreeBuilder, len: int): auto =
-    t.input.read(len)
-
-  template readable(t: var TreeBuilder): bool =
-    t.input.readable
-
-  template readable(t: var TreeBuilder, len: int): bool =
-    t.input.readable(len)
-
-else:
-  template readByte(t: var TreeBuilder): byte =
-    let pos = t.pos
-    inc t.pos
-    t.input[pos]
-
-  template len(t: TreeBuilder): int =
-    t.input.len
-
-  template readable(t: var TreeBuilder): bool =
-    t.pos < t.input.len
-
-  template readable(t: var TreeBuilder, length: int): bool =
-    t.pos + length <= t.input.len
-
-  template read(t: var TreeBuilder, len: int): auto =
-    let pos = t.pos
-    inc(t.pos, len)
-    toOpenArray(t.input, pos, pos+len-1)
+template readByte(t: var TreeBuilder): byte =
+  let pos = t.pos
+  inc t.pos
+  t.input[pos]
+
+template len(t: TreeBuilder): int =
+  t.inputLen
+
+template readable(t: var TreeBuilder): bool =
+  t.pos < t.inputLen
+
+template readable(t: var TreeBuilder, length: int): bool =
+  t.pos + length <= t.inputLen
+
+template read(t: var TreeBuilder, len: int): auto =
+  # the input is an unchecked array, guard against truncated
+  # witnesses even if the caller forgot `safeReadBytes`
+  if len < 0 or not t.readable(len):
+    raise newException(ParsingError, "Failed when try to read " & $len & " bytes")
+  let pos = t.pos
+  inc(t.pos, len)
+  toOpenArray(t.input, pos, pos+len-1)
+
+template measureDecode(t: var TreeBuilder, body: untyped) =
+  # failed decodes are observed too, up to the point of failure
+  let startPos = t.pos
+  let startTime = getMonoTime()
+  try:
+    body
+  finally:
+    witness_decode_seconds.observe(
+      (getMonoTime() - startTime).inNanoseconds.float64 / 1e9)
+    witness_decoded_bytes.inc(t.pos - startPos)
 
 proc safeReadByte(t: var TreeBuilder): byte =
   if t.readable:
@@ -157,11 +181,12 @@ proc toKeccak(r: var NodeKey, z: byte, x: openArray[byte]) {.inline.} =
 
 proc append(r: var RlpWriter, n: NodeKey) =
   if n.usedBytes < 32:
-    r.append rlpFromBytes(n.data.toOpenArray(0, n.usedBytes-1))
+    r.appendRawBytes n.data.toOpenArray(0, n.usedBytes-1)
   else:
     r.append n.data.toOpenArray(0, n.usedBytes-1)
 
 proc toNodeKey(t: var TreeBuilder, z: openArray[byte]): NodeKey =
+  witness_decoded_nodes.inc
   if z.len < 32:
     result.usedBytes = z.len
     result.data[0..z.len-1] = z[0..z.len-1]
@@ -195,41 +220,43 @@ proc treeNode(t: var TreeBuilder, depth: int = 0, storageMode = false): NodeKey
 
 proc buildTree*(t: var TreeBuilder): KeccakHash
   {.raises: [ContractCodeError, Defect, IOError, ParsingError, Exception].} =
-  let version = t.safeReadByte().int
-  if version != BlockWitnessVersion.int:
-    raise newException(ParsingError, "Wrong block witness version")
+  t.measureDecode:
+    let version = t.safeReadByte().int
+    if version != BlockWitnessVersion.int:
+      raise newException(ParsingError, "Wrong block witness version")
 
-  # one or more trees
+    # one or more trees
 
-  # we only parse one tree here
-  let metadataType = t.safeReadByte().int
-  if metadataType != MetadataNothing.int:
-    raise newException(ParsingError, "This tree builder support no metadata")
+    # we only parse one tree here
+    let metadataType = t.safeReadByte().int
+    if metadataType != MetadataNothing.int:
+      raise newException(ParsingError, "This tree builder support no metadata")
 
-  var res = treeNode(t)
-  if res.usedBytes != 32:
-    raise newException(ParsingError, "Buildtree should produce hash")
+    var res = treeNode(t)
+    if res.usedBytes != 32:
+      raise newException(ParsingError, "Buildtree should produce hash")
 
-  result.data = res.data
+    result.data = res.data
 
 # after the block witness spec mention how to split the big tree into
 # chunks, modify this buildForest into chunked witness tree builder
 proc buildForest*(t: var TreeBuilder): seq[KeccakHash]
   {.raises: [ContractCodeError, Defect, IOError, ParsingError, Exception].} =
-  let version = t.safeReadByte().int
-  if version != BlockWitnessVersion.int:
-    raise newException(ParsingError, "Wrong block witness version")
+  t.measureDecode:
+    let version = t.safeReadByte().int
+    if version != BlockWitnessVersion.int:
+      raise newException(ParsingError, "Wrong block witness version")
 
-  while t.readable:
-    let metadataType = t.safeReadByte().int
-    if metadataType != MetadataNothing.int:
-      raise newException(ParsingError, "This tree builder support no metadata")
+    while t.readable:
+      let metadataType = t.safeReadByte().int
+      if metadataType != MetadataNothing.int:
+        raise newException(ParsingError, "This tree builder support no metadata")
 
-    var res = treeNode(t)
-    if res.usedBytes != 32:
-      raise newException(ParsingError, "Buildtree should produce hash")
+      var res = treeNode(t)
+      if res.usedBytes != 32:
+        raise newException(ParsingError, "Buildtree should produce hash")
 
-    result.add KeccakHash(data: res.data)
+      result.add KeccakHash(data: res.data)
 
 proc treeNode(t: var TreeBuilder, depth: int, storageMode = false): NodeKey =
   if depth > 64:
@@ -262,7 +289,8 @@ proc branchNode(t: var TreeBuilder, depth: int, storageMode: bool): NodeKey =
 
   when defined(debugHash):
     var hash: NodeKey
-    toKeccak(hash, t.read(32))
+    safeReadBytes(t, 32):
+      toKeccak(hash, t.read(32))
 
   var r = initRlpList(17)
 
@@ -341,7 +369,8 @@ proc extensionNode(t: var TreeBuilder, depth: int, storageMode: bool): NodeKey =
 
   when defined(debugHash):
     var hash: NodeKey
-    toKeccak(hash, t.read(32))
+    safeReadBytes(t, 32):
+      toKeccak(hash, t.read(32))
 
   if nibblesLen + depth > 64 or nibblesLen + depth < 1:
     raise newException(ParsingError, "depth should between 1..64")
@@ -404,7 +433,9 @@ proc accountNode(t: var TreeBuilder, depth: int): NodeKey =
 
   when defined(debugHash):
     let len = t.safeReadU32().int
-    let node = @(t.read(len))
+    var node: seq[byte]
+    safeReadBytes(t, len):
+      node = @(t.read(len))
     let nodeKey = t.toNodeKey(node)
 
   when defined(debugDepth):
@@ -473,7 +504,9 @@ proc accountStorageLeafNode(t: var TreeBuilder, depth: int): NodeKey =
 
   when defined(debugHash):
     let len = t.safeReadU32().int
-    let node = @(t.read(len))
+    var node: seq[byte]
+    safeReadBytes(t, len):
+      node = @(t.read(len))
     let nodeKey = t.toNodeKey(node)
 
   when defined(debugDepth):
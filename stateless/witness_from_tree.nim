@@ -1,4 +1,5 @@
 import
+  tables, hashes,
   stew/[byteutils, endians2],
   nimcrypto/[keccak, hash], eth/[common, rlp],
   eth/trie/[trie_defs, nibbles, db],
@@ -9,11 +10,33 @@ import
 type
   DB = TrieDatabaseRef
 
+  CoverKey = object
+    node: KeyHash       # hash of an expanded trie node
+    key: KeyHash        # key hash that went through the node
+    depth: int
+    storageMode: bool
+
+  KeyCover = object
+    # what was emitted below an account leaf, the leaf
+    # can only be shared if it covers the new request
+    codeTouched: bool
+    storageKeys: MultikeysRef
+
+  WitnessCoverRef = ref object
+    # nodes expanded by earlier witnesses of a block range
+    nodes: Table[CoverKey, KeyCover]
+
   WitnessBuilder* = object
     db*: DB
     root: KeccakHash
     output: OutputStream
     flags: WitnessFlags
+    cover: WitnessCoverRef
+
+  RangeWitnessBuilder* = object
+    db: DB
+    flags: WitnessFlags
+    cover: WitnessCoverRef
 
   StackElem = object
     node: seq[byte]
@@ -28,6 +51,48 @@ proc initWitnessBuilder*(db: DB, rootHash: KeccakHash, flags: WitnessFlags = {})
   result.output = memoryOutput().s
   result.flags = flags
 
+proc initRangeWitnessBuilder*(db: DB, flags: WitnessFlags = {}): RangeWitnessBuilder =
+  ## Witnesses for consecutive blocks, see `buildWitness(RangeWitnessBuilder)`
+  result.db = db
+  result.flags = flags
+  result.cover = WitnessCoverRef(nodes: initTable[CoverKey, KeyCover]())
+
+func hash(k: CoverKey): Hash =
+  var h = hash(k.node) !& hash(k.key)
+  h = h !& hash(k.depth) !& hash(k.storageMode)
+  result = !$h
+
+func covers(c: KeyCover, kd: KeyData): bool =
+  if kd.storageMode:
+    return true
+  if kd.codeTouched and not c.codeTouched:
+    return false
+  if kd.storageKeys.isNil:
+    return true
+  result = not c.storageKeys.isNil and kd.storageKeys.isSubsetOf(c.storageKeys)
+
+proc isCovered(wb: var WitnessBuilder, z: StackElem, nodeHash: KeyHash): bool =
+  # true if every key below this node was already
+  # expanded by an earlier witness of the range
+  for i in z.parentGroup.first..z.parentGroup.last:
+    let kd = z.keys.keys[i]
+    let ck = CoverKey(node: nodeHash, key: kd.hash, depth: z.depth, storageMode: z.storageMode)
+    let c = wb.cover.nodes.getOrDefault(ck)
+    if not wb.cover.nodes.hasKey(ck) or not c.covers(kd):
+      return false
+  result = true
+
+proc setCovered(wb: var WitnessBuilder, z: StackElem, nodeHash: KeyHash) =
+  for i in z.parentGroup.first..z.parentGroup.last:
+    let kd = z.keys.keys[i]
+    let ck = CoverKey(node: nodeHash, key: kd.hash, depth: z.depth, storageMode: z.storageMode)
+    if kd.storageMode:
+      wb.cover.nodes[ck] = KeyCover()
+    else:
+      let c = KeyCover(codeTouched: kd.codeTouched, storageKeys: kd.storageKeys)
+      if not wb.cover.nodes.hasKey(ck) or not wb.cover.nodes.getOrDefault(ck).covers(kd):
+        wb.cover.nodes[ck] = c
+
 template extensionNodeKey(r: Rlp): auto =
   hexPrefixDecode r.listElem(0).toBytes
 
@@ -249,6 +314,15 @@ proc getBranchRecurse(wb: var WitnessBuilder, z: var StackElem) =
     writeShortRlp(wb, z.node, z.depth, z.storageMode)
     return
 
+  if not wb.cover.isNil:
+    # block range mode: a sub-trie already sent with an
+    # earlier block is only referenced by its hash
+    let nodeHash = keccak(z.node).data
+    if wb.isCovered(z, nodeHash):
+      writeHashNode(wb, nodeHash, z.depth, z.storageMode)
+      return
+    wb.setCovered(z, nodeHash)
+
   var nodeRlp = rlpFromBytes z.node
 
   case nodeRlp.listLen
@@ -347,3 +421,23 @@ proc buildWitness*(wb: var WitnessBuilder, keys: MultikeysRef): seq[byte]
 
   # result
   result = wb.output.getOutput(seq[byte])
+
+proc buildWitness*(rb: var RangeWitnessBuilder, rootHash: KeccakHash, keys: MultikeysRef): seq[byte]
+  {.raises: [ContractCodeError, IOError, Defect, CatchableError, Exception].} =
+  ## Witness for the next block of a range. Sub-tries that were fully
+  ## expanded for the keys of an earlier block are emitted as hash nodes.
+  ## The witnesses must be decoded in the same order into one database,
+  ## each one is a valid witness on its own for a receiver that already
+  ## holds the nodes of the earlier ones.
+  var wb = initWitnessBuilder(rb.db, rootHash, rb.flags)
+  wb.cover = rb.cover
+  result = wb.buildWitness(keys)
+
+proc buildRangeWitness*(db: DB, roots: openArray[KeccakHash], keys: openArray[MultikeysRef],
+                        flags: WitnessFlags = {}): seq[seq[byte]]
+  {.raises: [ContractCodeError, IOError, Defect, CatchableError, Exception].} =
+  ## Witnesses for blocks with pre-state `roots[i]` and touched `keys[i]`
+  doAssert(roots.len == keys.len)
+  var rb = initRangeWitnessBuilder(db, flags)
+  for i in 0..<roots.len:
+    result.add rb.buildWitness(roots[i], keys[i])
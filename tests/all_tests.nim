@@ -36,5 +36,10 @@ cliBuilder:
           ../stateless/test_witness_json,
           ./test_misc,
           ./test_graphql,
+          ./test_rlp_import,
+          ./test_state_pruner,
           ./test_lru_cache,
+          ./test_bloombits,
+          ./test_header_cache,
+          ./test_stack_trie,
           ./test_clique
@@ -0,0 +1,88 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+# timings of the MODEXP and BLAKE2b F precompile engines, not run by the
+# test suite (correctness is checked in `test_precompiles`), build with
+# `make bench_precompiles`
+
+import
+  std/[strformat, times],
+  stint,
+  ../nimbus/utils/modexp, ../nimbus/vm2/blake2b_f
+
+proc pseudoRandom(n: int; seed: var uint64): seq[byte] =
+  result = newSeq[byte](n)
+  for i in 0 ..< n:
+    seed = seed xor (seed shl 13)
+    seed = seed xor (seed shr 7)
+    seed = seed xor (seed shl 17)
+    result[i] = byte(seed and 0xff)
+
+proc benchModExp(T: type StUint; expBytes, rounds: int) =
+  ## Montgomery engine vs. the generic `powmod()` for a random odd modulus
+  ## of the full width of `T`
+  const size = T.bits div 8
+  var seed = 0x9E3779B97F4A7C15'u64
+  var m = pseudoRandom(size, seed)
+  m[0] = m[0] or 0x80
+  m[^1] = m[^1] or 1
+  let
+    e = pseudoRandom(expBytes, seed)
+    modulo = readUintBE[T.bits](m)
+    base = readUintBE[T.bits](pseudoRandom(size, seed)) mod modulo
+    exp = readUintBE[T.bits](e)
+
+  var
+    mont: seq[byte]
+    generic: T
+  let start = cpuTime()
+  for _ in 0 ..< rounds:
+    mont = powModOdd(base.toByteArrayBE, e, m)
+  let middle = cpuTime()
+  for _ in 0 ..< rounds:
+    generic = powmod(base, exp, modulo)
+  let done = cpuTime()
+
+  doAssert mont == @(generic.toByteArrayBE)
+  echo &"  modexp {T.bits:>4} bit modulus, {8*expBytes:>4} bit exponent: " &
+    &"montgomery {1e6 * (middle - start) / rounds.float:>9.1f} us, " &
+    &"generic {1e6 * (done - middle) / rounds.float:>9.1f} us"
+
+proc benchBlake2b(rounds: uint32; calls: int) =
+  ## Rounds per second of the scalar kernel and the SIMD kernels supported
+  ## by the CPU
+  var seed = 0x2545F4914F6CDD1D'u64
+  var input = pseudoRandom(blake2FInputLength, seed)
+  input[0 .. 3] = [byte(rounds shr 24), byte(rounds shr 16),
+                   byte(rounds shr 8), byte(rounds)]
+  input[^1] = 1
+
+  for kernel in bkScalar .. blake2bKernel():
+    var output: array[64, byte]
+    let start = cpuTime()
+    for _ in 0 ..< calls:
+      doAssert blake2b_F(input, output, kernel)
+    let secs = max(cpuTime() - start, 1e-9)
+    echo &"  blake2b_f {rounds:>7} rounds, {$kernel:>6}: " &
+      &"{rounds.float * calls.float / secs / 1e6:>8.2f} M rounds/s"
+
+proc main() =
+  echo "MODEXP"
+  benchModExp(UInt256, 3, 1000)
+  benchModExp(StUint[1024], 3, 200)
+  benchModExp(StUint[2048], 3, 50)
+  benchModExp(StUint[4096], 3, 10)
+  benchModExp(UInt256, 32, 200)
+  benchModExp(StUint[1024], 128, 10)
+  benchModExp(StUint[2048], 256, 2)
+
+  echo "BLAKE2b F"
+  benchBlake2b(12, 100_000)
+  benchBlake2b(1_000_000, 10)
+
+when isMainModule:
+  main()
@@ -215,11 +215,7 @@ proc blockWitness(vmState: BaseVMState, chainDB: BaseChainDB) =
 
   # build tree from witness
   var db = newMemoryDB()
-  when defined(useInputStream):
-    var input = memoryInput(witness)
-    var tb = initTreeBuilder(input, db, flags)
-  else:
-    var tb = initTreeBuilder(witness, db, flags)
+  var tb = initTreeBuilder(witness, db, flags)
   let root = tb.buildTree()
 
   # compare the result
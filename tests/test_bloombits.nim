@@ -0,0 +1,96 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+import
+  std/[json, options],
+  unittest2, stew/byteutils, stint,
+  eth/[common, bloom], eth/trie/db,
+  ../nimbus/constants,
+  ../nimbus/db/[bloombits, db_chain, storage_types],
+  ../nimbus/rpc/[filters, rpc_types]
+
+proc toBloom(items: varargs[seq[byte]]): common.BloomFilter =
+  var b: bloom.BloomFilter
+  for item in items:
+    b.incl item
+  b.value.toByteArrayBE
+
+proc blockNumbers(chain: BaseChainDB; fromBlock, toBlock: int;
+                  query: BloomQuery): seq[int] =
+  for num in chain.candidateBlocks(
+      fromBlock.toBlockNumber, toBlock.toBlockNumber, query):
+    result.add num.truncate(int)
+
+proc bloomBitsMain*() =
+  suite "Log bloom bits index":
+    let
+      addrA = hexToByteArray[20]("0x0f572e5295c57f15886f9b263e2f6d2d6c7b5ec6")
+      addrB = hexToByteArray[20]("0xa3b2222afa5c987da6ef773fde8d01b9f23d481f")
+      topic = hexToByteArray[32](
+        "0xddf252ad1be2c89b69c2b068fc378daa952ba7f163c4a11628f55a4df523b3ef")
+      lastBlock = bloomSectionSize + 3
+      queryA = @[@[addrA.bloomBits]]
+
+    var
+      chain = newBaseChainDB(newMemoryDB())
+      sectionEnd: BlockHeader
+      parentHash = GENESIS_PARENT_HASH
+
+    for n in 0 .. lastBlock:
+      var header = BlockHeader(
+        parentHash:  parentHash,
+        blockNumber: n.toBlockNumber,
+        difficulty:  1.u256)
+      case n
+      of 5: header.bloom = toBloom(@addrA, @topic)
+      of 10: header.bloom = toBloom(@addrB)
+      of bloomSectionSize - 1, bloomSectionSize + 3:
+        header.bloom = toBloom(@addrA)
+      else: discard
+      discard chain.persistHeaderToDb(header)
+      parentHash = header.blockHash
+      if n == bloomSectionSize - 1:
+        sectionEnd = header
+
+    test "unindexed sections fall back to header blooms":
+      check chain.blockNumbers(0, lastBlock, queryA) ==
+        @[5, bloomSectionSize - 1, bloomSectionSize + 3]
+      check chain.blockNumbers(0, 20, @[]).len == 21
+
+    test "indexed section":
+      chain.updateBloomBits(sectionEnd, [Receipt(bloom: sectionEnd.bloom)])
+      check bloomSectionHeadKey(0).toOpenArray in chain.db
+      check 0 < chain.db.get(
+        bloomBitsKey(0, addrA.bloomBits[0]).toOpenArray).len
+
+      check chain.blockNumbers(0, lastBlock, queryA) ==
+        @[5, bloomSectionSize - 1, bloomSectionSize + 3]
+      check chain.blockNumbers(6, bloomSectionSize, queryA) ==
+        @[bloomSectionSize - 1]
+      check chain.blockNumbers(0, lastBlock,
+        @[@[addrA.bloomBits], @[topic.bloomBits]]) == @[5]
+      check chain.blockNumbers(0, 100,
+        @[@[addrA.bloomBits, addrB.bloomBits]]) == @[5, 10]
+      check chain.blockNumbers(11, 100, @[@[addrB.bloomBits]]).len == 0
+
+    test "filter options":
+      var opts: FilterOptions
+      fromJson(%*{
+        "fromBlock": "0x1",
+        "address": "0x0f572e5295c57f15886f9b263e2f6d2d6c7b5ec6",
+        "topics": [newJNull(), [
+          "0xddf252ad1be2c89b69c2b068fc378daa952ba7f163c4a11628f55a4df523b3ef"]]
+        }, "filterOptions", opts)
+      check opts.fromBlock == some("0x1")
+      check opts.toBlock.isNone
+      check opts.address == @[addrA]
+      check opts.topics.len == 2
+      check opts.topics[0].isNone
+      check opts.topics[1].get == @[Hash256(data: topic)]
+
+when isMainModule:
+  bloomBitsMain()
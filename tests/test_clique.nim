@@ -12,6 +12,7 @@ import
   std/[algorithm, os, sequtils, strformat, strutils],
   ../nimbus/db/db_chain,
   ../nimbus/p2p/[chain, clique],
+  ../nimbus/p2p/clique/snapshot/lru_snaps,
   ./test_clique/[pool, undump],
   eth/[common, keys],
   stint,
@@ -140,6 +141,19 @@ proc runGoerliReplay(noisy = true; dir = "tests"; stopAfterBlock = 0u64) =
           check addedPersistBlocks == ValidationResult.Ok
           if addedPersistBlocks != ValidationResult.Ok: return
 
+    test "Voting snapshot recovery with empty LRU cache":
+      let head = pool.db.getCanonicalHead
+      check pool.clique.cliqueSnapshot(head).isOk
+      let signers = pool.cliqueSigners
+
+      # Same as after a restart, the snapshot is re-built on top of the
+      # latest checkpoint loaded from the database
+      pool.clique.db = pool.db
+      check not pool.clique.recents.hasLruSnaps(head.hash)
+      check pool.clique.cliqueSnapshot(head).isOk
+      check pool.cliqueSigners.len == signers.len
+      check pool.cliqueSigners.allIt(it in signers)
+
     if stoppedOk:
       test &"Runner stopped after reaching #{stopThreshold}":
         discard
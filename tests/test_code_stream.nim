@@ -8,6 +8,13 @@
 import  unittest2, sequtils,
         ../nimbus/vm_internals
 
+when not defined(evmc_enabled) and defined(vm2_enabled):
+  import
+    nimcrypto/[hash, keccak],
+    ../nimbus/forks,
+    ../nimbus/vm2/code_analysis,
+    ../nimbus/vm2/interpreter/gas_costs
+
 proc codeStreamMain*() =
   suite "parse bytecode":
     test "accepts bytes":
@@ -116,3 +123,58 @@ proc codeStreamMain*() =
       check(not codeStream.isValidOpcode(3))
       check(codeStream.isValidOpcode(4))
       check(not codeStream.isValidOpcode(5))
+
+    when not defined(evmc_enabled) and defined(vm2_enabled):
+      test "basic blocks":
+        # PUSH1 1, PUSH1 2, ADD, JUMPDEST, POP, PUSH1 0, JUMP, DUP2, STOP
+        let ca = newCodeAnalysis(
+          @[0x60'u8, 0x01, 0x60, 0x02, 0x01, 0x5b, 0x50, 0x60, 0x00, 0x56,
+            0x81, 0x00])
+        var blk: BasicBlock
+        check ca.basicBlock(0, FkBerlin, BerlinGasCosts, blk)
+        check blk.lastPos == 4
+        check blk.gas == 9
+        check blk.stackReq == 0
+        check blk.stackMax == 2
+
+        check ca.basicBlock(5, FkBerlin, BerlinGasCosts, blk)
+        check blk.lastPos == 9
+        check blk.gas == 1 + 2 + 3 + 8
+        check blk.stackReq == 1
+        check blk.stackMax == 0
+
+        check ca.basicBlock(10, FkBerlin, BerlinGasCosts, blk)
+        check blk.stackReq == 2
+        check blk.stackMax == 1
+
+        check not ca.basicBlock(1, FkBerlin, BerlinGasCosts, blk)
+        check not ca.basicBlock(6, FkBerlin, BerlinGasCosts, blk)
+
+      test "analysis cached by code hash":
+        # PUSH1 0x5b, JUMPDEST, PUSH2 0x5b5b, then JUMPDEST in the second
+        # bitmap word, the 0x5b bytes inside PUSH data are no destinations
+        let
+          code = @[0x60'u8, 0x5b, 0x5b, 0x61, 0x5b, 0x5b].concat(
+            repeat(0x00'u8, 64)).concat(@[0x5b'u8, 0x00])
+          codeHash = keccak256.digest(code)
+        check getCodeAnalysis(codeHash).isNil
+
+        let ca = putCodeAnalysis(codeHash, code)
+        check getCodeAnalysis(codeHash) == ca
+        check ca.code == code
+
+        var codeStream = newCodeStream(getCodeAnalysis(codeHash))
+        check(codeStream.len == code.len)
+        check(codeStream.next == Op.PUSH1)
+        check(not codeStream.isValidJumpDest(1))
+        check(codeStream.isValidJumpDest(2))
+        check(not codeStream.isValidOpcode(4))
+        check(not codeStream.isValidJumpDest(5))
+        check(codeStream.isValidJumpDest(70))
+        check(not codeStream.isValidJumpDest(71))
+        check(not codeStream.isValidJumpDest(code.len))
+
+        # least recently used entries are evicted
+        for n in 0 ..< codeCacheMaxItems:
+          discard putCodeAnalysis(keccak256.digest($n), @[0x00'u8])
+        check getCodeAnalysis(codeHash).isNil
@@ -0,0 +1,88 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+import
+  unittest2, stint,
+  eth/common, eth/trie/db,
+  ../nimbus/constants,
+  ../nimbus/db/[db_chain, header_cache]
+
+proc hashOf(n: int): Hash256 =
+  result.data[0] = 1
+  result.data[30] = byte(n shr 8)
+  result.data[31] = byte(n and 255)
+
+proc headerCacheMain*() =
+  suite "Header and canonical hash cache":
+    test "ancestor ring":
+      let hc = newHeaderCache(maxHashes = 4)
+      var hash: Hash256
+      for n in 0 .. 299:
+        hc.setCanonical(n.uint64, hashOf(n))
+
+      # ring covers the latest blocks, the LRU only the last four
+      check hc.getHash(44, hash) and hash == hashOf(44)
+      check hc.getHash(299, hash) and hash == hashOf(299)
+      check not hc.getHash(43, hash)
+      check not hc.getHash(300, hash)
+
+      # rewrite number 200 truncates the ring
+      hc.setCanonical(200, hashOf(1200))
+      check hc.getHash(200, hash) and hash == hashOf(1200)
+      check hc.getHash(199, hash) and hash == hashOf(199)
+      check not hc.getHash(250, hash)
+      check hc.getHash(298, hash) and hash == hashOf(298) # from the LRU
+
+      # gap restarts the ring
+      hc.setCanonical(500, hashOf(500))
+      check hc.getHash(500, hash)
+      check not hc.getHash(199, hash)
+
+      hc.clear
+      check not hc.getHash(500, hash)
+
+    test "chain lookups":
+      var
+        chain = newBaseChainDB(newMemoryDB())
+        headers: seq[BlockHeader]
+        parentHash = GENESIS_PARENT_HASH
+      for n in 0 .. 300:
+        let header = BlockHeader(
+          parentHash:  parentHash,
+          blockNumber: n.toBlockNumber,
+          difficulty:  1.u256)
+        discard chain.persistHeaderToDb(header)
+        headers.add header
+        parentHash = header.blockHash
+
+      for n in [0, 100, 299, 300]:
+        check chain.getBlockHash(n.toBlockNumber) == headers[n].blockHash
+        check chain.getBlockHeader(n.toBlockNumber) == headers[n]
+
+      let ancestors = chain.getAncestorsHashes(7.u256, headers[300])
+      check ancestors.len == 7
+      check ancestors[^1] == headers[299].blockHash
+      check ancestors[0] == headers[293].blockHash
+
+      # rolled back writes must not be served from the cache
+      let
+        tx = chain.db.beginTransaction()
+        header = BlockHeader(
+          parentHash:  parentHash,
+          blockNumber: 301.toBlockNumber,
+          difficulty:  1.u256)
+      discard chain.persistHeaderToDb(header)
+      check chain.getBlockHash(301.toBlockNumber) == header.blockHash
+      tx.rollback()
+      chain.resetHeaderCache()
+      var hash: Hash256
+      check not chain.getBlockHash(301.toBlockNumber, hash)
+      check not chain.headerExists(header.blockHash)
+      check chain.getBlockHash(300.toBlockNumber) == headers[300].blockHash
+
+when isMainModule:
+  headerCacheMain()
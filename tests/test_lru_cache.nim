@@ -190,6 +190,33 @@ proc doRandomDeleteTest(noisy: bool) =
   c1.verifyBackLinks
 
 
+proc doPutItemTest(noisy: bool) =
+
+  proc say(a: varargs[string]) =
+    say(noisy = noisy, args = a)
+
+  var
+    c1 = filledTestCache(false)
+    first = c1.firstKey
+    oldLen = c1.len
+
+  # update existing entry, moves it to the end of the queue
+  c1.putItem(first, "updated")
+  say &"c1: update {first} => {c1.toKeyList}"
+  doAssert c1.len == oldLen
+  doAssert c1.lastKey == first
+  doAssert c1.getItem(first, peekOK = true).value == "updated"
+
+  # new entries push out the oldest ones
+  for n in 1000 ..< 1000 + cacheLimit:
+    c1.putItem(n, "new")
+  doAssert c1.len == cacheLimit
+  doAssert c1.firstKey == 1000
+  doAssert c1.lastKey == 1000 + cacheLimit - 1
+  doAssert not c1.hasKey(first)
+  c1.verifyBackLinks
+
+
 proc lruCacheMain*(noisy = defined(debug)) =
   suite "LRU Cache":
 
@@ -208,6 +235,9 @@ proc lruCacheMain*(noisy = defined(debug)) =
     test "Random Delete":
       doRandomDeleteTest(noisy)
 
+    test "Put Item":
+      doPutItemTest(noisy)
+
 
 when isMainModule:
   lruCacheMain()
@@ -69,3 +69,14 @@ proc memoryMain*() =
       check(mem.read(startPos = 5, size = 4) == @[1.byte, 0.byte, 1.byte, 0.byte])
       check(mem.read(startPos = 6, size = 4) == @[0.byte, 1.byte, 0.byte, 0.byte])
       check(mem.read(startPos = 1, size = 3) == @[0.byte, 0.byte, 0.byte])
+
+    when not defined(evmc_enabled) and defined(vm2_enabled):
+      test "views and in-place fill":
+        var mem = memory32()
+        mem.write(startPos = 4, value = @[1.byte, 2.byte, 3.byte])
+        check(@(mem.view(startPos = 4, size = 3)) == @[1.byte, 2.byte, 3.byte])
+        check(mem.view(startPos = 1_000_000, size = 0).len == 0)
+        mem.fill(startPos = 5, size = 2, value = 7.byte)
+        check(mem.read(startPos = 4, size = 3) == @[1.byte, 7.byte, 7.byte])
+        mem.fill(startPos = 4, size = 3)
+        check(mem.bytes == repeat(0.byte, 32))
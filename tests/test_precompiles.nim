@@ -10,7 +10,7 @@ import
   strformat, strutils, eth/trie/db, eth/common, ../nimbus/db/db_chain, ../nimbus/constants,
   ../nimbus/[vm_computation, vm_state, forks], macros,
   test_allowed_to_fail,
-  ../nimbus/transaction/call_evm, options
+  ../nimbus/transaction/call_evm, options, ../nimbus/utils/modexp, ../nimbus/vm2/blake2b_f
 
 proc initAddress(i: byte): EthAddress = result[19] = i
 
@@ -80,6 +80,75 @@ proc testFixture(fixtures: JsonNode, testStatusIMPL: var TestStatus) =
     echo "Unknown test vector '" & $label & "'"
     testStatusIMPL = SKIPPED
 
+proc pseudoRandom(n: int; seed: var uint64): seq[byte] =
+  result = newSeq[byte](n)
+  for i in 0 ..< n:
+    seed = seed xor (seed shl 13)
+    seed = seed xor (seed shr 7)
+    seed = seed xor (seed shl 17)
+    result[i] = byte(seed and 0xff)
+
+proc modExpAgrees(T: type StUint; modBytes: int; expBytes = 3;
+                  baseAboveModulus = false; padded = true): bool =
+  ## Compare the Montgomery engine with the generic `powmod()` for a random
+  ## odd modulus of `modBytes` significant bytes. With `padded` the modulus
+  ## has leading zero bytes up to the width of `T`, as in the precompile,
+  ## otherwise it is passed with its significant bytes only.
+  const size = T.bits div 8
+  doAssert modBytes <= size
+  var seed = 0x9E3779B97F4A7C15'u64 xor modBytes.uint64
+  var m = newSeq[byte](size)
+  m[size - modBytes .. ^1] = pseudoRandom(modBytes, seed)
+  m[size - modBytes] = m[size - modBytes] or 0x80
+  m[^1] = m[^1] or 1
+
+  # the engine accepts a base up to the width of its size class
+  let classBytes = 4 * ((modBytes + 3) div 4)
+  var b = newSeq[byte](size)
+  if baseAboveModulus:
+    for i in size - classBytes ..< size:
+      b[i] = 0xff
+  else:
+    b[size - modBytes .. ^1] = pseudoRandom(modBytes, seed)
+
+  let
+    e = pseudoRandom(expBytes, seed)
+    modulo = readUintBE[T.bits](m)
+    base = readUintBE[T.bits](b)
+    exp = readUintBE[T.bits](e)
+    mont =
+      if padded: powModOdd(b, e, m)
+      else: powModOdd(b[size - classBytes .. ^1], e, m[size - modBytes .. ^1])
+    expected = @(powmod(base, exp, modulo).toByteArrayBE)
+
+  # the result has the length of the size class, compare as numbers
+  if mont.len > size:
+    return false
+  var res = newSeq[byte](size)
+  res[size - mont.len .. ^1] = mont
+  res == expected
+
+proc blake2bKernels(rounds: uint32; calls: int): bool =
+  ## Compare the SIMD kernels supported by the CPU with the scalar one for
+  ## a random input, timings are in `bench_precompiles`
+  var seed = 0x2545F4914F6CDD1D'u64
+  var input = pseudoRandom(blake2FInputLength, seed)
+  input[0 .. 3] = [byte(rounds shr 24), byte(rounds shr 16),
+                   byte(rounds shr 8), byte(rounds)]
+  input[^1] = 1
+  result = true
+
+  var expected: array[64, byte]
+  for kernel in bkScalar .. blake2bKernel():
+    var output: array[64, byte]
+    for _ in 0 ..< calls:
+      if not blake2b_F(input, output, kernel):
+        return false
+    if kernel == bkScalar:
+      expected = output
+    elif output != expected:
+      result = false
+
 proc precompilesMain*() =
   suite "Precompiles":
     # TODO: For now, EVMC is incompatible with these tests.
@@ -88,5 +157,58 @@ proc precompilesMain*() =
     else:
       jsonTest("PrecompileTests", testFixture, skipPrecompilesTests)
 
+  suite "MODEXP Montgomery engine":
+    test "full width moduli":
+      check modExpAgrees(UInt256, 32)
+      check modExpAgrees(StUint[1024], 128)
+      check modExpAgrees(StUint[2048], 256)
+      check modExpAgrees(StUint[4096], 512)
+
+    test "windowed exponents":
+      check modExpAgrees(UInt256, 32, expBytes = 32)
+      check modExpAgrees(StUint[1024], 100, expBytes = 16)
+      check modExpAgrees(StUint[2048], 200, expBytes = 9)
+
+    test "moduli with leading zero bytes":
+      check modExpAgrees(UInt256, 1)
+      check modExpAgrees(UInt256, 5)
+      check modExpAgrees(StUint[1024], 33)
+      check modExpAgrees(StUint[4096], 130)
+      check modExpAgrees(StUint[8192], 520)
+
+    test "base not less than the modulus":
+      check modExpAgrees(UInt256, 32, baseAboveModulus = true)
+      check modExpAgrees(UInt256, 7, baseAboveModulus = true)
+      check modExpAgrees(StUint[1024], 65, expBytes = 16, baseAboveModulus = true)
+      check modExpAgrees(StUint[2048], 129, baseAboveModulus = true)
+
+    test "modulus shorter than the size class":
+      # 17, 33, 65 .. bytes round up to the next class, passed unpadded
+      check modExpAgrees(UInt256, 17, padded = false)
+      check modExpAgrees(UInt256, 30, padded = false)
+      check modExpAgrees(StUint[1024], 97, padded = false)
+      check modExpAgrees(StUint[2048], 250, padded = false)
+      check modExpAgrees(StUint[8192], 700, padded = false,
+                         baseAboveModulus = true)
+
+    test "size class boundaries":
+      # last byte count of a class and the first of the next one, up to
+      # 128/129 and 129/130 limbs
+      for modBytes in [16, 17, 32, 33, 48, 49, 64, 65, 96, 97]:
+        check modExpAgrees(StUint[1024], modBytes)
+      for modBytes in [128, 129, 192, 193, 256, 257]:
+        check modExpAgrees(StUint[2048], modBytes)
+      for modBytes in [384, 385, 512]:
+        check modExpAgrees(StUint[4096], modBytes)
+      for modBytes in [513, 516, 517, 520, 768, 769]:
+        check modExpAgrees(StUint[8192], modBytes)
+
+  suite "BLAKE2b F kernels":
+    test "kernels agree with the scalar version":
+      check blake2bKernels(0, 1)
+      check blake2bKernels(1, 100)
+      check blake2bKernels(12, 10)
+      check blake2bKernels(13, 100)
+
 when isMainModule:
   precompilesMain()
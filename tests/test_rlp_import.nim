@@ -0,0 +1,108 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+import
+  std/[os, json],
+  stew/byteutils, unittest2,
+  eth/[common, rlp, trie/db],
+  ../nimbus/[genesis, config], ../nimbus/db/db_chain,
+  ../nimbus/p2p/chain, ../nimbus/p2p/chain/rlp_import,
+  ./uncle_chain
+
+const
+  importFile = "rlp_import_test.rlp"
+  sealFixture = "tests" / "fixtures" / "PersistBlockTests" / "block116524.json"
+    ## Main net block with a PoW seal
+
+proc newTestChain(): Chain =
+  let chainDB = newBaseChainDB(newMemoryDb(),
+    pruneTrie = false,
+    getConfiguration().net.networkId
+  )
+  chainDB.initializeEmptyDb()
+  newChain(chainDB, extraValidation = true)
+
+proc newSealTestChain(): (Chain, EthBlock) =
+  ## Chain at the parent of the fixture block, and the block
+  let
+    node = json.parseFile(sealFixture)
+    memoryDB = newMemoryDB()
+    chainDB = newBaseChainDB(memoryDB, pruneTrie = false, MainNet)
+  for k, v in node["state"]:
+    memoryDB.put(hexToSeqByte(k), hexToSeqByte(v.getStr()))
+
+  let
+    blockNumber = UInt256.fromHex(node["blockNumber"].getStr())
+    header = chainDB.getBlockHeader(blockNumber)
+    body = chainDB.getBlockBody(header.blockHash)
+  chainDB.setHead(chainDB.getBlockHeader(blockNumber - 1), true)
+  # no header validation by `persistBlocks()`, seals are checked on import
+  (newChain(chainDB),
+   EthBlock(header: header, transactions: body.transactions,
+            uncles: body.uncles))
+
+proc writeBlocks(blocks: openArray[Blob]; truncate = 0) =
+  var data: Blob
+  for b in blocks:
+    data.add b
+  data.setLen(data.len - truncate)
+  writeFile(importFile, string.fromBytes(data))
+
+proc rlpImportMain*() =
+  suite "Streaming RLP block import":
+    let blocks = setupUncleChain()
+    let lastBlock = blocks.len.toBlockNumber
+
+    test "import blocks in file order":
+      blocks.writeBlocks
+      for lookAhead in [1, 0]:
+        let chain = newTestChain()
+        check chain.importRlpBlocks(importFile, lookAhead = lookAhead)
+        check chain.db.getCanonicalHead().blockNumber == lastBlock
+
+    test "blocks up to the head are skipped":
+      blocks.writeBlocks
+      let chain = newTestChain()
+      check chain.importRlpBlocks(importFile)
+      check chain.importRlpBlocks(importFile)
+      check chain.db.getCanonicalHead().blockNumber == lastBlock
+
+    test "truncated file":
+      blocks.writeBlocks(truncate = 10)
+      let chain = newTestChain()
+      check not chain.importRlpBlocks(importFile)
+      # the blocks before the broken one are kept
+      check chain.db.getCanonicalHead().blockNumber == lastBlock - 1
+
+    test "missing file":
+      check not newTestChain().importRlpBlocks("no" / "such" / "file.rlp")
+
+    test "valid seal":
+      let (chain, blk) = newSealTestChain()
+      [rlp.encode(blk)].writeBlocks
+      check chain.importRlpBlocks(importFile, checkSeal = true)
+      check chain.db.getCanonicalHead().blockHash == blk.header.blockHash
+
+    test "blocks with bad seals are rejected":
+      let (chain, blk) = newSealTestChain()
+      var badNonce, badMix = blk
+      badNonce.header.nonce[7] = badNonce.header.nonce[7] xor 1
+      badMix.header.mixDigest.data[0] = badMix.header.mixDigest.data[0] xor 1
+      [rlp.encode(badMix)].writeBlocks
+      check not chain.importRlpBlocks(importFile, checkSeal = true)
+      check chain.db.getCanonicalHead().blockNumber ==
+              blk.header.blockNumber - 1
+
+      # the blocks after a bad one in the same batch are imported
+      [rlp.encode(badNonce), rlp.encode(blk)].writeBlocks
+      check not chain.importRlpBlocks(importFile, checkSeal = true)
+      check chain.db.getCanonicalHead().blockHash == blk.header.blockHash
+
+    removeFile(importFile)
+
+when isMainModule:
+  rlpImportMain()
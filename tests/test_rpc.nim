@@ -11,9 +11,11 @@ import
   json_rpc/[rpcserver, rpcclient], eth/common as eth_common,
   eth/[rlp, keys], eth/trie/db, eth/p2p/rlpx_protocols/eth_protocol,
   eth/p2p/private/p2p_types,
-  ../nimbus/rpc/[common, p2p, hexstrings, rpc_types, rpc_utils],
+  ../nimbus/rpc/[common, p2p, hexstrings, rpc_types, rpc_utils, call_pool],
   ../nimbus/[constants, vm_state, config, genesis, utils, transaction],
-  ../nimbus/db/[accounts_cache, db_chain, storage_types, state_db],
+  ../nimbus/db/[accounts_cache, db_chain, storage_types, state_db,
+                select_backend],
+  ../nimbus/transaction/call_evm,
   ../nimbus/p2p/[chain, executor, executor/executor_helpers],
   ../nimbus/utils/difficulty,
   ./rpcclient/test_hexstrings, ./test_helpers, ./macro_assembler
@@ -30,6 +32,13 @@ template sourceDir: string = currentSourcePath.rsplit(DirSep, 1)[0]
 const sigPath = &"{sourceDir}{DirSep}rpcclient{DirSep}ethcallsigs.nim"
 createRpcSigs(RpcSocketClient, sigPath)
 
+const
+  gasChecker = hexToByteArray[20]("0x00000000000000000000000000000000000a11ce")
+    ## Contract failing with less than `gasCheckerLimit`
+
+  gasCheckerLimit = 21000 + 2 + 100000
+    ## Intrinsic gas, `GAS` and the gas the contract asks for
+
 type
   TestEnv = object
     txHash: Hash256
@@ -51,7 +60,18 @@ proc setupEnv(chain: BaseChainDB, signer, ks2: EthAddress, conf: NimbusConfigura
     PUSH1 "0x1C"        # RETURN OFFSET at 28
     RETURN
 
+  const checkerCode = evmByteCode:
+    GAS                 # remaining gas
+    PUSH3 "0x0186A0"    # 100000
+    GT                  # 100000 > remaining gas
+    PUSH1 "0x0A"        # JUMPDEST
+    JUMPI
+    STOP
+    JUMPDEST
+    INVALID
+
   ac.setCode(ks2, code)
+  ac.setCode(gasChecker, checkerCode)
   ac.addBalance(signer, 9_000_000_000.u256)
   var
     vmState = newBaseVMState(ac.rootHash, BlockHeader(parentHash: parentHash), chain)
@@ -119,7 +139,67 @@ proc setupEnv(chain: BaseChainDB, signer, ks2: EthAddress, conf: NimbusConfigura
     blockHash: header.hash
     )
 
+proc callPoolMain(signer, ks2: EthAddress; conf: NimbusConfiguration) =
+  when sharedReaders:
+    suite "Call executor pool":
+      let dbDir = getTempDir() / "nimbus_call_pool_test"
+      removeDir(dbDir)
+      let
+        backend = newChainDB(dbDir)
+        chain = newBaseChainDB(trieDB backend, false, conf.net.networkId)
+      chain.backend = backend
+      defaultGenesisBlockForNetwork(conf.net.networkId).commit(chain)
+      discard setupEnv(chain, signer, ks2, conf)
+      let
+        header = chain.getCanonicalHead()
+        pool = newCallPool(chain, 2)
+
+      test "read only database on another handle":
+        let
+          reader = newChainDB(backend.handle)
+          key = canonicalHeadHashKey().toOpenArray
+          newKey = @[1'u8, 2, 3]
+        check reader.get(key) == backend.get(key)
+
+        # writes after the snapshot are not seen
+        reader.pinReads
+        backend.put(newKey, @[4'u8])
+        check not reader.contains(newKey)
+        reader.unpinReads
+        check reader.contains(newKey)
+        reader.close
+
+      test "calls on the workers":
+        check not pool.isNil
+        let call = RpcCallData(
+          source: signer, to: ks2, gas: 100000, value: 100.u256)
+        var futs: seq[Future[HexDataStr]]
+        for _ in 0 ..< 8:
+          futs.add pool.call(call, header)
+        for fut in futs:
+          let res = await fut
+          check hexToByteArray[4](res.string) == hexToByteArray[4]("deadbeef")
+
+      test "gas estimates on the workers":
+        let call = RpcCallData(source: signer, to: gasChecker, gasPrice: 100)
+        var futs: seq[Future[GasInt]]
+        for _ in 0 ..< 4:
+          futs.add pool.estimateGas(call, header, haveGasLimit = false)
+        let expected = rpcEstimateGas(call, header, chain, false)
+        check gasCheckerLimit <= expected
+        for fut in futs:
+          let estimate = await fut
+          check estimate == expected
+
+      pool.close()
+
 proc rpcMain*() =
+  # also used by `callPoolMain()`, after the suite block
+  let
+    signer: EthAddress = hexToByteArray[20]("0x0e69cde81b1aa07a45c32c6cd85d67229d36bb1b")
+    ks2: EthAddress = hexToByteArray[20]("0xa3b2222afa5c987da6ef773fde8d01b9f23d481f")
+    conf = getConfiguration()
+
   suite "Remote Procedure Calls":
     # TODO: Include other transports such as Http
     var
@@ -127,10 +207,7 @@ proc rpcMain*() =
       chain = newBaseChainDB(newMemoryDb())
 
     let
-      signer: EthAddress = hexToByteArray[20]("0x0e69cde81b1aa07a45c32c6cd85d67229d36bb1b")
-      ks2: EthAddress = hexToByteArray[20]("0xa3b2222afa5c987da6ef773fde8d01b9f23d481f")
       ks3: EthAddress = hexToByteArray[20]("0x597176e9a64aad0845d83afdaf698fbeff77703b")
-      conf = getConfiguration()
 
     ethNode.chain = newChain(chain)
     conf.keyStore = "tests" / "keystore"
@@ -336,6 +413,33 @@ proc rpcMain*() =
       let res = await client.eth_estimateGas(ec, "latest")
       check hexToInt(res.string, int) == 21000
 
+    test "eth_estimateGas, more gas needed than used":
+      # The call uses little gas, but fails with less than `gasCheckerLimit`.
+      # The optimistic first try fails, the bisection stops within 1.5%.
+      var ec = EthCall(
+        source: ethAddressStr(signer).some,
+        to: ethAddressStr(gasChecker).some,
+        gasPrice: encodeQuantity(100'u).some
+        )
+
+      let
+        res = await client.eth_estimateGas(ec, "latest")
+        estimate = hexToInt(res.string, int)
+      check gasCheckerLimit <= estimate
+      check estimate <= gasCheckerLimit + gasCheckerLimit * 15 div 1000 + 1
+
+      # with a lower gas limit given
+      ec.gas = encodeQuantity(500000'u).some
+      let res2 = hexToInt(
+        (await client.eth_estimateGas(ec, "latest")).string, int)
+      check gasCheckerLimit <= res2
+      check res2 <= gasCheckerLimit + gasCheckerLimit * 15 div 1000 + 1
+
+      # not enough gas, it fails and reports all the gas used
+      ec.gas = encodeQuantity(100000'u).some
+      let res3 = await client.eth_estimateGas(ec, "latest")
+      check hexToInt(res3.string, int) == 100000
+
     test "eth_getBlockByHash":
       let res = await client.eth_getBlockByHash(env.blockHash, true)
       check res.isSome
@@ -406,5 +510,7 @@ proc rpcMain*() =
     rpcServer.stop()
     rpcServer.close()
 
+  callPoolMain(signer, ks2, conf)
+
 when isMainModule:
   rpcMain()
@@ -110,3 +110,29 @@ proc stackMain*() =
       stack.push(123)
       expect(InsufficientStack):
         discard stack.popInt(2)
+
+    when not defined(evmc_enabled) and defined(vm2_enabled):
+      test "unchecked operations and recycled stacks":
+        var stack = newStack()
+        for z in 0 ..< 3:
+          stack.pushUnchecked(z.u256)
+        stack.dupUnchecked(3)
+        check(stack.values == @[0.u256, 1.u256, 2.u256, 0.u256])
+        stack.swapUnchecked(2)
+        check(stack.values == @[0.u256, 0.u256, 2.u256, 1.u256])
+        check(stack.popUnchecked == 1.u256)
+        check(stack.len == 3)
+
+        stack.releaseStack
+        var recycled = newStack()
+        check(recycled.len == 0)
+        for z in 0 ..< 1024:
+          recycled.push(z.uint)
+        expect(FullStack):
+          recycled.push(1025)
+        # the stack limit is checked in release builds, too
+        expect(FullStack):
+          recycled.pushUnchecked(1025.u256)
+        expect(FullStack):
+          recycled.dupUnchecked(1)
+        check(recycled.len == 1024)
@@ -0,0 +1,68 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+import
+  std/random,
+  unittest2,
+  eth/[common, rlp], eth/trie/[db, hexary],
+  ../nimbus/db/stack_trie
+
+proc randomItems(count, maxLen: int): seq[seq[byte]] =
+  for n in 0 ..< count:
+    var item = newSeq[byte](1 + rand(maxLen - 1))
+    for b in item.mitems:
+      b = rand(255).byte
+    result.add item
+
+proc hexaryRoot(items: openArray[seq[byte]]): Hash256 =
+  var trie = initHexaryTrie(newMemoryDB())
+  for n, item in items:
+    trie.put(rlp.encode(n), rlp.encode(item))
+  trie.rootHash
+
+proc stackTrieMain*() =
+  suite "Stack trie root calculator":
+    test "empty trie":
+      check orderedTrieRoot(newSeq[seq[byte]]()) == emptyRlpHash
+
+    test "same root as the hexary trie":
+      randomize(4711)
+      for count in [1, 2, 3, 15, 16, 17, 127, 128, 129, 256, 300, 1000]:
+        for maxLen in [1, 8, 100]:
+          let items = randomItems(count, maxLen)
+          check orderedTrieRoot(items) == items.hexaryRoot
+
+    test "arbitrary increasing keys":
+      var
+        st: StackTrie
+        trie = initHexaryTrie(newMemoryDB())
+      st.initStackTrie
+      for key in [@[0x01'u8, 0x23], @[0x01'u8, 0x24], @[0x01'u8, 0x25, 0x00],
+                  @[0x12'u8], @[0x13'u8, 0x00, 0x00, 0x01], @[0xf0'u8]]:
+        st.put(key, key & key)
+        trie.put(key, key & key)
+      check st.rootHash == trie.rootHash
+
+    test "persisted nodes":
+      let
+        db = newMemoryDB()
+        items = randomItems(200, 40)
+        root = orderedTrieRoot(items, db)
+      var trie = initHexaryTrie(db, root)
+      for n, item in items:
+        check trie.get(rlp.encode(n)) == rlp.encode(item)
+
+    test "index key order":
+      var order: seq[int]
+      for n in indexKeys(130):
+        order.add n
+      check order.len == 130
+      check order[0] == 1 and order[126] == 127
+      check order[127] == 0 and order[128] == 128 and order[129] == 129
+
+when isMainModule:
+  stackTrieMain()
@@ -6,7 +6,8 @@
 # at your option. This file may not be copied, modified, or distributed except according to those terms.
 
 import  unittest2, eth/trie/[hexary, db],
-        ../nimbus/db/state_db, stew/[byteutils, endians2], eth/common
+        ../nimbus/db/state_db, stew/[byteutils, endians2], eth/common,
+        ../nimbus/p2p/executor/tx_conflicts, ../nimbus/db/state_pruner
 
 include ../nimbus/db/accounts_cache
 
@@ -214,5 +215,387 @@ proc stateDBMain*() =
       check ac.verifySlots(0xcc, 0x01)
       check ac.verifySlots(0xdd, 0x04)
 
+    test "savepoint journal":
+      var
+        ac = init(AccountsCache, newMemoryDB())
+        addr1 = initAddr(1)
+        addr2 = initAddr(2)
+
+      ac.setBalance(addr1, 1.u256)
+      let sp1 = ac.beginSavepoint
+      ac.setBalance(addr1, 2.u256)
+      ac.setStorage(addr1, 1.u256, 1.u256)
+
+      let sp2 = ac.beginSavepoint
+      ac.setBalance(addr1, 3.u256)
+      ac.setBalance(addr2, 3.u256)
+      ac.setStorage(addr1, 1.u256, 3.u256)
+      ac.rollback(sp2)
+      check ac.getBalance(addr1) == 2.u256
+      check ac.getStorage(addr1, 1.u256) == 1.u256
+      check ac.accountExists(addr2) == false
+
+      let sp3 = ac.beginSavepoint
+      ac.setBalance(addr2, 4.u256)
+      ac.commit(sp3)
+      check ac.getBalance(addr2) == 4.u256
+
+      ac.rollback(sp1)
+      check ac.getBalance(addr1) == 1.u256
+      check ac.getStorage(addr1, 1.u256) == 0.u256
+      check ac.accountExists(addr2) == false
+
+      # deep nesting, every level touches the same account
+      var sps: seq[SavePoint]
+      for n in 1 .. 1024:
+        sps.add ac.beginSavepoint
+        ac.setBalance(addr1, n.u256)
+      for n in countdown(1024, 513):
+        ac.commit(sps[n-1])
+      check ac.getBalance(addr1) == 1024.u256
+      ac.rollback(sps[511])
+      check ac.getBalance(addr1) == 511.u256
+      for n in countdown(511, 1):
+        ac.rollback(sps[n-1])
+      check ac.getBalance(addr1) == 1.u256
+
+    test "flat state snapshot":
+      var
+        snapDB = newMemoryDB()
+        ac = init(AccountsCache, snapDB, emptyRlpHash, true)
+        addr1 = initAddr(1)
+        addr2 = initAddr(2)
+
+      ac.setBalance(addr1, 1000.u256)
+      ac.setStorage(addr1, 1.u256, 10.u256)
+      ac.setStorage(addr1, 2.u256, 20.u256)
+      ac.setCode(addr2, code)
+      ac.persist()
+
+      # rebuild from the trie, the snapshot follows `persist()` from now on
+      let root1 = ac.rootHash
+      check StateSnapshot.rebuild(snapDB, root1).isValidFor(root1)
+
+      ac = init(AccountsCache, snapDB, root1, true, useSnapshot = true)
+      check ac.snapOk
+      check ac.getBalance(addr1) == 1000.u256
+      check ac.getStorage(addr1, 2.u256) == 20.u256
+      check ac.getCode(addr2) == code
+
+      ac.setStorage(addr1, 1.u256, 0.u256)
+      ac.setStorage(addr1, 3.u256, 30.u256)
+      ac.persist()
+      let root2 = ac.rootHash
+      check StateSnapshot.init(snapDB).isValidFor(root2)
+
+      # snapshot reads must agree with trie reads
+      var
+        bySnap = init(AccountsCache, snapDB, root2, true, useSnapshot = true)
+        byTrie = init(AccountsCache, snapDB, root2, true)
+      check bySnap.snapOk
+      check not byTrie.snapOk
+      for slot in [1, 2, 3, 4]:
+        check bySnap.getStorage(addr1, slot.u256) ==
+                byTrie.getStorage(addr1, slot.u256)
+
+      # a deleted and re-created account must not see stale slots
+      bySnap.deleteAccount(addr1)
+      bySnap.persist()
+      bySnap.setBalance(addr1, 1.u256)
+      bySnap.persist()
+      check bySnap.getStorage(addr1, 2.u256) == 0.u256
+      var fresh = init(AccountsCache, snapDB, bySnap.rootHash, true,
+                       useSnapshot = true)
+      check fresh.snapOk
+      check fresh.getStorage(addr1, 2.u256) == 0.u256
+      check fresh.getBalance(addr1) == 1.u256
+
+      # a block on another branch: back to `root1` along the stored
+      # transitions, and forth again
+      let rootE = fresh.rootHash
+      var snap = StateSnapshot.init(snapDB)
+      check snap.syncTo(root1)
+      var side = init(AccountsCache, snapDB, root1, true, useSnapshot = true)
+      check side.snapOk
+      check side.getStorage(addr1, 1.u256) == 10.u256
+      check side.getStorage(addr1, 3.u256) == 0.u256
+      side.setStorage(addr1, 4.u256, 40.u256)
+      side.persist()
+      let root3 = side.rootHash
+      check StateSnapshot.init(snapDB).isValidFor(root3)
+
+      snap = StateSnapshot.init(snapDB)
+      check snap.syncTo(rootE)
+      var
+        back = init(AccountsCache, snapDB, rootE, true, useSnapshot = true)
+        backByTrie = init(AccountsCache, snapDB, rootE, true)
+      check back.snapOk
+      check back.getBalance(addr1) == 1.u256
+      for slot in [1, 2, 3, 4]:
+        check back.getStorage(addr1, slot.u256) ==
+                backByTrie.getStorage(addr1, slot.u256)
+      check not snap.syncTo(keccakHash(code))
+      check snap.isValidFor(rootE)
+
+      # a cache opened at an older root falls back to the trie
+      var old = init(AccountsCache, snapDB, root1, true, useSnapshot = true)
+      check not old.snapOk
+      check old.getStorage(addr1, 1.u256) == 10.u256
+
+    test "cross-block state cache":
+      var
+        cacheDB = newMemoryDB()
+        sc = newStateCache()
+        ac = init(AccountsCache, cacheDB, emptyRlpHash, true)
+        addr1 = initAddr(1)
+
+      ac.attachStateCache(sc)
+      ac.setBalance(addr1, 1000.u256)
+      ac.setStorage(addr1, 1.u256, 10.u256)
+      ac.setCode(addr1, code)
+      ac.persist()
+      let root1 = ac.rootHash
+      check sc.root == root1
+
+      # next block, entries are written through
+      ac = init(AccountsCache, cacheDB, root1, true)
+      ac.attachStateCache(sc)
+      check sc.root == root1
+      check not sc.getAccount(addr1).isNil
+      check ac.getBalance(addr1) == 1000.u256
+      check ac.getStorage(addr1, 1.u256) == 10.u256
+      check ac.getCode(addr1) == code
+
+      ac.deleteAccount(addr1)
+      ac.persist()
+      let root2 = ac.rootHash
+      check sc.root == root2
+      check sc.getAccount(addr1).exists == false
+
+      # attaching at an unrelated root flushes the accounts
+      ac = init(AccountsCache, cacheDB, root1, true)
+      ac.attachStateCache(sc)
+      check sc.root == root1
+      check sc.getAccount(addr1).isNil
+      check ac.getStorage(addr1, 1.u256) == 10.u256
+
+    test "state cache slot budget":
+      let
+        sc = newStateCache(maxSlotBytes = 1)
+        (addr1, addr2) = (initAddr(1), initAddr(2))
+      var value: UInt256
+      sc.putAccount(addr1, true, newAccount())
+      sc.putAccount(addr2, true, newAccount())
+
+      # one slot fits, the budget is shared by all accounts
+      sc.putSlot(addr1, 1.u256, 10.u256)
+      check sc.getSlot(addr1, 1.u256, value) and value == 10.u256
+      sc.putSlot(addr2, 1.u256, 20.u256)
+      check not sc.getSlot(addr1, 1.u256, value)
+      check sc.getSlot(addr2, 1.u256, value) and value == 20.u256
+
+      sc.wipeSlots(addr2)
+      check not sc.getSlot(addr2, 1.u256, value)
+      sc.putSlot(addr2, 1.u256, 30.u256)
+      check sc.getSlot(addr2, 1.u256, value) and value == 30.u256
+
+    test "deferred commit":
+      proc runBlock(ac: var AccountsCache; deferred: bool): Hash256 =
+        let (addr1, addr2, addr3) = (initAddr(1), initAddr(2), initAddr(3))
+        ac.deferredCommit = deferred
+
+        # tx 1
+        ac.setBalance(addr1, 100.u256)
+        for n in 1 .. 20:
+          ac.setStorage(addr1, n.u256, n.u256)
+        ac.setBalance(addr2, 5.u256)
+        ac.setCode(addr2, code)
+        ac.setStorage(addr2, 1.u256, 1.u256)
+        ac.setBalance(addr3, 1.u256)
+        ac.setStorage(addr3, 1.u256, 1.u256)
+        ac.persist(clearCache = false)
+        check ac.getCommittedStorage(addr1, 20.u256) == 20.u256
+
+        # tx 2
+        ac.setStorage(addr1, 1.u256, 0.u256)
+        ac.setStorage(addr1, 21.u256, 7.u256)
+        ac.deleteAccount(addr3)
+        ac.persist(clearCache = false)
+        check ac.getCommittedStorage(addr1, 1.u256) == 0.u256
+        check ac.getStorage(addr1, 21.u256) == 7.u256
+        check ac.accountExists(addr3) == false
+
+        # tx 3
+        ac.setBalance(addr3, 2.u256)
+        ac.setStorage(addr3, 2.u256, 3.u256)
+        ac.clearStorage(addr2)
+        ac.persist(clearCache = false)
+        check ac.getStorage(addr3, 1.u256) == 0.u256
+        check ac.getStorage(addr3, 2.u256) == 3.u256
+
+        ac.persist()
+        result = ac.rootHash
+        check ac.getStorage(addr1, 21.u256) == 7.u256
+        check ac.getStorage(addr3, 2.u256) == 3.u256
+
+      var
+        immediate = init(AccountsCache, newMemoryDB(), emptyRlpHash, true)
+        deferred = init(AccountsCache, newMemoryDB(), emptyRlpHash, true)
+      check immediate.runBlock(false) == deferred.runBlock(true)
+
+    test "deferred commit, slot zeroed by an earlier transaction":
+      var
+        db = newMemoryDB()
+        sc = newStateCache()
+        ac = init(AccountsCache, db, emptyRlpHash, true)
+        addr1 = initAddr(1)
+
+      # previous block, the slot is in the trie and the state cache
+      ac.attachStateCache(sc)
+      ac.setBalance(addr1, 1.u256)
+      ac.setStorage(addr1, 1.u256, 10.u256)
+      ac.persist()
+      let root1 = ac.rootHash
+
+      ac = init(AccountsCache, db, root1, true)
+      ac.attachStateCache(sc)
+      ac.deferredCommit = true
+      check ac.getStorage(addr1, 1.u256) == 10.u256
+
+      # tx 1 zeroes the slot
+      ac.setStorage(addr1, 1.u256, 0.u256)
+      ac.persist(clearCache = false)
+
+      # tx 2 must not see the value still in the trie and the state cache
+      check ac.getStorage(addr1, 1.u256) == 0.u256
+      check ac.getCommittedStorage(addr1, 1.u256) == 0.u256
+      ac.setStorage(addr1, 2.u256, 1.u256)
+      ac.persist(clearCache = false)
+      check ac.getStorage(addr1, 1.u256) == 0.u256
+
+      ac.persist()
+      let root2 = ac.rootHash
+      var fresh = init(AccountsCache, db, root2, true)
+      check fresh.getStorage(addr1, 1.u256) == 0.u256
+      check fresh.getStorage(addr1, 2.u256) == 1.u256
+
+    test "transaction access sets":
+      var ac = init(AccountsCache, acDB, emptyRlpHash, true)
+      let
+        addr1 = initAddr(1)
+        addr2 = initAddr(2)
+        addr3 = initAddr(3)
+        addr4 = initAddr(4)
+        miner = initAddr(99)
+        recs = [newAccessRecorder(), newAccessRecorder(), newAccessRecorder()]
+      ac.setBalance(addr1, 10.u256)
+      ac.setBalance(addr3, 1.u256)
+      ac.setStorage(addr3, 9.u256, 9.u256)
+      ac.persist(clearCache = false)
+
+      # the EVM adds the accounts and slots it accesses to the EIP-2929
+      # access list, except for the miner fee
+      # tx 0: transfer addr1 -> addr2, pays the miner
+      ac.accessList(addr1)
+      ac.accessList(addr2)
+      ac.subBalance(addr1, 1.u256)
+      ac.addBalance(addr2, 1.u256)
+      ac.addBalance(miner, 1.u256)
+      ac.collectAccess(recs[0], miner)
+      ac.persist(clearCache = false)
+      # tx 1: other storage slot of addr3, pays the miner
+      ac.accessList(addr3, 1.u256)
+      ac.accessList(addr3, 2.u256)
+      ac.setStorage(addr3, 1.u256, 2.u256)
+      check ac.getStorage(addr3, 2.u256) == 0.u256
+      ac.addBalance(miner, 1.u256)
+      ac.collectAccess(recs[1], miner)
+      ac.persist(clearCache = false)
+      # tx 2: reads the balance of addr2
+      ac.accessList(addr2)
+      check ac.getBalance(addr2) == 1.u256
+      ac.accessList(addr3, 3.u256)
+      ac.setStorage(addr3, 3.u256, 1.u256)
+      ac.collectAccess(recs[2], miner)
+      ac.persist(clearCache = false)
+      check addr1 notin recs[2].reads.accounts
+
+      check addr1 in recs[0].writes.accounts
+      check addr2 in recs[0].writes.accounts
+      check addr3 notin recs[1].writes.accounts
+      check 1.u256 in recs[1].writes.slots.getOrDefault(addr3)
+      check 2.u256 in recs[1].reads.slots.getOrDefault(addr3)
+      check miner in recs[0].writes.credited
+      check miner notin recs[0].writes.accounts
+      check miner notin recs[0].reads.accounts
+      check ac.getBalance(miner) == 2.u256
+
+      check not recs[0].writes.overlaps(recs[1].reads)
+      check recs[0].writes.overlaps(recs[2].reads)
+      check not recs[1].writes.overlaps(recs[2].reads)
+
+      # a transaction reading the miner account depends on the fee credits,
+      # and its own fee is an ordinary write
+      let minerRead = newAccessRecorder()
+      ac.accessList(miner)
+      discard ac.getBalance(miner)
+      ac.addBalance(miner, 1.u256)
+      ac.collectAccess(minerRead, miner)
+      ac.persist(clearCache = false)
+      check recs[1].writes.overlaps(minerRead.reads)
+      check miner in minerRead.writes.accounts
+      check miner notin minerRead.writes.credited
+
+      # a storage write creating an account writes the account
+      let created = newAccessRecorder()
+      ac.accessList(addr4, 1.u256)
+      ac.setStorage(addr4, 1.u256, 1.u256)
+      ac.collectAccess(created, miner)
+      ac.persist(clearCache = false)
+      check addr4 in created.writes.accounts
+
+      let wiped = newAccessRecorder()
+      ac.accessList(addr3)
+      ac.clearStorage(addr3)
+      ac.collectAccess(wiped, miner)
+      ac.persist(clearCache = false)
+      check addr3 in wiped.writes.wiped
+      check addr3 in wiped.writes.accounts
+
+      let stats = recs.analyseTxConflicts
+      check stats.txs == 3
+      check stats.reExecuted == 1
+      check stats.criticalPath == 2
+
+    test "state trie pruning":
+      var
+        db = newMemoryDB()
+        ac = AccountsCache.init(db, emptyRlpHash, pruneTrie = false)
+        roots: seq[Hash256]
+      let pruner = newStatePruner(db, 1)
+      check not db.isInitialised
+
+      for n in 1 .. 3:
+        ac.setBalance(initAddr(1), n.u256)
+        ac.setBalance(initAddr(3), 5.u256)
+        ac.setStorage(initAddr(2), n.u256, 1.u256)
+        ac.persist()
+        roots.add ac.rootHash
+        pruner.pinState(n.toBlockNumber, ac.rootHash)
+      check db.isInitialised
+
+      # the head state only is kept
+      check pruner.pruneStep(3.toBlockNumber)
+      check pruner.pruneStep(3.toBlockNumber)
+      check not pruner.pruneStep(3.toBlockNumber)
+      check db.get(roots[0].data).len == 0
+      check db.get(roots[1].data).len == 0
+
+      let head = AccountsCache.init(db, roots[2], pruneTrie = false)
+      check head.getBalance(initAddr(1)) == 3.u256
+      check head.getBalance(initAddr(3)) == 5.u256
+      for slot in 1 .. 3:
+        check head.getStorage(initAddr(2), slot.u256) == 1.u256
+
 when isMainModule:
   stateDBMain()
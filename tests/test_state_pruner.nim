@@ -0,0 +1,78 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+import
+  unittest2,
+  eth/[common, trie/db],
+  ../nimbus/[config, genesis],
+  ../nimbus/db/[accounts_cache, db_chain, state_pruner],
+  ../nimbus/p2p/chain,
+  ./uncle_chain
+
+const
+  stateHistory = 2
+
+proc importChain(blocks: openArray[Blob]; pruneTrie: bool;
+                 history: int): (TrieDatabaseRef, seq[BlockHeader]) =
+  ## Import the blocks one by one and prune after each block, as the node
+  ## does between imports
+  let
+    db = newMemoryDB()
+    chainDB = newBaseChainDB(db, pruneTrie, CustomNet)
+    (headers, bodies) = blocks.decodeBlocks
+  chainDB.initializeEmptyDb()
+  let chain = newChain(chainDB)
+  if 0 < history:
+    chain.pruner = newStatePruner(db, history.uint64)
+
+  for n in 0 ..< headers.len:
+    doAssert chain.persistBlocks(
+      headers.toOpenArray(n, n), bodies.toOpenArray(n, n)) ==
+        ValidationResult.OK
+    if 0 < history:
+      while chain.pruner.pruneStep(headers[n].blockNumber):
+        discard
+  (db, headers)
+
+proc balances(db: TrieDatabaseRef; header: BlockHeader;
+              headers: openArray[BlockHeader]): seq[UInt256] =
+  ## Balances of the miners in the state of `header`
+  let ac = AccountsCache.init(db, header.stateRoot, pruneTrie = false)
+  for h in headers:
+    result.add ac.getBalance(h.coinbase)
+
+proc statePrunerMain*() =
+  suite "State pruning on block import":
+    let blocks = setupUncleChain()
+
+    test "recent states are kept with the node flags":
+      let conf = getConfiguration()
+      let (prune, history) = (conf.prune, conf.stateHistory)
+      defer:
+        conf.prune = prune
+        conf.stateHistory = history
+      conf.prune = PruneMode.Full
+      conf.stateHistory = stateHistory
+      check not conf.pruneTrie
+
+      let
+        (pruned, headers) = blocks.importChain(conf.pruneTrie, stateHistory)
+        (archive, _) = blocks.importChain(pruneTrie = false, history = 0)
+
+      # the states of the last `stateHistory` blocks are complete
+      for n in max(headers.len - stateHistory, 0) ..< headers.len:
+        check pruned.get(headers[n].stateRoot.data).len != 0
+        check pruned.balances(headers[n], headers) ==
+                archive.balances(headers[n], headers)
+
+      # older ones are gone
+      for n in 0 ..< headers.len - stateHistory:
+        check pruned.get(headers[n].stateRoot.data).len == 0
+        check archive.get(headers[n].stateRoot.data).len != 0
+
+when isMainModule:
+  statePrunerMain()
@@ -18,7 +18,9 @@ import
   ../premix/dumper,
   ../premix/hunter,
   ../premix/regress,
+  ../premix/bench,
   ./tracerTestGen,
+  ./bench_precompiles,
   ./persistBlockTestGen,
   ../hive_integration/nodocker/consensus/extract_consensus_data,
   ../hive_integration/nodocker/consensus/consensus_sim,
@@ -41,6 +41,28 @@ proc testFixture(node: JsonNode, testStatusIMPL: var TestStatus) =
   check node["txTraces"] == txTraces
   check node["stateDump"] == stateDump
   check node["blockTrace"] == blockTrace
+
+  if blockTrace.kind == JObject:
+    # streamed struct logs, followed by a summary line
+    let fileName = getTempDir() / "nimbus_tracer_test.jsonl"
+    var output = open(fileName, fmWrite)
+    discard traceBlock(chainDB, header, blockBody, {DisableState}, output)
+    output.close()
+    var entries: seq[JsonNode]
+    for line in lines(fileName):
+      entries.add parseJson(line)
+    removeFile(fileName)
+    let structLogs = blockTrace["structLogs"]
+    check entries.len == structLogs.len + 1
+    for i in 0 ..< min(structLogs.len, entries.len):
+      check entries[i] == structLogs[i]
+    check entries[^1]["gas"] == blockTrace["gas"]
+
+    # one call frame for each transaction
+    let callTrace = traceBlock(chainDB, header, blockBody, {DisableState, CallTracer})
+    check callTrace["calls"].len == blockBody.transactions.len
+    check not callTrace.hasKey("structLogs")
+
   for i in 0 ..< receipts.len:
     let receipt = receipts[i]
     let stateDiff = txTraces[i]["stateDiff"]
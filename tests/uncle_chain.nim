@@ -0,0 +1,71 @@
+# Nimbus
+# Copyright (c) 2018 Status Research & Development GmbH
+# Licensed under either of
+#  * Apache License, version 2.0, ([LICENSE-APACHE](LICENSE-APACHE) or http://www.apache.org/licenses/LICENSE-2.0)
+#  * MIT license ([LICENSE-MIT](LICENSE-MIT) or http://opensource.org/licenses/MIT)
+# at your option. This file may not be copied, modified, or distributed except according to those terms.
+
+## Test chain of the `bcUncleTest/oneUncle.json` blockchain fixture, with
+## its custom genesis
+
+import
+  std/[os, json],
+  stew/byteutils,
+  eth/[common, rlp],
+  ../nimbus/[genesis, config, chain_config]
+
+type
+  EthBlock* = object
+    header*: BlockHeader
+    transactions*: seq[Transaction]
+    uncles*: seq[BlockHeader]
+
+const
+  dataFolder = "tests" / "fixtures" / "eth_tests" / "BlockchainTests" /
+               "ValidBlocks" / "bcUncleTest"
+
+proc setupUncleChain*(): seq[Blob] =
+  ## Configure the custom genesis of the test chain, return its encoded
+  ## blocks
+  var jn = json.parseFile(dataFolder / "oneUncle.json")
+  for k, v in jn:
+    if v["network"].str == "Istanbul":
+      jn = v
+      break
+
+  let
+    genesis = rlp.decode(hexToSeqByte(jn["genesisRLP"].str), EthBlock).header
+    conf = getConfiguration()
+  conf.net.networkId = CustomNet
+  conf.customGenesis.config = ChainConfig(
+    chainId             : MainNet.ChainId,
+    byzantiumBlock      : 0.toBlockNumber,
+    constantinopleBlock : 0.toBlockNumber,
+    petersburgBlock     : 0.toBlockNumber,
+    istanbulBlock       : 0.toBlockNumber,
+    muirGlacierBlock    : 0.toBlockNumber,
+    berlinBlock         : 10.toBlockNumber,
+    londonBlock         : high(BlockNumber).toBlockNumber
+  )
+  conf.customGenesis.genesis.nonce      = genesis.nonce
+  conf.customGenesis.genesis.extraData  = genesis.extraData
+  conf.customGenesis.genesis.gasLimit   = genesis.gasLimit
+  conf.customGenesis.genesis.difficulty = genesis.difficulty
+  conf.customGenesis.genesis.mixHash    = genesis.mixDigest
+  conf.customGenesis.genesis.coinBase   = genesis.coinbase
+  conf.customGenesis.genesis.timestamp  = genesis.timestamp
+  conf.customGenesis.genesis.baseFeePerGas = genesis.fee
+  doAssert parseGenesisAlloc($(jn["pre"]), conf.customGenesis.genesis.alloc)
+
+  for n in jn["blocks"]:
+    result.add hexToSeqByte(n["rlp"].str)
+
+proc decodeBlocks*(blocks: openArray[Blob]):
+                  (seq[BlockHeader], seq[BlockBody]) =
+  ## Arguments for `persistBlocks()`
+  for data in blocks:
+    let ethBlock = rlp.decode(data, EthBlock)
+    result[0].add ethBlock.header
+    result[1].add BlockBody(
+      transactions: ethBlock.transactions,
+      uncles: ethBlock.uncles)